@@ -0,0 +1,287 @@
+/*****************************************************************************
+* 
+* Nagios check_wr plugin
+* 
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+* 
+* Description:
+* 
+* This file contains the check_wr multi-call plugin
+* 
+* All the check_wr_* plugins are built into this binary. The check is
+* selected by the name the binary was called with (check_wr_cpu is a
+* link to check_wr) or by the first argument (check_wr cpu -H ...).
+* check_wr worker runs the checks for Nagios as a query handler worker,
+* check_wr sweep (or wr-sweep) runs them for a list of hosts and writes
+* passive check results and check_wr exporter (or wr-exporter) serves
+* them as Prometheus metrics.
+* 
+* 
+*****************************************************************************/
+
+#include "config.h"
+#include <locale.h>
+#include <libintl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "nagios.h"
+#include "session.h"
+#include "deadline.h"
+#include "check_wr.h"
+
+static const struct check_wr_applet {
+	const char *name;
+	check_wr_main_f main;
+} applets[] = {
+	{ "check_wr_cpu", check_wr_cpu_main },
+	{ "check_wr_mem", check_wr_mem_main },
+	{ "check_wr_disk", check_wr_disk_main },
+	{ "check_wr_pf", check_wr_pf_main },
+	{ "check_wr_uptime", check_wr_uptime_main },
+	{ "check_wr_log", check_wr_log_main },
+	{ "check_wr_service", check_wr_service_main },
+	{ "check_wr_proc", check_wr_proc_main },
+	{ "check_wr_diskio", check_wr_diskio_main },
+	{ "check_wr_net", check_wr_net_main },
+	{ NULL, NULL }
+};
+
+/* Tools, run as check_wr <tool> or through a wr-<tool> link */
+static const struct check_wr_applet tools[] = {
+	{ "worker", check_wr_worker_main },
+	{ "sweep", check_wr_sweep_main },
+	{ "exporter", check_wr_exporter_main },
+	{ NULL, NULL }
+};
+
+static check_wr_main_f
+check_wr_tool (const char *name, const char *prefix)
+{
+	const char *p;
+
+	if ((p = strrchr (name, '/')) != NULL)
+		name = p + 1;
+	if (strncmp (name, prefix, strlen (prefix)) != 0)
+		return NULL;
+	name += strlen (prefix);
+	for (int i = 0; tools[i].name != NULL; i++) {
+		if (strcmp (name, tools[i].name) == 0)
+			return tools[i].main;
+	}
+	return NULL;
+}
+
+/* Accepts the plugin name or the short form (cpu, mem, ...). */
+check_wr_main_f
+check_wr_applet (const char *name)
+{
+	const char *p;
+
+	if (name == NULL)
+		return NULL;
+	if ((p = strrchr (name, '/')) != NULL)
+		name = p + 1;
+
+	for (int i = 0; applets[i].name != NULL; i++) {
+		if (strcmp (name, applets[i].name) == 0 ||
+				strcmp (name, applets[i].name + strlen ("check_wr_")) == 0)
+			return applets[i].main;
+	}
+	return NULL;
+}
+
+const char *
+check_wr_applet_name (int index)
+{
+	if (index < 0 || index >= (int) (sizeof (applets) / sizeof (applets[0])) - 1)
+		return NULL;
+	return applets[index].name;
+}
+
+int
+check_wr_split (char *line, char **argv, int max, int literal)
+{
+	char *in = line, *out = line;
+	int argc = 0;
+	char quote;
+
+	while (*in) {
+		while (*in == ' ' || *in == '\t')
+			in++;
+		if (*in == '\0')
+			break;
+		if (argc == max - 1)
+			return -1;
+		argv[argc++] = out;
+		quote = '\0';
+		for (; *in; in++) {
+			if (quote == '\'') {
+				if (*in == '\'')
+					quote = '\0';
+				else
+					*out++ = *in;
+			} else if (*in == '\\') {
+				if (in[1] == '\0')
+					return -1;
+				/* in double quotes only these are escaped */
+				if (quote == '"' && strchr ("$`\"\\", in[1]) == NULL)
+					*out++ = *in;
+				*out++ = *++in;
+			} else if (quote == '"') {
+				if (*in == '"')
+					quote = '\0';
+				else if (!literal && (*in == '$' || *in == '`'))
+					return -1;
+				else
+					*out++ = *in;
+			} else if (*in == '\'' || *in == '"') {
+				quote = *in;
+			} else if (*in == ' ' || *in == '\t') {
+				break;
+			} else if (!literal && strchr ("|&;<>()$`*?[]{}~#\n", *in) != NULL) {
+				return -1;
+			} else {
+				*out++ = *in;
+			}
+		}
+		if (quote != '\0')
+			return -1;
+		if (*in)
+			in++;
+		*out++ = '\0';
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+/*
+ * The checks end with exit() on usage errors and from the timeout alarm.
+ * check_wr is linked with --wrap=exit so that, while check_wr_run has a
+ * check running, exit() comes back to check_wr_run instead.
+ */
+void __real_exit (int status) __attribute__((noreturn));
+void __wrap_exit (int status) __attribute__((noreturn));
+
+static sigjmp_buf *run_jmp = NULL;
+static int run_exit_status;
+
+void
+__wrap_exit (int status)
+{
+	sigjmp_buf *jmp = run_jmp;
+
+	if (jmp != NULL) {
+		run_jmp = NULL;
+		run_exit_status = status;
+		siglongjmp (*jmp, 1);
+	}
+	__real_exit (status);
+}
+
+static char *
+close_capture (FILE *stream, char **buffer)
+{
+	if (stream == NULL)
+		return strdup ("");
+	/* the buffer is only final once the stream is closed */
+	fclose (stream);
+	return *buffer;
+}
+
+int
+check_wr_run (check_wr_main_f applet, int argc, char **argv,
+		char **out, char **err, int *clean,
+		check_wr_abort_f on_abort, void *abort_data)
+{
+	FILE *saved_out = stdout, *saved_err = stderr;
+	FILE *out_stream, *err_stream;
+	char *out_buffer = NULL, *err_buffer = NULL;
+	size_t out_size, err_size;
+	sigjmp_buf jmp;
+	int result;
+
+	fflush (stdout);
+	fflush (stderr);
+	out_stream = open_memstream (&out_buffer, &out_size);
+	err_stream = open_memstream (&err_buffer, &err_size);
+	if (out_stream)
+		stdout = out_stream;
+	if (err_stream)
+		stderr = err_stream;
+
+	if (sigsetjmp (jmp, 1) == 0) {
+		run_jmp = &jmp;
+		result = applet (argc, argv);
+		run_jmp = NULL;
+		*clean = 1;
+	} else {
+		/*
+		 * The check did not get to clean up after itself, and when
+		 * exit() came from the alarm it may have interrupted malloc
+		 * or stdio: the caller gets to leave before touching either.
+		 */
+		if (on_abort != NULL)
+			on_abort (run_exit_status, abort_data);
+		result = run_exit_status;
+		*clean = 0;
+		wr_session_abandon ();
+	}
+	alarm (0);
+	signal (SIGALRM, SIG_DFL);
+	wr_deadline_clear (wr_check_deadline ());
+
+	stdout = saved_out;
+	stderr = saved_err;
+	*out = close_capture (out_stream, &out_buffer);
+	*err = close_capture (err_stream, &err_buffer);
+	return result;
+}
+
+static void
+print_applets (void)
+{
+	printf ("%s\n", "Usage:");
+	printf ("  check_wr <check> [check options]\n");
+	printf ("  check_wr_<check> [check options]\n");
+	printf ("  check_wr worker [worker options]\n");
+	printf ("  check_wr sweep [sweep options]\n");
+	printf ("  check_wr exporter [exporter options]\n\n");
+	printf ("Checks:\n");
+	for (int i = 0; applets[i].name != NULL; i++)
+		printf ("  %s\n", applets[i].name + strlen ("check_wr_"));
+}
+
+int
+main (int argc, char **argv)
+{
+	check_wr_main_f applet;
+
+	applet = check_wr_applet (argv[0]);
+	if (applet == NULL)
+		applet = check_wr_tool (argv[0], "wr-");
+	if (applet == NULL && argc > 1) {
+		applet = check_wr_applet (argv[1]);
+		if (applet == NULL)
+			applet = check_wr_tool (argv[1], "");
+		argc--;
+		argv++;
+	}
+	if (applet == NULL) {
+		print_applets ();
+		return STATE_UNKNOWN;
+	}
+
+	/* only bound once a check is going to run */
+	setlocale (LC_ALL, "");
+	/* perfdata and the exporter metrics need a decimal point whatever the locale */
+	setlocale (LC_NUMERIC, "C");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	return applet (argc, argv);
+}
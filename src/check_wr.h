@@ -0,0 +1,58 @@
+#ifndef __CHECK_WR_H_
+#define __CHECK_WR_H_
+
+/*
+ * Entry points of the checks built into the check_wr binary. Each one
+ * takes the arguments the standalone plugin used to take and returns
+ * the nagios state.
+ */
+typedef int (*check_wr_main_f)(int argc, char **argv);
+
+int check_wr_cpu_main (int argc, char **argv);
+int check_wr_mem_main (int argc, char **argv);
+int check_wr_disk_main (int argc, char **argv);
+int check_wr_pf_main (int argc, char **argv);
+int check_wr_uptime_main (int argc, char **argv);
+int check_wr_log_main (int argc, char **argv);
+int check_wr_service_main (int argc, char **argv);
+int check_wr_proc_main (int argc, char **argv);
+int check_wr_diskio_main (int argc, char **argv);
+int check_wr_net_main (int argc, char **argv);
+
+check_wr_main_f check_wr_applet (const char *name);
+const char *check_wr_applet_name (int index);
+
+/*
+ * Splits a line into arguments, in place, the way /bin/sh would for the
+ * plain command lines Nagios runs: words, single and double quotes and
+ * backslash escapes. Unless literal is set, returns -1 when the line
+ * uses anything else of the shell (pipes, redirections, variables, ...).
+ */
+int check_wr_split (char *line, char **argv, int max, int literal);
+
+/*
+ * Called by check_wr_run when a check ended through exit(), with the
+ * status it exited with. This may be from the timeout alarm, in the
+ * middle of anything, so it may only use async-signal-safe functions
+ * (write, _exit, ...) and must not return.
+ */
+typedef void (*check_wr_abort_f) (int status, void *data);
+
+/*
+ * Runs a check in this process as if it was the plugin, returning its
+ * state. What the check prints is returned in out and err, both to be
+ * freed by the caller. clean is set to 0 when the check ended through
+ * exit() (usage errors, timeouts) and may have left state behind. Then
+ * on_abort, when not NULL, is called instead of returning; otherwise
+ * the memory and the sessions of the process are only fit to report
+ * the result and end it.
+ */
+int check_wr_run (check_wr_main_f applet, int argc, char **argv,
+		char **out, char **err, int *clean,
+		check_wr_abort_f on_abort, void *abort_data);
+
+int check_wr_worker_main (int argc, char **argv);
+int check_wr_sweep_main (int argc, char **argv);
+int check_wr_exporter_main (int argc, char **argv);
+
+#endif
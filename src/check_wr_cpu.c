@@ -10,17 +10,13 @@
 * This file contains the check_wr_cpu plugin
 * 
 * Connects to a Windows machine with Windows Remote Protocol and pulls
-* CPU usage data from WMI
+* CPU usage data from the WMI raw performance counters
 * 
 * 
 * 
 * 
 *****************************************************************************/
 
-const char *progname = "check_wr_cpu";
-const char *copyright = "2023-2037";
-const char *email = "info@samanagroup.com";
-
 #include "config.h"
 #include <locale.h>
 #include <libintl.h>
@@ -28,36 +24,52 @@ const char *email = "info@samanagroup.com";
 #include <signal.h>
 #include <stdio.h>
 #include "protocol.h"
+#include "session.h"
+#include "deadline.h"
 #include "transport.h"
 #include "nagios.h"
-#include "xml.h"
+#include "refresher.h"
+#include "check_wr.h"
 
 #define NAMESPACE "root/cimv2"
-#define CHECK_CLASS_NAME "Win32_PerfFormattedData_Counters_ProcessorInformation"
-#define NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/" CHECK_CLASS_NAME
-#define WQL_QUERY "select * FROM " CHECK_CLASS_NAME " WHERE NAME='_total'";
-
-int legacy = 0;
-int port = -1;
-char *server_name = NULL;
-int verbose = FALSE;
-char *username = NULL;
-char *password = NULL;
-char *url = NULL;
-int warn = UNKNOWN_PERCENTAGE_USAGE;
-int crit = UNKNOWN_PERCENTAGE_USAGE;
+#define CHECK_CLASS_NAME "Win32_PerfRawData_Counters_ProcessorInformation"
+#define WQL_WHERE "Name='_Total'"
+
+enum {
+	CPU_PROCESSOR_TIME,
+	CPU_IDLE_TIME,
+	CPU_USER_TIME,
+	CPU_PRIVILEGED_TIME,
+	CPU_INTERRUPT_TIME,
+	CPU_COUNTERS
+};
+
+static const wr_counter_t cpu_counters[CPU_COUNTERS] = {
+	{ "PercentProcessorTime", WR_PERF_100NSEC_TIMER_INV },
+	{ "PercentIdleTime", WR_PERF_100NSEC_TIMER },
+	{ "PercentUserTime", WR_PERF_100NSEC_TIMER },
+	{ "PercentPrivilegedTime", WR_PERF_100NSEC_TIMER },
+	{ "PercentInterruptTime", WR_PERF_100NSEC_TIMER }
+};
+
+static const char *cpu_labels[CPU_COUNTERS] = {
+	"load",
+	"idle_time_percent",
+	"user_time_percent",
+	"privileged_time_percent",
+	"interrupt_time_percent"
+};
+
 
 int check_cpu (char *url);
 char *perfdata (const char *label, long int val, const char *uom, int warnp, long int warn, int critp, long int crit, int minp, long int minv, int maxp, long int maxv);
 
 int
-main (int argc, char **argv)
+check_wr_cpu_main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	smn_applet_init ("check_wr_cpu", UNKNOWN_PERCENTAGE_USAGE);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -69,6 +81,7 @@ main (int argc, char **argv)
 	signal (SIGALRM, timeout_alarm_handler);
 
 	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
 
 	/* ssh_connect exits if error is found */
 	result = check_cpu (url);
@@ -82,87 +95,81 @@ int
 check_cpu (char *url)
 {
 	int result = STATE_OK;
-	void *proto=NULL, *wql_ctx=NULL;
+	void *proto=NULL;
+	wr_refresher_t refresher = NULL;
 	struct timeval tv;
-	char *namespace=NAMESPACE;
-	char *wql = WQL_QUERY;
-	long PercentProcessorTime, PercentPrivilegedTime;
-	long PercentInterruptTime, PercentIdleTime, PercentUserTime;
-	xmlDocPtr response=NULL, schema=NULL;
-	xmlNodeSetPtr nodes = NULL;
+	long values[CPU_COUNTERS];
+	double value;
+	int32_t instance;
 	long elapsed_time;
-	char *perfdata_str, *xPathExpr = NULL;;
+	char *perfdata_str;
 
 	gettimeofday(&tv, NULL);
 
-	proto = wrprotocol_ctx_new();
+	proto = wr_session_get(username, password, url);
 	if(proto == NULL) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
-	if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-
-	wql_ctx = wr_wql_new(proto, namespace, wql);
-	if(wql_ctx == NULL) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-
-	if(!wr_wql_run(wql_ctx)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
 
-	response = wr_wql_response_toxml(wql_ctx);
-	if(response == NULL) {
+	refresher = wr_refresher_new(NAMESPACE, CHECK_CLASS_NAME, cpu_counters, CPU_COUNTERS);
+	if(refresher == NULL) {
 		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Response from server was empty"));
 		goto end;
 	}
 
-	schema = wr_wql_schema_toxml(wql_ctx);
-	if(schema == NULL) {
+	/*
+	 * The usage is computed from the raw counters of this check and the
+	 * previous one. Without a previous sample a second one is taken.
+	 */
+	wr_refresher_load(refresher, url);
+	if(!wr_refresher_sample(refresher, proto, WQL_WHERE)) {
+		smn_unknown(_("Unable to sample the performance counters."));
 		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Schema from server was empty"));
 		goto end;
 	}
-
-	xPathExpr = "//p:" CHECK_CLASS_NAME;
-	if(!xml_find_all(&nodes, response, xPathExpr, "p", NS_URL)) {
+	instance = wr_refresher_instance_index(refresher, "_Total");
+	if(instance < 0) {
 		result = STATE_UNKNOWN;
 		fprintf(stderr, "UNKNOWN - Invalid response from server.\n");
 		goto end;
 	}
-	if(nodes->nodeNr < 1) {
-		result = STATE_UNKNOWN;
-		fprintf(stderr, "UNKNOWN - Invalid response from server.\n");
-		goto end;
+	if(!wr_refresher_value(refresher, instance, CPU_PROCESSOR_TIME, &value)) {
+		sleep(1);
+		if(!wr_refresher_sample(refresher, proto, WQL_WHERE)) {
+			smn_unknown(_("Unable to sample the performance counters."));
+			result = STATE_UNKNOWN;
+			goto end;
+		}
+		instance = wr_refresher_instance_index(refresher, "_Total");
 	}
-
-	if(!xml_class_get_prop_num(&PercentProcessorTime, 
-			nodes->nodeTab[0], "PercentProcessorTime", schema)) {
-		result = STATE_UNKNOWN;
-		goto end;
+	for(int i = 0; i < CPU_COUNTERS; i++) {
+		if(instance < 0 || !wr_refresher_value(refresher, instance, i, &value)) {
+			result = STATE_UNKNOWN;
+			fprintf(stderr, "UNKNOWN - Unable to compute %s.\n", cpu_counters[i].name);
+			goto end;
+		}
+		if(value < 0) value = 0;
+		if(value > 100) value = 100;
+		values[i] = (long) (value + 0.5);
 	}
+	wr_refresher_save(refresher, url);
 
-	if(PercentProcessorTime > crit) {
+	if(values[CPU_PROCESSOR_TIME] > crit) {
 		printf(_("CRITICAL"));
 		result = STATE_CRITICAL;
-	} else if(PercentProcessorTime > warn) {
+	} else if(values[CPU_PROCESSOR_TIME] > warn) {
 		printf(_("WARNING"));
 		result = STATE_WARNING;
 	} else {
 		printf(_("OK"));
 	}
-	printf(_(" - CPU Usage %ld%%"), PercentProcessorTime);
+	printf(_(" - CPU Usage %ld%%"), values[CPU_PROCESSOR_TIME]);
 
 	printf(_(" |"));
 
 	if(legacy == 1) {
-		perfdata_str = perfdata("cpuLoad", PercentProcessorTime, "",
+		perfdata_str = perfdata("cpuLoad", values[CPU_PROCESSOR_TIME], "",
 			(warn != UNKNOWN_PERCENTAGE_USAGE), warn,
 			(crit != UNKNOWN_PERCENTAGE_USAGE), crit,
 			1, 0, 1, 100);
@@ -172,58 +179,25 @@ check_cpu (char *url)
 		goto end;
 	}
 
-	perfdata_str = smn_perfdata("load", PercentProcessorTime, "",
+	perfdata_str = smn_perfdata(cpu_labels[CPU_PROCESSOR_TIME], values[CPU_PROCESSOR_TIME], "",
 		(warn != UNKNOWN_PERCENTAGE_USAGE), warn,
 		(crit != UNKNOWN_PERCENTAGE_USAGE), crit,
 		1, 0, 1, 100);
 	printf(_(" %s"), perfdata_str);
 	free(perfdata_str);
 
-	if(!xml_class_get_prop_num(&PercentIdleTime, 
-			nodes->nodeTab[0], "PercentIdleTime", schema)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-	perfdata_str = smn_perfdata("idle_time_percent", PercentIdleTime, "",
-		0, 0, 0, 0, 1, 0, 1, 100);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	if(!xml_class_get_prop_num(&PercentUserTime, 
-			nodes->nodeTab[0], "PercentUserTime", schema)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-	perfdata_str = smn_perfdata("user_time_percent", PercentUserTime, "",
-		0, 0, 0, 0, 1, 0, 1, 100);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	if(!xml_class_get_prop_num(&PercentPrivilegedTime, 
-			nodes->nodeTab[0], "PercentPrivilegedTime", schema)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-	perfdata_str = smn_perfdata("privileged_time_percent", PercentPrivilegedTime, "",
-		0, 0, 0, 0, 1, 0, 1, 100);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	if(!xml_class_get_prop_num(&PercentInterruptTime, 
-			nodes->nodeTab[0], "PercentInterruptTime", schema)) {
-		result = STATE_UNKNOWN;
-		goto end;
+	for(int i = CPU_IDLE_TIME; i < CPU_COUNTERS; i++) {
+		perfdata_str = smn_perfdata(cpu_labels[i], values[i], "",
+			0, 0, 0, 0, 1, 0, 1, 100);
+		printf(_(" %s"), perfdata_str);
+		free(perfdata_str);
 	}
-	perfdata_str = smn_perfdata("interrupt_time_percent", PercentInterruptTime, "",
-		0, 0, 0, 0, 1, 0, 1, 100);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
 
 	printf(_("\n"));
 
 	end:
-	wr_wql_free(&wql_ctx);
-	wrprotocol_ctx_free(proto);
+	wr_refresher_free(&refresher);
+	wr_session_put(proto);
 	elapsed_time = (double)deltime(tv) / 1.0e6;
 	return result;
 }
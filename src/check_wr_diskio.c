@@ -0,0 +1,570 @@
+/*****************************************************************************
+* 
+* Nagios check_wr_diskio plugin
+* 
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+* 
+* Description:
+* 
+* This file contains the check_wr_diskio plugin
+* 
+* Connects to a Windows machine with Windows Remote Protocol and pulls
+* the latency, IOPS, throughput and queue length of every volume from the
+* WMI raw performance counters
+* 
+* 
+* 
+*****************************************************************************/
+
+#include "config.h"
+#include <locale.h>
+#include <libintl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include "protocol.h"
+#include "session.h"
+#include "deadline.h"
+#include "transport.h"
+#include "nagios.h"
+#include "refresher.h"
+#include "check_wr.h"
+
+#define NAMESPACE "root/cimv2"
+#define CHECK_CLASS_NAME "Win32_PerfRawData_PerfDisk_LogicalDisk"
+#define WQL_WHERE "Name <> '_Total'"
+#define VOLUME_MAX 32
+
+enum {
+	DISK_SEC_PER_READ,
+	DISK_SEC_PER_WRITE,
+	DISK_READS,
+	DISK_WRITES,
+	DISK_READ_BYTES,
+	DISK_WRITE_BYTES,
+	DISK_QUEUE_LENGTH,
+	DISK_COUNTERS
+};
+
+static const wr_counter_t disk_counters[DISK_COUNTERS] = {
+	{ "AvgDiskSecPerRead", WR_PERF_AVERAGE_TIMER },
+	{ "AvgDiskSecPerWrite", WR_PERF_AVERAGE_TIMER },
+	{ "DiskReadsPersec", WR_PERF_COUNTER_COUNTER },
+	{ "DiskWritesPersec", WR_PERF_COUNTER_COUNTER },
+	{ "DiskReadBytesPersec", WR_PERF_COUNTER_BULK_COUNT },
+	{ "DiskWriteBytesPersec", WR_PERF_COUNTER_BULK_COUNT },
+	{ "AvgDiskQueueLength", WR_PERF_COUNTER_100NS_QUEUELEN_TYPE }
+};
+
+/* Latency thresholds in ms, the first entry (without name) is the default */
+typedef struct _volume_threshold {
+	const char *name;
+	int warn;
+	int crit;
+} volume_threshold_t;
+
+typedef struct _volume_io {
+	const char *name;
+	double values[DISK_COUNTERS];
+	const volume_threshold_t *th;
+	int state;
+} volume_io_t;
+
+static volume_threshold_t thresholds[VOLUME_MAX + 1];
+static int thresholdNr = 1;
+static char *volumes[VOLUME_MAX];
+static int volumeNr = 0;
+static char *warn_list = NULL, *crit_list = NULL, *volume_list = NULL;
+
+int check_diskio (char *url);
+int validate_arguments_diskio (void);
+int process_arguments_diskio (int argc, char **argv);
+void print_help_diskio (void);
+
+int
+check_wr_diskio_main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+
+	smn_applet_init ("check_wr_diskio", UNKNOWN_VALUE);
+	thresholdNr = 1;
+	volumeNr = 0;
+	warn_list = crit_list = volume_list = NULL;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments_diskio (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal (SIGALRM, timeout_alarm_handler);
+
+	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
+
+	result = check_diskio (url);
+
+	alarm (0);
+
+	return (result);
+}
+
+/*
+ * All the volumes come from one query, restricted to the volumes given
+ * with -i. Names are quoted as they are, the arguments reject quotes.
+ */
+static char *
+diskio_where (void)
+{
+	char *where = NULL;
+	size_t size = 0;
+	FILE *out;
+
+	if (volumeNr == 0)
+		return strdup (WQL_WHERE);
+	out = open_memstream (&where, &size);
+	if (out == NULL)
+		return NULL;
+	for (int i = 0; i < volumeNr; i++)
+		fprintf (out, "%sName = '%s'", i ? " or " : "", volumes[i]);
+	if (fclose (out) != 0) {
+		free (where);
+		return NULL;
+	}
+	return where;
+}
+
+static const volume_threshold_t *
+find_threshold (const char *name)
+{
+	/* WQL compares instance names ignoring case */
+	for (int i = 1; i < thresholdNr; i++) {
+		if (!strcasecmp (thresholds[i].name, name))
+			return &thresholds[i];
+	}
+	return &thresholds[0];
+}
+
+/*
+ * Returns 0 when the volume has no previous sample. Latencies are not
+ * defined when there was no I/O, those are reported as 0.
+ */
+static uint32_t
+read_volume (wr_refresher_t refresher, uint32_t instance, volume_io_t *volume)
+{
+	for (int i = 0; i < DISK_COUNTERS; i++) {
+		if (wr_refresher_value (refresher, instance, i, &volume->values[i]))
+			continue;
+		if (i == DISK_READS || i == DISK_WRITES)
+			return 0;
+		volume->values[i] = 0;
+	}
+	volume->name = wr_refresher_instance_name (refresher, instance);
+	return 1;
+}
+
+static uint32_t
+count_ready (wr_refresher_t refresher)
+{
+	uint32_t ready = 0;
+	volume_io_t volume;
+
+	for (uint32_t i = 0; i < wr_refresher_instance_count (refresher); i++)
+		ready += read_volume (refresher, i, &volume);
+	return ready;
+}
+
+static void
+print_perfdata (const volume_io_t *volume)
+{
+	const volume_threshold_t *th = volume->th;
+	int warnp = th->warn != UNKNOWN_VALUE, critp = th->crit != UNKNOWN_VALUE;
+	/* drive letters lose their colon, C: becomes c_read_latency */
+	int len = strlen (volume->name);
+	char *label, *perfdata_str;
+
+	if (len > 0 && volume->name[len - 1] == ':')
+		len--;
+
+	xasprintf (&label, "%.*s_read_latency", len, volume->name);
+	perfdata_str = smn_fperfdata (label, volume->values[DISK_SEC_PER_READ] * 1000.0, "ms",
+		warnp, th->warn, critp, th->crit, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	xasprintf (&label, "%.*s_write_latency", len, volume->name);
+	perfdata_str = smn_fperfdata (label, volume->values[DISK_SEC_PER_WRITE] * 1000.0, "ms",
+		warnp, th->warn, critp, th->crit, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	xasprintf (&label, "%.*s_iops", len, volume->name);
+	perfdata_str = smn_perfdata (label,
+		(long) (volume->values[DISK_READS] + volume->values[DISK_WRITES] + 0.5), "",
+		0, 0, 0, 0, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	xasprintf (&label, "%.*s_read_bytes", len, volume->name);
+	perfdata_str = smn_perfdata (label, (long) (volume->values[DISK_READ_BYTES] + 0.5), "B",
+		0, 0, 0, 0, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	xasprintf (&label, "%.*s_write_bytes", len, volume->name);
+	perfdata_str = smn_perfdata (label, (long) (volume->values[DISK_WRITE_BYTES] + 0.5), "B",
+		0, 0, 0, 0, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	xasprintf (&label, "%.*s_queue_length", len, volume->name);
+	perfdata_str = smn_fperfdata (label, volume->values[DISK_QUEUE_LENGTH], "",
+		0, 0, 0, 0, 1, 0, 0, 0);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+}
+
+int
+check_diskio (char *url)
+{
+	int result = STATE_UNKNOWN;
+	void *proto=NULL;
+	wr_refresher_t refresher = NULL;
+	volume_io_t *volume_data = NULL;
+	uint32_t volume_count = 0, instances;
+	int alerts = 0;
+	double latency;
+	char *where = NULL;
+
+	where = diskio_where ();
+	if(where == NULL) {
+		printf(_("UNKNOWN - Could not reserve memory for the query.\n"));
+		goto end;
+	}
+
+	proto = wr_session_get(username, password, url);
+	if(proto == NULL)
+		goto end;
+
+	refresher = wr_refresher_new(NAMESPACE, CHECK_CLASS_NAME, disk_counters, DISK_COUNTERS);
+	if(refresher == NULL)
+		goto end;
+
+	/*
+	 * The rates are computed from the raw counters of this check and the
+	 * previous one. Without a previous sample a second one is taken.
+	 */
+	wr_refresher_load(refresher, url);
+	if(!wr_refresher_sample(refresher, proto, where)) {
+		smn_unknown(_("Unable to sample the performance counters."));
+		goto end;
+	}
+	if(count_ready(refresher) == 0) {
+		sleep(1);
+		if(!wr_refresher_sample(refresher, proto, where)) {
+			smn_unknown(_("Unable to sample the performance counters."));
+			goto end;
+		}
+	}
+	wr_refresher_save(refresher, url);
+
+	instances = wr_refresher_instance_count(refresher);
+	volume_data = calloc(instances, sizeof(volume_io_t));
+	if(volume_data == NULL) {
+		printf(_("UNKNOWN - Could not reserve memory for disk data.\n"));
+		goto end;
+	}
+	for(uint32_t i = 0; i < instances; i++) {
+		volume_io_t *volume = &volume_data[volume_count];
+
+		/* volumes mounted since the previous check show up next time */
+		if(!read_volume(refresher, i, volume))
+			continue;
+		volume->th = find_threshold(volume->name);
+		volume->state = STATE_OK;
+		latency = volume->values[DISK_SEC_PER_READ];
+		if(volume->values[DISK_SEC_PER_WRITE] > latency)
+			latency = volume->values[DISK_SEC_PER_WRITE];
+		latency *= 1000.0;
+		if(volume->th->crit != UNKNOWN_VALUE && latency > volume->th->crit)
+			volume->state = STATE_CRITICAL;
+		else if(volume->th->warn != UNKNOWN_VALUE && latency > volume->th->warn)
+			volume->state = STATE_WARNING;
+		if(volume->state != STATE_OK)
+			alerts++;
+		volume_count++;
+	}
+	if(volume_count == 0) {
+		printf(_("UNKNOWN - Unable to compute the disk counters.\n"));
+		goto end;
+	}
+
+	result = STATE_OK;
+	for(uint32_t i = 0; i < volume_count; i++) {
+		if(volume_data[i].state == STATE_CRITICAL)
+			result = STATE_CRITICAL;
+		else if(volume_data[i].state == STATE_WARNING && result == STATE_OK)
+			result = STATE_WARNING;
+	}
+
+	if(result == STATE_CRITICAL) {
+		printf(_("CRITICAL"));
+	} else if (result == STATE_WARNING) {
+		printf(_("WARNING"));
+	} else {
+		printf(_("OK"));
+	}
+	printf(_(" - %d of %u volumes over the latency threshold |"), alerts, volume_count);
+	for(uint32_t i = 0; i < volume_count; i++)
+		print_perfdata(&volume_data[i]);
+	printf(_("\n"));
+
+	for(uint32_t i = 0; i < volume_count; i++) {
+		printf("%sVolume %s, Read: %.1fms, Write: %.1fms, IOPS: %.0f, Queue: %.2f\n",
+			volume_data[i].state != STATE_OK ? "*** " : "",
+			volume_data[i].name,
+			volume_data[i].values[DISK_SEC_PER_READ] * 1000.0,
+			volume_data[i].values[DISK_SEC_PER_WRITE] * 1000.0,
+			volume_data[i].values[DISK_READS] + volume_data[i].values[DISK_WRITES],
+			volume_data[i].values[DISK_QUEUE_LENGTH]);
+	}
+
+	end:
+	free(volume_data);
+	wr_refresher_free(&refresher);
+	wr_session_put(proto);
+	free(where);
+	return result;
+}
+
+/*
+ * Parses "20,E:=50": a default and thresholds of single volumes. The
+ * defaults of both lists are parsed first, volumes start from them.
+ */
+static int
+parse_thresholds (char *list, size_t offset, int named, const char *error)
+{
+	char *copy, *item, *value, *saveptr = NULL;
+	volume_threshold_t *th;
+	int t;
+
+	if (list == NULL)
+		return OK;
+	copy = strdup (list);
+	if (copy == NULL)
+		return ERROR;
+	for (item = strtok_r (copy, ",", &saveptr); item; item = strtok_r (NULL, ",", &saveptr)) {
+		value = strrchr (item, '=');
+		if ((value != NULL) != named)
+			continue;
+		th = &thresholds[0];
+		if (named) {
+			*value++ = '\0';
+			th = (volume_threshold_t *) find_threshold (item);
+			if (th == &thresholds[0]) {
+				if (thresholdNr > VOLUME_MAX)
+					usage2 (error, list);
+				th = &thresholds[thresholdNr++];
+				*th = thresholds[0];
+				th->name = item;
+			}
+		} else {
+			value = item;
+		}
+		if (get_threshold (value, &t) == ERROR)
+			usage2 (error, list);
+		*(int *) ((char *) th + offset) = t;
+	}
+	/* the names of the volumes point into the copy */
+	if (!named)
+		free (copy);
+	return OK;
+}
+
+static int
+split_volumes (char *list)
+{
+	char *item, *saveptr = NULL;
+
+	if (list == NULL)
+		return OK;
+	for (item = strtok_r (list, ",", &saveptr); item; item = strtok_r (NULL, ",", &saveptr)) {
+		if (volumeNr == VOLUME_MAX || strpbrk (item, "'\\") != NULL)
+			usage2 (_("Invalid volume list"), item);
+		volumes[volumeNr++] = item;
+	}
+	return OK;
+}
+
+int
+process_arguments_diskio (int argc, char **argv)
+{
+	int c;
+
+	int option = 0;
+	static struct option longopts[] = {
+		STD_LONG_OPTS,
+		{"port", required_argument, 0, 'p'},
+		{"username", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'P'},
+		{"volumes", required_argument, 0, 'i'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	for (c = 1; c < argc; c++)
+		if (strcmp ("-to", argv[c]) == 0)
+			strcpy (argv[c], "-t");
+
+	while (1) {
+		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:i:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':                                   /* help */
+			usage5 ();
+		case 'V':                                   /* version */
+			print_revision (progname, VERSION);
+			exit (STATE_OK);
+		case 'h':                                   /* help */
+			print_help_diskio ();
+			exit (STATE_OK);
+		case 'v':                                   /* verbose */
+			verbose = TRUE;
+			break;
+		case 't':                                   /* timeout period */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'H':                                   /* host */
+			if (is_host (optarg) == FALSE)
+			usage2 (_("Invalid hostname/address"), optarg);
+			server_name = optarg;
+			break;
+		case 'p':                                   /* port */
+			if (is_intpos (optarg)) {
+				port = atoi (optarg);
+			}
+			else {
+				usage2 (_("Port number must be a positive integer"), optarg);
+			}
+			break;
+		case 'c':
+			crit_list = optarg;
+			break;
+		case 'w':
+			warn_list = optarg;
+			break;
+		case 'u':
+			username = optarg;
+			break;
+		case 'P':
+			password = optarg;
+			break;
+		case 'i':
+			volume_list = optarg;
+			break;
+		}
+	}
+
+	return validate_arguments_diskio ();
+}
+
+int
+validate_arguments_diskio (void)
+{
+	if(username == NULL || strlen(username) == 0) {
+		username = getenv("WR_USERNAME");
+		if(username == NULL) {
+			return ERROR;
+		}
+	}
+	if(password == NULL || strlen(password) == 0) {
+		password = getenv("WR_PASSWORD");
+		if(password == NULL) {
+			return ERROR;
+		}
+	}
+
+	if (server_name == NULL || strlen(server_name) == 0)
+		return ERROR;
+	if (port == -1)                             /* funky, but allows -p to override stray integer in args */
+		port = WINR_DEF_PORT;
+
+	thresholds[0].name = NULL;
+	thresholds[0].warn = UNKNOWN_VALUE;
+	thresholds[0].crit = UNKNOWN_VALUE;
+	for (int named = 0; named < 2; named++) {
+		if (parse_thresholds (warn_list, offsetof (volume_threshold_t, warn), named,
+					_("Warning threshold must be integer or VOLUME=integer!")) == ERROR ||
+				parse_thresholds (crit_list, offsetof (volume_threshold_t, crit), named,
+					_("Critical threshold must be integer or VOLUME=integer!")) == ERROR)
+			return ERROR;
+	}
+	if (split_volumes (volume_list) == ERROR)
+		return ERROR;
+
+	xasprintf(&url, "http://%s:%d/wsman", server_name, port);
+	if (url == NULL)
+		return ERROR;
+
+	return OK;
+}
+
+void
+print_help_diskio (void)
+{
+    char *myport;
+    xasprintf (&myport, "%d", WINR_DEF_PORT);
+
+    print_revision (progname, VERSION);
+
+    printf ("Copyright (c) 2022 Fabian Baena <info@samanagroup.com>\n");
+
+    printf ("%s\n", _("Gets the disk latency, IOPS and throughput of every volume from a Windows server using WinRM"));
+
+    printf ("\n\n");
+
+    print_usage ();
+
+    printf (UT_HELP_VRSN);
+    printf (UT_EXTRA_OPTS);
+
+    printf (UT_HOST_PORT, 'p', myport);
+
+    printf (UT_CREDENTIALS);
+
+    printf (" %s\n", "-w, --warning=MS[,VOLUME=MS...]");
+    printf ("    %s\n", _("Read or write latency in ms that raises a warning, for all the volumes"));
+    printf ("    %s\n", _("and optionally for single volumes, e.g. 20,E:=50"));
+    printf (" %s\n", "-c, --critical=MS[,VOLUME=MS...]");
+    printf ("    %s\n", _("Same as -w for critical"));
+    printf (" %s\n", "-i, --volumes=VOLUME[,VOLUME...]");
+    printf ("    %s\n", _("Only check these volumes (default: all)"));
+
+    printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+
+    printf (UT_VERBOSE);
+
+    printf ("\n%s\n", _("The rates are averages since the previous check of the same host, kept in"));
+    printf ("%s\n", _("WR_STATE_DIR (default: " WR_STATE_DIR_DEFAULT "). The first check, or one after"));
+    printf (_("more than WR_STATE_MAX_AGE seconds (default: %d), waits a second for a second\n"),
+        WR_STATE_MAX_AGE_DEFAULT);
+    printf ("%s\n", _("sample."));
+
+    printf (UT_SUPPORT_SMN);
+}
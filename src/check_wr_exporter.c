@@ -0,0 +1,674 @@
+/*****************************************************************************
+*
+* Nagios check_wr plugin
+*
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+*
+* Description:
+*
+* This file contains wr-exporter, the Prometheus exporter of check_wr
+*
+* wr-exporter (or check_wr exporter) serves
+*
+*   /metrics?target=<host>&module=<cpu|mem|disk|pf|services|uptime>
+*
+* by running the check of the module in process against the target and
+* turning its performance data into OpenMetrics gauges. A few processes
+* serve the scrapes, each keeping its sessions logged in between them.
+* The results of the queries are shared through the file cache of the
+* library (WR_CACHE_TTL), so that several Prometheus servers scraping
+* the same target only query the Windows host once.
+*
+*
+*****************************************************************************/
+
+#include "config.h"
+#include <errno.h>
+#include <getopt.h>
+#include <libintl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "nagios.h"
+#include "parse.h"
+#include "session.h"
+#include "hostslot.h"
+#include "check_wr.h"
+
+#define EXPORTER_DEFAULT_LISTEN "127.0.0.1:9851"
+#define EXPORTER_DEFAULT_TTL 30
+/* below the 120 seconds WinRM keeps an idle connection open */
+#define EXPORTER_DEFAULT_IDLE 90
+#define EXPORTER_MAX_REQUEST 8192
+#define EXPORTER_MAX_ARGS 32
+#define EXPORTER_RESTART_DELAY 5
+#define EXPORTER_DEFAULT_WORKERS 4
+#define EXPORTER_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static const struct exporter_module {
+	const char *name;
+	const char *check;
+} exporter_modules[] = {
+	{ "cpu", "check_wr_cpu" },
+	{ "mem", "check_wr_mem" },
+	{ "disk", "check_wr_disk" },
+	{ "pf", "check_wr_pf" },
+	{ "services", "check_wr_service" },
+	{ "uptime", "check_wr_uptime" },
+	{ NULL, NULL }
+};
+
+struct exporter_options {
+	const char *username;
+	const char *password;
+	const char *timeout;
+};
+
+static volatile sig_atomic_t exporter_stop = 0;
+
+static void
+exporter_usage (void)
+{
+	printf ("%s\n", "Usage:");
+	printf ("  wr-exporter [-l [<address>:]<port>] [-c <seconds>] [-u <username>] [-P <password>]\n"
+			"              [-t <timeout>] [-i <seconds>] [-n <workers>]\n\n");
+	printf (" -l, --listen=[ADDRESS:]PORT\n");
+	printf ("    Address to serve /metrics on (default: %s)\n", EXPORTER_DEFAULT_LISTEN);
+	printf (" -c, --cache=INTEGER\n");
+	printf ("    Seconds a query result is served from the cache, WR_CACHE_TTL overrides it\n"
+			"    (default: %d)\n", EXPORTER_DEFAULT_TTL);
+	printf (" -t, --timeout=INTEGER\n");
+	printf ("    Timeout of every check (default: %d)\n", DEFAULT_SOCKET_TIMEOUT);
+	printf (" -i, --idle=INTEGER\n");
+	printf ("    Seconds an unused session is kept logged in (default: %d)\n",
+			EXPORTER_DEFAULT_IDLE);
+	printf (" -n, --workers=INTEGER\n");
+	printf ("    Processes serving scrapes, each one at a time (default: %d)\n",
+			EXPORTER_DEFAULT_WORKERS);
+	printf (UT_CREDENTIALS);
+	printf ("    WR_USERNAME and WR_PASSWORD are used when not given\n");
+	printf ("    WR_HOST_MAX_CONCURRENCY limits the requests sent at once to a host\n");
+}
+
+static double
+seconds_since (struct timeval *tv)
+{
+	return (double) deltime (*tv) / 1.0e6;
+}
+
+/* Decodes a query string value in place. */
+static void
+url_decode (char *s)
+{
+	char *out = s, hex[3] = { 0, 0, 0 };
+
+	for (; *s; s++) {
+		if (*s == '+') {
+			*out++ = ' ';
+		} else if (*s == '%' && s[1] && s[2]) {
+			hex[0] = s[1];
+			hex[1] = s[2];
+			*out++ = (char) strtol (hex, NULL, 16);
+			s += 2;
+		} else {
+			*out++ = *s;
+		}
+	}
+	*out = '\0';
+}
+
+static char *
+query_param (char *query, const char *name)
+{
+	size_t len = strlen (name);
+	char *p = query;
+
+	while (p && *p) {
+		if (strncmp (p, name, len) == 0 && p[len] == '=')
+			return p + len + 1;
+		p = strchr (p, '&');
+		if (p)
+			p++;
+	}
+	return NULL;
+}
+
+/*
+ * Writes a metric name from the module and the perfdata label, as
+ * normalized by smn_perfdata_label, and the unit suffix for the uom.
+ * Returns the factor to scale the value to the base unit.
+ */
+static double
+metric_name (FILE *out, const char *module, const char *label, const char *uom)
+{
+	static const struct { const char *uom; const char *suffix; double scale; } units[] = {
+		{ "%", "_percent", 1 }, { "s", "_seconds", 1 },
+		{ "ms", "_seconds", 1e-3 }, { "us", "_seconds", 1e-6 },
+		{ "B", "_bytes", 1 }, { "KB", "_bytes", 1024.0 },
+		{ "MB", "_bytes", 1048576.0 }, { "GB", "_bytes", 1073741824.0 },
+		{ "TB", "_bytes", 1099511627776.0 }, { "c", "_total", 1 },
+		{ NULL, NULL, 1 }
+	};
+	size_t suffix_len, len = strlen (label);
+
+	fprintf (out, "wr_%s_%s", module, label);
+	for (int i = 0; units[i].uom; i++) {
+		if (strcmp (uom, units[i].uom) != 0)
+			continue;
+		/* labels like used_percent already carry the unit */
+		suffix_len = strlen (units[i].suffix);
+		if (len < suffix_len || strncmp (label + len - suffix_len, units[i].suffix, suffix_len) != 0)
+			fputs (units[i].suffix, out);
+		return units[i].scale;
+	}
+	return 1;
+}
+
+/* Names of the metric families written, a family can only appear once */
+struct exporter_seen {
+	char **names;
+	int count;
+};
+
+static int
+seen_add (struct exporter_seen *seen, char *name)
+{
+	char **names;
+
+	for (int i = 0; i < seen->count; i++) {
+		if (strcmp (seen->names[i], name) == 0)
+			return 0;
+	}
+	names = realloc (seen->names, (seen->count + 1) * sizeof (char *));
+	if (names == NULL)
+		return 0;
+	seen->names = names;
+	seen->names[seen->count++] = name;
+	return 1;
+}
+
+/*
+ * Parses one perfdata item, 'label'=value[uom];warn;crit;min;max, and
+ * writes it as a gauge. Returns the position after the item.
+ */
+static const char *
+write_perfdata_item (FILE *out, const char *module, const char *p, struct exporter_seen *seen)
+{
+	const char *label, *value, *end;
+	size_t label_len, value_len;
+	char uom[8], *name = NULL, *normalized;
+	size_t name_size;
+	FILE *name_out;
+	double d, scale;
+
+	if (*p == '\'') {
+		label = ++p;
+		while (*p && *p != '\'')
+			p++;
+		label_len = p - label;
+		if (*p)
+			p++;
+	} else {
+		label = p;
+		while (*p && *p != '=' && *p != ' ')
+			p++;
+		label_len = p - label;
+	}
+	if (*p != '=')
+		return p + strcspn (p, " ");
+	value = ++p;
+	value_len = strspn (value, "0123456789.-+eE");
+	end = value + value_len;
+	p = end + strcspn (end, " ");
+	if (value_len == 0 || label_len == 0 || !wr_parse_real64 (&d, value, value_len))
+		return p;
+	snprintf (uom, sizeof (uom), "%.*s", (int) strcspn (end, "; "), end);
+
+	normalized = smn_perfdata_label (label, label_len);
+	if (normalized == NULL)
+		return p;
+	name_out = open_memstream (&name, &name_size);
+	if (name_out == NULL) {
+		free (normalized);
+		return p;
+	}
+	scale = metric_name (name_out, module, normalized, uom);
+	fclose (name_out);
+	free (normalized);
+
+	if (!seen_add (seen, name)) {
+		free (name);
+		return p;
+	}
+	fprintf (out, "# TYPE %s gauge\n%s %.15g\n", name, name, d * scale);
+	return p;
+}
+
+/*
+ * Performance data is what follows the | of the first line and every
+ * line after the | of the long output, as Nagios reads it.
+ */
+static void
+write_perfdata (FILE *out, const char *module, const char *output)
+{
+	const char *line = output, *p, *eol;
+	struct exporter_seen seen = { NULL, 0 };
+	int in_perfdata = 0, first = 1;
+
+	for (; line && *line; line = *eol ? eol + 1 : eol, first = 0) {
+		eol = line + strcspn (line, "\n");
+		p = in_perfdata ? line : memchr (line, '|', eol - line);
+		if (p == NULL)
+			continue;
+		if (!in_perfdata) {
+			p++;
+			in_perfdata = !first;
+		}
+		while (p < eol) {
+			char *item;
+			const char *next;
+			size_t len;
+
+			while (p < eol && *p == ' ')
+				p++;
+			if (p >= eol)
+				break;
+			/* items are parsed from a copy so they stop at the end of line */
+			len = eol - p;
+			item = strndup (p, len);
+			if (item == NULL)
+				break;
+			next = write_perfdata_item (out, module, item, &seen);
+			p += next - item;
+			free (item);
+		}
+	}
+	for (int i = 0; i < seen.count; i++)
+		free (seen.names[i]);
+	free (seen.names);
+}
+
+/*
+ * The check ended through exit(), likely from its timeout alarm in the
+ * middle of malloc or stdio: the reply is written as it is and the
+ * exporter ends, to be started again, without touching anything else.
+ */
+static void
+scrape_aborted (int status, void *data)
+{
+	static const char reply[] = "HTTP/1.1 504 Gateway Timeout\r\n"
+		"Content-Type: text/plain\r\nContent-Length: 14\r\n"
+		"Connection: close\r\n\r\nCheck aborted\n";
+	int fd = *(int *) data;
+
+	while (write (fd, reply, sizeof (reply) - 1) < 0 && errno == EINTR)
+		;
+	_exit (STATE_OK);
+}
+
+static char *
+run_module (int fd, const struct exporter_module *module, const char *target,
+		char *include, char *exclude, struct exporter_options *opt, int *clean)
+{
+	char *argv[EXPORTER_MAX_ARGS], *out = NULL, *err = NULL, *body = NULL;
+	size_t size;
+	struct timeval tv;
+	wr_host_slot_stats_t before, after;
+	int argc = 0, state;
+	FILE *metrics;
+
+	argv[argc++] = (char *) module->check;
+	argv[argc++] = "-H";
+	argv[argc++] = (char *) target;
+	if (opt->username) {
+		argv[argc++] = "-u";
+		argv[argc++] = (char *) opt->username;
+	}
+	if (opt->password) {
+		argv[argc++] = "-P";
+		argv[argc++] = (char *) opt->password;
+	}
+	argv[argc++] = "-t";
+	argv[argc++] = (char *) opt->timeout;
+	if (include) {
+		argv[argc++] = "-i";
+		argv[argc++] = include;
+	}
+	if (exclude) {
+		argv[argc++] = "-e";
+		argv[argc++] = exclude;
+	}
+	argv[argc] = NULL;
+
+	gettimeofday (&tv, NULL);
+	wr_host_slot_stats (&before);
+	state = check_wr_run (check_wr_applet (module->check), argc, argv, &out, &err, clean,
+			scrape_aborted, &fd);
+	wr_host_slot_stats (&after);
+
+	metrics = open_memstream (&body, &size);
+	if (metrics != NULL) {
+		write_perfdata (metrics, module->name, out ? out : "");
+		fprintf (metrics, "# TYPE wr_check_state gauge\n");
+		fprintf (metrics, "wr_check_state{module=\"%s\"} %d\n", module->name, state);
+		fprintf (metrics, "# TYPE wr_up gauge\n");
+		fprintf (metrics, "wr_up{module=\"%s\"} %d\n", module->name,
+				state == STATE_UNKNOWN ? 0 : 1);
+		fprintf (metrics, "# TYPE wr_scrape_duration_seconds gauge\n");
+		fprintf (metrics, "wr_scrape_duration_seconds{module=\"%s\"} %f\n", module->name,
+				seconds_since (&tv));
+		/* time spent waiting for a slot of the host (WR_HOST_MAX_CONCURRENCY) */
+		fprintf (metrics, "# TYPE wr_host_queue_wait_seconds gauge\n");
+		fprintf (metrics, "wr_host_queue_wait_seconds{module=\"%s\"} %f\n", module->name,
+				after.wait_seconds - before.wait_seconds);
+		fprintf (metrics, "# TYPE wr_host_queue_depth gauge\n");
+		fprintf (metrics, "wr_host_queue_depth{module=\"%s\"} %u\n", module->name,
+				after.waited > before.waited ? after.queue_depth : 0);
+		fclose (metrics);
+	}
+	free (out);
+	free (err);
+	return body;
+}
+
+static void
+http_reply (int fd, int code, const char *reason, const char *type, const char *body)
+{
+	char *reply = NULL;
+	ssize_t len;
+
+	len = xasprintf (&reply, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+			"Content-Length: %lu\r\nConnection: close\r\n\r\n%s",
+			code, reason, type, (unsigned long) strlen (body), body);
+	if (len > 0 && write (fd, reply, len) != len)
+		fprintf (stderr, "Error - Unable to send reply.\n");
+	free (reply);
+}
+
+/* Returns 0 when the exporter has to be restarted after this request. */
+static int
+serve (int fd, struct exporter_options *opt)
+{
+	const struct exporter_module *module = NULL;
+	char request[EXPORTER_MAX_REQUEST], *path, *query, *p;
+	char *target, *module_name, *include, *exclude, *body, *reply = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int clean = 1;
+
+	/* the request line is all that is needed */
+	while (len < sizeof (request) - 1) {
+		n = read (fd, request + len, sizeof (request) - 1 - len);
+		if (n <= 0)
+			return 1;
+		len += n;
+		request[len] = '\0';
+		if (strstr (request, "\r\n") != NULL)
+			break;
+	}
+	if (strncmp (request, "GET ", 4) != 0) {
+		http_reply (fd, 405, "Method Not Allowed", "text/plain", "Only GET is supported\n");
+		return 1;
+	}
+	path = request + 4;
+	path[strcspn (path, " \r\n")] = '\0';
+	if ((query = strchr (path, '?')) != NULL)
+		*query++ = '\0';
+	if (strcmp (path, "/metrics") != 0) {
+		http_reply (fd, 404, "Not Found", "text/plain",
+				"Use /metrics?target=<host>&module=<module>\n");
+		return 1;
+	}
+
+	target = query_param (query, "target");
+	module_name = query_param (query, "module");
+	include = query_param (query, "include");
+	exclude = query_param (query, "exclude");
+	/* end every value now that all of them were found */
+	for (p = query; p && (p = strchr (p, '&')) != NULL; p++)
+		*p = '\0';
+	if (target)
+		url_decode (target);
+	if (module_name)
+		url_decode (module_name);
+	if (include)
+		url_decode (include);
+	if (exclude)
+		url_decode (exclude);
+
+	for (int i = 0; module_name && exporter_modules[i].name; i++) {
+		if (strcmp (module_name, exporter_modules[i].name) == 0)
+			module = &exporter_modules[i];
+	}
+	if (target == NULL || *target == '\0' || module == NULL) {
+		http_reply (fd, 400, "Bad Request", "text/plain",
+				"target and module (cpu, mem, disk, pf, services, uptime) are required\n");
+		return 1;
+	}
+
+	/* the queries of the check come from the cache when recent enough */
+	body = run_module (fd, module, target, include, exclude, opt, &clean);
+	if (body == NULL) {
+		http_reply (fd, 500, "Internal Server Error", "text/plain", "Unable to run check\n");
+		return clean;
+	}
+
+	xasprintf (&reply, "%s# EOF\n", body);
+	http_reply (fd, 200, "OK", EXPORTER_CONTENT_TYPE, reply);
+	free (reply);
+	free (body);
+	return clean;
+}
+
+static int
+exporter_listen (const char *listen_on)
+{
+	struct addrinfo hints, *res = NULL;
+	char *host, *port, *copy;
+	int fd = -1, one = 1;
+
+	copy = strdup (listen_on);
+	if (copy == NULL)
+		return -1;
+	if ((port = strrchr (copy, ':')) != NULL) {
+		*port++ = '\0';
+		host = copy;
+	} else {
+		port = copy;
+		host = NULL;
+	}
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo (host && *host ? host : NULL, port, &hints, &res) != 0 || res == NULL) {
+		fprintf (stderr, "Error - Invalid listen address %s\n", listen_on);
+		goto end;
+	}
+	fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		fprintf (stderr, "Error - Unable to create socket: %s\n", strerror (errno));
+		goto end;
+	}
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+	if (bind (fd, res->ai_addr, res->ai_addrlen) < 0 || listen (fd, 64) < 0) {
+		fprintf (stderr, "Error - Unable to listen on %s: %s\n", listen_on, strerror (errno));
+		close (fd);
+		fd = -1;
+	}
+
+	end:
+	if (res)
+		freeaddrinfo (res);
+	free (copy);
+	return fd;
+}
+
+/*
+ * Serves scrapes one at a time, the other processes of the pool taking
+ * those coming meanwhile. Returns when a check left the process in a
+ * state that should not be reused.
+ */
+static void
+exporter_run (int listen_fd, struct exporter_options *opt)
+{
+	struct timeval tv = { 10, 0 };
+	int fd, clean = 1;
+
+	while (clean && !exporter_stop) {
+		fd = accept (listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+		setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+		clean = serve (fd, opt);
+		close (fd);
+	}
+}
+
+static void
+stop_handler (int signo)
+{
+	exporter_stop = 1;
+}
+
+int
+check_wr_exporter_main (int argc, char **argv)
+{
+	struct exporter_options opt = { NULL, NULL, "10" };
+	const char *listen_on = EXPORTER_DEFAULT_LISTEN, *ttl = NULL;
+	int idle = EXPORTER_DEFAULT_IDLE, workers = EXPORTER_DEFAULT_WORKERS;
+	int listen_fd, status = 0, c;
+	char default_ttl[16];
+	struct sigaction sa;
+	pid_t *pids;
+	int *delay;
+	pid_t pid;
+
+	static struct option longopts[] = {
+		{"listen", required_argument, 0, 'l'},
+		{"cache", required_argument, 0, 'c'},
+		{"timeout", required_argument, 0, 't'},
+		{"idle", required_argument, 0, 'i'},
+		{"username", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'P'},
+		{"workers", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	progname = "wr-exporter";
+	optind = 0;
+	while ((c = getopt_long (argc, argv, "l:c:t:i:u:P:n:h", longopts, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			listen_on = optarg;
+			break;
+		case 'c':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Cache time must be a non-negative integer"), optarg);
+			ttl = optarg;
+			break;
+		case 't':
+			if (!is_intpos (optarg))
+				usage2 (_("Timeout must be a positive integer"), optarg);
+			opt.timeout = optarg;
+			break;
+		case 'i':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Idle time must be a non-negative integer"), optarg);
+			idle = atoi (optarg);
+			break;
+		case 'u':
+			opt.username = optarg;
+			break;
+		case 'P':
+			opt.password = optarg;
+			break;
+		case 'n':
+			if (!is_intpos (optarg))
+				usage2 (_("Workers must be a positive integer"), optarg);
+			workers = atoi (optarg);
+			break;
+		default:
+			exporter_usage ();
+			return STATE_UNKNOWN;
+		}
+	}
+
+	/* the processes of the pool share the results of the queries */
+	if (ttl == NULL) {
+		snprintf (default_ttl, sizeof (default_ttl), "%d", EXPORTER_DEFAULT_TTL);
+		ttl = default_ttl;
+	}
+	setenv ("WR_CACHE_TTL", ttl, 0);
+
+	pids = calloc (workers, sizeof (pid_t));
+	delay = calloc (workers, sizeof (int));
+	if (pids == NULL || delay == NULL) {
+		fprintf (stderr, "Error - Unable to reserve memory for exporters.\n");
+		return STATE_UNKNOWN;
+	}
+	listen_fd = exporter_listen (listen_on);
+	if (listen_fd < 0) {
+		free (pids);
+		free (delay);
+		return STATE_UNKNOWN;
+	}
+
+	/* without SA_RESTART so that accept and wait return on a signal */
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = stop_handler;
+	sigemptyset (&sa.sa_mask);
+	sigaction (SIGTERM, &sa, NULL);
+	sigaction (SIGINT, &sa, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	/* keep every exporter of the pool running, restarting the ones that end */
+	while (!exporter_stop) {
+		for (int i = 0; i < workers && !exporter_stop; i++) {
+			if (pids[i] > 0)
+				continue;
+			/* do not spin on an exporter that crashes */
+			if (delay[i])
+				sleep (EXPORTER_RESTART_DELAY);
+			pid = fork ();
+			if (pid == 0) {
+				signal (SIGINT, SIG_IGN);
+				wr_session_pool_enable (idle);
+				exporter_run (listen_fd, &opt);
+				_exit (STATE_OK);
+			}
+			if (pid < 0)
+				fprintf (stderr, "Error - Unable to start exporter: %s\n", strerror (errno));
+			else
+				pids[i] = pid;
+		}
+		pid = wait (&status);
+		for (int i = 0; pid > 0 && i < workers; i++) {
+			if (pids[i] != pid)
+				continue;
+			pids[i] = 0;
+			delay[i] = !WIFEXITED (status);
+		}
+	}
+
+	for (int i = 0; i < workers; i++) {
+		if (pids[i] > 0)
+			kill (pids[i], SIGTERM);
+	}
+	while (wait (&status) > 0)
+		;
+	close (listen_fd);
+	free (pids);
+	free (delay);
+	return STATE_OK;
+}
@@ -17,10 +17,6 @@
 * 
 *****************************************************************************/
 
-const char *progname = "check_wr_log";
-const char *copyright = "2023-2037";
-const char *email = "info@samanagroup.com";
-
 #include "config.h"
 #include <locale.h>
 #include <libintl.h>
@@ -30,40 +26,54 @@ const char *email = "info@samanagroup.com";
 #include <string.h>
 #include <errno.h>
 #include "protocol.h"
+#include "session.h"
+#include "deadline.h"
 #include "transport.h"
 #include "nagios.h"
 #include "xml.h"
+#include "check_wr.h"
 #include <regex.h>
 
 #define NAMESPACE "root/cimv2"
 #define CHECK_CLASS_NAME "Win32_NTLogEvent"
-#define NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/" CHECK_CLASS_NAME
-#define WQL_QUERY "SELECT * FROM " CHECK_CLASS_NAME " WHERE TimeGenerated > '%s' and EventType <= %d and Logfile = '%s'"
+#define RESOURCE_URI "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/*"
+#define WQL_WHERE "TimeGenerated > '%s' and EventType <= %d and "
+#define WQL_EVENTS "SELECT RecordNumber, Logfile, EventCode, EventType, SourceName, Type FROM " CHECK_CLASS_NAME " WHERE "
+#define WQL_MESSAGES "SELECT RecordNumber, Message FROM " CHECK_CLASS_NAME " WHERE "
 #define MAX_EVENTS_PRINT 10
+#define MESSAGE_FETCH_CHUNK 25          /* RecordNumber terms per query */
+#define MESSAGE_FETCH_MAX 100           /* more than this and all messages are fetched */
 #define EXCEPTION_SEPARATOR '|'
 #define EXC_VALUE_SEPARATOR ','
+#define BRE_SPECIAL ".[]*^$\\"
+#define LOG_MAX 8                       /* logs in one -l list */
+#define LOG_SEPARATOR ','
+#define SERVICE_SUFFIX " Errors"        /* passive results go to "<log> Errors" */
 
 typedef struct _log_exception_set *log_exception_set_t;
 typedef struct _wmi_log *wmi_log_t;
-
-int legacy = 0;
-int port = -1;
-char *server_name = NULL;
-int verbose = FALSE;
-char *username = NULL;
-char *password = NULL;
-char *url = NULL;
-char *logname = NULL;
-int warn = UNKNOWN_VALUE;
-int crit = UNKNOWN_VALUE;
-int log_minutes = 5;
-struct _log_exception_set le;
+typedef struct _log_check *log_check_t;
+
+static char *logname = NULL;
+static int log_minutes = 5;
+static char *warn_list = NULL, *crit_list = NULL;
+static char *exception_list[LOG_MAX];
+static int exception_listNr = 0;
+static char *spool_dir = NULL, *command_file = NULL, *result_host = NULL;
+static char *lognames = NULL;
+static struct _log_check *logs = NULL;
+static int logNr = 0;
 
 int check_log (char *url);
 int validate_arguments_log (void);
 int process_arguments_log (int argc, char **argv);
 int is_host (const char *);
+void free_exception_set(log_exception_set_t l);
 uint32_t process_exceptions(log_exception_set_t l, const char *e);
+uint32_t index_exceptions(log_exception_set_t l);
+void append_exclusions(FILE *out, log_exception_set_t l, const char *logfile);
+int exception_without_message(wmi_log_t event, log_exception_set_t le);
+static uint32_t exception_with_message(wmi_log_t event, log_exception_set_t le);
 uint32_t is_exception(wmi_log_t event, log_exception_set_t le);
 void print_help_log (void);
 
@@ -75,22 +85,50 @@ typedef struct _log_exception {
 	regex_t rx_Message;
 } *log_exception_t;
 
+/*
+ * The exceptions of one EventCode. Those with only a source, or only a
+ * message, are tested with a single regex that joins all of them, the
+ * rest one by one.
+ */
+typedef struct _log_exception_bucket {
+	int32_t EventCode;
+	uint32_t used;
+	uint32_t any;                   /* an exception with only the code */
+	uint32_t has_SourceName;
+	uint32_t has_Message;
+	regex_t rx_SourceName;
+	regex_t rx_Message;
+	uint32_t exceptionNr;
+	log_exception_t *exceptionTab;
+} *log_exception_bucket_t;
+
 typedef struct _log_exception_set {
 	uint32_t exceptionNr;
 	uint32_t exceptionMax;
 	log_exception_t exceptionTab;
+	struct _log_exception_bucket wildcard;  /* EventCode 0 */
+	uint32_t bucketMax;             /* power of 2 */
+	log_exception_bucket_t bucketTab;
 } *log_exception_set_t;
 
 typedef struct _wmi_log {
-	xmlNodePtr node;
+	uint64_t RecordNumber;
 	uint64_t EventCode;
-	char *Message;
-	char *SourceName;
-	char *Type;
+	char *Message;                  /* only fetched when needed */
+	const char *SourceName;
+	const char *Type;
 	uint64_t EventType;
-	uint32_t is_exception;
+	int is_exception;               /* -1 until the message is known */
 } *wmi_log_t;
 
+typedef struct _log_events {
+	uint32_t eventNr;
+	uint32_t eventMax;
+	wmi_log_t eventTab;
+	uint32_t fetchNr;
+	wmi_log_t *fetchTab;            /* sorted by RecordNumber */
+} *log_events_t;
+
 struct event_count {
 	int Error;
 	int Warning;
@@ -99,14 +137,34 @@ struct event_count {
 	int Total;
 };
 
+/* One log of the -l list, with its own thresholds and exceptions */
+typedef struct _log_check {
+	const char *name;
+	int warn;
+	int crit;
+	struct _log_exception_set le;
+	struct _log_events events;
+	struct event_count ec;
+} *log_check_t;
+
+/* Demultiplexes the events of all the logs by Logfile */
+struct log_reader {
+	xmlDictPtr dict;
+	log_check_t logs;
+	int count;
+};
+
 int
-main (int argc, char **argv)
+check_wr_log_main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	smn_applet_init ("check_wr_log", UNKNOWN_VALUE);
+	logname = NULL;
+	log_minutes = 5;
+	warn_list = crit_list = NULL;
+	exception_listNr = 0;
+	spool_dir = command_file = result_host = NULL;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -118,244 +176,566 @@ main (int argc, char **argv)
 	signal (SIGALRM, timeout_alarm_handler);
 
 	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
 
 	/* ssh_connect exits if error is found */
 	result = check_log (url);
 
 	alarm (0);
 
+	for (int i = 0; i < logNr; i++)
+		free_exception_set (&logs[i].le);
+	FREE_NULL (logs);
+	FREE_NULL (lognames);
+	logNr = 0;
+
 	return (result);
 }
 
+static xmlNodePtr
+find_prop(xmlNodePtr item, const char *name)
+{
+	for(xmlNodePtr property = xmlFirstElementChild(item); property;
+			property = xmlNextElementSibling(property)) {
+		if(strcmp((char *) property->name, name) != 0) continue;
+		return xmlHasProp(property, BAD_CAST "nil") ? NULL : property;
+	}
+	return NULL;
+}
+
+/* Reads the metadata of every event, the items are XmlFragment nodes. */
+static uint32_t
+read_events(xmlNodePtr items, void *data)
+{
+	struct log_reader *reader = (struct log_reader *) data;
+	log_events_t events;
+	wmi_log_t event;
+	const char *logfile;
+	int i;
+
+	for(xmlNodePtr item = xmlFirstElementChild(items); item; item = xmlNextElementSibling(item)) {
+		if(!xml_class_get_prop_interned(&logfile, item, "Logfile", reader->dict)) {
+			printf(_("UNKNOWN - Invalid response from server.\n"));
+			return 0;
+		}
+		for(i = 0; i < reader->count && strcasecmp(reader->logs[i].name, logfile); i++);
+		if(i == reader->count) continue;
+		events = &reader->logs[i].events;
+
+		if(events->eventNr == events->eventMax) {
+			uint32_t max = events->eventMax ? events->eventMax * 2 : 64;
+			void *temp = realloc(events->eventTab, max * sizeof(struct _wmi_log));
+			if(temp == NULL) {
+				printf(_("UNKNOWN - Could not reserve memory for log data.\n"));
+				return 0;
+			}
+			events->eventTab = temp;
+			events->eventMax = max;
+		}
+		event = &events->eventTab[events->eventNr];
+		memset(event, 0, sizeof(struct _wmi_log));
+
+		if(!xml_class_get_prop_uint64(&event->RecordNumber, item, "RecordNumber") ||
+				!xml_class_get_prop_uint64(&event->EventCode, item, "EventCode") ||
+				!xml_class_get_prop_uint64(&event->EventType, item, "EventType") ||
+				!xml_class_get_prop_interned(&event->SourceName, item, "SourceName", reader->dict) ||
+				!xml_class_get_prop_interned(&event->Type, item, "Type", reader->dict)) {
+			printf(_("UNKNOWN - Invalid response from server.\n"));
+			return 0;
+		}
+		events->eventNr++;
+	}
+	return 1;
+}
+
+static int
+compare_record(const void *a, const void *b)
+{
+	uint64_t ra = (*(const wmi_log_t *) a)->RecordNumber;
+	uint64_t rb = (*(const wmi_log_t *) b)->RecordNumber;
+
+	return ra < rb ? -1 : ra > rb;
+}
+
+/* Stores the message of every event waiting for one. */
+static uint32_t
+read_messages(xmlNodePtr items, void *data)
+{
+	log_events_t events = (log_events_t) data;
+	struct _wmi_log key;
+	wmi_log_t key_ptr = &key, *found;
+	xmlNodePtr property;
+
+	for(xmlNodePtr item = xmlFirstElementChild(items); item; item = xmlNextElementSibling(item)) {
+		if(!xml_class_get_prop_uint64(&key.RecordNumber, item, "RecordNumber")) continue;
+		found = bsearch(&key_ptr, events->fetchTab, events->fetchNr,
+			sizeof(wmi_log_t), compare_record);
+		if(found == NULL || (*found)->Message != NULL) continue;
+		property = find_prop(item, "Message");
+		if(property == NULL) continue;
+		(*found)->Message = (char *) xmlNodeGetContent(property);
+	}
+	return 1;
+}
+
+static uint32_t
+run_query(void *proto, const char *wql, wr_items_cb callback, void *data)
+{
+	if(verbose)
+		fprintf(stderr, "%s\n", wql);
+	if(!wr_enumerate(proto, RESOURCE_URI, NULL, wql, NULL) ||
+			!wr_pull_each(proto, RESOURCE_URI, callback, data)) {
+		smn_unknown(_("Unable to run WQL query."));
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Builds the filter of the events of count logs, with the exclusions
+ * of every log.
+ */
+static char *
+build_where(const char *TimeGenerated, log_check_t log, int count)
+{
+	char *where = NULL;
+	size_t where_size = 0;
+	FILE *out;
+
+	out = open_memstream(&where, &where_size);
+	if(out == NULL) return NULL;
+	fprintf(out, WQL_WHERE, TimeGenerated, 2);
+	if(count == 1) {
+		fprintf(out, "Logfile = '%s'", log->name);
+	} else {
+		fputc('(', out);
+		for(int i = 0; i < count; i++)
+			fprintf(out, "%sLogfile = '%s'", i ? " or " : "", log[i].name);
+		fputc(')', out);
+	}
+	for(int i = 0; i < count; i++)
+		append_exclusions(out, &log[i].le, count > 1 ? log[i].name : NULL);
+	if(fclose(out) == EOF) {
+		free(where);
+		return NULL;
+	}
+	return where;
+}
+
+/*
+ * Fetches the messages of the events that need one, the ones that an
+ * exception must check and the ones that are printed. Few events are
+ * fetched by RecordNumber, many with the same filter as the events.
+ */
+static uint32_t
+fetch_messages(void *proto, const char *TimeGenerated, log_check_t log)
+{
+	log_events_t events = &log->events;
+	uint32_t printed = 0, result = 1;
+	char *wql, *where;
+
+	events->fetchNr = 0;
+	events->fetchTab = calloc(events->eventNr, sizeof(wmi_log_t));
+	if(events->fetchTab == NULL && events->eventNr > 0) {
+		printf(_("UNKNOWN - Could not reserve memory for log data.\n"));
+		return 0;
+	}
+	/* an undecided event can only push printed events further down */
+	for(uint32_t i = 0; i < events->eventNr; i++) {
+		wmi_log_t event = &events->eventTab[i];
+
+		if(event->is_exception == 0 && printed < MAX_EVENTS_PRINT)
+			printed++;
+		else if(event->is_exception != -1)
+			continue;
+		events->fetchTab[events->fetchNr++] = event;
+	}
+	if(events->fetchNr == 0) return 1;
+	qsort(events->fetchTab, events->fetchNr, sizeof(wmi_log_t), compare_record);
+
+	if(events->fetchNr > MESSAGE_FETCH_MAX) {
+		where = build_where(TimeGenerated, log, 1);
+		if(where == NULL) return 0;
+		xasprintf(&wql, "%s%s", WQL_MESSAGES, where);
+		result = run_query(proto, wql, read_messages, events);
+		free(wql);
+		free(where);
+		return result;
+	}
+
+	for(uint32_t i = 0; i < events->fetchNr && result; i += MESSAGE_FETCH_CHUNK) {
+		char *temp;
+
+		xasprintf(&wql, "%sLogfile = '%s' and TimeGenerated > '%s' and (",
+			WQL_MESSAGES, log->name, TimeGenerated);
+		for(uint32_t j = i; j < events->fetchNr && j < i + MESSAGE_FETCH_CHUNK; j++) {
+			xasprintf(&temp, "%s%sRecordNumber = %lu", wql, j > i ? " or " : "",
+				(unsigned long) events->fetchTab[j]->RecordNumber);
+			free(wql);
+			wql = temp;
+		}
+		xasprintf(&temp, "%s)", wql);
+		free(wql);
+		wql = temp;
+		result = run_query(proto, wql, read_messages, events);
+		free(wql);
+	}
+	return result;
+}
+
+static void
+count_events(log_check_t log)
+{
+	struct event_count *ec = &log->ec;
+
+	for(uint32_t i = 0; i < log->events.eventNr; i++) {
+		wmi_log_t event = &log->events.eventTab[i];
+
+		if(event->is_exception == -1)
+			event->is_exception = exception_with_message(event, &log->le);
+
+		if(!event->is_exception) {
+			ec->Total++;
+			switch(event->EventType) {
+			case 1:
+				ec->Error++;
+				break;
+			case 2:
+				ec->Warning++;
+				break;
+			case 4:
+				ec->AuditSuccess++;
+				break;
+			case 5:
+				ec->AuditFailures++;
+				break;
+			}			
+		}
+	}
+}
+
+static int
+log_state(log_check_t log)
+{
+	if(log->ec.Total > log->crit)
+		return STATE_CRITICAL;
+	if(log->ec.Total > log->warn)
+		return STATE_WARNING;
+	return STATE_OK;
+}
+
+static const char *
+state_text(int state)
+{
+	switch(state) {
+	case STATE_OK:
+		return _("OK");
+	case STATE_WARNING:
+		return _("WARNING");
+	case STATE_CRITICAL:
+		return _("CRITICAL");
+	}
+	return _("UNKNOWN");
+}
+
+/* Writes the perfdata of a log, labels prefixed with the log name in
+ * multi-log output. */
+static void
+print_perfdata(FILE *out, log_check_t log, int prefixed)
+{
+	static const char *labels[] = { "error", "warning", "audit_success", "audit_failure" };
+	int values[] = { log->ec.Error, log->ec.Warning, log->ec.AuditSuccess, log->ec.AuditFailures };
+	char *label, *perfdata_str;
+
+	for(int i = 0; i < 4; i++) {
+		if(prefixed)
+			xasprintf(&label, "%s_%s", log->name, labels[i]);
+		else
+			label = strdup(labels[i]);
+		perfdata_str = smn_perfdata(label,
+			values[i], "",
+			(log->warn != UNKNOWN_VALUE), log->warn,
+			(log->crit != UNKNOWN_VALUE), log->crit,
+			0, 0, 0, 0);
+		fprintf(out, " %s", perfdata_str);
+		free(perfdata_str);
+		free(label);
+	}
+}
+
+static void
+print_events(FILE *out, log_check_t log)
+{
+	int printed = 0;
+
+	for (int i = 0; i < log->events.eventNr && printed < MAX_EVENTS_PRINT; i++) {
+		wmi_log_t event = &log->events.eventTab[i];
+
+		if(event->is_exception) continue;
+		fprintf(out, "   %s - %ld - %.50s - %.80s\n",
+			event->Type,
+			event->EventCode,
+			event->SourceName,
+			event->Message ? event->Message : "");
+		printed++;
+	}
+	if(printed >= MAX_EVENTS_PRINT) {
+		fprintf(out, "Truncated... (Showing only %d events)\n", printed);
+	}
+}
+
+/* Writes the output of a single log check. */
+static void
+print_log(FILE *out, log_check_t log)
+{
+	fprintf(out, "%s", state_text(log_state(log)));
+	fprintf(out, _(" - Error or Warning Events=%d"), log->ec.Total);
+	fprintf(out, _(" |"));
+	print_perfdata(out, log, 0);
+	fprintf(out, _("\n"));
+	print_events(out, log);
+}
+
+/*
+ * Sends the result of every log as a passive check of the service
+ * "<log> Errors", the way role-samana6-windows.cfg names them.
+ */
+static int
+submit_results(struct timeval *start)
+{
+	smn_result_t results[LOG_MAX];
+	char *descriptions[LOG_MAX], *outputs[LOG_MAX];
+	struct timeval finish;
+	size_t size;
+	FILE *out;
+	int result = OK, count;
+
+	gettimeofday(&finish, NULL);
+	for(count = 0; count < logNr; count++) {
+		smn_result_t *r = &results[count];
+
+		outputs[count] = NULL;
+		out = open_memstream(&outputs[count], &size);
+		if(out == NULL) {
+			result = ERROR;
+			goto end;
+		}
+		print_log(out, &logs[count]);
+		fclose(out);
+		xasprintf(&descriptions[count], "%s%s", logs[count].name, SERVICE_SUFFIX);
+
+		r->host_name = result_host ? result_host : server_name;
+		r->service_description = descriptions[count];
+		r->return_code = log_state(&logs[count]);
+		r->output = outputs[count];
+		r->start = *start;
+		r->finish = finish;
+	}
+	if(spool_dir)
+		result = smn_spool_results(spool_dir, results, count);
+	if(command_file && result == OK)
+		result = smn_command_results(command_file, results, count);
+
+	end:
+	for(int i = 0; i < count; i++) {
+		free(descriptions[i]);
+		free(outputs[i]);
+	}
+	return result;
+}
+
 int
 check_log (char *url)
 {
 	int result = STATE_OK;
-	void *proto=NULL, *wql_ctx=NULL;
+	void *proto=NULL;
 	struct timeval tv;
-	char *namespace=NAMESPACE;
-	char *wql = WQL_QUERY;
+	char *where = NULL, *wql = NULL;
 	long elapsed_time;
-	char *perfdata_str;
-	xmlDocPtr response=NULL, schema=NULL;
-	xmlNodeSetPtr nodes = NULL;
-	char *xPathExpr;
 	char TimeGenerated[128];
 	time_t current_time;
 	struct tm current_time_tm;
-	wmi_log_t log_data = NULL;
-	struct event_count ec = { 0 };
+	struct log_reader reader;
 
 	gettimeofday(&tv, NULL);
 	current_time = time(NULL) - log_minutes * 60;
 	gmtime_r(&current_time, &current_time_tm);
 	strftime(TimeGenerated, 128, "%Y%m%d%H%M%S.000000Z", &current_time_tm);
 
-	proto = wrprotocol_ctx_new();
+	proto = wr_session_get(username, password, url);
 	if(proto == NULL) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
-	if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
 
-	xasprintf(&wql, WQL_QUERY, TimeGenerated, 2, logname);
-	wql_ctx = wr_wql_new(proto, namespace, wql);
-	free(wql);
-	if(wql_ctx == NULL) {
+	/* All the logs come in one query and are split by Logfile. */
+	where = build_where(TimeGenerated, logs, logNr);
+	if(where == NULL) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
-	if(!wr_wql_run(wql_ctx)) {
+	/* The messages are rendered by the server and are the largest part
+	 * of an event, they are left for a second query. */
+	reader.dict = wrprotocol_ctx_dict(proto);
+	reader.logs = logs;
+	reader.count = logNr;
+	xasprintf(&wql, "%s%s", WQL_EVENTS, where);
+	if(!run_query(proto, wql, read_events, &reader)) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
-	response = wr_wql_response_toxml(wql_ctx);
-	if(response == NULL) {
-		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Response from server was empty"));
-		goto end;
+	for(int l = 0; l < logNr; l++) {
+		log_events_t events = &logs[l].events;
+
+		for(uint32_t i = 0; i < events->eventNr; i++)
+			events->eventTab[i].is_exception =
+				exception_without_message(&events->eventTab[i], &logs[l].le);
+		if(!fetch_messages(proto, TimeGenerated, &logs[l])) {
+			result = STATE_UNKNOWN;
+			goto end;
+		}
+		count_events(&logs[l]);
 	}
 
-	schema = wr_wql_schema_toxml(wql_ctx);
-	if(schema == NULL) {
+	if((spool_dir || command_file) && submit_results(&tv) != OK) {
+		printf(_("UNKNOWN - Unable to submit the passive results\n"));
 		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Schema from server was empty"));
 		goto end;
 	}
 
-	xPathExpr = "//p:" CHECK_CLASS_NAME;
-	xml_find_all(&nodes, response, xPathExpr, "p", NS_URL);
-
-	log_data = calloc(nodes->nodeNr, sizeof(struct _wmi_log));
-	if(log_data == NULL && nodes->nodeNr > 0) {
-		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Could not reserve memory for log data.\n"));
+	if(logNr == 1) {
+		result = log_state(&logs[0]);
+		print_log(stdout, &logs[0]);
 		goto end;
 	}
 
 	result = STATE_OK;
-	for(int i = 0; i < nodes->nodeNr; i++) {
-		log_data[i].node = nodes->nodeTab[i];
-
-		if(!xml_class_get_prop_num(&log_data[i].EventCode, 
-				log_data[i].node, "EventCode", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
-
-		if(!xml_class_get_prop_num(&log_data[i].EventType, 
-				log_data[i].node, "EventType", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
+	for(int l = 0; l < logNr; l++)
+		if(log_state(&logs[l]) > result) result = log_state(&logs[l]);
+	printf("%s", state_text(result));
+	printf(_(" - Error or Warning Events"));
+	for(int l = 0; l < logNr; l++)
+		printf(" %s=%d", logs[l].name, logs[l].ec.Total);
+	printf(_(" |"));
+	for(int l = 0; l < logNr; l++)
+		print_perfdata(stdout, &logs[l], 1);
+	printf(_("\n"));
+	for(int l = 0; l < logNr; l++) {
+		if(logs[l].ec.Total == 0) continue;
+		printf("%s:\n", logs[l].name);
+		print_events(stdout, &logs[l]);
+	}
 
-		if(!xml_class_get_prop_string(&log_data[i].Message, 
-				log_data[i].node, "Message", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
+	end:
+	for(int l = 0; logs && l < logNr; l++) {
+		log_events_t events = &logs[l].events;
 
-		if(!xml_class_get_prop_string(&log_data[i].SourceName, 
-				log_data[i].node, "SourceName", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
+		for (uint32_t i = 0; i < events->eventNr; i++)
+			xmlFree(events->eventTab[i].Message);
+		free(events->eventTab);
+		free(events->fetchTab);
+	}
+	free(where);
+	free(wql);
+	wr_session_put(proto);
+	elapsed_time = (double)deltime(tv) / 1.0e6;
+	return result;
+}
 
-		if(!xml_class_get_prop_string(&log_data[i].Type, 
-				log_data[i].node, "Type", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
+static uint32_t
+exception_hash(int32_t EventCode)
+{
+	uint32_t h = (uint32_t) EventCode * 2654435761u;
+	return h ^ (h >> 16);
+}
 
-		log_data[i].is_exception = is_exception(&log_data[i], &le);
+static log_exception_bucket_t
+find_bucket(log_exception_set_t l, uint64_t EventCode)
+{
+	uint32_t mask = l->bucketMax - 1, i;
 
-		if(!log_data[i].is_exception) {
-			ec.Total++;
-			switch(log_data[i].EventType) {
-			case 1:
-				ec.Error++;
-				break;
-			case 2:
-				ec.Warning++;
-				break;
-			case 4:
-				ec.AuditSuccess++;
-				break;
-			case 5:
-				ec.AuditFailures++;
-				break;
-			}			
-		}
+	if(l->bucketMax == 0 || EventCode == 0 || EventCode > INT32_MAX) return NULL;
+	for(i = exception_hash(EventCode) & mask; l->bucketTab[i].used; i = (i + 1) & mask) {
+		if(l->bucketTab[i].EventCode == (int32_t) EventCode) return &l->bucketTab[i];
 	}
+	return NULL;
+}
 
-	noevents:
-	if(ec.Total > crit) {
-		result = STATE_CRITICAL;
-		printf(_("CRITICAL"));
-	} else if (ec.Total > warn) {
-		result = STATE_WARNING;
-		printf(_("WARNING"));
-	} else {
-		result = STATE_OK;
-		printf(_("OK"));
+/*
+ * Tests the exceptions of a bucket that do not need the message.
+ * Returns 1 for an exception, 0 when none applies and -1 when it
+ * depends on the message.
+ */
+static int
+match_bucket_source(log_exception_bucket_t b, wmi_log_t event)
+{
+	int result = 0;
+
+	if(b == NULL) return 0;
+	if(b->any) return 1;
+	if(b->has_SourceName &&
+			regexec(&b->rx_SourceName, event->SourceName, 0, NULL, 0) == 0)
+		return 1;
+	for(uint32_t i = 0; i < b->exceptionNr; i++) {
+		log_exception_t exc_item = b->exceptionTab[i];
+
+		if(exc_item->r_SourceName &&
+				regexec(&exc_item->rx_SourceName, event->SourceName, 0, NULL, 0) != 0)
+			continue;
+		if(exc_item->r_Message == NULL) return 1;
+		result = -1;
 	}
+	return b->has_Message ? -1 : result;
+}
 
-	printf(_(" - Error or Warning Events=%d"), ec.Total);
-
-	printf(_(" |"));
-	perfdata_str = smn_perfdata("error",
-		ec.Error, "",
-		(warn != UNKNOWN_VALUE), warn,
-		(crit != UNKNOWN_VALUE), crit,
-		0, 0, 0, 0);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	perfdata_str = smn_perfdata("warning",
-		ec.Warning, "",
-		(warn != UNKNOWN_VALUE), warn,
-		(crit != UNKNOWN_VALUE), crit,
-		0, 0, 0, 0);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	perfdata_str = smn_perfdata("audit_success",
-		ec.AuditSuccess, "",
-		(warn != UNKNOWN_VALUE), warn,
-		(crit != UNKNOWN_VALUE), crit,
-		0, 0, 0, 0);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
-
-	perfdata_str = smn_perfdata("audit_failure",
-		ec.AuditFailures, "",
-		(warn != UNKNOWN_VALUE), warn,
-		(crit != UNKNOWN_VALUE), crit,
-		0, 0, 0, 0);
-	printf(_(" %s"), perfdata_str);
-	free(perfdata_str);
+static uint32_t
+match_bucket_message(log_exception_bucket_t b, wmi_log_t event)
+{
+	const char *message = event->Message ? event->Message : "";
 
-	printf(_("\n"));
+	if(b == NULL) return 0;
+	for(uint32_t i = 0; i < b->exceptionNr; i++) {
+		log_exception_t exc_item = b->exceptionTab[i];
 
-	int printed = 0;
-	for (int i = 0; i < nodes->nodeNr && printed < MAX_EVENTS_PRINT; i++) {
-		if(log_data[i].is_exception) continue;
-		printf("   %s - %ld - %.50s - %.80s\n",
-			log_data[i].Type,
-			log_data[i].EventCode,
-			log_data[i].SourceName,
-			log_data[i].Message);
-		printed++;
-	}
-	if(printed >= MAX_EVENTS_PRINT) {
-		printf("Truncated... (Showing only %d events)\n", printed);
+		if(exc_item->r_Message == NULL) continue;
+		if(exc_item->r_SourceName &&
+				regexec(&exc_item->rx_SourceName, event->SourceName, 0, NULL, 0) != 0)
+			continue;
+		if(regexec(&exc_item->rx_Message, message, 0, NULL, 0) == 0)
+			return 1;
 	}
+	return b->has_Message &&
+		regexec(&b->rx_Message, message, 0, NULL, 0) == 0;
+}
 
-	end:
-	if(log_data && nodes) {
-		for (int i = 0; i < nodes->nodeNr; i++) {
-			if(log_data[i].Message) free(log_data[i].Message);
-			if(log_data[i].SourceName) free(log_data[i].SourceName);
-			if(log_data[i].Type) free(log_data[i].Type);
-		}
-		free(log_data);
-	}
-	if(nodes) xmlXPathFreeNodeSet(nodes);
-	wr_wql_free(&wql_ctx);
-	wrprotocol_ctx_free(proto);
-	elapsed_time = (double)deltime(tv) / 1.0e6;
-	return result;
+int
+exception_without_message(wmi_log_t event, log_exception_set_t le)
+{
+	log_exception_bucket_t b = find_bucket(le, event->EventCode);
+	int code, wildcard;
+
+	if((code = match_bucket_source(b, event)) == 1) return 1;
+	if((wildcard = match_bucket_source(&le->wildcard, event)) == 1) return 1;
+	return code || wildcard ? -1 : 0;
+}
+
+/* The rest of is_exception, once exception_without_message returned -1. */
+static uint32_t
+exception_with_message(wmi_log_t event, log_exception_set_t le)
+{
+	return match_bucket_message(find_bucket(le, event->EventCode), event) ||
+		match_bucket_message(&le->wildcard, event);
 }
 
 uint32_t
 is_exception(wmi_log_t event, log_exception_set_t le)
 {
-	for (int i = 0; i < le->exceptionNr; i++) {
-		regex_t r;
-		regmatch_t pmatch[1];
-		log_exception_t exc_item = &(le->exceptionTab[i]);
-
-		if(le->exceptionTab[i].EventCode == 0 || event->EventCode == le->exceptionTab[i].EventCode) {
-			if(exc_item->r_SourceName && 
-					regexec(&exc_item->rx_SourceName, 
-						event->SourceName, 1, pmatch, 0) == REG_NOMATCH) {
-				continue;
-			}
-			if(exc_item->r_Message &&
-					regexec(&exc_item->rx_Message,
-						event->Message, 1, pmatch, 0) == REG_NOMATCH) {
-				continue;
-			}
+	int result = exception_without_message(event, le);
 
-			return 1;
-		}
-	}
-	return 0;
+	if(result != -1) return result;
+	return exception_with_message(event, le);
 }
 
 /* process command-line arguments */
@@ -372,10 +752,6 @@ process_arguments_log (int argc, char **argv)
 		{"password", required_argument, 0, 'P'},
 		{0, 0, 0, 0}
 	};
-	le.exceptionNr = 0;
-	le.exceptionMax = 0;
-	le.exceptionTab = NULL;
-
 	if (argc < 2)
 		return ERROR;
 
@@ -384,7 +760,7 @@ process_arguments_log (int argc, char **argv)
 			strcpy (argv[c], "-t");
 
 	while (1) {
-		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:l:e:m:", longopts, &option);
+		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:l:e:m:d:x:n:", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -418,12 +794,10 @@ process_arguments_log (int argc, char **argv)
 			}
 			break;
 		case 'c':
-			if (get_threshold (optarg, &crit) == ERROR) 
-				usage2 (_("Critical threshold must be integer or percentage!"), optarg);
+			crit_list = optarg;
 			break;
 		case 'w':
-			if (get_threshold (optarg, &warn) == ERROR)
-				usage2 (_("Warning threshold must be integer or percentage!"), optarg);
+			warn_list = optarg;
 			break;
 		case 'u':
 			username = optarg;
@@ -435,7 +809,18 @@ process_arguments_log (int argc, char **argv)
 			logname = optarg;
 			break;
 		case 'e':
-			process_exceptions(&le, optarg);
+			if (exception_listNr == LOG_MAX)
+				usage2 (_("Too many exception lists"), optarg);
+			exception_list[exception_listNr++] = optarg;
+			break;
+		case 'd':
+			spool_dir = optarg;
+			break;
+		case 'x':
+			command_file = optarg;
+			break;
+		case 'n':
+			result_host = optarg;
 			break;
 		case 'm':
 			if (is_intpos (optarg)) {
@@ -448,11 +833,26 @@ process_arguments_log (int argc, char **argv)
 	return validate_arguments_log ();
 }
 
+static void
+free_bucket(log_exception_bucket_t b)
+{
+	if(b->has_SourceName) regfree(&b->rx_SourceName);
+	if(b->has_Message) regfree(&b->rx_Message);
+	free(b->exceptionTab);
+	memset(b, 0, sizeof(struct _log_exception_bucket));
+}
+
 void
 free_exception_set(log_exception_set_t l)
 {
 	if(l == NULL) return;
 
+	free_bucket(&l->wildcard);
+	for (int i = 0; i < l->bucketMax; i++)
+		free_bucket(&l->bucketTab[i]);
+	FREE_NULL(l->bucketTab);
+	l->bucketMax = 0;
+
 	for (int i = 0; i < l->exceptionNr; i++) {
 		if(l->exceptionTab[i].r_Message) 
 			regfree(&(l->exceptionTab[i].rx_Message));
@@ -556,6 +956,261 @@ process_exceptions(log_exception_set_t l, const char *e)
 	return 0;
 }
 
+/*
+ * Returns 1 when the basic regex only matches its own text, with
+ * optional anchors.
+ */
+static uint32_t
+is_literal(const char *pattern)
+{
+	const char *p = pattern;
+
+	if(*p == '^') p++;
+	if(*p == '\0') return 0;
+	for(; *p; p++) {
+		if(*p == '\\' && p[1] && strchr(BRE_SPECIAL, p[1])) {
+			p++;
+			continue;
+		}
+		if(*p == '$' && p[1] == '\0' && p > pattern && p[-1] != '^')
+			continue;
+		if(strchr(BRE_SPECIAL, *p) || (unsigned char) *p < 0x20 || *p == '\'')
+			return 0;
+	}
+	return 1;
+}
+
+/* Writes a LIKE pattern that matches what the literal regex matches. */
+static void
+append_like(FILE *out, const char *pattern)
+{
+	const char *p = pattern;
+
+	fputs(" LIKE '", out);
+	if(*p == '^')
+		p++;
+	else
+		fputc('%', out);
+	for(; *p; p++) {
+		if(*p == '$' && p[1] == '\0')
+			break;
+		if(*p == '\\')
+			p++;
+		if(*p == '%' || *p == '_' || *p == '[')
+			fprintf(out, "[%c]", *p);
+		else if(*p == '\\')
+			fputs("\\\\", out);
+		else
+			fputc(*p, out);
+	}
+	if(*p == '\0')
+		fputc('%', out);
+	fputc('\'', out);
+}
+
+/*
+ * Writes the exceptions that the server can apply as NOT clauses, those
+ * with an EventCode, a plain SourceName or both and no message. They
+ * are still matched locally, so the result does not change. logfile
+ * limits them to one log of a multi-log query.
+ */
+void
+append_exclusions(FILE *out, log_exception_set_t l, const char *logfile)
+{
+	for(uint32_t i = 0; i < l->exceptionNr; i++) {
+		log_exception_t exc_item = &l->exceptionTab[i];
+
+		if(exc_item->r_Message != NULL || exc_item->EventCode < 0) continue;
+		if(exc_item->r_SourceName == NULL && exc_item->EventCode == 0) continue;
+		if(exc_item->r_SourceName != NULL && !is_literal(exc_item->r_SourceName)) continue;
+
+		fputs(" and NOT (", out);
+		if(logfile != NULL)
+			fprintf(out, "Logfile = '%s' and ", logfile);
+		if(exc_item->EventCode > 0)
+			fprintf(out, "EventCode = %d", exc_item->EventCode);
+		if(exc_item->r_SourceName != NULL) {
+			fprintf(out, "%sSourceName", exc_item->EventCode > 0 ? " and " : "");
+			append_like(out, exc_item->r_SourceName);
+		}
+		fputc(')', out);
+	}
+}
+
+/*
+ * Joins the patterns in one regex, \\| is a GNU extension to the basic
+ * syntax. Patterns with back-references are not joined, the groups
+ * added around every pattern would renumber them.
+ */
+static uint32_t
+can_join(const char *pattern)
+{
+	for(const char *p = pattern; *p; p++) {
+		if(*p != '\\' || p[1] == '\0') continue;
+		p++;
+		if(*p >= '1' && *p <= '9') return 0;
+	}
+	return 1;
+}
+
+static uint32_t
+join_patterns(regex_t *rx, char **patterns, uint32_t count)
+{
+	char *joined = NULL, *temp;
+	int error;
+
+	for(uint32_t i = 0; i < count; i++) {
+		xasprintf(&temp, "%s%s\\(%s\\)", joined ? joined : "",
+			joined ? "\\|" : "", patterns[i]);
+		free(joined);
+		joined = temp;
+	}
+	error = regcomp(rx, joined, REG_ICASE | REG_NOSUB);
+	free(joined);
+	return error == 0;
+}
+
+static uint32_t
+fill_bucket(log_exception_bucket_t b, log_exception_set_t l, int32_t EventCode)
+{
+	char **sources, **messages;
+	uint32_t sourceNr = 0, messageNr = 0, result = 0;
+
+	sources = calloc(l->exceptionNr, sizeof(char *));
+	messages = calloc(l->exceptionNr, sizeof(char *));
+	b->exceptionTab = calloc(l->exceptionNr, sizeof(log_exception_t));
+	if(sources == NULL || messages == NULL || b->exceptionTab == NULL)
+		goto end;
+
+	b->EventCode = EventCode;
+	b->used = 1;
+	for(uint32_t i = 0; i < l->exceptionNr; i++) {
+		log_exception_t exc_item = &l->exceptionTab[i];
+
+		if(exc_item->EventCode != EventCode) continue;
+		if(exc_item->r_SourceName == NULL && exc_item->r_Message == NULL)
+			b->any = 1;
+		else if(exc_item->r_Message == NULL && can_join(exc_item->r_SourceName))
+			sources[sourceNr++] = exc_item->r_SourceName;
+		else if(exc_item->r_SourceName == NULL && can_join(exc_item->r_Message))
+			messages[messageNr++] = exc_item->r_Message;
+		else
+			b->exceptionTab[b->exceptionNr++] = exc_item;
+	}
+	if(sourceNr > 0) {
+		if(!join_patterns(&b->rx_SourceName, sources, sourceNr)) goto end;
+		b->has_SourceName = 1;
+	}
+	if(messageNr > 0) {
+		if(!join_patterns(&b->rx_Message, messages, messageNr)) goto end;
+		b->has_Message = 1;
+	}
+	result = 1;
+
+	end:
+	free(sources);
+	free(messages);
+	return result;
+}
+
+/*
+ * Builds a hash table of the exceptions by EventCode, so every event
+ * is only tested against the exceptions of its code and the ones that
+ * apply to any code.
+ */
+uint32_t
+index_exceptions(log_exception_set_t l)
+{
+	uint32_t codes = 0, mask, j;
+
+	if(l->exceptionNr == 0) return 1;
+	for(uint32_t i = 0; i < l->exceptionNr; i++)
+		if(l->exceptionTab[i].EventCode != 0) codes++;
+
+	for(l->bucketMax = 8; l->bucketMax < codes * 2; l->bucketMax <<= 1);
+	l->bucketTab = calloc(l->bucketMax, sizeof(struct _log_exception_bucket));
+	if(l->bucketTab == NULL) {
+		l->bucketMax = 0;
+		return 0;
+	}
+	mask = l->bucketMax - 1;
+
+	if(!fill_bucket(&l->wildcard, l, 0)) return 0;
+	for(uint32_t i = 0; i < l->exceptionNr; i++) {
+		int32_t EventCode = l->exceptionTab[i].EventCode;
+
+		if(EventCode == 0) continue;
+		for(j = exception_hash(EventCode) & mask; l->bucketTab[j].used; j = (j + 1) & mask)
+			if(l->bucketTab[j].EventCode == EventCode) break;
+		if(l->bucketTab[j].used) continue;
+		if(!fill_bucket(&l->bucketTab[j], l, EventCode)) return 0;
+	}
+	return 1;
+}
+
+static int
+split_logs (void)
+{
+	char *p;
+
+	lognames = strdup (logname);
+	if (lognames == NULL)
+		return ERROR;
+	logNr = 1;
+	for (p = lognames; *p; p++)
+		if (*p == LOG_SEPARATOR) logNr++;
+	if (logNr > LOG_MAX)
+		usage2 (_("Too many logs"), logname);
+	logs = calloc (logNr, sizeof (struct _log_check));
+	if (logs == NULL)
+		return ERROR;
+
+	p = lognames;
+	for (int i = 0; i < logNr; i++) {
+		logs[i].name = p;
+		p = strchr (p, LOG_SEPARATOR);
+		if (p != NULL) *p++ = '\0';
+		/* the name goes between quotes in the query */
+		if (*logs[i].name == '\0' || strchr (logs[i].name, '\'') || strchr (logs[i].name, '\\'))
+			usage2 (_("Invalid log name"), logname);
+		logs[i].warn = warn;
+		logs[i].crit = crit;
+	}
+	return OK;
+}
+
+/*
+ * Sets the threshold of every log from a list with one value for every
+ * log, or a single value for all of them. value is the threshold of the
+ * first log, the others follow in logs.
+ */
+static int
+parse_thresholds (char *list, int *value, const char *error)
+{
+	size_t offset = (char *) value - (char *) &logs[0];
+	char *copy, *item, *saveptr = NULL;
+	int count = 0, th;
+
+	if (list == NULL)
+		return OK;
+	copy = strdup (list);
+	if (copy == NULL)
+		return ERROR;
+	for (item = strtok_r (copy, ",", &saveptr); item; item = strtok_r (NULL, ",", &saveptr)) {
+		if (count == logNr || get_threshold (item, &th) == ERROR)
+			usage2 (error, list);
+		*(int *) ((char *) &logs[count++] + offset) = th;
+	}
+	free (copy);
+	if (count == 1) {
+		for (int i = 1; i < logNr; i++)
+			*(int *) ((char *) &logs[i] + offset) = *value;
+	} else if (count != logNr) {
+		usage2 (error, list);
+	}
+	return OK;
+}
+
 int
 validate_arguments_log (void)
 {
@@ -581,6 +1236,22 @@ validate_arguments_log (void)
 		return ERROR;
 	}
 
+	if (split_logs () == ERROR)
+		return ERROR;
+	if (parse_thresholds (warn_list, &logs[0].warn, _("Warning threshold must be integer or percentage!")) == ERROR ||
+			parse_thresholds (crit_list, &logs[0].crit, _("Critical threshold must be integer or percentage!")) == ERROR)
+		return ERROR;
+
+	/* one exception list for every log, or one for all of them */
+	if (exception_listNr > 1 && exception_listNr != logNr)
+		usage4 (_("Give one exception list, or one for every log"));
+	for (int i = 0; i < logNr && exception_listNr > 0; i++) {
+		const char *e = exception_list[exception_listNr > 1 ? i : 0];
+
+		if (!process_exceptions (&logs[i].le, e) || !index_exceptions (&logs[i].le))
+			return ERROR;
+	}
+
 	xasprintf(&url, "http://%s:%d/wsman", server_name, port);
 	if (url == NULL)
 		return ERROR;
@@ -612,6 +1283,19 @@ print_help_log (void)
     printf (UT_CREDENTIALS);
 
     printf (UT_WARN_CRIT);
+    printf ("    %s\n", _("A list like 1,5 gives a threshold for every log of -l"));
+
+    printf (" %s\n", "-l LOG[,LOG...]");
+    printf ("    %s\n", _("Event logs to check, several logs are checked with one query"));
+    printf (" %s\n", "-e <eventid>,<source regex>,<message regex>|...");
+    printf ("    %s\n", _("Events not to count, repeat it to give a list for every log"));
+    printf (" %s\n", "-m MINUTES");
+    printf ("    %s\n", _("Count the events of the last MINUTES minutes (default: 5)"));
+    printf (" %s\n", "-d DIR | -x FILE");
+    printf ("    %s\n", _("Also submit the result of every log as a passive check of"));
+    printf ("    %s\n", _("\"<log> Errors\" to a checkresult directory or a command file"));
+    printf (" %s\n", "-n HOST");
+    printf ("    %s\n", _("Host name of the passive results (default: -H)"));
 
     printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -17,10 +17,6 @@
 * 
 *****************************************************************************/
 
-const char *progname = "check_wr_mem";
-const char *copyright = "2023-2037";
-const char *email = "info@samanagroup.com";
-
 #include "config.h"
 #include <locale.h>
 #include <libintl.h>
@@ -28,36 +24,28 @@ const char *email = "info@samanagroup.com";
 #include <signal.h>
 #include <stdio.h>
 #include "protocol.h"
+#include "session.h"
+#include "deadline.h"
 #include "transport.h"
 #include "nagios.h"
 #include "xml.h"
+#include "check_wr.h"
 
 #define NAMESPACE "root/cimv2"
 #define CHECK_CLASS_NAME "Win32_OperatingSystem"
 #define NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/" CHECK_CLASS_NAME
 #define WQL_QUERY "select * FROM " CHECK_CLASS_NAME "";
 
-int legacy = 0;
-int port = -1;
-char *server_name = NULL;
-int verbose = FALSE;
-char *username = NULL;
-char *password = NULL;
-char *url = NULL;
-int warn = UNKNOWN_PERCENTAGE_USAGE;
-int crit = UNKNOWN_PERCENTAGE_USAGE;
 
 int check_mem (char *url);
 char *perfdata (const char *label, long int val, const char *uom, int warnp, long int warn, int critp, long int crit, int minp, long int minv, int maxp, long int maxv);
 
 int
-main (int argc, char **argv)
+check_wr_mem_main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	smn_applet_init ("check_wr_mem", UNKNOWN_PERCENTAGE_USAGE);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -69,6 +57,7 @@ main (int argc, char **argv)
 	signal (SIGALRM, timeout_alarm_handler);
 
 	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
 
 	/* ssh_connect exits if error is found */
 	result = check_mem (url);
@@ -90,29 +79,26 @@ check_mem (char *url)
 	long UsedPhysicalMemory, PercentMemoryUsed, PercentMemoryFree;
 	xmlDocPtr response=NULL, schema=NULL;
 	xmlNodeSetPtr nodes = NULL;
-	long elapsed_time;
+	long elapsed_time, stale_age;
 	char *perfdata_str, *xPathExpr = NULL;
 
 	gettimeofday(&tv, NULL);
 
-	proto = wrprotocol_ctx_new();
+	proto = wr_session_get(username, password, url);
 	if(proto == NULL) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
-	if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-
 	wql_ctx = wr_wql_new(proto, namespace, wql);
 	if(wql_ctx == NULL) {
+		smn_unknown(_("Unable to run WQL query."));
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
 	if(!wr_wql_run(wql_ctx)) {
+	smn_unknown(_("Unable to run WQL query."));
 	result = STATE_UNKNOWN;
 	goto end;
 	}
@@ -173,6 +159,8 @@ check_mem (char *url)
 	UsedPhysicalMemory / 1024, PercentMemoryUsed,
 	FreePhysicalMemory / 1024, PercentMemoryFree);
 
+	if(wr_wql_stale(wql_ctx, &stale_age))
+		printf(_(" - STALE result from %lds ago"), stale_age);
 	printf(_(" |"));
 
 	if (legacy == 1) {
@@ -218,7 +206,7 @@ check_mem (char *url)
 
   end:
   wr_wql_free(&wql_ctx);
-  wrprotocol_ctx_free(proto);
+  wr_session_put(proto);
 	elapsed_time = (double)deltime(tv) / 1.0e6;
   return result;
 }
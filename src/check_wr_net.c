@@ -0,0 +1,482 @@
+/*****************************************************************************
+* 
+* Nagios check_wr_net plugin
+* 
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+* 
+* Description:
+* 
+* This file contains the check_wr_net plugin
+* 
+* Connects to a Windows machine with Windows Remote Protocol and pulls
+* the throughput, packets, discards and errors of every network interface
+* from the WMI raw performance counters
+* 
+* 
+* 
+*****************************************************************************/
+
+#include "config.h"
+#include <locale.h>
+#include <libintl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <string.h>
+#include "protocol.h"
+#include "session.h"
+#include "deadline.h"
+#include "transport.h"
+#include "nagios.h"
+#include "refresher.h"
+#include "check_wr.h"
+
+#define NAMESPACE "root/cimv2"
+#define CHECK_CLASS_NAME "Win32_PerfRawData_Tcpip_NetworkInterface"
+#define NIC_MAX 32
+
+enum {
+	NET_BYTES_RECEIVED,
+	NET_BYTES_SENT,
+	NET_PACKETS_RECEIVED,
+	NET_PACKETS_SENT,
+	NET_RECEIVED_DISCARDED,
+	NET_OUTBOUND_DISCARDED,
+	NET_RECEIVED_ERRORS,
+	NET_OUTBOUND_ERRORS,
+	NET_BANDWIDTH,
+	NET_COUNTERS
+};
+
+/* discards and errors are cumulative counts, read with wr_refresher_delta */
+static const wr_counter_t net_counters[NET_COUNTERS] = {
+	{ "BytesReceivedPersec", WR_PERF_COUNTER_BULK_COUNT },
+	{ "BytesSentPersec", WR_PERF_COUNTER_BULK_COUNT },
+	{ "PacketsReceivedPersec", WR_PERF_COUNTER_COUNTER },
+	{ "PacketsSentPersec", WR_PERF_COUNTER_COUNTER },
+	{ "PacketsReceivedDiscarded", WR_PERF_COUNTER_RAWCOUNT },
+	{ "PacketsOutboundDiscarded", WR_PERF_COUNTER_RAWCOUNT },
+	{ "PacketsReceivedErrors", WR_PERF_COUNTER_RAWCOUNT },
+	{ "PacketsOutboundErrors", WR_PERF_COUNTER_RAWCOUNT },
+	{ "CurrentBandwidth", WR_PERF_COUNTER_LARGE_RAWCOUNT }
+};
+
+typedef struct _nic_io {
+	const char *name;
+	double values[NET_COUNTERS];
+	long utilization;
+	int state;
+} nic_io_t;
+
+static char *nics[NIC_MAX];
+static int nicNr = 0;
+static char *nic_list = NULL;
+
+int check_net (char *url);
+int validate_arguments_net (void);
+int process_arguments_net (int argc, char **argv);
+void print_help_net (void);
+
+int
+check_wr_net_main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+
+	smn_applet_init ("check_wr_net", UNKNOWN_PERCENTAGE_USAGE);
+	nicNr = 0;
+	nic_list = NULL;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments_net (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal (SIGALRM, timeout_alarm_handler);
+
+	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
+
+	result = check_net (url);
+
+	alarm (0);
+
+	return (result);
+}
+
+/*
+ * All the interfaces come from one query, restricted to the interfaces
+ * given with -i. Names are quoted as they are, the arguments reject quotes.
+ */
+static char *
+net_where (void)
+{
+	char *where = NULL;
+	size_t size = 0;
+	FILE *out;
+
+	if (nicNr == 0)
+		return NULL;
+	out = open_memstream (&where, &size);
+	if (out == NULL)
+		return NULL;
+	for (int i = 0; i < nicNr; i++)
+		fprintf (out, "%sName = '%s'", i ? " or " : "", nics[i]);
+	if (fclose (out) != 0) {
+		free (where);
+		return NULL;
+	}
+	return where;
+}
+
+/* Returns 0 when the interface has no previous sample. */
+static uint32_t
+read_nic (wr_refresher_t refresher, uint32_t instance, nic_io_t *nic)
+{
+	uint32_t result;
+
+	for (int i = 0; i < NET_COUNTERS; i++) {
+		if (i >= NET_RECEIVED_DISCARDED && i <= NET_OUTBOUND_ERRORS)
+			result = wr_refresher_delta (refresher, instance, i, &nic->values[i]);
+		else
+			result = wr_refresher_value (refresher, instance, i, &nic->values[i]);
+		if (!result)
+			return 0;
+	}
+	nic->name = wr_refresher_instance_name (refresher, instance);
+	return 1;
+}
+
+static uint32_t
+count_ready (wr_refresher_t refresher)
+{
+	uint32_t ready = 0;
+	nic_io_t nic;
+
+	for (uint32_t i = 0; i < wr_refresher_instance_count (refresher); i++)
+		ready += read_nic (refresher, i, &nic);
+	return ready;
+}
+
+static void
+print_perfdata (const nic_io_t *nic)
+{
+	/* labels of the values of one interface, in the order of the counters */
+	static const char *labels[NET_BANDWIDTH] = {
+		"in_bytes", "out_bytes", "in_packets", "out_packets",
+		"in_discards", "out_discards", "in_errors", "out_errors"
+	};
+	char *label, *perfdata_str;
+
+	xasprintf (&label, "%s_utilization", nic->name);
+	perfdata_str = smn_perfdata (label, nic->utilization, "%",
+		(warn != UNKNOWN_PERCENTAGE_USAGE), warn,
+		(crit != UNKNOWN_PERCENTAGE_USAGE), crit,
+		1, 0, 1, 100);
+	printf (" %s", perfdata_str);
+	free (perfdata_str);
+	free (label);
+
+	for (int i = 0; i < NET_BANDWIDTH; i++) {
+		xasprintf (&label, "%s_%s", nic->name, labels[i]);
+		perfdata_str = smn_perfdata (label, (long) (nic->values[i] + 0.5),
+			i <= NET_BYTES_SENT ? "B" : "",
+			0, 0, 0, 0, 1, 0, 0, 0);
+		printf (" %s", perfdata_str);
+		free (perfdata_str);
+		free (label);
+	}
+}
+
+int
+check_net (char *url)
+{
+	int result = STATE_UNKNOWN;
+	void *proto=NULL;
+	wr_refresher_t refresher = NULL;
+	nic_io_t *nic_data = NULL;
+	uint32_t nic_count = 0, instances;
+	int alerts = 0;
+	double bytes;
+	char *where;
+
+	where = net_where ();
+	if(nicNr > 0 && where == NULL) {
+		printf(_("UNKNOWN - Could not reserve memory for the query.\n"));
+		goto end;
+	}
+
+	proto = wr_session_get(username, password, url);
+	if(proto == NULL)
+		goto end;
+
+	refresher = wr_refresher_new(NAMESPACE, CHECK_CLASS_NAME, net_counters, NET_COUNTERS);
+	if(refresher == NULL)
+		goto end;
+
+	/*
+	 * The rates are computed from the raw counters of this check and the
+	 * previous one. Without a previous sample a second one is taken.
+	 */
+	wr_refresher_load(refresher, url);
+	if(!wr_refresher_sample(refresher, proto, where)) {
+		smn_unknown(_("Unable to sample the performance counters."));
+		goto end;
+	}
+	if(count_ready(refresher) == 0) {
+		sleep(1);
+		if(!wr_refresher_sample(refresher, proto, where)) {
+			smn_unknown(_("Unable to sample the performance counters."));
+			goto end;
+		}
+	}
+	wr_refresher_save(refresher, url);
+
+	instances = wr_refresher_instance_count(refresher);
+	nic_data = calloc(instances, sizeof(nic_io_t));
+	if(nic_data == NULL) {
+		printf(_("UNKNOWN - Could not reserve memory for interface data.\n"));
+		goto end;
+	}
+	for(uint32_t i = 0; i < instances; i++) {
+		nic_io_t *nic = &nic_data[nic_count];
+
+		/* interfaces added since the previous check show up next time */
+		if(!read_nic(refresher, i, nic))
+			continue;
+
+		/*
+		 * The links are full duplex, the busier direction is compared
+		 * with the bandwidth (bits per second).
+		 */
+		bytes = nic->values[NET_BYTES_RECEIVED];
+		if(nic->values[NET_BYTES_SENT] > bytes)
+			bytes = nic->values[NET_BYTES_SENT];
+		nic->utilization = 0;
+		if(nic->values[NET_BANDWIDTH] > 0)
+			nic->utilization = (long) (bytes * 8 * 100 / nic->values[NET_BANDWIDTH] + 0.5);
+		if(nic->utilization > 100)
+			nic->utilization = 100;
+
+		nic->state = STATE_OK;
+		if(nic->utilization > crit)
+			nic->state = STATE_CRITICAL;
+		else if(nic->utilization > warn)
+			nic->state = STATE_WARNING;
+		if(nic->state != STATE_OK)
+			alerts++;
+		nic_count++;
+	}
+	if(nic_count == 0) {
+		printf(_("UNKNOWN - Unable to compute the network counters.\n"));
+		goto end;
+	}
+
+	result = STATE_OK;
+	for(uint32_t i = 0; i < nic_count; i++) {
+		if(nic_data[i].state == STATE_CRITICAL)
+			result = STATE_CRITICAL;
+		else if(nic_data[i].state == STATE_WARNING && result == STATE_OK)
+			result = STATE_WARNING;
+	}
+
+	if(result == STATE_CRITICAL) {
+		printf(_("CRITICAL"));
+	} else if (result == STATE_WARNING) {
+		printf(_("WARNING"));
+	} else {
+		printf(_("OK"));
+	}
+	printf(_(" - %d of %u interfaces over the utilization threshold |"), alerts, nic_count);
+	for(uint32_t i = 0; i < nic_count; i++)
+		print_perfdata(&nic_data[i]);
+	printf(_("\n"));
+
+	for(uint32_t i = 0; i < nic_count; i++) {
+		printf("%sInterface %s, Utilization: %ld%%, In: %.0fB/s, Out: %.0fB/s, "
+			"Discards: %.0f, Errors: %.0f\n",
+			nic_data[i].state != STATE_OK ? "*** " : "",
+			nic_data[i].name,
+			nic_data[i].utilization,
+			nic_data[i].values[NET_BYTES_RECEIVED],
+			nic_data[i].values[NET_BYTES_SENT],
+			nic_data[i].values[NET_RECEIVED_DISCARDED] + nic_data[i].values[NET_OUTBOUND_DISCARDED],
+			nic_data[i].values[NET_RECEIVED_ERRORS] + nic_data[i].values[NET_OUTBOUND_ERRORS]);
+	}
+
+	end:
+	free(nic_data);
+	wr_refresher_free(&refresher);
+	wr_session_put(proto);
+	free(where);
+	return result;
+}
+
+static int
+split_nics (char *list)
+{
+	char *item, *saveptr = NULL;
+
+	if (list == NULL)
+		return OK;
+	for (item = strtok_r (list, ",", &saveptr); item; item = strtok_r (NULL, ",", &saveptr)) {
+		if (nicNr == NIC_MAX || strpbrk (item, "'\\") != NULL)
+			usage2 (_("Invalid interface list"), item);
+		nics[nicNr++] = item;
+	}
+	return OK;
+}
+
+int
+process_arguments_net (int argc, char **argv)
+{
+	int c;
+
+	int option = 0;
+	static struct option longopts[] = {
+		STD_LONG_OPTS,
+		{"port", required_argument, 0, 'p'},
+		{"username", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'P'},
+		{"interfaces", required_argument, 0, 'i'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	for (c = 1; c < argc; c++)
+		if (strcmp ("-to", argv[c]) == 0)
+			strcpy (argv[c], "-t");
+
+	while (1) {
+		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:i:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':                                   /* help */
+			usage5 ();
+		case 'V':                                   /* version */
+			print_revision (progname, VERSION);
+			exit (STATE_OK);
+		case 'h':                                   /* help */
+			print_help_net ();
+			exit (STATE_OK);
+		case 'v':                                   /* verbose */
+			verbose = TRUE;
+			break;
+		case 't':                                   /* timeout period */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'H':                                   /* host */
+			if (is_host (optarg) == FALSE)
+			usage2 (_("Invalid hostname/address"), optarg);
+			server_name = optarg;
+			break;
+		case 'p':                                   /* port */
+			if (is_intpos (optarg)) {
+				port = atoi (optarg);
+			}
+			else {
+				usage2 (_("Port number must be a positive integer"), optarg);
+			}
+			break;
+		case 'c':
+			if (get_threshold (optarg, &crit) == ERROR)
+				usage2 (_("Critical threshold must be integer or percentage!"), optarg);
+			break;
+		case 'w':
+			if (get_threshold (optarg, &warn) == ERROR)
+				usage2 (_("Warning threshold must be integer or percentage!"), optarg);
+			break;
+		case 'u':
+			username = optarg;
+			break;
+		case 'P':
+			password = optarg;
+			break;
+		case 'i':
+			nic_list = optarg;
+			break;
+		}
+	}
+
+	return validate_arguments_net ();
+}
+
+int
+validate_arguments_net (void)
+{
+	if(username == NULL || strlen(username) == 0) {
+		username = getenv("WR_USERNAME");
+		if(username == NULL) {
+			return ERROR;
+		}
+	}
+	if(password == NULL || strlen(password) == 0) {
+		password = getenv("WR_PASSWORD");
+		if(password == NULL) {
+			return ERROR;
+		}
+	}
+
+	if (server_name == NULL || strlen(server_name) == 0)
+		return ERROR;
+	if (port == -1)                             /* funky, but allows -p to override stray integer in args */
+		port = WINR_DEF_PORT;
+
+	if (split_nics (nic_list) == ERROR)
+		return ERROR;
+
+	xasprintf(&url, "http://%s:%d/wsman", server_name, port);
+	if (url == NULL)
+		return ERROR;
+
+	return OK;
+}
+
+void
+print_help_net (void)
+{
+    char *myport;
+    xasprintf (&myport, "%d", WINR_DEF_PORT);
+
+    print_revision (progname, VERSION);
+
+    printf ("Copyright (c) 2022 Fabian Baena <info@samanagroup.com>\n");
+
+    printf ("%s\n", _("Gets the throughput, packets, discards and errors of every network interface from a Windows server using WinRM"));
+
+    printf ("\n\n");
+
+    print_usage ();
+
+    printf (UT_HELP_VRSN);
+    printf (UT_EXTRA_OPTS);
+
+    printf (UT_HOST_PORT, 'p', myport);
+
+    printf (UT_CREDENTIALS);
+
+    printf (UT_WARN_CRIT);
+    printf ("    %s\n", _("Utilization in percent of the bandwidth, in the busier direction"));
+    printf (" %s\n", "-i, --interfaces=NAME[,NAME...]");
+    printf ("    %s\n", _("Only check these interfaces, as named by the performance counters"));
+    printf ("    %s\n", _("(default: all)"));
+
+    printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+
+    printf (UT_VERBOSE);
+
+    printf ("\n%s\n", _("The rates, discards and errors are since the previous check of the same host,"));
+    printf ("%s\n", _("kept in WR_STATE_DIR (default: " WR_STATE_DIR_DEFAULT "). The first check, or one"));
+    printf (_("after more than WR_STATE_MAX_AGE seconds (default: %d), waits a second for a\n"),
+        WR_STATE_MAX_AGE_DEFAULT);
+    printf ("%s\n", _("second sample."));
+
+    printf (UT_SUPPORT_SMN);
+}
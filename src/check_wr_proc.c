@@ -0,0 +1,451 @@
+/*****************************************************************************
+* 
+* Nagios check_wr_proc plugin
+* 
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+* 
+* Description:
+* 
+* This file contains the check_wr_proc plugin
+* 
+* Connects to a Windows machine with Windows Remote Protocol and pulls
+* the processes using the most CPU or memory from WMI
+* 
+* 
+* 
+* 
+*****************************************************************************/
+
+#include "config.h"
+#include <locale.h>
+#include <libintl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include "protocol.h"
+#include "session.h"
+#include "deadline.h"
+#include "transport.h"
+#include "nagios.h"
+#include "xml.h"
+#include "check_wr.h"
+
+#define NAMESPACE "root/cimv2"
+#define CHECK_CLASS_NAME "Win32_PerfFormattedData_PerfProc_Process"
+#define RESOURCE_URI "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/*"
+#define WQL_QUERY "SELECT Name, IDProcess, PercentProcessorTime, WorkingSet FROM " \
+	CHECK_CLASS_NAME " WHERE Name <> '_Total' and Name <> 'Idle'"
+#define DEFAULT_TOP 5
+#define MAX_TOP 50
+#define MB (1024 * 1024)
+
+enum {
+	SORT_CPU,
+	SORT_MEM
+};
+
+typedef struct _proc {
+	char *Name;
+	uint64_t IDProcess;
+	uint64_t PercentProcessorTime;
+	uint64_t WorkingSet;
+	uint64_t metric;                /* the one processes are ranked by */
+} *proc_t;
+
+/* Min-heap of the top processes seen so far, the root is the smallest */
+typedef struct _proc_heap {
+	int sort;
+	uint32_t procNr;
+	uint32_t procMax;
+	struct _proc proc[MAX_TOP];
+	uint32_t total;
+} *proc_heap_t;
+
+static int top = DEFAULT_TOP, sort = SORT_CPU;
+static long floor_value = 0;
+
+int check_proc (char *url);
+int validate_arguments_proc (void);
+int process_arguments_proc (int argc, char **argv);
+void print_help_proc (void);
+
+int
+check_wr_proc_main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+
+	smn_applet_init ("check_wr_proc", UNKNOWN_VALUE);
+	top = DEFAULT_TOP;
+	sort = SORT_CPU;
+	floor_value = 0;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments_proc (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal (SIGALRM, timeout_alarm_handler);
+
+	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
+
+	result = check_proc (url);
+
+	alarm (0);
+
+	return (result);
+}
+
+static void
+heap_swap (proc_heap_t heap, uint32_t a, uint32_t b)
+{
+	struct _proc temp = heap->proc[a];
+
+	heap->proc[a] = heap->proc[b];
+	heap->proc[b] = temp;
+}
+
+/* The heap owns the name of proc, freed when it does not make the top. */
+static void
+heap_push (proc_heap_t heap, const struct _proc *proc)
+{
+	uint32_t i, child;
+
+	if (heap->procNr < heap->procMax) {
+		i = heap->procNr++;
+		heap->proc[i] = *proc;
+		while (i > 0 && heap->proc[(i - 1) / 2].metric > heap->proc[i].metric) {
+			heap_swap (heap, i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+	if (proc->metric <= heap->proc[0].metric) {
+		free (proc->Name);
+		return;
+	}
+	free (heap->proc[0].Name);
+	heap->proc[0] = *proc;
+	for (i = 0; (child = 2 * i + 1) < heap->procNr; i = child) {
+		if (child + 1 < heap->procNr && heap->proc[child + 1].metric < heap->proc[child].metric)
+			child++;
+		if (heap->proc[i].metric <= heap->proc[child].metric)
+			break;
+		heap_swap (heap, i, child);
+	}
+}
+
+static int
+compare_proc (const void *a, const void *b)
+{
+	uint64_t ma = ((const struct _proc *) a)->metric;
+	uint64_t mb = ((const struct _proc *) b)->metric;
+
+	return ma > mb ? -1 : ma < mb;
+}
+
+/* Keeps the top processes of every Pull batch, nothing else is stored. */
+static uint32_t
+rank_processes (xmlNodePtr items, void *data)
+{
+	proc_heap_t heap = (proc_heap_t) data;
+	struct _proc proc;
+
+	for (xmlNodePtr item = xmlFirstElementChild (items); item; item = xmlNextElementSibling (item)) {
+		/* names are copied, most of them leave the heap soon */
+		proc.Name = NULL;
+		if (!xml_class_get_prop_string (&proc.Name, item, "Name", NULL) ||
+				!xml_class_get_prop_uint64 (&proc.IDProcess, item, "IDProcess") ||
+				!xml_class_get_prop_uint64 (&proc.PercentProcessorTime, item, "PercentProcessorTime") ||
+				!xml_class_get_prop_uint64 (&proc.WorkingSet, item, "WorkingSet")) {
+			printf (_("UNKNOWN - Invalid response from server.\n"));
+			free (proc.Name);
+			return 0;
+		}
+		proc.metric = heap->sort == SORT_CPU ? proc.PercentProcessorTime : proc.WorkingSet;
+		heap->total++;
+		heap_push (heap, &proc);
+	}
+	return 1;
+}
+
+static long
+proc_value (const struct _proc *proc)
+{
+	return sort == SORT_CPU ? (long) proc->PercentProcessorTime : (long) (proc->WorkingSet / MB);
+}
+
+int
+check_proc (char *url)
+{
+	int result = STATE_OK;
+	void *proto=NULL;
+	char *wql = NULL;
+	long value;
+	char *perfdata_str, *label;
+	proc_heap_t heap = NULL;
+
+	heap = calloc(1, sizeof(struct _proc_heap));
+	if(heap == NULL) {
+		printf(_("UNKNOWN - Could not reserve memory for process data.\n"));
+		result = STATE_UNKNOWN;
+		goto end;
+	}
+	heap->sort = sort;
+	heap->procMax = top;
+
+	/* Most processes of a busy server are idle, only those above the
+	 * floor leave the server. */
+	if(sort == SORT_CPU)
+		xasprintf(&wql, "%s and PercentProcessorTime > %ld", WQL_QUERY, floor_value);
+	else
+		xasprintf(&wql, "%s and WorkingSet > %llu", WQL_QUERY,
+			(unsigned long long) floor_value * MB);
+	if(verbose)
+		fprintf(stderr, "%s\n", wql);
+
+	proto = wr_session_get(username, password, url);
+	if(proto == NULL) {
+		printf(_("UNKNOWN - Unable to initialize protocol context.\n"));
+		result = STATE_UNKNOWN;
+		goto end;
+	}
+
+	if(!wr_enumerate(proto, RESOURCE_URI, NULL, wql, NULL) ||
+			!wr_pull_each(proto, RESOURCE_URI, rank_processes, heap)) {
+		smn_unknown(_("Run WQL command."));
+		printf(_("%s\n"), wql);
+		result = STATE_UNKNOWN;
+		goto end;
+	}
+	qsort(heap->proc, heap->procNr, sizeof(struct _proc), compare_proc);
+
+	value = heap->procNr > 0 ? proc_value(&heap->proc[0]) : 0;
+	if(value > crit) {
+		result = STATE_CRITICAL;
+		printf(_("CRITICAL"));
+	} else if(value > warn) {
+		result = STATE_WARNING;
+		printf(_("WARNING"));
+	} else {
+		result = STATE_OK;
+		printf(_("OK"));
+	}
+
+	printf(_(" - Top processes by %s:"), sort == SORT_CPU ? "CPU" : "memory");
+	if(heap->procNr == 0)
+		printf(_(" none above %ld%s"), floor_value, sort == SORT_CPU ? "%" : "MB");
+	for(uint32_t i = 0; i < heap->procNr; i++)
+		printf(" %s(%lu)=%ld%s", heap->proc[i].Name, (unsigned long) heap->proc[i].IDProcess,
+			proc_value(&heap->proc[i]), sort == SORT_CPU ? "%" : "MB");
+
+	printf(_(" |"));
+
+	perfdata_str = smn_perfdata("processes_above_floor", heap->total, "",
+		0, 0, 0, 0, 0, 0, 0, 0);
+	printf(_(" %s"), perfdata_str);
+	free(perfdata_str);
+
+	/* Labelled by the instance name, WMI numbers the ones of a name (svchost#3).
+	 * A PID would start a new graph every time the process restarts. */
+	for(uint32_t i = 0; i < heap->procNr; i++) {
+		xasprintf(&label, "%s_cpu", heap->proc[i].Name);
+		perfdata_str = smn_perfdata(label, (long) heap->proc[i].PercentProcessorTime, "",
+			(sort == SORT_CPU && warn != UNKNOWN_VALUE), warn,
+			(sort == SORT_CPU && crit != UNKNOWN_VALUE), crit,
+			1, 0, 0, 0);
+		printf(_(" %s"), perfdata_str);
+		free(perfdata_str);
+		free(label);
+
+		xasprintf(&label, "%s_memory", heap->proc[i].Name);
+		perfdata_str = smn_perfdata(label, (long) (heap->proc[i].WorkingSet / MB), "MB",
+			(sort == SORT_MEM && warn != UNKNOWN_VALUE), warn,
+			(sort == SORT_MEM && crit != UNKNOWN_VALUE), crit,
+			1, 0, 0, 0);
+		printf(_(" %s"), perfdata_str);
+		free(perfdata_str);
+		free(label);
+	}
+
+	printf(_("\n"));
+
+	end:
+	for(uint32_t i = 0; heap && i < heap->procNr; i++)
+		free(heap->proc[i].Name);
+	free(heap);
+	free(wql);
+	wr_session_put(proto);
+	return result;
+}
+
+/* process command-line arguments */
+int
+process_arguments_proc (int argc, char **argv)
+{
+	int c;
+
+	int option = 0;
+	static struct option longopts[] = {
+		STD_LONG_OPTS,
+		{"port", required_argument, 0, 'p'},
+		{"username", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'P'},
+		{"top", required_argument, 0, 'n'},
+		{"sort", required_argument, 0, 's'},
+		{"floor", required_argument, 0, 'f'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	for (c = 1; c < argc; c++)
+		if (strcmp ("-to", argv[c]) == 0)
+			strcpy (argv[c], "-t");
+
+	while (1) {
+		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:n:s:f:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':                                   /* help */
+			usage5 ();
+		case 'V':                                   /* version */
+			print_revision (progname, VERSION);
+			exit (STATE_OK);
+		case 'h':                                   /* help */
+			print_help_proc ();
+			exit (STATE_OK);
+		case 'v':                                   /* verbose */
+			verbose = TRUE;
+			break;
+		case 't':                                   /* timeout period */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'H':                                   /* host */
+			if (is_host (optarg) == FALSE)
+			usage2 (_("Invalid hostname/address"), optarg);
+			server_name = optarg;
+			break;
+		case 'p':                                   /* port */
+			if (is_intpos (optarg)) {
+				port = atoi (optarg);
+			}
+			else {
+				usage2 (_("Port number must be a positive integer"), optarg);
+			}
+			break;
+		case 'c':
+			if (get_threshold (optarg, &crit) == ERROR)
+				usage2 (_("Critical threshold must be integer or percentage!"), optarg);
+			break;
+		case 'w':
+			if (get_threshold (optarg, &warn) == ERROR)
+				usage2 (_("Warning threshold must be integer or percentage!"), optarg);
+			break;
+		case 'u':
+			username = optarg;
+			break;
+		case 'P':
+			password = optarg;
+			break;
+		case 'n':
+			if (!is_intpos (optarg) || (top = atoi (optarg)) > MAX_TOP)
+				usage2 (_("Number of processes must be between 1 and 50"), optarg);
+			break;
+		case 's':
+			if (strcmp (optarg, "cpu") == 0)
+				sort = SORT_CPU;
+			else if (strcmp (optarg, "mem") == 0)
+				sort = SORT_MEM;
+			else
+				usage2 (_("Sort must be cpu or mem"), optarg);
+			break;
+		case 'f':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Floor must be a non-negative integer"), optarg);
+			floor_value = atol (optarg);
+			break;
+		}
+	}
+
+	return validate_arguments_proc ();
+}
+
+int
+validate_arguments_proc (void)
+{
+	if(username == NULL || strlen(username) == 0) {
+		username = getenv("WR_USERNAME");
+		if(username == NULL) {
+			return ERROR;
+		}
+	}
+	if(password == NULL || strlen(password) == 0) {
+		password = getenv("WR_PASSWORD");
+		if(password == NULL) {
+			return ERROR;
+		}
+	}
+
+	if (server_name == NULL || strlen(server_name) == 0)
+		return ERROR;
+	if (port == -1)                             /* funky, but allows -p to override stray integer in args */
+		port = WINR_DEF_PORT;
+
+	xasprintf(&url, "http://%s:%d/wsman", server_name, port);
+	if (url == NULL)
+		return ERROR;
+
+	return OK;
+}
+
+void
+print_help_proc (void)
+{
+    char *myport;
+    xasprintf (&myport, "%d", WINR_DEF_PORT);
+
+    print_revision (progname, VERSION);
+
+    printf ("Copyright (c) 2022 Fabian Baena <info@samanagroup.com>\n");
+
+    printf ("%s\n", _("Gets the processes using the most CPU or memory from a Windows server using WinRM"));
+
+    printf ("\n\n");
+
+    print_usage ();
+
+    printf (UT_HELP_VRSN);
+    printf (UT_EXTRA_OPTS);
+
+    printf (UT_HOST_PORT, 'p', myport);
+
+    printf (UT_CREDENTIALS);
+
+    printf (UT_WARN_CRIT);
+    printf ("    %s\n", _("Percentage of one processor, or MB of working set with -s mem,"));
+    printf ("    %s\n", _("compared with the busiest process"));
+
+    printf (" %s\n", "-n, --top=N");
+    printf ("    %s\n", _("Number of processes to report (default: 5)"));
+    printf (" %s\n", "-s, --sort=cpu|mem");
+    printf ("    %s\n", _("Rank the processes by CPU or by working set (default: cpu)"));
+    printf (" %s\n", "-f, --floor=VALUE");
+    printf ("    %s\n", _("Only processes above VALUE (percent or MB) are sent by the server"));
+    printf ("    %s\n", _("(default: 0)"));
+
+    printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+
+    printf (UT_VERBOSE);
+
+    printf (UT_SUPPORT_SMN);
+}
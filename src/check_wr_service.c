@@ -17,10 +17,6 @@
 * 
 *****************************************************************************/
 
-const char *progname = "check_wr_service";
-const char *copyright = "2023-2037";
-const char *email = "info@samanagroup.com";
-
 #include "config.h"
 #include <locale.h>
 #include <libintl.h>
@@ -30,47 +26,49 @@ const char *email = "info@samanagroup.com";
 #include <string.h>
 #include <errno.h>
 #include "protocol.h"
+#include "session.h"
+#include "deadline.h"
 #include "transport.h"
 #include "nagios.h"
 #include "xml.h"
+#include "check_wr.h"
 #include <regex.h>
 
 #define NAMESPACE "root/cimv2"
 #define CHECK_CLASS_NAME "Win32_Service"
-#define NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/" CHECK_CLASS_NAME
-#define WQL_QUERY "SELECT * FROM " CHECK_CLASS_NAME ""
+#define RESOURCE_URI "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/*"
+#define WQL_QUERY "SELECT Name, DisplayName, State FROM " CHECK_CLASS_NAME
+#define REGEX_SPECIAL ".[]()*+?{}|^$\\"
 #define MAX_EVENTS_PRINT 10
 #define EXCEPTION_SEPARATOR ';'
 #define EXC_VALUE_SEPARATOR ','
 
-int legacy = 0;
-int port = -1;
-char *server_name = NULL;
-int verbose = FALSE;
-char *username = NULL;
-char *password = NULL;
-char *url = NULL;
-char *exclude = NULL, *include = NULL;
-regex_t r_exclude, r_include;
-int running = 0, stopped = 0;
-int warn = UNKNOWN_VALUE;
-int crit = UNKNOWN_VALUE;
+static char *exclude = NULL, *include = NULL;
+static regex_t r_exclude, r_include;
+static int running = 0, stopped = 0, auto_only = 0;
+
+typedef struct _service_count {
+	xmlDictPtr dict;
+	const char *state_running;
+	char *addl;
+} service_count_t;
 
 int check_service (char *url);
 int validate_arguments_service (void);
 int process_arguments_service (int argc, char **argv);
-uint32_t is_excluded(char *service_name);
-uint32_t is_included(char *service_name);
+uint32_t is_excluded(const char *service_name);
+uint32_t is_included(const char *service_name);
+char *service_query (void);
 void print_help_service (void);
 
 int
-main (int argc, char **argv)
+check_wr_service_main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	smn_applet_init ("check_wr_service", UNKNOWN_VALUE);
+	exclude = include = NULL;
+	running = stopped = auto_only = 0;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -82,116 +80,214 @@ main (int argc, char **argv)
 	signal (SIGALRM, timeout_alarm_handler);
 
 	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
 
 	/* ssh_connect exits if error is found */
 	result = check_service (url);
 
 	alarm (0);
 
+	if (exclude != NULL) regfree (&r_exclude);
+	if (include != NULL) regfree (&r_include);
+
 	return (result);
 }
 
+/*
+ * Appends to out a LIKE predicate on Name and DisplayName for every
+ * alternative of pattern when it is a plain name or an alternation of
+ * plain names, anchors included. Returns 0 for real patterns, those are
+ * only matched locally.
+ */
+static int
+append_like (FILE *out, const char *pattern)
+{
+	const char *p = pattern, *end;
+	int first = 1;
+
+	if (pattern == NULL || *pattern == '\0')
+		return 0;
+
+	/* check the whole pattern before writing anything */
+	for (p = pattern; *p; p++) {
+		if (*p == '\\' && p[1] && strchr (REGEX_SPECIAL, p[1])) {
+			p++;
+			continue;
+		}
+		if (*p == '^' && (p == pattern || p[-1] == '|') && p[1] && p[1] != '|' && p[1] != '$')
+			continue;
+		if (*p == '$' && (p[1] == '\0' || p[1] == '|') && p != pattern && p[-1] != '|' && p[-1] != '^')
+			continue;
+		if (*p == '|' && p != pattern && p[-1] != '|' && p[1] && p[1] != '|')
+			continue;
+		if (strchr (REGEX_SPECIAL, *p) || (unsigned char) *p < 0x20 || *p == '\'')
+			return 0;
+	}
+
+	fputc ('(', out);
+	for (p = pattern; *p; p = *end ? end + 1 : end) {
+		for (end = p; *end && *end != '|'; end++)
+			if (*end == '\\' && end[1]) end++;
+		for (int column = 0; column < 2; column++) {
+			const char *c = p;
+			fprintf (out, "%s%s LIKE '", first ? "" : " OR ",
+				column == 0 ? "Name" : "DisplayName");
+			first = 0;
+			if (*c == '^')
+				c++;
+			else
+				fputc ('%', out);
+			for (; c < end; c++) {
+				if (*c == '$' && c + 1 == end)
+					break;
+				if (*c == '\\')
+					c++;
+				/* wildcards of LIKE are matched as a set of one */
+				if (*c == '%' || *c == '_' || *c == '[')
+					fprintf (out, "[%c]", *c);
+				else if (*c == '\\')
+					fputs ("\\\\", out);
+				else
+					fputc (*c, out);
+			}
+			if (c == end)
+				fputc ('%', out);
+			fputc ('\'', out);
+		}
+	}
+	fputc (')', out);
+	return 1;
+}
+
+/*
+ * Builds the query for the services to check. Plain include and exclude
+ * names and the start mode are filtered by WMI, the patterns are still
+ * matched locally so the result is the same either way.
+ */
+char *
+service_query (void)
+{
+	char *query = NULL;
+	size_t size = 0;
+	const char *where = " WHERE ";
+	long mark;
+	FILE *out;
+
+	out = open_memstream (&query, &size);
+	if (out == NULL)
+		return NULL;
+	fputs (WQL_QUERY, out);
+	if (auto_only) {
+		fprintf (out, "%sStartMode = 'Auto'", where);
+		where = " AND ";
+	}
+	if (include != NULL) {
+		mark = ftell (out);
+		fputs (where, out);
+		if (append_like (out, include))
+			where = " AND ";
+		else
+			fseek (out, mark, SEEK_SET);
+	}
+	if (exclude != NULL) {
+		mark = ftell (out);
+		fprintf (out, "%sNOT ", where);
+		if (!append_like (out, exclude))
+			fseek (out, mark, SEEK_SET);
+	}
+	if (fclose (out) == EOF) {
+		free (query);
+		return NULL;
+	}
+	return query;
+}
+
+static uint32_t
+count_services (xmlNodePtr items, void *data)
+{
+	service_count_t *count = (service_count_t *) data;
+	char *addltemp;
+
+	for (xmlNodePtr item = xmlFirstElementChild (items); item; item = xmlNextElementSibling (item)) {
+		char *svc_name = NULL;
+		char *svc_displayname = NULL;
+		const char *svc_state;
+
+		/* the items of a projected query are XmlFragment nodes with the
+		 * same properties, only the few states are interned */
+		if (!xml_class_get_prop_string (&svc_name, item, "Name", NULL) ||
+				!xml_class_get_prop_string (&svc_displayname, item, "DisplayName", NULL) ||
+				!xml_class_get_prop_interned (&svc_state, item, "State", count->dict)) {
+			fprintf (stderr, "UNKNOWN - Invalid response from server.\n");
+			free (svc_name);
+			free (svc_displayname);
+			return 0;
+		}
+
+		if (!is_included (svc_name) && !is_included (svc_displayname))
+			goto next;
+		if (is_excluded (svc_name) || is_excluded (svc_displayname))
+			goto next;
+		if (svc_state == count->state_running) {
+			running ++;
+			goto next;
+		}
+		xasprintf (&addltemp, "%s** %s - %s(%s)\n", count->addl == NULL ? "" : count->addl,
+			svc_state, svc_displayname, svc_name);
+		free (count->addl);
+		count->addl = addltemp;
+		stopped ++;
+
+	next:
+		free (svc_name);
+		free (svc_displayname);
+	}
+	return 1;
+}
+
 int
 check_service (char *url)
 {
 	int result = STATE_OK;
-	void *proto=NULL, *wql_ctx=NULL;
+	void *proto=NULL;
 	struct timeval tv;
-	char *namespace=NAMESPACE;
-	char *wql = WQL_QUERY;
+	char *wql = NULL;
 	long elapsed_time;
 	char *perfdata_str;
-	xmlDocPtr response=NULL, schema=NULL;
-	xmlNodeSetPtr nodes = NULL;
-	char *xPathExpr;
-	char *addl = NULL, *addltemp = NULL;
+	service_count_t count = { NULL, NULL, NULL };
 
 	gettimeofday(&tv, NULL);
 
-	proto = wrprotocol_ctx_new();
-	if(proto == NULL) {
-		printf(_("UNKNOWN - Unable to create protocol context.\n"));
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-	if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
-		printf(_("UNKNOWN - Unable to initialize protocol context.\n"));
+	wql = service_query ();
+	if(wql == NULL) {
+		printf(_("UNKNOWN - Unable to build the query.\n"));
 		result = STATE_UNKNOWN;
 		goto end;
 	}
+	if(verbose)
+		fprintf(stderr, "%s\n", wql);
 
-	wql_ctx = wr_wql_new(proto, namespace, wql);
-	if(wql_ctx == NULL) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
-
-	if(!wr_wql_run(wql_ctx)) {
-		printf(_("UNKNOWN - Run WQL command.\n"));
-		printf(_("%s\n"), WQL_QUERY);
+	proto = wr_session_get(username, password, url);
+	if(proto == NULL) {
+		printf(_("UNKNOWN - Unable to initialize protocol context.\n"));
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
-	response = wr_wql_response_toxml(wql_ctx);
-	if(response == NULL) {
-		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Response from server was empty"));
-		goto end;
-	}
+	/* The response is parsed with the session dictionary, so the
+	 * state strings can be compared by pointer. */
+	count.dict = wrprotocol_ctx_dict(proto);
+	count.state_running = xmlDictLookup(count.dict, "Running", -1);
 
-	schema = wr_wql_schema_toxml(wql_ctx);
-	if(schema == NULL) {
+	/* No class schema is needed, the query is sent right away. */
+	if(!wr_enumerate(proto, RESOURCE_URI, NULL, wql, NULL) ||
+			!wr_pull_each(proto, RESOURCE_URI, count_services, &count)) {
+		smn_unknown(_("Run WQL command."));
+		printf(_("%s\n"), wql);
 		result = STATE_UNKNOWN;
-		printf(_("UNKNOWN - Schema from server was empty"));
 		goto end;
 	}
 
-	xPathExpr = "//p:" CHECK_CLASS_NAME;
-	xml_find_all(&nodes, response, xPathExpr, "p", NS_URL);
-
-	result = STATE_OK;
-	for(int i = 0; i < nodes->nodeNr; i++) {
-		char *svc_name;
-		char *svc_displayname;
-		char *svc_state;
-
-		if(!xml_class_get_prop_string(&svc_name,
-				nodes->nodeTab[i], "Name", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
-
-		if(!xml_class_get_prop_string(&svc_displayname,
-				nodes->nodeTab[i], "DisplayName", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
-
-		if(!xml_class_get_prop_string(&svc_state,
-				nodes->nodeTab[i], "State", schema)) {
-			result = STATE_UNKNOWN;
-			goto end;
-		}
-
-		if(is_included(svc_name) || is_included(svc_displayname)) {
-			if(!is_excluded(svc_name) && !is_excluded(svc_displayname)) {
-				if(!strcmp(svc_state, "Running")) {
-					running ++;
-				} else {
-					xasprintf(&addltemp, "%s** %s - %s(%s)\n", addl == NULL? "" : addl,
-						svc_state, svc_displayname, svc_name);
-					if(addl) free(addl);
-					addl = addltemp;
-					stopped ++;
-				}
-			}
-		}
-		free(svc_name);
-		free(svc_displayname);
-		free(svc_state);
-	}
-
 	if(stopped > crit) {
 		result = STATE_CRITICAL;
 		printf(_("CRITICAL"));
@@ -223,18 +319,17 @@ check_service (char *url)
 
 	printf(_("\n"));
 
-	printf("%s", addl == NULL ? "" : addl);
+	printf("%s", count.addl == NULL ? "" : count.addl);
 
 	end:
-	if(addl) free(addl);
-	if(nodes) xmlXPathFreeNodeSet(nodes);
-	wr_wql_free(&wql_ctx);
-	wrprotocol_ctx_free(proto);
+	free(count.addl);
+	free(wql);
+	wr_session_put(proto);
 	elapsed_time = (double)deltime(tv) / 1.0e6;
 	return result;
 }
 
-uint32_t is_excluded(char *service_name)
+uint32_t is_excluded(const char *service_name)
 {
 	regmatch_t pmatch[1];
 	if(exclude == NULL || regexec(&r_exclude, service_name, 1, pmatch, 0) == REG_NOMATCH) {
@@ -243,7 +338,7 @@ uint32_t is_excluded(char *service_name)
 	return 1;
 }
 
-uint32_t is_included(char *service_name)
+uint32_t is_included(const char *service_name)
 {
 	regmatch_t pmatch[1];
 	if(include == NULL) return 1;
@@ -265,6 +360,9 @@ process_arguments_service (int argc, char **argv)
 		{"port", required_argument, 0, 'p'},
 		{"username", required_argument, 0, 'u'},
 		{"password", required_argument, 0, 'P'},
+		{"include", required_argument, 0, 'i'},
+		{"exclude", required_argument, 0, 'e'},
+		{"auto", no_argument, 0, 'A'},
 		{0, 0, 0, 0}
 	};
 
@@ -276,7 +374,7 @@ process_arguments_service (int argc, char **argv)
 			strcpy (argv[c], "-t");
 
 	while (1) {
-		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:e:i:", longopts, &option);
+		c = getopt_long (argc, argv, "+Vhvt:H:p:u:P:c:w:e:i:A", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -323,11 +421,15 @@ process_arguments_service (int argc, char **argv)
 		case 'P':
 			password = optarg;
 			break;
+		/* an empty pattern matches every name, it means no filter */
 		case 'e':
-			exclude  = optarg;
+			exclude = *optarg ? optarg : NULL;
 			break;
 		case 'i':
-			include = optarg;
+			include = *optarg ? optarg : NULL;
+			break;
+		case 'A':
+			auto_only = 1;
 			break;
 		}
 	}
@@ -400,6 +502,15 @@ print_help_service (void)
 
     printf (UT_WARN_CRIT);
 
+    printf (" %s\n", "-i, --include=REGEX");
+    printf ("    %s\n", _("Only check the services with a matching name or display name"));
+    printf (" %s\n", "-e, --exclude=REGEX");
+    printf ("    %s\n", _("Skip the services with a matching name or display name"));
+    printf ("    %s\n", _("Plain names and name1|name2 lists are filtered by the server,"));
+    printf ("    %s\n", _("an empty REGEX is the same as none"));
+    printf (" %s\n", "-A, --auto");
+    printf ("    %s\n", _("Only check the services that start automatically"));
+
     printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
     printf (UT_VERBOSE);
@@ -0,0 +1,431 @@
+/*****************************************************************************
+*
+* Nagios check_wr plugin
+*
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+*
+* Description:
+*
+* This file contains wr-sweep, the passive check sweeper of check_wr
+*
+* wr-sweep (or check_wr sweep) reads a manifest of hosts and runs on
+* each one the checks of the role-samana6-windows template, with the
+* thresholds taken from the same custom variables. The checks of a host
+* run in process over one session, several hosts are swept at the same
+* time. Results are written to the Nagios check_result_path or to the
+* external command file as passive service check results.
+*
+* Manifest lines are a host name, its address and, optionally, custom
+* variables overriding the template defaults:
+*
+*   srv01 10.0.0.1 CPU_WARN=50 SVCS_INCL='spooler|w32time'
+*
+* A line starting with "default" changes the defaults of the hosts
+* that follow it. Empty lines and lines starting with # are ignored.
+*
+*
+*****************************************************************************/
+
+#include "config.h"
+#include <errno.h>
+#include <getopt.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "nagios.h"
+#include "session.h"
+#include "check_wr.h"
+
+#define SWEEP_MAX_ARGS 64
+#define SWEEP_DEFAULT_JOBS 10
+#define SWEEP_SESSION_IDLE 3600
+
+/* Custom variables of role-samana6-windows.cfg used by the checks */
+enum {
+	VAR_CPU_WARN, VAR_CPU_CRIT,
+	VAR_RAM_WARN, VAR_RAM_CRIT,
+	VAR_SWAP_WARN, VAR_SWAP_CRIT,
+	VAR_DISKC_WARN, VAR_DISKC_CRIT,
+	VAR_APPLOG_WARN, VAR_APPLOG_CRIT, VAR_APPLOG_EXC,
+	VAR_SYSLOG_WARN, VAR_SYSLOG_CRIT, VAR_SYSLOG_EXC,
+	VAR_UPTIME_WARN, VAR_UPTIME_CRIT,
+	VAR_SVCS_INCL, VAR_SVCS_EXCL, VAR_SVCS_WARN, VAR_SVCS_CRIT,
+	VAR_COUNT,
+	VAR_NONE = -1
+};
+
+static const struct sweep_var {
+	const char *name;
+	const char *value;
+} sweep_vars[VAR_COUNT] = {
+	{ "CPU_WARN", "35" }, { "CPU_CRIT", "45" },
+	{ "RAM_WARN", "90" }, { "RAM_CRIT", "100" },
+	{ "SWAP_WARN", "90" }, { "SWAP_CRIT", "100" },
+	{ "DISKC_WARN", "75" }, { "DISKC_CRIT", "95" },
+	{ "APPLOG_WARN", "1" }, { "APPLOG_CRIT", "3" }, { "APPLOG_EXC", "" },
+	{ "SYSLOG_WARN", "1" }, { "SYSLOG_CRIT", "3" }, { "SYSLOG_EXC", "" },
+	{ "UPTIME_WARN", "672" }, { "UPTIME_CRIT", "1008" },
+	{ "SVCS_INCL", "spooler" }, { "SVCS_EXCL", "" },
+	{ "SVCS_WARN", "1" }, { "SVCS_CRIT", "1" }
+};
+
+/* The services of role-samana6-windows.cfg and their commands */
+static const struct sweep_check {
+	const char *service_description;
+	const char *check;
+	const char *log;
+	int warn;
+	int crit;
+	int include;
+	int exclude;
+} sweep_checks[] = {
+	{ "CPU Load", "check_wr_cpu", NULL,
+		VAR_CPU_WARN, VAR_CPU_CRIT, VAR_NONE, VAR_NONE },
+	{ "Memory Utilization", "check_wr_mem", NULL,
+		VAR_RAM_WARN, VAR_RAM_CRIT, VAR_NONE, VAR_NONE },
+	{ "Page File Utilization", "check_wr_pf", NULL,
+		VAR_SWAP_WARN, VAR_SWAP_CRIT, VAR_NONE, VAR_NONE },
+	{ "Disk space", "check_wr_disk", NULL,
+		VAR_DISKC_WARN, VAR_DISKC_CRIT, VAR_NONE, VAR_NONE },
+	{ "Application Errors", "check_wr_log", "Application",
+		VAR_APPLOG_WARN, VAR_APPLOG_CRIT, VAR_NONE, VAR_APPLOG_EXC },
+	{ "System Errors", "check_wr_log", "System",
+		VAR_SYSLOG_WARN, VAR_SYSLOG_CRIT, VAR_NONE, VAR_SYSLOG_EXC },
+	{ "Uptime", "check_wr_uptime", NULL,
+		VAR_UPTIME_WARN, VAR_UPTIME_CRIT, VAR_NONE, VAR_NONE },
+	{ "Windows Services", "check_wr_service", NULL,
+		VAR_SVCS_WARN, VAR_SVCS_CRIT, VAR_SVCS_INCL, VAR_SVCS_EXCL },
+	{ NULL, NULL, NULL, VAR_NONE, VAR_NONE, VAR_NONE, VAR_NONE }
+};
+
+struct sweep_host {
+	char *name;
+	char *address;
+	char *vars[VAR_COUNT];
+	char *line;
+};
+
+/* default lines, the values of their variables are used by the hosts */
+static char **default_lines = NULL;
+static int default_line_count = 0;
+
+struct sweep_options {
+	const char *spool_dir;
+	const char *command_file;
+	const char *username;
+	const char *password;
+	const char *timeout;
+	int jobs;
+};
+
+static void
+sweep_usage (void)
+{
+	printf ("%s\n", "Usage:");
+	printf ("  wr-sweep -m <manifest> (-d <check_result_path> | -x <command file>)\n"
+			"           [-u <username>] [-P <password>] [-j <hosts>] [-t <timeout>]\n\n");
+	printf (" -m, --manifest=PATH\n");
+	printf ("    Hosts to check, one per line: <host name> <address> [VAR=value ...]\n");
+	printf (" -d, --spool=PATH\n");
+	printf ("    Write check result files to the Nagios check_result_path\n");
+	printf (" -x, --command-file=PATH\n");
+	printf ("    Write passive check results to the Nagios external command file\n");
+	printf (" -j, --jobs=INTEGER\n");
+	printf ("    Hosts checked at the same time (default: %d)\n", SWEEP_DEFAULT_JOBS);
+	printf (" -t, --timeout=INTEGER\n");
+	printf ("    Timeout of every check (default: %d)\n", DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_CREDENTIALS);
+	printf ("    WR_USERNAME and WR_PASSWORD are used when not given\n");
+}
+
+static int
+find_var (const char *name)
+{
+	/* accept the names as written in the host definition */
+	if (*name == '_')
+		name++;
+	for (int i = 0; i < VAR_COUNT; i++) {
+		if (strcmp (name, sweep_vars[i].name) == 0)
+			return i;
+	}
+	return VAR_NONE;
+}
+
+/* Sets VAR=value arguments, unknown variables are ignored. */
+static void
+set_vars (char **vars, char **argv, int argc)
+{
+	char *value;
+	int var;
+
+	for (int i = 0; i < argc; i++) {
+		if ((value = strchr (argv[i], '=')) == NULL) {
+			fprintf (stderr, "Warning - Ignoring \"%s\", not a VAR=value\n", argv[i]);
+			continue;
+		}
+		*value++ = '\0';
+		if ((var = find_var (argv[i])) != VAR_NONE)
+			vars[var] = value;
+	}
+}
+
+static struct sweep_host *
+read_manifest (const char *path, int *count)
+{
+	struct sweep_host *hosts = NULL, *temp;
+	char *defaults[VAR_COUNT], *argv[SWEEP_MAX_ARGS];
+	char *line = NULL, *copy;
+	size_t size = 0;
+	int argc, lineno = 0;
+	FILE *in;
+
+	*count = 0;
+	in = fopen (path, "r");
+	if (in == NULL) {
+		fprintf (stderr, "Error - Unable to open manifest %s: %s\n", path, strerror (errno));
+		return NULL;
+	}
+	for (int i = 0; i < VAR_COUNT; i++)
+		defaults[i] = (char *) sweep_vars[i].value;
+
+	while (getline (&line, &size, in) != -1) {
+		lineno++;
+		line[strcspn (line, "\r\n")] = '\0';
+		/* the arguments point into the copy, it lives as long as the host */
+		if ((copy = strdup (line)) == NULL)
+			break;
+		argc = check_wr_split (copy, argv, SWEEP_MAX_ARGS, 1);
+		if (argc <= 0 || argv[0][0] == '#') {
+			if (argc < 0)
+				fprintf (stderr, "Error - %s:%d: invalid line\n", path, lineno);
+			free (copy);
+			continue;
+		}
+		if (strcmp (argv[0], "default") == 0) {
+			char **temp_lines = realloc (default_lines,
+					(default_line_count + 1) * sizeof (char *));
+			if (temp_lines == NULL) {
+				free (copy);
+				break;
+			}
+			default_lines = temp_lines;
+			default_lines[default_line_count++] = copy;
+			set_vars (defaults, argv + 1, argc - 1);
+			continue;
+		}
+		if (argc < 2) {
+			fprintf (stderr, "Error - %s:%d: host without address\n", path, lineno);
+			free (copy);
+			continue;
+		}
+
+		temp = realloc (hosts, (*count + 1) * sizeof (struct sweep_host));
+		if (temp == NULL) {
+			free (copy);
+			break;
+		}
+		hosts = temp;
+		hosts[*count].name = argv[0];
+		hosts[*count].address = argv[1];
+		hosts[*count].line = copy;
+		memcpy (hosts[*count].vars, defaults, sizeof (defaults));
+		set_vars (hosts[*count].vars, argv + 2, argc - 2);
+		(*count)++;
+	}
+	free (line);
+	fclose (in);
+	return hosts;
+}
+
+/*
+ * Runs the checks of one host, in process so that all of them share
+ * the session, and writes their results.
+ */
+static int
+sweep_host (struct sweep_host *host, struct sweep_options *opt)
+{
+	smn_result_t results[sizeof (sweep_checks) / sizeof (sweep_checks[0])];
+	char *outputs[sizeof (sweep_checks) / sizeof (sweep_checks[0])];
+	const struct sweep_check *check;
+	char *argv[SWEEP_MAX_ARGS], *out, *err;
+	int argc, count = 0, clean = 1, result;
+
+	for (check = sweep_checks; check->service_description; check++, count++) {
+		results[count].host_name = host->name;
+		results[count].service_description = check->service_description;
+		gettimeofday (&results[count].start, NULL);
+
+		if (!clean) {
+			/* the host did not answer the previous check */
+			results[count].return_code = STATE_UNKNOWN;
+			outputs[count] = strdup ("UNKNOWN - Not checked, previous check on this host did not complete");
+			results[count].output = outputs[count];
+			results[count].finish = results[count].start;
+			continue;
+		}
+
+		argc = 0;
+		argv[argc++] = (char *) check->check;
+		argv[argc++] = "-H";
+		argv[argc++] = host->address;
+		if (opt->username) {
+			argv[argc++] = "-u";
+			argv[argc++] = (char *) opt->username;
+		}
+		if (opt->password) {
+			argv[argc++] = "-P";
+			argv[argc++] = (char *) opt->password;
+		}
+		argv[argc++] = "-t";
+		argv[argc++] = (char *) opt->timeout;
+		if (check->log) {
+			argv[argc++] = "-l";
+			argv[argc++] = (char *) check->log;
+		}
+		argv[argc++] = "-w";
+		argv[argc++] = host->vars[check->warn];
+		argv[argc++] = "-c";
+		argv[argc++] = host->vars[check->crit];
+		/* an empty one, like the default SVCS_EXCL, filters nothing */
+		if (check->include != VAR_NONE && *host->vars[check->include]) {
+			argv[argc++] = "-i";
+			argv[argc++] = host->vars[check->include];
+		}
+		if (check->exclude != VAR_NONE && *host->vars[check->exclude]) {
+			argv[argc++] = "-e";
+			argv[argc++] = host->vars[check->exclude];
+		}
+		argv[argc] = NULL;
+
+		results[count].return_code = check_wr_run (check_wr_applet (check->check),
+				argc, argv, &out, &err, &clean, NULL, NULL);
+		gettimeofday (&results[count].finish, NULL);
+		/* Nagios falls back to stderr when a plugin prints nothing */
+		if (out == NULL || *out == '\0') {
+			free (out);
+			out = err;
+			err = NULL;
+		}
+		free (err);
+		outputs[count] = out;
+		results[count].output = out;
+	}
+
+	if (opt->spool_dir)
+		result = smn_spool_results (opt->spool_dir, results, count);
+	else
+		result = smn_command_results (opt->command_file, results, count);
+
+	for (int i = 0; i < count; i++)
+		free (outputs[i]);
+	return result;
+}
+
+int
+check_wr_sweep_main (int argc, char **argv)
+{
+	struct sweep_options opt = { NULL, NULL, NULL, NULL, "10", SWEEP_DEFAULT_JOBS };
+	struct sweep_host *hosts;
+	const char *manifest = NULL;
+	struct timeval tv;
+	int count, running = 0, failed = 0, status, c;
+	pid_t pid;
+
+	static struct option longopts[] = {
+		{"manifest", required_argument, 0, 'm'},
+		{"spool", required_argument, 0, 'd'},
+		{"command-file", required_argument, 0, 'x'},
+		{"jobs", required_argument, 0, 'j'},
+		{"timeout", required_argument, 0, 't'},
+		{"username", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'P'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	progname = "wr-sweep";
+	optind = 0;
+	while ((c = getopt_long (argc, argv, "m:d:x:j:t:u:P:h", longopts, NULL)) != -1) {
+		switch (c) {
+		case 'm':
+			manifest = optarg;
+			break;
+		case 'd':
+			opt.spool_dir = optarg;
+			break;
+		case 'x':
+			opt.command_file = optarg;
+			break;
+		case 'j':
+			if (!is_intpos (optarg))
+				usage2 (_("Jobs must be a positive integer"), optarg);
+			opt.jobs = atoi (optarg);
+			break;
+		case 't':
+			if (!is_intpos (optarg))
+				usage2 (_("Timeout must be a positive integer"), optarg);
+			opt.timeout = optarg;
+			break;
+		case 'u':
+			opt.username = optarg;
+			break;
+		case 'P':
+			opt.password = optarg;
+			break;
+		default:
+			sweep_usage ();
+			return STATE_UNKNOWN;
+		}
+	}
+	if (manifest == NULL || (opt.spool_dir == NULL) == (opt.command_file == NULL)) {
+		sweep_usage ();
+		return STATE_UNKNOWN;
+	}
+
+	hosts = read_manifest (manifest, &count);
+	if (count == 0) {
+		fprintf (stderr, "Error - No hosts to check.\n");
+		return STATE_UNKNOWN;
+	}
+
+	gettimeofday (&tv, NULL);
+	for (int i = 0; i < count || running > 0; ) {
+		if (i < count && running < opt.jobs) {
+			pid = fork ();
+			if (pid == 0) {
+				/* one session per host, shared by its checks */
+				wr_session_pool_enable (SWEEP_SESSION_IDLE);
+				_exit (sweep_host (&hosts[i], &opt) == OK ? STATE_OK : STATE_UNKNOWN);
+			}
+			if (pid < 0) {
+				fprintf (stderr, "Error - Unable to start sweep of %s: %s\n",
+						hosts[i].name, strerror (errno));
+				failed++;
+			} else {
+				running++;
+			}
+			i++;
+			continue;
+		}
+		if (wait (&status) < 0)
+			break;
+		running--;
+		if (!WIFEXITED (status) || WEXITSTATUS (status) != STATE_OK)
+			failed++;
+	}
+
+	printf ("wr-sweep: %d hosts, %d failed, %.1f seconds\n", count, failed,
+			(double) deltime (tv) / 1.0e6);
+	for (int i = 0; i < count; i++)
+		free (hosts[i].line);
+	free (hosts);
+	for (int i = 0; i < default_line_count; i++)
+		free (default_lines[i]);
+	free (default_lines);
+	return failed ? STATE_WARNING : STATE_OK;
+}
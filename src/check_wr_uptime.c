@@ -17,49 +17,34 @@
 * 
 *****************************************************************************/
 
-const char *progname = "check_wr_uptime";
-const char *copyright = "2023-2037";
-const char *email = "info@samanagroup.com";
-
 #include "config.h"
 #include <locale.h>
 #include <libintl.h>
 #include <unistd.h>
 #include <signal.h>
-
-#define __USE_XOPEN
-#define _GNU_SOURCE
 #include <time.h>
 #include "protocol.h"
+#include "session.h"
+#include "deadline.h"
 #include "transport.h"
 #include "nagios.h"
 #include "xml.h"
+#include "check_wr.h"
 
 #define NAMESPACE "root/cimv2"
 #define CHECK_CLASS_NAME "Win32_OperatingSystem"
 #define NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/" NAMESPACE "/" CHECK_CLASS_NAME
 #define WQL_QUERY "select * FROM " CHECK_CLASS_NAME "";
 
-int legacy = 0;
-int port = -1;
-char *server_name = NULL;
-int verbose = FALSE;
-char *username = NULL;
-char *password = NULL;
-char *url = NULL;
-int warn = UNKNOWN_VALUE;
-int crit = UNKNOWN_VALUE;
 
 int check_uptime (char *url);
 
 int
-main (int argc, char **argv)
+check_wr_uptime_main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	smn_applet_init ("check_wr_uptime", UNKNOWN_VALUE);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -71,6 +56,7 @@ main (int argc, char **argv)
 	signal (SIGALRM, timeout_alarm_handler);
 
 	alarm (timeout_interval);
+	wr_check_deadline_start (timeout_interval);
 
 	/* ssh_connect exits if error is found */
 	result = check_uptime (url);
@@ -88,36 +74,33 @@ check_uptime (char *url)
 	struct timeval tv;
 	char *namespace=NAMESPACE;
 	char *wql = WQL_QUERY;
-	char *LastBootUpTime = NULL, *xPathExpr = NULL;
+	char *xPathExpr = NULL;
 	xmlDocPtr response=NULL, schema=NULL;
 	xmlNodeSetPtr nodes = NULL;
-	long elapsed_time;
-	struct tm LastBootUpTime_tm;
+	long elapsed_time, stale_age;
+	int64_t LastBootUpTime;
 	time_t BootUpHours = 0;
-	time_t tzh, tzm, LastBootUpTime_time;
+	time_t LastBootUpTime_time;
 	time_t current_time;
 	char *perfdata_str;
-	char *p;
 
 	gettimeofday(&tv, NULL);
 
-	proto = wrprotocol_ctx_new();
+	proto = wr_session_get(username, password, url);
 	if(proto == NULL) {
 		result = STATE_UNKNOWN;
 		goto end;
 	}
-	if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
-		result = STATE_UNKNOWN;
-		goto end;
-	}
 
 	wql_ctx = wr_wql_new(proto, namespace, wql);
 	if(wql_ctx == NULL) {
+		smn_unknown(_("Unable to run WQL query."));
 		result = STATE_UNKNOWN;
 		goto end;
 	}
 
 	if(!wr_wql_run(wql_ctx)) {
+		smn_unknown(_("Unable to run WQL query."));
 		result = STATE_UNKNOWN;
 		goto end;
 	}
@@ -148,7 +131,7 @@ check_uptime (char *url)
 		goto end;
 	}
 
-	if(!xml_class_get_prop_string(&LastBootUpTime, nodes->nodeTab[0], "LastBootUpTime", schema)) {
+	if(!xml_class_get_prop_datetime(&LastBootUpTime, nodes->nodeTab[0], "LastBootUpTime", schema)) {
 		result = STATE_UNKNOWN;
 		printf(_("UNKNOWN - Schema from server was empty"));
 		goto end;
@@ -156,11 +139,7 @@ check_uptime (char *url)
 
 	current_time = time(NULL);
 
-	p = strptime(LastBootUpTime, "%FT%T", &LastBootUpTime_tm);
-	while(*p && *p != '+' && *p != '-') p++;
-	sscanf(p, "%ld:%ld", &tzh, &tzm);
-	if(tzh < 0) tzm *= -1;
-	LastBootUpTime_time = mktime(&LastBootUpTime_tm) - (tzh*60*60 + tzm*60);
+	LastBootUpTime_time = LastBootUpTime / 1000000;
 	BootUpHours = (current_time - LastBootUpTime_time) / 60 / 60;
 
 	if(BootUpHours > crit) {
@@ -175,6 +154,8 @@ check_uptime (char *url)
 	}
 	printf(_(" - Uptime of server is %ld Hours"), BootUpHours);
 
+	if(wr_wql_stale(wql_ctx, &stale_age))
+		printf(_(" - STALE result from %lds ago"), stale_age);
 	printf(" | ");
 
 	perfdata_str = smn_perfdata("uptime", current_time - LastBootUpTime_time, "",
@@ -188,9 +169,8 @@ check_uptime (char *url)
 
 	end:
 	if(nodes) xmlXPathFreeNodeSet(nodes);
-	if(LastBootUpTime) free(LastBootUpTime);
 	wr_wql_free(&wql_ctx);
-	wrprotocol_ctx_free(proto);
+	wr_session_put(proto);
 	elapsed_time = (double)deltime(tv) / 1.0e6;
 	return result;
 }
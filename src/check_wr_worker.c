@@ -0,0 +1,670 @@
+/*****************************************************************************
+*
+* Nagios check_wr plugin
+*
+* License: TBD
+* Copyright (c) 2023-2037 Samana Group LLC
+*
+* Description:
+*
+* This file contains the worker mode of check_wr
+*
+* check_wr worker connects to the Nagios 4 (or Naemon) query handler
+* socket and registers as a worker for the check_wr_* plugins. Nagios
+* then sends the check_wr_* command lines to the worker instead of
+* running them, the worker runs the check in process, reusing the
+* sessions already logged in to the server, and sends back the output
+* and the exit status the same way a plugin run by Nagios would have.
+*
+*
+*****************************************************************************/
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <getopt.h>
+#include <libintl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "nagios.h"
+#include "session.h"
+#include "check_wr.h"
+
+#define WORKER_QH_SOCKET "/usr/local/nagios/var/rw/nagios.qh"
+#define WORKER_MSG_DELIM "\1\0\0"
+#define WORKER_MSG_DELIM_LEN 3
+#define WORKER_MAX_ARGS 128
+#define WORKER_RESTART_DELAY 5
+/* below the 120 seconds WinRM keeps an idle connection open */
+#define WORKER_DEFAULT_IDLE 90
+#define WORKER_DEFAULT_TIMEOUT 60
+
+struct worker_job {
+	char *job_id;
+	char *type;
+	char *command;
+	char *timeout;
+};
+
+struct worker_result {
+	int wait_status;
+	int exited_ok;
+	int early_timeout;
+	struct timeval start;
+	struct timeval stop;
+	char *out;
+	char *err;
+};
+
+static volatile sig_atomic_t worker_stop = 0;
+
+static void
+worker_usage (void)
+{
+	printf ("%s\n", "Usage:");
+	printf ("  check_wr worker [-s <query handler socket>] [-n <workers>] [-i <seconds>]\n\n");
+	printf (" -s, --socket=PATH\n");
+	printf ("    Nagios query handler socket (default: %s)\n", WORKER_QH_SOCKET);
+	printf (" -n, --workers=INTEGER\n");
+	printf ("    Worker processes to register, each runs one check at a time (default: 1)\n");
+	printf (" -i, --idle=INTEGER\n");
+	printf ("    Seconds an unused session is kept logged in (default: %d)\n",
+			WORKER_DEFAULT_IDLE);
+}
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write (fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+static int
+qh_connect (const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen (path) >= sizeof (addr.sun_path)) {
+		fprintf (stderr, "Error - Socket path too long: %s\n", path);
+		return -1;
+	}
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf (stderr, "Error - Unable to create socket: %s\n", strerror (errno));
+		return -1;
+	}
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+	if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+		fprintf (stderr, "Error - Unable to connect to %s: %s\n", path, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Input buffer of the query handler connection. Messages are appended
+ * as they arrive and consumed from the start.
+ */
+struct worker_input {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int
+input_fill (int fd, struct worker_input *in)
+{
+	ssize_t n;
+
+	if (in->size - in->len < 4096) {
+		char *data = realloc (in->data, in->size + 65536);
+		if (data == NULL) {
+			fprintf (stderr, "Error - Unable to reserve memory for worker input.\n");
+			return 0;
+		}
+		in->data = data;
+		in->size += 65536;
+	}
+	do {
+		n = read (fd, in->data + in->len, in->size - in->len);
+	} while (n < 0 && errno == EINTR && !worker_stop);
+	if (n <= 0)
+		return 0;
+	in->len += n;
+	return 1;
+}
+
+static void
+input_consume (struct worker_input *in, size_t len)
+{
+	memmove (in->data, in->data + len, in->len - len);
+	in->len -= len;
+}
+
+static int
+worker_register (int fd, struct worker_input *in, int id)
+{
+	char *msg = NULL, *temp;
+	const char *name;
+	char *reply;
+
+	xasprintf (&msg, "@wproc register name=check_wr %d;pid=%d;max_jobs=1",
+			id, (int) getpid ());
+	for (int i = 0; (name = check_wr_applet_name (i)) != NULL; i++) {
+		xasprintf (&temp, "%s;plugin=%s", msg, name);
+		free (msg);
+		msg = temp;
+	}
+	/* the query handler expects the request nul terminated */
+	if (!write_all (fd, msg, strlen (msg) + 1)) {
+		fprintf (stderr, "Error - Unable to register worker.\n");
+		free (msg);
+		return 0;
+	}
+	free (msg);
+
+	while ((reply = in->len ? memchr (in->data, '\0', in->len) : NULL) == NULL) {
+		if (!input_fill (fd, in)) {
+			fprintf (stderr, "Error - No reply to worker registration.\n");
+			return 0;
+		}
+	}
+	if (strcmp (in->data, "OK") != 0) {
+		fprintf (stderr, "Error - Worker registration refused: %s\n", in->data);
+		return 0;
+	}
+	input_consume (in, reply - in->data + 1);
+	return 1;
+}
+
+static char *
+read_stream (FILE *stream)
+{
+	char *data;
+	long size;
+
+	fflush (stream);
+	size = ftell (stream);
+	if (size < 0)
+		size = 0;
+	data = calloc (1, size + 1);
+	if (data == NULL)
+		return NULL;
+	rewind (stream);
+	size = fread (data, 1, size, stream);
+	data[size] = '\0';
+	return data;
+}
+
+static void
+ignore_alarm (int signo)
+{
+}
+
+/* Without SA_RESTART, so that the signal interrupts the blocking call. */
+static void
+set_handler (int signo, void (*handler) (int))
+{
+	struct sigaction sa;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = handler;
+	sigemptyset (&sa.sa_mask);
+	sigaction (signo, &sa, NULL);
+}
+
+/*
+ * Commands that are not a check_wr check, or that need the shell, run
+ * as Nagios itself would run them.
+ */
+static void
+run_shell (const char *command, int timeout, struct worker_result *res)
+{
+	FILE *out = tmpfile (), *err = tmpfile ();
+	pid_t pid;
+	int status = 0;
+
+	if (out == NULL || err == NULL) {
+		res->err = strdup ("Unable to create output files");
+		goto end;
+	}
+	pid = fork ();
+	if (pid < 0) {
+		res->err = strdup ("Unable to fork");
+		goto end;
+	}
+	if (pid == 0) {
+		setpgid (0, 0);
+		dup2 (fileno (out), STDOUT_FILENO);
+		dup2 (fileno (err), STDERR_FILENO);
+		execl ("/bin/sh", "sh", "-c", command, (char *) NULL);
+		_exit (127);
+	}
+
+	set_handler (SIGALRM, ignore_alarm);
+	alarm (timeout);
+	if (waitpid (pid, &status, 0) < 0) {
+		/* interrupted by the alarm */
+		kill (-pid, SIGKILL);
+		waitpid (pid, &status, 0);
+		res->early_timeout = 1;
+	} else {
+		res->exited_ok = 1;
+		res->wait_status = status;
+	}
+	alarm (0);
+	signal (SIGALRM, SIG_DFL);
+	res->out = read_stream (out);
+	if (res->err == NULL)
+		res->err = read_stream (err);
+
+	end:
+	if (out)
+		fclose (out);
+	if (err)
+		fclose (err);
+}
+
+static void
+msg_put (FILE *msg, const char *key, const char *value)
+{
+	fprintf (msg, "%s=%s", key, value ? value : "");
+	fputc ('\0', msg);
+}
+
+static void
+msg_put_int (FILE *msg, const char *key, long value)
+{
+	fprintf (msg, "%s=%ld", key, value);
+	fputc ('\0', msg);
+}
+
+static void
+msg_put_time (FILE *msg, const char *key, struct timeval *tv)
+{
+	fprintf (msg, "%s=%lu.%06lu", key, (unsigned long) tv->tv_sec,
+			(unsigned long) tv->tv_usec);
+	fputc ('\0', msg);
+}
+
+/* The fields of the result that come from the job, ahead of the rest. */
+static char *
+result_head (struct worker_job *job, size_t *len)
+{
+	FILE *msg;
+	char *data = NULL;
+
+	msg = open_memstream (&data, len);
+	if (msg == NULL)
+		return NULL;
+	msg_put (msg, "job_id", job->job_id);
+	msg_put (msg, "type", job->type);
+	msg_put (msg, "command", job->command);
+	msg_put (msg, "timeout", job->timeout);
+	fclose (msg);
+	return data;
+}
+
+/* What job_aborted needs, all of it ready before the check runs. */
+struct worker_abort {
+	int fd;
+	char *head;
+	size_t head_len;
+	struct timeval start;
+};
+
+static char *
+put_str (char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+/* value in decimal, zero padded to width digits */
+static char *
+put_ulong (char *p, unsigned long value, int width)
+{
+	char digits[24];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0 || n < width);
+	while (n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+static char *
+put_time (char *p, const char *key, unsigned long sec, unsigned long usec)
+{
+	p = put_str (p, key);
+	p = put_ulong (p, sec, 1);
+	*p++ = '.';
+	p = put_ulong (p, usec, 6);
+	*p++ = '\0';
+	return p;
+}
+
+/*
+ * The check ended through exit(), likely from its timeout alarm, which
+ * may have stopped it inside malloc or stdio. Nothing it allocated can
+ * be trusted any more, so the result goes out with write() only, built
+ * from what was ready before the check ran, and the worker ends for the
+ * parent to start a new one.
+ */
+static void
+job_aborted (int status, void *data)
+{
+	static const char tail[] = "exited_ok=1\0early_timeout=0\0error_code=0\0"
+		"outstd=UNKNOWN - Check aborted (timeout or usage error), its output is lost\0"
+		"outerr=\0" WORKER_MSG_DELIM;
+	struct worker_abort *ctx = data;
+	struct timespec now;
+	char fields[256], *p = fields;
+	long runtime;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	runtime = (now.tv_sec - ctx->start.tv_sec) * 1000000L +
+			now.tv_nsec / 1000 - ctx->start.tv_usec;
+	if (runtime < 0)
+		runtime = 0;
+
+	p = put_str (p, "wait_status=");
+	p = put_ulong (p, (status & 0xff) << 8, 1);
+	*p++ = '\0';
+	p = put_time (p, "start=", ctx->start.tv_sec, ctx->start.tv_usec);
+	p = put_time (p, "stop=", now.tv_sec, now.tv_nsec / 1000);
+	p = put_time (p, "runtime=", runtime / 1000000, runtime % 1000000);
+
+	if (ctx->head != NULL && write_all (ctx->fd, ctx->head, ctx->head_len))
+		if (write_all (ctx->fd, fields, p - fields))
+			write_all (ctx->fd, tail, sizeof (tail) - 1);
+	_exit (STATE_OK);
+}
+
+/* Returns 0 when the worker has to be restarted after this job. */
+static int
+run_job (int fd, struct worker_job *job, struct worker_result *res)
+{
+	struct worker_abort ctx = { fd, NULL, 0 };
+	char *line, *argv[WORKER_MAX_ARGS];
+	const char *name;
+	check_wr_main_f applet = NULL;
+	int argc, timeout, status, clean = 1;
+
+	timeout = job->timeout ? atoi (job->timeout) : 0;
+	if (timeout <= 0)
+		timeout = WORKER_DEFAULT_TIMEOUT;
+
+	gettimeofday (&res->start, NULL);
+	line = strdup (job->command ? job->command : "");
+	if (line == NULL) {
+		res->err = strdup ("Unable to reserve memory for command");
+		goto end;
+	}
+	argc = check_wr_split (line, argv, WORKER_MAX_ARGS, 0);
+	if (argc > 0) {
+		applet = check_wr_applet (argv[0]);
+		name = strrchr (argv[0], '/');
+		name = name ? name + 1 : argv[0];
+		/* check_wr <check> ... */
+		if (applet == NULL && argc > 1 && strcmp (name, "check_wr") == 0) {
+			applet = check_wr_applet (argv[1]);
+			argc--;
+			memmove (argv, argv + 1, (argc + 1) * sizeof (char *));
+		}
+	}
+
+	if (applet == NULL) {
+		run_shell (job->command ? job->command : "", timeout, res);
+	} else {
+		ctx.start = res->start;
+		ctx.head = result_head (job, &ctx.head_len);
+		status = check_wr_run (applet, argc, argv, &res->out, &res->err, &clean,
+				job_aborted, &ctx);
+		res->wait_status = (status & 0xff) << 8;
+		res->exited_ok = 1;
+		free (ctx.head);
+	}
+	free (line);
+
+	end:
+	gettimeofday (&res->stop, NULL);
+	return clean;
+}
+
+static int
+send_result (int fd, struct worker_job *job, struct worker_result *res)
+{
+	struct timeval runtime;
+	FILE *msg;
+	char *data = NULL;
+	size_t size = 0;
+	int result;
+
+	msg = open_memstream (&data, &size);
+	if (msg == NULL) {
+		fprintf (stderr, "Error - Unable to reserve memory for job result.\n");
+		return 0;
+	}
+	msg_put (msg, "job_id", job->job_id);
+	msg_put (msg, "type", job->type);
+	msg_put (msg, "command", job->command);
+	msg_put (msg, "timeout", job->timeout);
+	msg_put_int (msg, "wait_status", res->wait_status);
+	msg_put_time (msg, "start", &res->start);
+	msg_put_time (msg, "stop", &res->stop);
+	/* not %f, the checks may have set a locale with a decimal comma */
+	timersub (&res->stop, &res->start, &runtime);
+	msg_put_time (msg, "runtime", &runtime);
+	msg_put_int (msg, "exited_ok", res->exited_ok);
+	msg_put_int (msg, "early_timeout", res->early_timeout);
+	msg_put_int (msg, "error_code", 0);
+	msg_put (msg, "outstd", res->out);
+	msg_put (msg, "outerr", res->err);
+	fwrite (WORKER_MSG_DELIM, 1, WORKER_MSG_DELIM_LEN, msg);
+	fclose (msg);
+
+	result = write_all (fd, data, size);
+	free (data);
+	return result;
+}
+
+/* Jobs are key=value pairs separated by nul bytes. */
+static void
+parse_job (char *data, size_t len, struct worker_job *job)
+{
+	char *end = data + len, *value;
+
+	memset (job, 0, sizeof (*job));
+	while (data < end) {
+		size_t pair_len = strnlen (data, end - data);
+		if (pair_len == (size_t) (end - data))
+			break;
+		if ((value = strchr (data, '=')) != NULL) {
+			*value++ = '\0';
+			if (strcmp (data, "job_id") == 0)
+				job->job_id = value;
+			else if (strcmp (data, "type") == 0)
+				job->type = value;
+			else if (strcmp (data, "command") == 0)
+				job->command = value;
+			else if (strcmp (data, "timeout") == 0)
+				job->timeout = value;
+		}
+		data += pair_len + 1;
+	}
+}
+
+/*
+ * Serves jobs over one connection to Nagios. Returns 1 when a check left
+ * the process in a state that should not be reused, 0 when the
+ * connection could not be made or was lost.
+ */
+static int
+worker_run (const char *socket_path, int id)
+{
+	struct worker_input in = { NULL, 0, 0 };
+	struct worker_job job;
+	struct worker_result res;
+	char *delim;
+	int fd, clean = 1;
+
+	fd = qh_connect (socket_path);
+	if (fd < 0)
+		return 0;
+	if (!worker_register (fd, &in, id))
+		goto end;
+
+	while (clean && !worker_stop) {
+		delim = in.len ? memmem (in.data, in.len, WORKER_MSG_DELIM,
+				WORKER_MSG_DELIM_LEN) : NULL;
+		if (delim == NULL) {
+			if (!input_fill (fd, &in))
+				break;
+			continue;
+		}
+
+		/* the job ends with a nul so parsing can stay in place */
+		*delim = '\0';
+		parse_job (in.data, delim - in.data + 1, &job);
+		memset (&res, 0, sizeof (res));
+		if (job.job_id != NULL) {
+			clean = run_job (fd, &job, &res);
+			if (!send_result (fd, &job, &res))
+				clean = 0;
+		}
+		FREE_NULL (res.out);
+		FREE_NULL (res.err);
+		input_consume (&in, delim - in.data + WORKER_MSG_DELIM_LEN);
+	}
+
+	end:
+	free (in.data);
+	close (fd);
+	wr_session_pool_free ();
+	return !clean;
+}
+
+static void
+stop_handler (int signo)
+{
+	worker_stop = 1;
+}
+
+int
+check_wr_worker_main (int argc, char **argv)
+{
+	const char *socket_path = WORKER_QH_SOCKET;
+	int workers = 1, idle = WORKER_DEFAULT_IDLE, c, status;
+	pid_t *pids;
+	int *delay;
+	pid_t pid;
+
+	static struct option longopts[] = {
+		{"socket", required_argument, 0, 's'},
+		{"workers", required_argument, 0, 'n'},
+		{"idle", required_argument, 0, 'i'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	progname = "check_wr worker";
+	optind = 0;
+	while ((c = getopt_long (argc, argv, "s:n:i:h", longopts, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'n':
+			if (!is_intpos (optarg))
+				usage2 (_("Workers must be a positive integer"), optarg);
+			workers = atoi (optarg);
+			break;
+		case 'i':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Idle time must be a non-negative integer"), optarg);
+			idle = atoi (optarg);
+			break;
+		case 'h':
+			worker_usage ();
+			return STATE_UNKNOWN;
+		default:
+			worker_usage ();
+			return STATE_UNKNOWN;
+		}
+	}
+
+	pids = calloc (workers, sizeof (pid_t));
+	delay = calloc (workers, sizeof (int));
+	if (pids == NULL || delay == NULL) {
+		fprintf (stderr, "Error - Unable to reserve memory for workers.\n");
+		return STATE_UNKNOWN;
+	}
+	set_handler (SIGTERM, stop_handler);
+	set_handler (SIGINT, stop_handler);
+	signal (SIGPIPE, SIG_IGN);
+
+	/* keep every worker running, restarting the ones that end */
+	while (!worker_stop) {
+		for (int i = 0; i < workers && !worker_stop; i++) {
+			if (pids[i] > 0)
+				continue;
+			/* do not spin while Nagios is down */
+			if (delay[i])
+				sleep (WORKER_RESTART_DELAY);
+			pid = fork ();
+			if (pid == 0) {
+				signal (SIGINT, SIG_IGN);
+				wr_session_pool_enable (idle);
+				_exit (worker_run (socket_path, i) ? STATE_OK : STATE_UNKNOWN);
+			}
+			if (pid < 0)
+				fprintf (stderr, "Error - Unable to start worker: %s\n", strerror (errno));
+			else
+				pids[i] = pid;
+		}
+		pid = wait (&status);
+		for (int i = 0; pid > 0 && i < workers; i++) {
+			if (pids[i] != pid)
+				continue;
+			pids[i] = 0;
+			delay[i] = !WIFEXITED (status) || WEXITSTATUS (status) != STATE_OK;
+		}
+	}
+
+	for (int i = 0; i < workers; i++) {
+		if (pids[i] > 0)
+			kill (pids[i], SIGTERM);
+	}
+	while (wait (&status) > 0)
+		;
+	free (pids);
+	free (delay);
+	return STATE_OK;
+}
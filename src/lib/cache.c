@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "cache.h"
+#include "deadline.h"
+#include "library.h"
+
+#define CACHE_FILE_VERSION 1
+#define CACHE_SOFT_DEADLINE_DEFAULT 2.0
+#define CACHE_LOCK_WAIT_MIN_MS 10
+#define CACHE_LOCK_WAIT_MAX_MS 200
+#define CACHE_CLOSE_FD_MAX 4096
+
+struct _wr_cache {
+    char *key;
+    char *path;
+    int lock;                   /* held from open to close */
+    uint32_t locked;
+    time_t ttl;
+    time_t max_age;             /* of stale results, 0 when not used */
+    double soft_deadline;
+    wr_deadline_t *deadline;    /* of the check, bounds the waits for the lock */
+    time_t opened;
+    struct _wr_cache *next;
+};
+
+/* Entries open by the check of this thread, closed by wr_cache_abandon */
+static __thread wr_cache_t open_entries = NULL;
+
+/*
+ * WQL keywords and property names ignore case and spacing, the literals
+ * between quotes are kept as they are.
+ */
+static void
+normalize_query(FILE *out, const char *query)
+{
+    char quote = 0;
+
+    while(isspace((unsigned char) *query)) query++;
+    for(const char *p = query; *p; p++) {
+        if(quote) {
+            fputc(*p, out);
+            if(*p == quote) quote = 0;
+        } else if(*p == '\'' || *p == '"') {
+            quote = *p;
+            fputc(*p, out);
+        } else if(isspace((unsigned char) *p)) {
+            while(isspace((unsigned char) p[1])) p++;
+            if(p[1] != '\0') fputc(' ', out);
+        } else {
+            fputc(tolower((unsigned char) *p), out);
+        }
+    }
+}
+
+static char *
+cache_key(const char *host, const char *namespace, const char *query)
+{
+    char *key = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&key, &size);
+
+    if(out == NULL) return NULL;
+    fprintf(out, "%s %s ", host, namespace);
+    normalize_query(out, query);
+    if(fclose(out) != 0) {
+        free(key);
+        return NULL;
+    }
+    return key;
+}
+
+/* FNV-1a, the file names only need to spread the keys */
+uint64_t
+wr_cache_hash(const char *key)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(const char *p = key; *p; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const char *
+wr_cache_dir(void)
+{
+    const char *dir = getenv("WR_CACHE_DIR");
+    struct stat st;
+
+    if(dir == NULL || *dir == '\0') dir = WR_CACHE_DIR_DEFAULT;
+    if(mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        wr_error("Error - Unable to create cache directory %s: %s\n",
+            dir, strerror(errno));
+        return NULL;
+    }
+    /* one made by another user in /dev/shm would let them forge results */
+    if(lstat(dir, &st) == -1) {
+        wr_error("Error - Unable to read cache directory %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+    if(!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        wr_error("Error - Cache directory %s must be a directory writable only by its owner, "
+            "this user.\n", dir);
+        return NULL;
+    }
+    return dir;
+}
+
+static time_t
+env_seconds(const char *name)
+{
+    const char *value = getenv(name);
+    char *end;
+    long seconds;
+
+    if(value == NULL || *value == '\0') return 0;
+    seconds = strtol(value, &end, 10);
+    if(*end != '\0' || seconds < 0) return 0;
+    return seconds;
+}
+
+static double
+env_deadline(const char *name, double value)
+{
+    const char *text = getenv(name);
+    char *end;
+    double seconds;
+
+    if(text == NULL || *text == '\0') return value;
+    seconds = strtod(text, &end);
+    if(*end != '\0' || seconds < 0) return value;
+    return seconds;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/*
+ * Waits at most the soft deadline for a process fetching the same query
+ * when a stale result can be used instead.
+ */
+static uint32_t
+cache_try_lock(wr_cache_t cache, double deadline)
+{
+    uint32_t wait_ms = CACHE_LOCK_WAIT_MIN_MS;
+
+    deadline += now_seconds();
+    while(flock(cache->lock, LOCK_EX | LOCK_NB) == -1) {
+        if(errno != EWOULDBLOCK && errno != EINTR) return 0;
+        if(now_seconds() >= deadline) return 0;
+        usleep(wait_ms * 1000);
+        if(wait_ms < CACHE_LOCK_WAIT_MAX_MS) wait_ms *= 2;
+    }
+    cache->locked = 1;
+    return 1;
+}
+
+uint32_t
+wr_cache_lock(wr_cache_t cache)
+{
+    const char *phase;
+    int64_t left;
+
+    if(cache == NULL || cache->lock == -1) return 0;
+    if(cache->locked) return 1;
+    /* waits for a process fetching the same query, within the deadline */
+    left = wr_deadline_left(cache->deadline);
+    if(left >= 0) {
+        phase = cache->deadline->phase;
+        if(!wr_deadline_enter(cache->deadline, "cache wait")) return 0;
+        if(!cache_try_lock(cache, left / 1000.0)) {
+            /* the requests that follow fail with the phase the time ran out in */
+            wr_deadline_check(cache->deadline);
+            wr_error("Error - Timeout waiting for the process fetching %s.\n", cache->path);
+            return 0;
+        }
+        cache->deadline->phase = phase;
+        return 1;
+    }
+    while(flock(cache->lock, LOCK_EX) == -1) {
+        if(errno == EINTR) continue;
+        wr_error("Error - Unable to lock %s.lock: %s\n", cache->path, strerror(errno));
+        return 0;
+    }
+    cache->locked = 1;
+    return 1;
+}
+
+uint32_t
+wr_cache_locked(wr_cache_t cache)
+{
+    return cache != NULL && cache->locked;
+}
+
+wr_cache_t
+wr_cache_open(const char *host, const char *namespace, const char *query,
+        wr_deadline_t *deadline)
+{
+    const char *ttl = getenv("WR_CACHE_TTL"), *dir;
+    char *lock_path = NULL, *end;
+    wr_cache_t cache;
+    int64_t left;
+    long seconds;
+
+    if(ttl == NULL || *ttl == '\0' || host == NULL || namespace == NULL || query == NULL)
+        return NULL;
+    seconds = strtol(ttl, &end, 10);
+    if(*end != '\0' || seconds < 0) return NULL;
+    if((dir = wr_cache_dir()) == NULL) return NULL;
+
+    cache = calloc(1, sizeof(struct _wr_cache));
+    if(cache == NULL) goto error;
+    cache->lock = -1;
+    cache->ttl = seconds;
+    cache->max_age = env_seconds("WR_CACHE_STALE");
+    if(cache->max_age <= cache->ttl) cache->max_age = 0;
+    cache->soft_deadline = env_deadline("WR_CACHE_SOFT_DEADLINE", CACHE_SOFT_DEADLINE_DEFAULT);
+    cache->deadline = deadline;
+    left = wr_deadline_left(deadline);
+    if(left >= 0 && left / 1000.0 < cache->soft_deadline) cache->soft_deadline = left / 1000.0;
+    cache->opened = time(NULL);
+    cache->key = cache_key(host, namespace, query);
+    if(cache->key == NULL) goto error;
+    if(asprintf(&cache->path, "%s/%016llx.cache", dir,
+            (unsigned long long) wr_cache_hash(cache->key)) == -1) {
+        cache->path = NULL;
+        goto error;
+    }
+    if(asprintf(&lock_path, "%s.lock", cache->path) == -1) {
+        lock_path = NULL;
+        goto error;
+    }
+
+    cache->lock = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if(cache->lock == -1) {
+        wr_error("Error - Unable to open %s: %s\n", lock_path, strerror(errno));
+        goto error;
+    }
+    free(lock_path);
+    lock_path = NULL;
+    /* when a stale result may be used the wait is bounded, see wr_cache_locked */
+    if(cache->max_age)
+        cache_try_lock(cache, cache->soft_deadline);
+    else if(!wr_cache_lock(cache))
+        goto error;
+    cache->next = open_entries;
+    open_entries = cache;
+    return cache;
+
+    error:
+    free(lock_path);
+    wr_cache_close(&cache);
+    return NULL;
+}
+
+void
+wr_cache_close(wr_cache_t *cache)
+{
+    wr_cache_t c;
+
+    if(cache == NULL || *cache == NULL) return;
+    c = *cache;
+    for(wr_cache_t *link = &open_entries; *link; link = &(*link)->next) {
+        if(*link != c) continue;
+        *link = c->next;
+        break;
+    }
+    /* closing the file releases the lock */
+    if(c->lock != -1) close(c->lock);
+    free(c->key);
+    free(c->path);
+    free(c);
+    *cache = NULL;
+}
+
+static char *
+read_file(const char *path, size_t *size)
+{
+    struct stat st;
+    char *data = NULL;
+    ssize_t n;
+    size_t done = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+
+    if(fd == -1) return NULL;
+    if(fstat(fd, &st) == -1 || (data = malloc(st.st_size + 1)) == NULL) goto error;
+    while(done < (size_t) st.st_size) {
+        n = read(fd, data + done, st.st_size - done);
+        if(n == -1 && errno == EINTR) continue;
+        if(n <= 0) goto error;
+        done += n;
+    }
+    data[done] = '\0';
+    *size = done;
+    close(fd);
+    return data;
+
+    error:
+    free(data);
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Reads the entry when it was fetched less than max_age seconds ago, or
+ * while this process waited for the lock.
+ */
+static uint32_t
+cache_read(wr_cache_t cache, char **parts, size_t *lengths, uint32_t count,
+        time_t max_age, time_t *age)
+{
+    unsigned int version, stored_count;
+    long long fetched;
+    size_t size, key_len, length;
+    char *data, *p, *end;
+    uint32_t i = 0;
+
+    if(cache == NULL || parts == NULL || lengths == NULL) return 0;
+    data = read_file(cache->path, &size);
+    if(data == NULL) return 0;
+
+    /* a result fetched while this process waited for the lock is shared */
+    if(sscanf(data, "# wr-cache %u %lld %u\n", &version, &fetched, &stored_count) != 3 ||
+            version != CACHE_FILE_VERSION || stored_count != count ||
+            (time(NULL) - fetched >= max_age && fetched < cache->opened))
+        goto end;
+    if(age != NULL) *age = time(NULL) - fetched;
+    if((p = strchr(data, '\n')) == NULL) goto end;
+    p++;
+    key_len = strlen(cache->key);
+    if(size - (p - data) < key_len + 1 || memcmp(p, cache->key, key_len) || p[key_len] != '\n')
+        goto end;
+    p += key_len + 1;
+
+    for(i = 0; i < count; i++) {
+        length = strtoul(p, &end, 10);
+        if(end == p || *end != '\n' || size - (end + 1 - data) < length) goto end;
+        p = end + 1;
+        parts[i] = malloc(length + 1);
+        if(parts[i] == NULL) goto end;
+        memcpy(parts[i], p, length);
+        parts[i][length] = '\0';
+        lengths[i] = length;
+        p += length;
+    }
+
+    end:
+    free(data);
+    if(i == count) return 1;
+    while(i-- > 0) {
+        free(parts[i]);
+        parts[i] = NULL;
+    }
+    return 0;
+}
+
+uint32_t
+wr_cache_load(wr_cache_t cache, char **parts, size_t *lengths, uint32_t count)
+{
+    return cache_read(cache, parts, lengths, count, cache ? cache->ttl : 0, NULL);
+}
+
+uint32_t
+wr_cache_load_stale(wr_cache_t cache, char **parts, size_t *lengths, uint32_t count,
+        time_t *age)
+{
+    if(cache == NULL || cache->max_age == 0) return 0;
+    return cache_read(cache, parts, lengths, count, cache->max_age, age);
+}
+
+uint32_t
+wr_cache_store(wr_cache_t cache, char *const *parts, const size_t *lengths, uint32_t count)
+{
+    char *temp_path = NULL;
+    FILE *out = NULL;
+    uint32_t result = 0;
+    int fd;
+
+    if(cache == NULL || parts == NULL || lengths == NULL) return 0;
+
+    /* written aside and renamed, a process reading it never sees a partial file */
+    if(asprintf(&temp_path, "%s.XXXXXX", cache->path) == -1) return 0;
+    fd = mkstemp(temp_path);
+    if(fd == -1 || (out = fdopen(fd, "w")) == NULL) {
+        wr_error("Error - Unable to create %s: %s\n", temp_path, strerror(errno));
+        if(fd != -1) close(fd);
+        goto end;
+    }
+    fprintf(out, "# wr-cache %u %lld %u\n%s\n", CACHE_FILE_VERSION,
+        (long long) time(NULL), count, cache->key);
+    for(uint32_t i = 0; i < count; i++) {
+        fprintf(out, "%zu\n", lengths[i]);
+        fwrite(parts[i], 1, lengths[i], out);
+    }
+    if(fclose(out) == EOF) {
+        wr_error("Error - Unable to write %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    if(rename(temp_path, cache->path) == -1) {
+        wr_error("Error - Unable to rename %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    result = 1;
+
+    end:
+    if(!result) unlink(temp_path);
+    free(temp_path);
+    return result;
+}
+
+/*
+ * The refresh outlives the check, it is detached from the process that
+ * runs it: its output would keep the pipe of the plugin open, the
+ * sockets of a daemon open after it closed them.
+ */
+static void
+cache_detach(wr_cache_t cache, int done)
+{
+    int fd;
+
+    setsid();
+    signal(SIGALRM, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    /* a refresh still running when the stale result expires is useless */
+    alarm(cache->max_age);
+    fd = open("/dev/null", O_RDWR);
+    if(fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if(fd > STDERR_FILENO) close(fd);
+    }
+    for(fd = STDERR_FILENO + 1; fd < CACHE_CLOSE_FD_MAX; fd++)
+        if(fd != cache->lock && fd != done) close(fd);
+}
+
+/*
+ * fork() only copies the calling thread, the refresh of a process with
+ * others could find their locks held forever. When Linux does not tell,
+ * the process is taken as having threads.
+ */
+static uint32_t
+single_threaded(void)
+{
+    char *line = NULL;
+    size_t size = 0;
+    uint32_t result = 0;
+    FILE *in = fopen("/proc/self/status", "re");
+
+    if(in == NULL) return 0;
+    while(getline(&line, &size, in) != -1) {
+        if(strncmp(line, "Threads:", 8) != 0) continue;
+        result = strtol(line + 8, NULL, 10) == 1;
+        break;
+    }
+    free(line);
+    fclose(in);
+    return result;
+}
+
+uint32_t
+wr_cache_revalidate(wr_cache_t cache, wr_cache_fetch_cb fetch, void *data)
+{
+    int done[2], status;
+    double deadline;
+    struct pollfd pfd;
+    char stored = 0;
+    pid_t pid;
+
+    if(cache == NULL || fetch == NULL || !cache->locked) return 0;
+    /* the caller fetches the result itself, with the entry still locked */
+    if(!single_threaded()) return 0;
+    if(pipe2(done, O_CLOEXEC) == -1) return 0;
+
+    pid = fork();
+    if(pid == -1) {
+        close(done[0]);
+        close(done[1]);
+        return 0;
+    }
+    if(pid == 0) {
+        /* the intermediate process ends now, nobody waits for the refresh */
+        if(fork() != 0) _exit(0);
+        close(done[0]);
+        cache_detach(cache, done[1]);
+        stored = fetch(cache, data) ? 1 : 0;
+        write(done[1], &stored, 1);
+        _exit(!stored);
+    }
+    close(done[1]);
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+    deadline = now_seconds() + cache->soft_deadline;
+    pfd.fd = done[0];
+    pfd.events = POLLIN;
+    for(;;) {
+        double left = deadline - now_seconds();
+        int n;
+
+        if(left <= 0) break;
+        n = poll(&pfd, 1, (int) (left * 1000) + 1);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == 1 && read(done[0], &stored, 1) == 0) {
+            /* the refresh could not be started, the caller fetches the result */
+            close(done[0]);
+            return 0;
+        }
+        break;
+    }
+    close(done[0]);
+    if(stored) return 1;
+
+    /* a refresh still running keeps the lock, the entry is used stale meanwhile */
+    close(cache->lock);
+    cache->lock = -1;
+    cache->locked = 0;
+    return 0;
+}
+
+void
+wr_cache_abandon(void)
+{
+    while(open_entries != NULL) {
+        wr_cache_t cache = open_entries;
+        wr_cache_close(&cache);
+    }
+}
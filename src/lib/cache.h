@@ -0,0 +1,77 @@
+#ifndef __CACHE_H_
+#define __CACHE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "deadline.h"
+
+/*
+ * Results of queries shared by the plugin processes of the same machine
+ * for WR_CACHE_TTL seconds (caching is off without it). The entries are
+ * files in WR_CACHE_DIR keyed by host, namespace and query. Opening an
+ * entry locks it, so the processes asking for the same query while one
+ * of them fetches it wait for that result instead of asking the host.
+ * With WR_CACHE_TTL=0 only those waiting processes share the result.
+ *
+ * WR_CACHE_STALE allows results older than WR_CACHE_TTL, but younger than
+ * it in seconds, to be used while a background process fetches the new
+ * one. They are only used when the new result is not there within
+ * WR_CACHE_SOFT_DEADLINE seconds (2 by default). Processes running more
+ * than one thread, like those of the scheduler or embedding the library,
+ * never start that background process: they fetch the new result
+ * themselves, as without WR_CACHE_STALE.
+ */
+
+/* Directory of the cache entries, WR_CACHE_DIR overrides it */
+#define WR_CACHE_DIR_DEFAULT "/dev/shm/check_wr"
+
+typedef struct _wr_cache *wr_cache_t;
+
+/*
+ * Returns the directory of the cache and lock files, created if needed,
+ * NULL when it is not owned by this user or others can write to it.
+ */
+const char *wr_cache_dir(void);
+uint64_t wr_cache_hash(const char *key);
+
+/*
+ * Returns NULL when caching is off or the entry cannot be used. When
+ * stale results are allowed the entry may be returned unlocked, another
+ * process still fetching it after the soft deadline. deadline, NULL for
+ * none, bounds the waits for the process holding the entry: once it is
+ * spent the entry is not used and the check ends in the "cache wait"
+ * phase.
+ */
+wr_cache_t wr_cache_open(const char *host, const char *namespace, const char *query,
+        wr_deadline_t *deadline);
+void wr_cache_close(wr_cache_t *cache);
+uint32_t wr_cache_locked(wr_cache_t cache);
+/* Waits for the process holding the entry, at most until the deadline. */
+uint32_t wr_cache_lock(wr_cache_t cache);
+
+/* Unlocks the entries left open by a check of this thread that was aborted. */
+void wr_cache_abandon(void);
+
+/*
+ * An entry has count parts, the documents of one result. load returns 0
+ * when the entry is missing or expired, the parts are freed by the caller.
+ */
+uint32_t wr_cache_load(wr_cache_t cache, char **parts, size_t *lengths, uint32_t count);
+/* Same for a result younger than WR_CACHE_STALE, age is set to its age. */
+uint32_t wr_cache_load_stale(wr_cache_t cache, char **parts, size_t *lengths,
+        uint32_t count, time_t *age);
+uint32_t wr_cache_store(wr_cache_t cache, char *const *parts, const size_t *lengths,
+        uint32_t count);
+
+/*
+ * Runs fetch, which stores the new result of the locked entry, in a
+ * detached process. Returns 1 when the result was stored within the soft
+ * deadline. Otherwise the entry is unlocked, the refresh still running
+ * or failed, or kept locked when the refresh could not be started, or
+ * the process has other threads, and the caller has to fetch the result
+ * itself.
+ */
+typedef uint32_t (*wr_cache_fetch_cb)(wr_cache_t cache, void *data);
+uint32_t wr_cache_revalidate(wr_cache_t cache, wr_cache_fetch_cb fetch, void *data);
+
+#endif
@@ -0,0 +1,810 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cimbin.h"
+#include "parse.h"
+#include "library.h"
+
+#define CIMBIN_BYTE_ORDER 0x01020304
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t)7))
+#define BITMAP_WORDS(rows) (((uint64_t)(rows) + 63) / 64)
+#define HEAP_HASH_MIN 256
+
+struct cimbin_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t property_count;
+    uint32_t row_count;
+    uint32_t reserved;
+    uint64_t class_name;        /* heap offset */
+    uint64_t schema_offset;     /* struct cimbin_property[property_count] */
+    uint64_t heap_offset;
+    uint64_t heap_size;
+    uint64_t file_size;
+};
+
+struct cimbin_property {
+    uint64_t name;              /* heap offset */
+    uint32_t type;
+    uint32_t is_array;
+    uint64_t nulls;             /* file offset of the presence bitmap */
+    uint64_t values;            /* file offset of the row slots */
+};
+
+typedef struct _cimbin {
+    const uint8_t *data;
+    size_t size;
+    uint32_t mapped;
+    const struct cimbin_header *header;
+    const struct cimbin_property *property;
+    const char *heap;
+} *cimbin_t;
+
+/*
+ * String heap used while writing. Strings are stored once, the hash
+ * table keeps heap offsets + 1 so 0 marks an empty bucket.
+ */
+struct cimbin_heap {
+    uint8_t *data;
+    uint64_t size;
+    uint64_t max;
+    uint64_t *hash;
+    uint64_t hash_max;
+    uint64_t hash_count;
+    uint32_t error;
+};
+
+static uint64_t
+heap_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while(*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint32_t
+heap_reserve(struct cimbin_heap *heap, uint64_t len, uint64_t *offset)
+{
+    uint64_t max = heap->max;
+
+    if(heap->error) return 0;
+    while(heap->size + len > max) {
+        max = max ? max * 2 : 4096;
+    }
+    if(max != heap->max) {
+        void *temp = realloc(heap->data, max);
+        if(temp == NULL) {
+            wr_error("Error - Unable to reserve memory for string heap.\n");
+            heap->error = 1;
+            return 0;
+        }
+        heap->data = temp;
+        heap->max = max;
+    }
+    memset(heap->data + heap->size, 0, len);
+    *offset = heap->size;
+    heap->size += len;
+    return 1;
+}
+
+static uint32_t
+heap_rehash(struct cimbin_heap *heap)
+{
+    uint64_t max = heap->hash_max ? heap->hash_max * 2 : HEAP_HASH_MIN;
+    uint64_t *hash;
+
+    hash = calloc(max, sizeof(uint64_t));
+    if(hash == NULL) {
+        wr_error("Error - Unable to reserve memory for string heap.\n");
+        heap->error = 1;
+        return 0;
+    }
+    for(uint64_t i = 0; i < heap->hash_max; i++) {
+        uint64_t j;
+        if(heap->hash[i] == 0) continue;
+        j = heap_hash((char *) heap->data + heap->hash[i] - 1) & (max - 1);
+        while(hash[j] != 0) j = (j + 1) & (max - 1);
+        hash[j] = heap->hash[i];
+    }
+    free(heap->hash);
+    heap->hash = hash;
+    heap->hash_max = max;
+    return 1;
+}
+
+static uint32_t
+heap_add_string(struct cimbin_heap *heap, const char *s, uint64_t *offset)
+{
+    uint64_t i, len;
+
+    if(heap->hash_count * 2 >= heap->hash_max && !heap_rehash(heap)) return 0;
+
+    i = heap_hash(s) & (heap->hash_max - 1);
+    while(heap->hash[i] != 0) {
+        if(!strcmp((char *) heap->data + heap->hash[i] - 1, s)) {
+            *offset = heap->hash[i] - 1;
+            return 1;
+        }
+        i = (i + 1) & (heap->hash_max - 1);
+    }
+    len = strlen(s) + 1;
+    if(!heap_reserve(heap, len, offset)) return 0;
+    memcpy(heap->data + *offset, s, len);
+    heap->hash[i] = *offset + 1;
+    heap->hash_count++;
+    return 1;
+}
+
+/*
+ * Converts a native value to its 8 byte slot. Returns 0 when the value
+ * has no binary form (octetstring) or the heap could not grow.
+ */
+static uint32_t
+cimbin_slot(struct cimbin_heap *heap, cimval_type_e type, const void *value, uint64_t *slot)
+{
+    int64_t i;
+    double d;
+
+    switch(type) {
+    case CIM_UINT8:
+        *slot = *((uint8_t*)value);
+        break;
+    case CIM_UINT16:
+        *slot = *((uint16_t*)value);
+        break;
+    case CIM_UINT32:
+        *slot = *((uint32_t*)value);
+        break;
+    case CIM_UINT64:
+        *slot = *((uint64_t*)value);
+        break;
+    case CIM_SINT8:
+        i = *((int8_t*)value);
+        *slot = (uint64_t) i;
+        break;
+    case CIM_SINT16:
+        i = *((int16_t*)value);
+        *slot = (uint64_t) i;
+        break;
+    case CIM_SINT32:
+        i = *((int32_t*)value);
+        *slot = (uint64_t) i;
+        break;
+    case CIM_SINT64:
+    case CIM_DATETIME:
+        i = *((int64_t*)value);
+        *slot = (uint64_t) i;
+        break;
+    case CIM_REAL32:
+        d = *((float*)value);
+        memcpy(slot, &d, sizeof(d));
+        break;
+    case CIM_REAL64:
+        memcpy(slot, value, sizeof(double));
+        break;
+    case CIM_STRING:
+        if(*((char**)value) == NULL) return 0;
+        return heap_add_string(heap, *((char**)value), slot);
+    case CIM_BOOLEAN:
+        *slot = *((uint8_t*)value) ? 1 : 0;
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t
+cimbin_value(struct cimbin_heap *heap, cimval_t cv, uint64_t *slot)
+{
+    size_t s = cv->size == (size_t) -1 ? sizeof(char**) : cv->size;
+    uint64_t record, item;
+
+    if(!cv->is_array) return cimbin_slot(heap, cv->type, cv->value, slot);
+
+    if(!heap_reserve(heap, ALIGN8(heap->size) - heap->size, &record)) return 0;
+    if(!heap_reserve(heap, sizeof(uint64_t) * ((uint64_t)cv->array_len + 1), &record))
+        return 0;
+    memcpy(heap->data + record, &(uint64_t){ cv->array_len }, sizeof(uint64_t));
+    for(uint32_t k = 0; k < cv->array_len; k++) {
+        if(!cimbin_slot(heap, cv->type, cv->value + s * k, &item)) {
+            if(heap->error) return 0;
+            item = 0;
+        }
+        /* the heap may have moved while adding the item */
+        memcpy(heap->data + record + sizeof(uint64_t) * (k + 1), &item, sizeof(item));
+    }
+    *slot = record;
+    return 1;
+}
+
+void *
+cimbin_to_buffer(size_t *size, cimclass_t schema, cimclass_set_t cimclass_set)
+{
+    struct cimbin_heap heap = { 0 };
+    struct cimbin_header *header;
+    struct cimbin_property *property;
+    uint8_t *out = NULL;
+    uint64_t offset, column_size, words, rows = 0, heap_offset, heap_size;
+    uint32_t property_count;
+
+    if(size == NULL) return NULL;
+    if(schema == NULL && cimclass_set != NULL && cimclass_set->nodeNr > 0)
+        schema = cimclass_set->node[0];
+    if(schema == NULL) {
+        wr_error("Error - No schema to serialize.\n");
+        return NULL;
+    }
+    if(cimclass_set != NULL) rows = cimclass_set->nodeNr;
+    property_count = schema->property_count;
+    words = BITMAP_WORDS(rows);
+    column_size = (words + rows) * sizeof(uint64_t);
+
+    offset = ALIGN8(sizeof(struct cimbin_header));
+    offset += ALIGN8(sizeof(struct cimbin_property) * property_count);
+    heap_offset = offset + column_size * property_count;
+
+    out = calloc(1, heap_offset);
+    if(out == NULL) {
+        wr_error("Error - Unable to reserve memory for binary class set.\n");
+        goto error;
+    }
+    header = (struct cimbin_header *) out;
+    property = (struct cimbin_property *) (out + ALIGN8(sizeof(struct cimbin_header)));
+
+    /* offset 0 of the heap is always the empty string */
+    if(!heap_add_string(&heap, "", &header->class_name)) goto error;
+    if(!heap_add_string(&heap, schema->name, &header->class_name)) goto error;
+
+    for(uint32_t p = 0; p < property_count; p++) {
+        cimval_t schema_cv = schema->property[p];
+        uint64_t *nulls, *values;
+
+        if(!heap_add_string(&heap, schema_cv->name, &property[p].name)) goto error;
+        property[p].type = schema_cv->type;
+        property[p].is_array = schema_cv->is_array;
+        property[p].nulls = offset;
+        property[p].values = offset + words * sizeof(uint64_t);
+        nulls = (uint64_t *) (out + property[p].nulls);
+        values = (uint64_t *) (out + property[p].values);
+        offset += column_size;
+
+        for(uint64_t r = 0; r < rows; r++) {
+            cimclass_t node = cimclass_set->node[r];
+            cimval_t cv = NULL;
+
+            if(node == NULL) continue;
+            /* classes in a set are copies of the schema, so the property
+             * is normally at the same position */
+            if(p < node->property_count &&
+                    !strcmp(node->property[p]->name, schema_cv->name)) {
+                cv = node->property[p];
+            } else {
+                cv = cimclass_property_value_get(node, schema_cv->name);
+            }
+            if(cv == NULL || cv->value == NULL || cv->type != schema_cv->type ||
+                    cv->is_array != schema_cv->is_array) continue;
+
+            if(cimbin_value(&heap, cv, &values[r])) {
+                nulls[r / 64] |= 1ULL << (r % 64);
+            } else if(heap.error) {
+                goto error;
+            }
+        }
+    }
+
+    {
+        /* at least one trailing \0 so strings can not run past the heap */
+        heap_size = ALIGN8(heap.size + 1);
+        void *temp = realloc(out, heap_offset + heap_size);
+        if(temp == NULL) {
+            wr_error("Error - Unable to reserve memory for binary class set.\n");
+            goto error;
+        }
+        out = temp;
+    }
+    header = (struct cimbin_header *) out;
+    memcpy(out + heap_offset, heap.data, heap.size);
+    memset(out + heap_offset + heap.size, 0, heap_size - heap.size);
+
+    memcpy(header->magic, CIMBIN_MAGIC, sizeof(header->magic));
+    header->version = CIMBIN_VERSION;
+    header->byte_order = CIMBIN_BYTE_ORDER;
+    header->property_count = property_count;
+    header->row_count = rows;
+    header->schema_offset = ALIGN8(sizeof(struct cimbin_header));
+    header->heap_offset = heap_offset;
+    header->heap_size = heap_size;
+    header->file_size = heap_offset + header->heap_size;
+    *size = header->file_size;
+
+    free(heap.data);
+    free(heap.hash);
+    return out;
+
+    error:
+    free(heap.data);
+    free(heap.hash);
+    free(out);
+    return NULL;
+}
+
+uint32_t
+cimbin_write(const char *path, cimclass_t schema, cimclass_set_t cimclass_set)
+{
+    uint32_t result = 0;
+    uint8_t *data = NULL;
+    size_t size = 0, written = 0;
+    char *temp_path = NULL;
+    int fd = -1;
+
+    if(path == NULL) return 0;
+
+    data = cimbin_to_buffer(&size, schema, cimclass_set);
+    if(data == NULL) goto end;
+
+    /* write next to the destination and rename, so readers never see
+     * a partial file */
+    if(asprintf(&temp_path, "%s.XXXXXX", path) == -1) {
+        temp_path = NULL;
+        goto end;
+    }
+    fd = mkstemp(temp_path);
+    if(fd == -1) {
+        wr_error("Error - Unable to create %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    while(written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            wr_error("Error - Unable to write %s: %s\n", temp_path, strerror(errno));
+            goto end;
+        }
+        written += n;
+    }
+    if(close(fd) == -1) {
+        fd = -1;
+        wr_error("Error - Unable to write %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    fd = -1;
+    if(rename(temp_path, path) == -1) {
+        wr_error("Error - Unable to rename %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    result = 1;
+
+    end:
+    if(fd != -1) close(fd);
+    if(!result && temp_path) unlink(temp_path);
+    free(temp_path);
+    free(data);
+    return result;
+}
+
+static uint32_t
+range_ok(uint64_t offset, uint64_t len, uint64_t limit)
+{
+    return offset <= limit && len <= limit - offset;
+}
+
+static cimbin_t
+cimbin_validate(cimbin_t cimbin)
+{
+    const struct cimbin_header *header;
+    uint64_t words;
+
+    if(cimbin->size < sizeof(struct cimbin_header) ||
+            ((uintptr_t) cimbin->data & 7) != 0) {
+        wr_error("Error - Binary class set is too short or misaligned.\n");
+        return NULL;
+    }
+    header = (const struct cimbin_header *) cimbin->data;
+    if(memcmp(header->magic, CIMBIN_MAGIC, sizeof(header->magic)) != 0) {
+        wr_error("Error - Not a binary class set.\n");
+        return NULL;
+    }
+    if(header->version != CIMBIN_VERSION || header->byte_order != CIMBIN_BYTE_ORDER) {
+        wr_error("Error - Unsupported binary class set version or byte order.\n");
+        return NULL;
+    }
+    if(header->file_size > cimbin->size ||
+            header->heap_offset % 8 != 0 || header->heap_size == 0 ||
+            header->heap_size != header->file_size - header->heap_offset ||
+            !range_ok(header->heap_offset, header->heap_size, header->file_size) ||
+            header->schema_offset % 8 != 0 ||
+            !range_ok(header->schema_offset,
+                (uint64_t) header->property_count * sizeof(struct cimbin_property),
+                header->heap_offset) ||
+            header->class_name >= header->heap_size ||
+            cimbin->data[header->file_size - 1] != '\0') {
+        wr_error("Error - Binary class set is corrupt.\n");
+        return NULL;
+    }
+
+    cimbin->header = header;
+    cimbin->property = (const struct cimbin_property *)
+        (cimbin->data + header->schema_offset);
+    cimbin->heap = (const char *) (cimbin->data + header->heap_offset);
+
+    words = BITMAP_WORDS(header->row_count);
+    for(uint32_t p = 0; p < header->property_count; p++) {
+        const struct cimbin_property *prop = &cimbin->property[p];
+        if(prop->name >= header->heap_size ||
+                prop->type == CIM_INVALID || prop->type > CIM_OCTETSTRING ||
+                prop->nulls % 8 != 0 || prop->values % 8 != 0 ||
+                !range_ok(prop->nulls, words * sizeof(uint64_t), header->heap_offset) ||
+                !range_ok(prop->values, (uint64_t) header->row_count * sizeof(uint64_t),
+                    header->heap_offset)) {
+            wr_error("Error - Binary class set property %u is corrupt.\n", p);
+            return NULL;
+        }
+    }
+    return cimbin;
+}
+
+cimbin_t
+cimbin_from_buffer(const void *data, size_t size)
+{
+    cimbin_t cimbin;
+
+    if(data == NULL) return NULL;
+    cimbin = calloc(1, sizeof(struct _cimbin));
+    if(cimbin == NULL) {
+        wr_error("Error - Unable to reserve memory for binary class set.\n");
+        return NULL;
+    }
+    cimbin->data = data;
+    cimbin->size = size;
+    if(cimbin_validate(cimbin) == NULL) {
+        free(cimbin);
+        return NULL;
+    }
+    return cimbin;
+}
+
+cimbin_t
+cimbin_open(const char *path)
+{
+    cimbin_t cimbin = NULL;
+    struct stat st;
+    void *data;
+    int fd;
+
+    if(path == NULL) return NULL;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        wr_error("Error - Unable to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct cimbin_header)) {
+        wr_error("Error - %s is not a binary class set.\n", path);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        wr_error("Error - Unable to map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    cimbin = cimbin_from_buffer(data, st.st_size);
+    if(cimbin == NULL) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    cimbin->mapped = 1;
+    return cimbin;
+}
+
+void
+cimbin_close(cimbin_t *cimbin)
+{
+    if(cimbin == NULL || *cimbin == NULL) return;
+    if((*cimbin)->mapped) munmap((void *) (*cimbin)->data, (*cimbin)->size);
+    free(*cimbin);
+    *cimbin = NULL;
+}
+
+const char *
+cimbin_class_name(cimbin_t cimbin)
+{
+    if(cimbin == NULL) return NULL;
+    return cimbin->heap + cimbin->header->class_name;
+}
+
+uint32_t
+cimbin_row_count(cimbin_t cimbin)
+{
+    if(cimbin == NULL) return 0;
+    return cimbin->header->row_count;
+}
+
+uint32_t
+cimbin_property_count(cimbin_t cimbin)
+{
+    if(cimbin == NULL) return 0;
+    return cimbin->header->property_count;
+}
+
+int32_t
+cimbin_property_index(cimbin_t cimbin, const char *name)
+{
+    if(cimbin == NULL || name == NULL) return -1;
+    for(uint32_t p = 0; p < cimbin->header->property_count; p++) {
+        if(!strcmp(cimbin->heap + cimbin->property[p].name, name)) return p;
+    }
+    return -1;
+}
+
+const char *
+cimbin_property_name(cimbin_t cimbin, uint32_t property)
+{
+    if(cimbin == NULL || property >= cimbin->header->property_count) return NULL;
+    return cimbin->heap + cimbin->property[property].name;
+}
+
+cimval_type_e
+cimbin_property_type(cimbin_t cimbin, uint32_t property)
+{
+    if(cimbin == NULL || property >= cimbin->header->property_count) return CIM_INVALID;
+    return cimbin->property[property].type;
+}
+
+uint32_t
+cimbin_property_is_array(cimbin_t cimbin, uint32_t property)
+{
+    if(cimbin == NULL || property >= cimbin->header->property_count) return 0;
+    return cimbin->property[property].is_array;
+}
+
+/*
+ * Returns the row slot of a property, or the heap offset of the array
+ * record for array properties.
+ */
+static uint32_t
+cimbin_row_slot(cimbin_t cimbin, uint32_t property, uint32_t row, uint64_t *slot)
+{
+    const struct cimbin_property *prop;
+    const uint64_t *nulls;
+
+    if(cimbin == NULL || property >= cimbin->header->property_count ||
+            row >= cimbin->header->row_count) return 0;
+    prop = &cimbin->property[property];
+    nulls = (const uint64_t *) (cimbin->data + prop->nulls);
+    if(!((nulls[row / 64] >> (row % 64)) & 1)) return 0;
+    *slot = ((const uint64_t *) (cimbin->data + prop->values))[row];
+    return 1;
+}
+
+static const uint64_t *
+cimbin_array_record(cimbin_t cimbin, uint32_t property, uint32_t row, uint64_t *count)
+{
+    uint64_t offset, heap_size = cimbin->header->heap_size;
+
+    if(!cimbin_row_slot(cimbin, property, row, &offset)) return NULL;
+    if(offset % 8 != 0 || !range_ok(offset, sizeof(uint64_t), heap_size)) return NULL;
+    *count = *((const uint64_t *) (cimbin->heap + offset));
+    /* never trust the count beyond the end of the heap */
+    if(*count > (heap_size - offset) / sizeof(uint64_t) - 1)
+        *count = (heap_size - offset) / sizeof(uint64_t) - 1;
+    return (const uint64_t *) (cimbin->heap + offset) + 1;
+}
+
+static uint32_t
+cimbin_slot_get(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index,
+    uint64_t *slot)
+{
+    const uint64_t *items;
+    uint64_t count;
+
+    if(cimbin == NULL || property >= cimbin->header->property_count) return 0;
+    if(!cimbin->property[property].is_array) {
+        if(index != 0) return 0;
+        return cimbin_row_slot(cimbin, property, row, slot);
+    }
+    items = cimbin_array_record(cimbin, property, row, &count);
+    if(items == NULL || index >= count) return 0;
+    *slot = items[index];
+    return 1;
+}
+
+uint32_t
+cimbin_is_null(cimbin_t cimbin, uint32_t property, uint32_t row)
+{
+    uint64_t slot;
+    return !cimbin_row_slot(cimbin, property, row, &slot);
+}
+
+uint32_t
+cimbin_array_len(cimbin_t cimbin, uint32_t property, uint32_t row)
+{
+    uint64_t count;
+
+    if(cimbin == NULL || !cimbin_property_is_array(cimbin, property)) return 0;
+    if(cimbin_array_record(cimbin, property, row, &count) == NULL) return 0;
+    return count > UINT32_MAX ? UINT32_MAX : count;
+}
+
+uint32_t
+cimbin_get_uint64(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index,
+    uint64_t *value)
+{
+    uint64_t slot;
+
+    if(value == NULL || !cimbin_slot_get(cimbin, property, row, index, &slot)) return 0;
+    switch(cimbin->property[property].type) {
+    case CIM_UINT8:
+    case CIM_UINT16:
+    case CIM_UINT32:
+    case CIM_UINT64:
+    case CIM_BOOLEAN:
+        break;
+    case CIM_SINT8:
+    case CIM_SINT16:
+    case CIM_SINT32:
+    case CIM_SINT64:
+    case CIM_DATETIME:
+        if((int64_t) slot < 0) return 0;
+        break;
+    default:
+        return 0;
+    }
+    *value = slot;
+    return 1;
+}
+
+uint32_t
+cimbin_get_int64(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index,
+    int64_t *value)
+{
+    uint64_t slot;
+
+    if(value == NULL || !cimbin_slot_get(cimbin, property, row, index, &slot)) return 0;
+    switch(cimbin->property[property].type) {
+    case CIM_UINT8:
+    case CIM_UINT16:
+    case CIM_UINT32:
+    case CIM_UINT64:
+    case CIM_BOOLEAN:
+        if(slot > INT64_MAX) return 0;
+        break;
+    case CIM_SINT8:
+    case CIM_SINT16:
+    case CIM_SINT32:
+    case CIM_SINT64:
+    case CIM_DATETIME:
+        break;
+    default:
+        return 0;
+    }
+    *value = (int64_t) slot;
+    return 1;
+}
+
+uint32_t
+cimbin_get_real64(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index,
+    double *value)
+{
+    uint64_t slot;
+
+    if(value == NULL || !cimbin_slot_get(cimbin, property, row, index, &slot)) return 0;
+    switch(cimbin->property[property].type) {
+    case CIM_REAL32:
+    case CIM_REAL64:
+        memcpy(value, &slot, sizeof(double));
+        break;
+    case CIM_UINT8:
+    case CIM_UINT16:
+    case CIM_UINT32:
+    case CIM_UINT64:
+        *value = (double) slot;
+        break;
+    case CIM_SINT8:
+    case CIM_SINT16:
+    case CIM_SINT32:
+    case CIM_SINT64:
+        *value = (double) (int64_t) slot;
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t
+cimbin_get_string(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index,
+    const char **value)
+{
+    uint64_t slot;
+
+    if(value == NULL || !cimbin_slot_get(cimbin, property, row, index, &slot)) return 0;
+    if(cimbin->property[property].type != CIM_STRING ||
+            slot >= cimbin->header->heap_size) return 0;
+    /* the heap ends with \0, so the string is always terminated */
+    *value = cimbin->heap + slot;
+    return 1;
+}
+
+static void
+cimbin_value_print(cimbin_t cimbin, uint32_t property, uint32_t row, uint32_t index)
+{
+    uint64_t u;
+    int64_t i;
+    double d;
+    const char *s;
+    char datetime[40];
+
+    switch(cimbin->property[property].type) {
+    case CIM_UINT8:
+    case CIM_UINT16:
+    case CIM_UINT32:
+    case CIM_UINT64:
+        if(cimbin_get_uint64(cimbin, property, row, index, &u)) printf("%lu", u);
+        break;
+    case CIM_SINT8:
+    case CIM_SINT16:
+    case CIM_SINT32:
+    case CIM_SINT64:
+        if(cimbin_get_int64(cimbin, property, row, index, &i)) printf("%ld", i);
+        break;
+    case CIM_REAL32:
+    case CIM_REAL64:
+        if(cimbin_get_real64(cimbin, property, row, index, &d)) printf("%lf", d);
+        break;
+    case CIM_STRING:
+        if(cimbin_get_string(cimbin, property, row, index, &s)) printf("\"%s\"", s);
+        break;
+    case CIM_DATETIME:
+        if(cimbin_get_int64(cimbin, property, row, index, &i)) {
+            wr_format_datetime(datetime, sizeof(datetime), i);
+            printf("\"%s\"", datetime);
+        }
+        break;
+    case CIM_BOOLEAN:
+        if(cimbin_get_uint64(cimbin, property, row, index, &u))
+            printf("%s", u ? "<true>" : "<false>");
+        break;
+    default:
+        printf("(bin)");
+        break;
+    }
+}
+
+void
+cimbin_print(cimbin_t cimbin)
+{
+    if(cimbin == NULL) return;
+
+    for(uint32_t r = 0; r < cimbin->header->row_count; r++) {
+        printf("ClassName      : %s\n", cimbin_class_name(cimbin));
+        printf("property_count : %d\n", cimbin->header->property_count);
+        for(uint32_t p = 0; p < cimbin->header->property_count; p++) {
+            if(cimbin_is_null(cimbin, p, r)) continue;
+            printf("| %s: ", cimbin_property_name(cimbin, p));
+            if(cimbin->property[p].is_array) {
+                uint32_t len = cimbin_array_len(cimbin, p, r);
+                printf("[ ");
+                for(uint32_t k = 0; k < len; k++) {
+                    cimbin_value_print(cimbin, p, r, k);
+                    printf(", ");
+                }
+                printf(" ]");
+            } else {
+                cimbin_value_print(cimbin, p, r, 0);
+            }
+            printf("\n");
+        }
+    }
+}
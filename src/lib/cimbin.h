@@ -0,0 +1,61 @@
+#ifndef __CIMBIN_H_
+#define __CIMBIN_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "cimclass.h"
+
+/*
+ * Binary form of a cimclass schema and, optionally, a cimclass set with
+ * values of that schema. The layout is
+ *
+ *   header | schema (one entry per property) | columns | string heap
+ *
+ * Every property has a column with a presence bitmap followed by one
+ * 8 byte slot per row. Integers, booleans and datetimes are stored as
+ * 64 bit integers, reals as double, strings as an offset into the heap.
+ * Array values are an offset to a record in the heap holding the item
+ * count followed by the item slots. All sections are 8 byte aligned so
+ * the file can be mapped and read in place.
+ *
+ * Files are written in host byte order, a file written on a host with a
+ * different byte order is rejected when opened.
+ */
+#define CIMBIN_MAGIC "WRCB"
+#define CIMBIN_VERSION 1
+
+typedef struct _cimbin *cimbin_t;
+
+void *cimbin_to_buffer(size_t *size, cimclass_t schema, cimclass_set_t cimclass_set);
+uint32_t cimbin_write(const char *path, cimclass_t schema, cimclass_set_t cimclass_set);
+
+cimbin_t cimbin_open(const char *path);
+cimbin_t cimbin_from_buffer(const void *data, size_t size);
+void cimbin_close(cimbin_t *cimbin);
+
+const char *cimbin_class_name(cimbin_t cimbin);
+uint32_t cimbin_row_count(cimbin_t cimbin);
+uint32_t cimbin_property_count(cimbin_t cimbin);
+int32_t cimbin_property_index(cimbin_t cimbin, const char *name);
+const char *cimbin_property_name(cimbin_t cimbin, uint32_t property);
+cimval_type_e cimbin_property_type(cimbin_t cimbin, uint32_t property);
+uint32_t cimbin_property_is_array(cimbin_t cimbin, uint32_t property);
+
+/*
+ * Value accessors. For array properties index selects the item, for
+ * other properties it must be 0. They return 0 when the value is null,
+ * out of range or of a type that does not fit the accessor.
+ */
+uint32_t cimbin_is_null(cimbin_t cimbin, uint32_t property, uint32_t row);
+uint32_t cimbin_array_len(cimbin_t cimbin, uint32_t property, uint32_t row);
+uint32_t cimbin_get_uint64(cimbin_t cimbin, uint32_t property, uint32_t row,
+    uint32_t index, uint64_t *value);
+uint32_t cimbin_get_int64(cimbin_t cimbin, uint32_t property, uint32_t row,
+    uint32_t index, int64_t *value);
+uint32_t cimbin_get_real64(cimbin_t cimbin, uint32_t property, uint32_t row,
+    uint32_t index, double *value);
+uint32_t cimbin_get_string(cimbin_t cimbin, uint32_t property, uint32_t row,
+    uint32_t index, const char **value);
+
+void cimbin_print(cimbin_t cimbin);
+
+#endif
@@ -3,6 +3,8 @@
 #include "protocol.h"
 #include "cimclass.h"
 #include "xml.h"
+#include "parse.h"
+#include "library.h"
 
 char *_cimval_name[] = {
     "invalid",
@@ -37,7 +39,7 @@ size_t _cimval_size[] = {
     sizeof(float),
     sizeof(double),
     -1,
-    -1,
+    sizeof(int64_t),
     sizeof(uint8_t),
     -1,
     -1
@@ -93,9 +95,15 @@ cimval_value_print(uint32_t typeid, void *value)
         printf("%lf", *((double*)value));
         break;
     case CIM_STRING:
-    case CIM_DATETIME:
         printf("\"%s\"", *(char**)value);
         break;
+    case CIM_DATETIME:
+        {
+            char datetime[40];
+            wr_format_datetime(datetime, sizeof(datetime), *((int64_t*)value));
+            printf("\"%s\"", datetime);
+        }
+        break;
     case CIM_BOOLEAN:
         printf("%s", *((uint8_t*)value) ? "<true>" : "<false>");
         break;
@@ -109,11 +117,15 @@ cimval_value_print(uint32_t typeid, void *value)
 }
 
 uint32_t
-cimval_value_set(cimval_t cv, const char *value)
+cimval_value_set(cimval_t cv, const char *value, xmlDictPtr dict)
 {
     uint32_t result = 1;
     void *new_value;
     size_t new_size = cv->size == -1 ? sizeof(char **) : cv->size;
+    size_t value_len;
+    uint64_t u;
+    int64_t i;
+    double d;
 
     if(value == NULL) return 1;
 
@@ -125,7 +137,7 @@ cimval_value_set(cimval_t cv, const char *value)
             cv->array_max += 10;
             void *temp = realloc(cv->value, new_size * (cv->array_max + 1));
             if(temp == NULL) {
-                fprintf(stderr, "Error - Unable to reserver memory for CIM Value\n");
+                wr_error("Error - Unable to reserver memory for CIM Value\n");
                 return 0;
             }
             cv->value = temp;
@@ -135,47 +147,76 @@ cimval_value_set(cimval_t cv, const char *value)
 
     } else {
         if(cv->value != NULL) {
-            fprintf(stderr, "Error - Value already defined.\n");
+            wr_error("Error - Value already defined.\n");
             return 0;
         }
         cv->value = calloc(1, new_size);
         new_value = cv->value;
     }
 
+    value_len = strlen(value);
     switch(cv->type) {
     case CIM_UINT8:
-        *((uint8_t*)new_value) = (uint8_t) strtol(value, NULL, 10);
-        break;
     case CIM_UINT16:
-        *((uint16_t*)new_value) = (uint16_t) strtol(value, NULL, 10);
-        break;
     case CIM_UINT32:
-        *((uint32_t*)new_value) = (uint32_t) strtol(value, NULL, 10);
-        break;
     case CIM_UINT64:
-        *((uint64_t*)new_value) = (uint64_t) strtoul(value, NULL, 10);
+        if(!wr_parse_uint64(&u, value, value_len) || 
+                (cv->size < sizeof(uint64_t) && u >> (cv->size * 8))) {
+            result = 0;
+            break;
+        }
+        if(cv->type == CIM_UINT8) *((uint8_t*)new_value) = (uint8_t) u;
+        else if(cv->type == CIM_UINT16) *((uint16_t*)new_value) = (uint16_t) u;
+        else if(cv->type == CIM_UINT32) *((uint32_t*)new_value) = (uint32_t) u;
+        else *((uint64_t*)new_value) = u;
         break;
     case CIM_SINT8:
-        *((int8_t*)new_value) = (int8_t) strtol(value, NULL, 10);
-        break;
     case CIM_SINT16:
-        *((int16_t*)new_value) = (int16_t) strtol(value, NULL, 10);
-        break;
     case CIM_SINT32:
-        *((int32_t*)new_value) = (int32_t) strtol(value, NULL, 10);
-        break;
     case CIM_SINT64:
-        *((int64_t*)new_value) = (int64_t) strtol(value, NULL, 10);
+        if(!wr_parse_int64(&i, value, value_len)) {
+            result = 0;
+            break;
+        }
+        if(cv->size < sizeof(int64_t)) {
+            int64_t limit = 1LL << (cv->size * 8 - 1);
+            if(i < -limit || i >= limit) {
+                result = 0;
+                break;
+            }
+        }
+        if(cv->type == CIM_SINT8) *((int8_t*)new_value) = (int8_t) i;
+        else if(cv->type == CIM_SINT16) *((int16_t*)new_value) = (int16_t) i;
+        else if(cv->type == CIM_SINT32) *((int32_t*)new_value) = (int32_t) i;
+        else *((int64_t*)new_value) = i;
         break;
     case CIM_REAL32:
-        *((float*)new_value) = strtof(value, NULL);
+        if(!wr_parse_real64(&d, value, value_len)) {
+            result = 0;
+            break;
+        }
+        *((float*)new_value) = (float) d;
         break;
     case CIM_REAL64:
-        *((double*)new_value) = (double) strtod(value, NULL);
+        if(!wr_parse_real64(&d, value, value_len)) {
+            result = 0;
+            break;
+        }
+        *((double*)new_value) = d;
         break;
     case CIM_STRING:
+        if(dict != NULL) {
+            *((const char**)new_value) = xmlDictLookup(dict, value, value_len);
+        } else {
+            *((char**)new_value) = strdup(value);
+        }
+        break;
     case CIM_DATETIME:
-        *((char**)new_value) = strdup(value);
+        if(!wr_parse_datetime(&i, value, value_len)) {
+            result = 0;
+            break;
+        }
+        *((int64_t*)new_value) = i;
         break;
     case CIM_BOOLEAN:
         *((uint8_t*)new_value) = strcmp(value, "true") == 0 ? 1 : 0;
@@ -184,9 +225,12 @@ cimval_value_set(cimval_t cv, const char *value)
         new_value = NULL;
         break;
     default:
-        fprintf(stderr, "(invalid type)");
-        result = 0;
-        break;
+        wr_error("Error - Invalid type for %s.\n", cv->name);
+        return 0;
+    }
+    if(!result) {
+        wr_error("Error - Invalid %s value \"%s\" for %s.\n", 
+            _cimval_name[cv->type], value, cv->name);
     }
     return result;
 }
@@ -212,25 +256,29 @@ cimval_print(cimval_t cv)
 }
 
 cimval_t
-cimval_new(const char *name, const char *type_name, uint32_t is_array)
+cimval_new(const char *name, const char *type_name, uint32_t is_array, xmlDictPtr dict)
 {
-    cimval_t cv;
+    cimval_t cv = NULL;
     uint32_t typeid;
 
     if(name == NULL || type_name == NULL) return NULL;
     typeid = cimval_typeid_from_string(type_name);
     if(typeid == -1) {
-        fprintf(stderr, "Error - Invalid cimval type %s\n", type_name);
+        wr_error("Error - Invalid cimval type %s\n", type_name);
         goto error;
     }
 
     cv = calloc(1, sizeof(struct _cimval));
     if(cv == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for cimvalue.\n");
+        wr_error("Error - Unable to reserve memory for cimvalue.\n");
         goto error;
     }
     cv->type = typeid;
-    cv->name = strdup(name);
+    if(dict != NULL) {
+        cv->name = (char *) xmlDictLookup(dict, name, -1);
+    } else {
+        cv->name = strdup(name);
+    }
     if(cv->name == NULL) goto error;
     cv->size = _cimval_size[typeid];
     cv->value = NULL;
@@ -240,17 +288,18 @@ cimval_new(const char *name, const char *type_name, uint32_t is_array)
 
     error:
     if(cv == NULL) return NULL;
-    if(cv->name) free(cv->name);
+    if(cv->name && dict == NULL) free(cv->name);
     free(cv);
+    return NULL;
 }
 
 void
-cimval_free(cimval_t cv)
+cimval_free(cimval_t cv, xmlDictPtr dict)
 {
     if(cv == NULL) return;
-    if(cv->name) free(cv->name);
+    if(cv->name && dict == NULL) free(cv->name);
     if(cv->value) {
-        if(cv->type == CIM_STRING || cv->type == CIM_DATETIME) {
+        if(cv->type == CIM_STRING && dict == NULL) {
             uint32_t array_len = cv->is_array ? cv->array_len : 1;
             char **s = (char**)cv->value;
             for(int i = 0; i < array_len; i++) {
@@ -262,21 +311,25 @@ cimval_free(cimval_t cv)
     free(cv);
 }
 
-cimclass_t
-cimclass_new(const char *name, uint32_t property_max)
+static cimclass_t
+cimclass_new_dict(const char *name, uint32_t property_max, xmlDictPtr dict)
 {
     cimclass_t cimclass = NULL;
 
     if(name == NULL) return NULL;
     cimclass = calloc(1, sizeof(struct _cimclass));
     if(cimclass == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for CIM Class.\n");
+        wr_error("Error - Unable to reserve memory for CIM Class.\n");
         return NULL;
     }
 
-    cimclass->name = strdup(name);
+    if(dict != NULL) {
+        cimclass->name = (char *) xmlDictLookup(dict, name, -1);
+    } else {
+        cimclass->name = strdup(name);
+    }
     if(cimclass->name == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for CIM Class name.\n");
+        wr_error("Error - Unable to reserve memory for CIM Class name.\n");
         free(cimclass);
         return NULL;
     }
@@ -284,18 +337,32 @@ cimclass_new(const char *name, uint32_t property_max)
     cimclass->__property_max = property_max + 1;
     cimclass->__property_step = 10;
 
-    cimclass->property = calloc(1, sizeof(cimval_t) * property_max);
+    cimclass->property = calloc(cimclass->__property_max, sizeof(cimval_t));
+    if(cimclass->property == NULL) {
+        wr_error("Error - Unable to reserve memory for CIM Class properties.\n");
+        goto error;
+    }
+    if(dict != NULL) {
+        cimclass->dict = dict;
+        xmlDictReference(dict);
+    }
 
     return cimclass;
 
     error:
     if(cimclass == NULL) return NULL;
-    if(cimclass->name) free(cimclass->name);
+    if(cimclass->name && dict == NULL) free(cimclass->name);
     if(cimclass->property) free(cimclass->property);
     free(cimclass);
     return NULL;
 }
 
+cimclass_t
+cimclass_new(const char *name, uint32_t property_max)
+{
+    return cimclass_new_dict(name, property_max, NULL);
+}
+
 void
 cimclass_free(cimclass_t *cimclass_p)
 {
@@ -303,11 +370,12 @@ cimclass_free(cimclass_t *cimclass_p)
     if(cimclass_p == NULL || *cimclass_p == NULL) return;
 
     cimclass = *cimclass_p;
-    if(cimclass->name) free(cimclass->name);
+    if(cimclass->name && cimclass->dict == NULL) free(cimclass->name);
     for(int i = 0; i < cimclass->property_count; i++) {
-        cimval_free(cimclass->property[i]);
+        cimval_free(cimclass->property[i], cimclass->dict);
     }
     if(cimclass->property) free(cimclass->property);
+    if(cimclass->dict) xmlDictFree(cimclass->dict);
     free(*cimclass_p);
     *cimclass_p = NULL;
 }
@@ -334,23 +402,26 @@ cimclass_property_add(cimclass_t cimclass, const char *name, const char *type_na
         cimclass->__property_max += cimclass->__property_step;
         void *temp = realloc(cimclass->property, sizeof(cimval_t) * cimclass->__property_max);
         if(temp == NULL) {
-            fprintf(stderr, "Error - Unable to reserve memory for class property array.\n");
+            wr_error("Error - Unable to reserve memory for class property array.\n");
             return 0;
         }
         cimclass->property = temp;
     }
 
-    cimclass->property[cimclass->property_count++] = cimval_new(name, type_name, is_array);
+    cimclass->property[cimclass->property_count] = cimval_new(name, type_name, 
+        is_array, cimclass->dict);
+    if(cimclass->property[cimclass->property_count] == NULL) return 0;
+    cimclass->property_count++;
     return 1;
 }
 
-cimclass_t
-cimclass_copy(cimclass_t source)
+static cimclass_t
+cimclass_copy_dict(cimclass_t source, xmlDictPtr dict)
 {
     cimclass_t copy = NULL;
-    copy = cimclass_new(source->name, source->property_count);
+    copy = cimclass_new_dict(source->name, source->property_count, dict);
     if(copy == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for cimclass copy.\n");
+        wr_error("Error - Unable to reserve memory for cimclass copy.\n");
         return NULL;
     }
     for(int i = 0; i < source->property_count; i++) {
@@ -366,6 +437,13 @@ cimclass_copy(cimclass_t source)
     return NULL;
 }
 
+cimclass_t
+cimclass_copy(cimclass_t source)
+{
+    if(source == NULL) return NULL;
+    return cimclass_copy_dict(source, source->dict);
+}
+
 
 cimval_t
 cimclass_property_value_get(cimclass_t cimclass, const char *name)
@@ -390,7 +468,7 @@ cimclass_property_value_set(cimclass_t cimclass, const char *name, const char *v
     cim_property = cimclass_property_value_get(cimclass, name);
     if(cim_property == NULL) return 0;
 
-    cimval_value_set(cim_property, value);
+    cimval_value_set(cim_property, value, cimclass->dict);
     return 1;
 }
 
@@ -429,12 +507,12 @@ cimschema_from_xmlschema(xmlDocPtr doc)
         }
         name = xmlGetNsProp(xml_property, "NAME", NULL);
         if(name == NULL) {
-            fprintf(stderr, "Error - Property has no attribute \"NAME\".\n");
+            wr_error("Error - Property has no attribute \"NAME\".\n");
             goto error;
         }
         type_name = xmlGetNsProp(xml_property, "TYPE", NULL);
         if(type_name == NULL) {
-            fprintf(stderr, "Error - Property has no attribute \"TYPE\".\n");
+            wr_error("Error - Property has no attribute \"TYPE\".\n");
             goto error;
         }
         if(!cimclass_property_add(cimclass, name, type_name, is_array)) {
@@ -472,8 +550,7 @@ cimclass_from_xml_class(cimclass_t cimclass, xmlNodePtr class_node)
             value = xmlNodeGetContent(xml_property);
         }
         if(!cimclass_property_value_set(cimclass, xml_property->name, value)) {
-            if(value) free(value);
-            fprintf(stderr, "Warning - Cannot set property %s.\n", xml_property->name);
+            wr_error("Warning - Cannot set property %s.\n", xml_property->name);
         }
         if(value) free(value);
     } while(xml_property = xmlNextElementSibling(xml_property));
@@ -494,21 +571,33 @@ cimclass_set_from_xml_doc(xmlDocPtr xml_class, cimclass_t cimclass_schema)
 
     cimclass_set = cimclass_set_new(cimclass_set_count);
     if(cimclass_set == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for cimclass set.\n");
+        wr_error("Error - Unable to reserve memory for cimclass set.\n");
+        goto error;
+    }
+    /* Strings already in the dictionary the response was parsed with,
+     * the names, are shared with it, the values go to one of the set
+     * freed with it: the dictionary of the session would keep every
+     * value of every check for as long as the session lives. */
+    if(xml_class->dict != NULL)
+        cimclass_set->dict = xmlDictCreateSub(xml_class->dict);
+    else
+        cimclass_set->dict = xmlDictCreate();
+    if(cimclass_set->dict == NULL) {
+        wr_error("Error - Unable to reserve memory for cimclass set.\n");
         goto error;
     }
 
     xml_class_node = xmlFirstElementChild(xml_item_set);
     for(int i = 0; i < cimclass_set_count && xml_class_node; i++) {
-        cimclass_t cs = cimclass_copy(cimclass_schema);
+        cimclass_t cs = cimclass_copy_dict(cimclass_schema, cimclass_set->dict);
 
         if(cs == NULL) {
-            fprintf(stderr, "Error - Unable to copy cimclass from schema.\n");
+            wr_error("Error - Unable to copy cimclass from schema.\n");
             goto error;
         }
         if(!cimclass_from_xml_class(cs, xml_class_node)) {
-            free(cs);
-            fprintf(stderr, "Error - Unable to extract values from xml node.\n");
+            cimclass_free(&cs);
+            wr_error("Error - Unable to extract values from xml node.\n");
             goto error;
         }
         cimclass_set->node[i] = cs;
@@ -531,12 +620,12 @@ cimclass_set_free(cimclass_set_t* cimclass_set)
     if((*cimclass_set)->node == NULL) goto end;
 
     for(int i = 0; i < (*cimclass_set)->nodeNr; i++) {
-        if((*cimclass_set)->node[i]) 
-            free((*cimclass_set)->node[i]);
+        cimclass_free(&(*cimclass_set)->node[i]);
     }
     free((*cimclass_set)->node);
 
     end:
+    if((*cimclass_set)->dict) xmlDictFree((*cimclass_set)->dict);
     free(*cimclass_set);
     *cimclass_set = NULL;
 }
@@ -547,7 +636,7 @@ cimclass_set_new(uint32_t nodeMax)
     cimclass_set_t cs;
     cs = calloc(1, sizeof(struct _cimclass_set));
     if(cs == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for cimclass set.\n");
+        wr_error("Error - Unable to reserve memory for cimclass set.\n");
         return NULL;
     }
     cs->nodeNr = nodeMax;
@@ -568,4 +657,12 @@ cimclass_set_print(cimclass_set_t cimclass_set)
         cimclass_print(*node);
         node++;
     }
-}
\ No newline at end of file
+}
+
+const char *
+cimclass_set_intern(cimclass_set_t cimclass_set, const char *value)
+{
+    if(cimclass_set == NULL || cimclass_set->dict == NULL || value == NULL)
+        return NULL;
+    return xmlDictLookup(cimclass_set->dict, value, -1);
+}
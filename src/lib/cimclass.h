@@ -1,5 +1,7 @@
 #ifndef __CIMCLASS_H_
 #define __CIMCLASS_H_
+#include <libxml/tree.h>
+#include <libxml/dict.h>
 
 typedef enum _cimval_type {
     CIM_INVALID,
@@ -14,7 +16,7 @@ typedef enum _cimval_type {
     CIM_REAL32,
     CIM_REAL64,
     CIM_STRING,
-    CIM_DATETIME,
+    CIM_DATETIME,   /* int64_t, microseconds since the epoch or interval length */
     CIM_BOOLEAN,
     CIM_OCTETSTRING
 } cimval_type_e;
@@ -29,18 +31,25 @@ typedef struct _cimval {
     void *value;
 } *cimval_t;
 
+/*
+ * When dict is set, the class name, property names and string values
+ * are interned in it and owned by the dictionary, so string values can
+ * be compared by pointer.
+ */
 typedef struct _cimclass {
     char *name;
     uint32_t property_count;
     uint32_t __property_max;
     uint32_t __property_step;
     cimval_t *property;
+    xmlDictPtr dict;
 } *cimclass_t;
 
 typedef struct _cimclass_set {
     uint32_t nodeNr;
     uint32_t nodeMax;
     cimclass_t *node;
+    xmlDictPtr dict;
 } *cimclass_set_t;
 
 cimclass_t cimschema_from_xmlschema(xmlDocPtr doc);
@@ -52,5 +61,6 @@ void cimclass_set_free(cimclass_set_t* cimclass_set);
 void cimclass_free(cimclass_t *cimclass_p);
 
 cimval_t cimclass_property_value_get(cimclass_t cimclass, const char *name);
+const char *cimclass_set_intern(cimclass_set_t cimclass_set, const char *value);
 
 #endif
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+#include "deadline.h"
+
+/* time kept from the alarm for the check to report */
+#define DEADLINE_MARGIN_MS 1000
+
+/* every thread runs its own check */
+static __thread wr_deadline_t check_deadline = { { 0, 0 }, 0, NULL, NULL };
+
+void
+wr_deadline_start(wr_deadline_t *deadline, uint32_t ms)
+{
+    if(deadline == NULL) return;
+    memset(deadline, 0, sizeof(wr_deadline_t));
+    clock_gettime(CLOCK_MONOTONIC, &deadline->expires);
+    deadline->expires.tv_sec += ms / 1000;
+    deadline->expires.tv_nsec += (ms % 1000) * 1000000L;
+    if(deadline->expires.tv_nsec >= 1000000000L) {
+        deadline->expires.tv_sec++;
+        deadline->expires.tv_nsec -= 1000000000L;
+    }
+    deadline->budget_ms = ms;
+}
+
+void
+wr_deadline_clear(wr_deadline_t *deadline)
+{
+    if(deadline == NULL) return;
+    memset(deadline, 0, sizeof(wr_deadline_t));
+}
+
+int64_t
+wr_deadline_left(const wr_deadline_t *deadline)
+{
+    struct timespec now;
+    int64_t left;
+
+    if(deadline == NULL || (deadline->expires.tv_sec == 0 && deadline->expires.tv_nsec == 0))
+        return -1;
+    if(deadline->expired != NULL) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left = (int64_t) (deadline->expires.tv_sec - now.tv_sec) * 1000 +
+        (deadline->expires.tv_nsec - now.tv_nsec) / 1000000L;
+    return left > 0 ? left : 0;
+}
+
+uint32_t
+wr_deadline_check(wr_deadline_t *deadline)
+{
+    if(wr_deadline_left(deadline) != 0) return 1;
+    if(deadline->expired == NULL)
+        deadline->expired = deadline->phase ? deadline->phase : "start";
+    return 0;
+}
+
+uint32_t
+wr_deadline_enter(wr_deadline_t *deadline, const char *phase)
+{
+    if(deadline == NULL) return 1;
+    if(!wr_deadline_check(deadline)) return 0;
+    deadline->phase = phase;
+    return 1;
+}
+
+const char *
+wr_deadline_expired(const wr_deadline_t *deadline)
+{
+    if(deadline == NULL) return NULL;
+    return deadline->expired;
+}
+
+wr_deadline_t *
+wr_check_deadline(void)
+{
+    return &check_deadline;
+}
+
+void
+wr_check_deadline_start(uint32_t seconds)
+{
+    uint32_t ms = seconds * 1000;
+
+    if(seconds == 0) {
+        wr_deadline_clear(&check_deadline);
+        return;
+    }
+    /* short timeouts keep a tenth of it */
+    ms -= ms / 10 < DEADLINE_MARGIN_MS ? ms / 10 : DEADLINE_MARGIN_MS;
+    wr_deadline_start(&check_deadline, ms);
+}
@@ -0,0 +1,39 @@
+#ifndef __DEADLINE_H_
+#define __DEADLINE_H_
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Time budget of the requests of a check. The transport sets the curl
+ * timeouts from the time left, the protocol scales the OperationTimeout
+ * of the server to it and sends nothing once it is spent. The phase in
+ * progress is kept so a check that ran out of time can tell where.
+ */
+typedef struct _wr_deadline {
+    struct timespec expires;    /* CLOCK_MONOTONIC, zero without a deadline */
+    uint32_t budget_ms;
+    const char *phase;
+    const char *expired;        /* phase the time ran out in */
+} wr_deadline_t;
+
+void wr_deadline_start(wr_deadline_t *deadline, uint32_t ms);
+void wr_deadline_clear(wr_deadline_t *deadline);
+
+/* Milliseconds left, -1 without a deadline. */
+int64_t wr_deadline_left(const wr_deadline_t *deadline);
+
+/* Returns 0 once the time is spent, the phase in progress is then the expired one. */
+uint32_t wr_deadline_check(wr_deadline_t *deadline);
+/* Same, then starts phase. */
+uint32_t wr_deadline_enter(wr_deadline_t *deadline, const char *phase);
+const char *wr_deadline_expired(const wr_deadline_t *deadline);
+
+/*
+ * Deadline of the check running in the calling thread, taken by the
+ * sessions it gets. It ends a little before the alarm of the plugin so that the
+ * check can still report.
+ */
+wr_deadline_t *wr_check_deadline(void);
+void wr_check_deadline_start(uint32_t seconds);
+
+#endif
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include "cache.h"
+#include "hostslot.h"
+#include "library.h"
+
+#define HOST_SLOT_MAX 64
+#define HOST_WAITERS_MAX 256
+#define HOST_WAIT_MIN_MS 10
+#define HOST_WAIT_MAX_MS 200
+
+struct _wr_host_slot {
+    int fd;
+    struct _wr_host_slot *next;
+};
+
+/* Slots taken by the check of this thread, released by wr_host_slot_abandon */
+static __thread wr_host_slot_t taken = NULL;
+static __thread int waiting = -1;       /* queue file of the wait in progress */
+/* of all the threads */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static wr_host_slot_stats_t stats = { 0, 0, 0, 0, 0 };
+
+static void
+stats_fork_prepare(void)
+{
+    pthread_mutex_lock(&stats_lock);
+}
+
+static void
+stats_fork_done(void)
+{
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* the refresh forked by the cache takes slots, another thread may hold the lock */
+static void
+stats_init(void)
+{
+    pthread_atfork(stats_fork_prepare, stats_fork_done, stats_fork_done);
+}
+
+static uint32_t
+max_concurrency(void)
+{
+    const char *value = getenv("WR_HOST_MAX_CONCURRENCY");
+    char *end;
+    long n;
+
+    if(value == NULL || *value == '\0') return 0;
+    n = strtol(value, &end, 10);
+    if(*end != '\0' || n <= 0) return 0;
+    return n > HOST_SLOT_MAX ? HOST_SLOT_MAX : n;
+}
+
+/*
+ * Takes a free slot of the host without waiting. Returns its file, -1
+ * when all are taken and -2 when the slots cannot be used.
+ */
+static int
+try_slots(const char *prefix, uint32_t count)
+{
+    char path[4096];
+    uint32_t first = getpid() % count;
+    int fd;
+
+    /* the processes start from different slots so they rarely collide */
+    for(uint32_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s.slot%u", prefix, (first + i) % count);
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        if(fd == -1) {
+            wr_error("Error - Unable to open %s: %s\n", path, strerror(errno));
+            return -2;
+        }
+        if(flock(fd, LOCK_EX | LOCK_NB) == 0) return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+/*
+ * Every waiting check locks one byte of the queue file. The locks belong
+ * to the open file, not to the process, so that the threads of a process
+ * count one each, and go away with it, so the count survives checks
+ * killed by their timeout.
+ */
+static int
+queue_join(const char *prefix, uint32_t *depth)
+{
+    struct flock lock;
+    char *path = NULL;
+    int fd, joined = 0;
+
+    *depth = 1;
+    if(asprintf(&path, "%s.queue", prefix) == -1) return -1;
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    free(path);
+    if(fd == -1) return -1;
+    for(off_t i = 0; i < HOST_WAITERS_MAX; i++) {
+        memset(&lock, 0, sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = i;
+        lock.l_len = 1;
+        if(!joined && fcntl(fd, F_OFD_SETLK, &lock) == 0) {
+            joined = 1;
+            continue;
+        }
+        if(fcntl(fd, F_OFD_GETLK, &lock) == 0 && lock.l_type != F_UNLCK) (*depth)++;
+    }
+    return fd;
+}
+
+wr_host_slot_t
+wr_host_slot_acquire(const char *host, const wr_deadline_t *deadline)
+{
+    uint32_t count = max_concurrency(), depth = 0, wait_ms = HOST_WAIT_MIN_MS;
+    struct timeval start, now;
+    wr_host_slot_t slot = NULL;
+    char *prefix = NULL;
+    const char *dir;
+    int fd, queue = -1;
+
+    if(count == 0 || host == NULL || (dir = wr_cache_dir()) == NULL) return NULL;
+    pthread_once(&stats_once, stats_init);
+    if(asprintf(&prefix, "%s/%016llx", dir, (unsigned long long) wr_cache_hash(host)) == -1)
+        return NULL;
+
+    fd = try_slots(prefix, count);
+    if(fd == -1) {
+        gettimeofday(&start, NULL);
+        waiting = queue = queue_join(prefix, &depth);
+        while((fd = try_slots(prefix, count)) == -1) {
+            /* the request is then refused for lack of time */
+            if(wr_deadline_left(deadline) == 0) break;
+            usleep(wait_ms * 1000);
+            if(wait_ms < HOST_WAIT_MAX_MS) wait_ms *= 2;
+        }
+        gettimeofday(&now, NULL);
+        if(queue != -1) close(queue);
+        waiting = -1;
+        pthread_mutex_lock(&stats_lock);
+        stats.waited++;
+        stats.wait_seconds += (now.tv_sec - start.tv_sec) +
+            (now.tv_usec - start.tv_usec) / 1.0e6;
+        stats.queue_depth = depth;
+        if(depth > stats.max_queue_depth) stats.max_queue_depth = depth;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    /* without the lock files the requests go unlimited, out of time they fail */
+    if(fd < 0) goto end;
+
+    slot = calloc(1, sizeof(struct _wr_host_slot));
+    if(slot == NULL) {
+        wr_error("Error - Unable to reserve memory for host slot.\n");
+        close(fd);
+        goto end;
+    }
+    slot->fd = fd;
+    slot->next = taken;
+    taken = slot;
+    pthread_mutex_lock(&stats_lock);
+    stats.acquired++;
+    pthread_mutex_unlock(&stats_lock);
+
+    end:
+    free(prefix);
+    return slot;
+}
+
+void
+wr_host_slot_release(wr_host_slot_t *slot)
+{
+    wr_host_slot_t s;
+
+    if(slot == NULL || *slot == NULL) return;
+    s = *slot;
+    for(wr_host_slot_t *link = &taken; *link; link = &(*link)->next) {
+        if(*link != s) continue;
+        *link = s->next;
+        break;
+    }
+    close(s->fd);
+    free(s);
+    *slot = NULL;
+}
+
+void
+wr_host_slot_abandon(void)
+{
+    if(waiting != -1) close(waiting);
+    waiting = -1;
+    while(taken != NULL) {
+        wr_host_slot_t slot = taken;
+        wr_host_slot_release(&slot);
+    }
+}
+
+void
+wr_host_slot_stats(wr_host_slot_stats_t *s)
+{
+    if(s == NULL) return;
+    pthread_mutex_lock(&stats_lock);
+    *s = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,37 @@
+#ifndef __HOSTSLOT_H_
+#define __HOSTSLOT_H_
+#include <stdint.h>
+#include "deadline.h"
+
+/*
+ * Limits the requests sent at the same time to one host by all the
+ * processes of the machine to WR_HOST_MAX_CONCURRENCY (no limit without
+ * it). Every request takes one of the slots of its host, lock files in
+ * the cache directory, and the requests finding them all taken wait for
+ * one to be released.
+ */
+
+typedef struct _wr_host_slot *wr_host_slot_t;
+
+/*
+ * Returns NULL when there is no limit, waits until a slot is free or
+ * the deadline is spent.
+ */
+wr_host_slot_t wr_host_slot_acquire(const char *host, const wr_deadline_t *deadline);
+void wr_host_slot_release(wr_host_slot_t *slot);
+
+/* Releases the slots left taken, or waited for, by a check that was aborted. */
+void wr_host_slot_abandon(void);
+
+/* Waits of all the threads of this process for a slot */
+typedef struct _wr_host_slot_stats {
+    uint64_t acquired;
+    uint64_t waited;            /* slots that were not free at once */
+    double wait_seconds;
+    uint32_t queue_depth;       /* waiting requests, seen by the last wait */
+    uint32_t max_queue_depth;
+} wr_host_slot_stats_t;
+
+void wr_host_slot_stats(wr_host_slot_stats_t *stats);
+
+#endif
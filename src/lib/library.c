@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <libxml/parser.h>
+#include "library.h"
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static uint32_t initialized = 0;
+static uint32_t quiet = 0;
+static __thread char last_error[WR_ERROR_MAX];
+static wr_allocator_t allocator = { malloc, calloc, realloc, free, strdup };
+static uint32_t custom_allocator = 0;
+
+static void
+library_init(void)
+{
+    /* neither is safe to run while other threads use the library */
+    if(custom_allocator) {
+        curl_global_init_mem(CURL_GLOBAL_ALL, allocator.malloc_fn, allocator.free_fn,
+            allocator.realloc_fn, allocator.strdup_fn, allocator.calloc_fn);
+    } else {
+        curl_global_init(CURL_GLOBAL_ALL);
+    }
+    xmlInitParser();
+    __atomic_store_n(&initialized, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+wr_library_init(void)
+{
+    pthread_once(&init_once, library_init);
+}
+
+uint32_t
+wr_library_set_allocator(const wr_allocator_t *a)
+{
+    if(a == NULL || a->malloc_fn == NULL || a->calloc_fn == NULL || a->realloc_fn == NULL ||
+            a->free_fn == NULL || a->strdup_fn == NULL)
+        return 0;
+    if(__atomic_load_n(&initialized, __ATOMIC_SEQ_CST)) {
+        wr_error("Error - The allocator must be set before the library is used.\n");
+        return 0;
+    }
+    allocator = *a;
+    custom_allocator = 1;
+    return 1;
+}
+
+const wr_allocator_t *
+wr_library_allocator(void)
+{
+    return &allocator;
+}
+
+void
+wr_library_cleanup(void)
+{
+    xmlCleanupParser();
+    curl_global_cleanup();
+}
+
+void
+wr_error(const char *format, ...)
+{
+    va_list ap, copy;
+    size_t len;
+
+    va_start(ap, format);
+    va_copy(copy, ap);
+    vsnprintf(last_error, sizeof(last_error), format, ap);
+    /* stderr gets all of it, a fault returned by the server may be long */
+    if(!__atomic_load_n(&quiet, __ATOMIC_RELAXED))
+        vfprintf(stderr, format, copy);
+    va_end(copy);
+    va_end(ap);
+    /* the messages end their line on stderr, not in the buffer */
+    len = strlen(last_error);
+    while(len > 0 && last_error[len - 1] == '\n') last_error[--len] = '\0';
+}
+
+const char *
+wr_last_error(void)
+{
+    return last_error;
+}
+
+void
+wr_error_clear(void)
+{
+    last_error[0] = '\0';
+}
+
+void
+wr_error_quiet(uint32_t q)
+{
+    __atomic_store_n(&quiet, q, __ATOMIC_RELAXED);
+}
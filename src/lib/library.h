@@ -0,0 +1,47 @@
+#ifndef __LIBRARY_H_
+#define __LIBRARY_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define WR_ERROR_MAX 512
+
+/*
+ * Memory functions given to libcurl and used for the handles of
+ * winremote.h. libxml2 keeps those of the libc, the library frees
+ * strings it returns with free().
+ */
+typedef struct _wr_allocator {
+    void *(*malloc_fn)(size_t size);
+    void *(*calloc_fn)(size_t count, size_t size);
+    void *(*realloc_fn)(void *ptr, size_t size);
+    void (*free_fn)(void *ptr);
+    char *(*strdup_fn)(const char *s);
+} wr_allocator_t;
+
+/*
+ * Process-wide setup of libcurl and libxml2. wr_library_init runs it
+ * once whatever the number of threads calling it, the contexts call it
+ * when they are created. wr_library_cleanup undoes it, once every
+ * session is freed and no thread uses the library any more.
+ */
+void wr_library_init(void);
+void wr_library_cleanup(void);
+/*
+ * Replaces the allocator of the libc, only before wr_library_init ran.
+ * Returns 0 when it is too late or the allocator misses a function.
+ */
+uint32_t wr_library_set_allocator(const wr_allocator_t *allocator);
+const wr_allocator_t *wr_library_allocator(void);
+
+/*
+ * Errors of the library are kept per thread, like errno, each thread
+ * running its own sessions reads those of its requests. They still go
+ * to stderr unless the process asks for quiet, a plugin has nowhere
+ * else to show them.
+ */
+void wr_error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+const char *wr_last_error(void);
+void wr_error_clear(void);
+void wr_error_quiet(uint32_t quiet);
+
+#endif
@@ -4,22 +4,83 @@
 #include <libintl.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include "config.h"
 #include "nagios.h"
+#include "deadline.h"
+
+const char *progname = "check_wr";
+const char *copyright = "2023-2037";
+const char *email = "info@samanagroup.com";
+int port = -1;
+char *server_name = NULL;
+int verbose = FALSE;
+char *username = NULL;
+char *password = NULL;
+char *url = NULL;
+int warn = UNKNOWN_VALUE;
+int crit = UNKNOWN_VALUE;
+int legacy = 0;
+
+/*
+ * All the checks live in the same binary and share the option globals,
+ * every check resets them before parsing its arguments.
+ */
+void
+smn_applet_init (const char *name, int threshold)
+{
+    progname = name;
+    port = -1;
+    server_name = NULL;
+    verbose = FALSE;
+    username = NULL;
+    password = NULL;
+    FREE_NULL(url);
+    warn = threshold;
+    crit = threshold;
+    legacy = 0;
+    timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+    optind = 0;
+    /* started with the alarm, once the timeout is known */
+    wr_deadline_clear(wr_check_deadline());
+}
 
-extern const char *progname;
-extern const char *copyright;
-extern const char *email;
-extern int port;
-extern char *server_name;
-extern int verbose;
-extern char *username;
-extern char *password;
-extern char *url;
-extern int warn;
-extern int crit;
-extern int legacy;
+/*
+ * Prints the status line of a check that could not get its data, or
+ * where it ran out of time when that was the reason.
+ */
+void
+smn_unknown (const char *message)
+{
+    const char *phase = wr_deadline_expired (wr_check_deadline ());
 
+    if (phase != NULL)
+        printf (_("UNKNOWN - Timeout during %s (%.1fs budget)\n"), phase,
+            wr_check_deadline ()->budget_ms / 1000.0);
+    else
+        printf (_("UNKNOWN - %s\n"), message);
+}
+
+/* Labels are lower case, anything but letters, digits and _ becomes _ */
+char *
+smn_perfdata_label (const char *label, size_t len)
+{
+    char *newlabel = strndup(label, len);
+    if(newlabel == NULL) return NULL;
+    for(char *p = newlabel; *p; p++) {
+        if(*p >= '0' && *p <= '9') continue;
+        if(*p >= 'A' && *p <= 'Z') {
+            *p |= 0x20;
+            continue;
+        }
+        if(*p >= 'a' && *p <= 'z') continue;
+        if(*p == '_') continue;
+            *p = '_';
+    }
+    return newlabel;
+}
 
 char *smn_perfdata (const char *label,
  long int val,
@@ -35,17 +96,7 @@ char *smn_perfdata (const char *label,
 {
     char *data, *temp;
 
-    char *newlabel = strdup(label);
-    for(char *p = newlabel; *p; p++) {
-        if(*p >= '0' && *p <= '9') continue;
-        if(*p >= 'A' && *p <= 'Z') {
-            *p |= 0x20;
-            continue;
-        }
-        if(*p >= 'a' && *p <= 'z') continue;
-        if(*p == '_') continue;
-            *p = '_';
-    }
+    char *newlabel = smn_perfdata_label(label, strlen(label));
     xasprintf (&data, "%s=%ld%s;", newlabel, val, uom);
     free(newlabel);
 
@@ -78,6 +129,54 @@ char *smn_perfdata (const char *label,
     return data;
 }
 
+/* Same as smn_perfdata, for values with a fractional part */
+char *smn_fperfdata (const char *label,
+ double val,
+ const char *uom,
+ int warnp,
+ double warn,
+ int critp,
+ double crit,
+ int minp,
+ double minv,
+ int maxp,
+ double maxv)
+{
+    char *data, *temp;
+
+    char *newlabel = smn_perfdata_label(label, strlen(label));
+    xasprintf (&data, "%s=%.3f%s;", newlabel, val, uom);
+    free(newlabel);
+
+    if (warnp)
+        xasprintf (&temp, "%s%.3f;", data, warn);
+    else
+        xasprintf (&temp, "%s;", data);
+    free(data);
+    data=temp;
+
+    if (critp)
+        xasprintf (&temp, "%s%.3f;", data, crit);
+    else
+        xasprintf (&temp, "%s;", data);
+    free(data);
+    data=temp;
+
+    if (minp){
+        xasprintf (&temp, "%s%.3f", data, minv);
+        free(data);
+        data=temp;
+    }
+
+    if (maxp){
+        xasprintf (&temp, "%s;%.3f", data, maxv);
+        free(data);
+        data=temp;
+    }
+
+    return data;
+}
+
 int
 get_threshold(char *arg, int *th)
 {
@@ -235,3 +334,138 @@ validate_arguments (void)
 
     return OK;
 }
+
+/*
+ * Writes the output in a single line, the way Nagios reads it back:
+ * newlines become \n and, for check result files, backslashes \\.
+ * Trailing newlines are dropped.
+ */
+static void
+write_result_output (FILE *out, const char *output, int escape_backslash)
+{
+    size_t len = output ? strlen(output) : 0;
+
+    while (len > 0 && (output[len - 1] == '\n' || output[len - 1] == '\r'))
+        len--;
+    for (size_t i = 0; i < len; i++) {
+        if (output[i] == '\n')
+            fputs("\\n", out);
+        else if (output[i] == '\\' && escape_backslash)
+            fputs("\\\\", out);
+        else if (output[i] != '\r')
+            fputc(output[i], out);
+    }
+}
+
+/*
+ * Writes the results as one check result file in the Nagios
+ * check_result_path. The file is only picked up by Nagios once its .ok
+ * file exists, which is created after the results are complete.
+ */
+int
+smn_spool_results (const char *spool_dir, const smn_result_t *results, int count)
+{
+    char *path = NULL, *ok_path = NULL;
+    FILE *out = NULL;
+    int fd, result = ERROR;
+
+    xasprintf(&path, "%s/cXXXXXX", spool_dir);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error - Unable to create check result file in %s: %s\n",
+            spool_dir, strerror(errno));
+        goto end;
+    }
+    out = fdopen(fd, "w");
+    if (out == NULL) {
+        close(fd);
+        unlink(path);
+        goto end;
+    }
+
+    fprintf(out, "### Active Check Result File ###\n");
+    fprintf(out, "file_time=%lu\n\n", (unsigned long) time(NULL));
+    for (int i = 0; i < count; i++) {
+        const smn_result_t *r = &results[i];
+        fprintf(out, "### Nagios Service Check Result ###\n");
+        fprintf(out, "host_name=%s\n", r->host_name);
+        fprintf(out, "service_description=%s\n", r->service_description);
+        fprintf(out, "check_type=1\n");                 /* passive */
+        fprintf(out, "check_options=0\n");
+        fprintf(out, "scheduled_check=0\n");
+        fprintf(out, "reschedule_check=0\n");
+        fprintf(out, "latency=0.0\n");
+        fprintf(out, "start_time=%lu.%06lu\n", (unsigned long) r->start.tv_sec,
+            (unsigned long) r->start.tv_usec);
+        fprintf(out, "finish_time=%lu.%06lu\n", (unsigned long) r->finish.tv_sec,
+            (unsigned long) r->finish.tv_usec);
+        fprintf(out, "early_timeout=0\n");
+        fprintf(out, "exited_ok=1\n");
+        fprintf(out, "return_code=%d\n", r->return_code);
+        fprintf(out, "output=");
+        write_result_output(out, r->output, 1);
+        fprintf(out, "\n\n");
+    }
+    if (fclose(out) == EOF) {
+        fprintf(stderr, "Error - Unable to write check result file %s\n", path);
+        unlink(path);
+        goto end;
+    }
+
+    xasprintf(&ok_path, "%s.ok", path);
+    fd = open(ok_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error - Unable to create %s: %s\n", ok_path, strerror(errno));
+        unlink(path);
+        goto end;
+    }
+    close(fd);
+    result = OK;
+
+    end:
+    free(path);
+    free(ok_path);
+    return result;
+}
+
+/*
+ * Writes the results as PROCESS_SERVICE_CHECK_RESULT commands to the
+ * Nagios external command file. Every command goes in a single write so
+ * that commands from concurrent writers do not mix.
+ */
+int
+smn_command_results (const char *command_file, const smn_result_t *results, int count)
+{
+    char *line = NULL;
+    size_t size = 0;
+    FILE *out;
+    int fd, result = OK;
+
+    fd = open(command_file, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        fprintf(stderr, "Error - Unable to open command file %s: %s\n",
+            command_file, strerror(errno));
+        return ERROR;
+    }
+    for (int i = 0; i < count && result == OK; i++) {
+        const smn_result_t *r = &results[i];
+        out = open_memstream(&line, &size);
+        if (out == NULL) {
+            result = ERROR;
+            break;
+        }
+        fprintf(out, "[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;",
+            (unsigned long) r->finish.tv_sec, r->host_name,
+            r->service_description, r->return_code);
+        write_result_output(out, r->output, 0);
+        fputc('\n', out);
+        fclose(out);
+        if (write(fd, line, size) != (ssize_t) size) {
+            fprintf(stderr, "Error - Unable to write to command file %s\n", command_file);
+            result = ERROR;
+        }
+        FREE_NULL(line);
+    }
+    close(fd);
+    return result;
+}
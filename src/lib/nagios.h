@@ -46,14 +46,47 @@ info@samanagroup.com\n\n")
    x = NULL; \
 } while(0);
 
+extern const char *progname;
+extern const char *copyright;
+extern const char *email;
+extern int port;
+extern char *server_name;
+extern int verbose;
+extern char *username;
+extern char *password;
+extern char *url;
+extern int warn;
+extern int crit;
+extern int legacy;
+
+void smn_applet_init (const char *name, int threshold);
+void smn_unknown (const char *message);
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 int get_threshold(char *arg, int *th);
+/* label of perfdata as smn_perfdata writes it, to be freed */
+char *smn_perfdata_label (const char *label, size_t len);
 char *smn_perfdata (const char *label, long int val, const char *uom,
     int warnp, long int warn, int critp, long int crit, int minp,
     long int minv, int maxp, long int maxv);
+char *smn_fperfdata (const char *label, double val, const char *uom,
+    int warnp, double warn, int critp, double crit, int minp,
+    double minv, int maxp, double maxv);
+
+/* Passive service check result, see smn_spool_results */
+typedef struct smn_result {
+   const char *host_name;
+   const char *service_description;
+   int return_code;
+   const char *output;
+   struct timeval start;
+   struct timeval finish;
+} smn_result_t;
+
+int smn_spool_results (const char *spool_dir, const smn_result_t *results, int count);
+int smn_command_results (const char *command_file, const smn_result_t *results, int count);
 
 /* Following functions were pulled from nagios-plugins header files. */
 extern unsigned int timeout_interval;
@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "output.h"
+#include "parse.h"
+#include "library.h"
+
+#define VALUE_NULL   0
+#define VALUE_RAW    1
+#define VALUE_STRING 2
+
+typedef struct _wr_output {
+    FILE *out;
+    wr_output_format_e format;
+    cimclass_t schema;
+    xmlNodePtr *slot;       /* first element of every property in the current item */
+    uint64_t count;
+} *wr_output_t;
+
+uint32_t
+wr_output_format_from_string(wr_output_format_e *format, const char *name)
+{
+    if(format == NULL || name == NULL) return 0;
+    if(!strcmp(name, "json")) {
+        *format = WR_OUTPUT_JSON;
+    } else if(!strcmp(name, "csv")) {
+        *format = WR_OUTPUT_CSV;
+    } else {
+        wr_error("Error - Unknown output format \"%s\".\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+static void
+write_json_string(FILE *out, const char *s)
+{
+    const char *run = s;
+
+    fputc('"', out);
+    for(; *s; s++) {
+        unsigned char c = *s;
+        if(c >= 0x20 && c != '"' && c != '\\') continue;
+        fwrite(run, 1, s - run, out);
+        run = s + 1;
+        switch(c) {
+        case '"':  fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\r': fputs("\\r", out); break;
+        case '\t': fputs("\\t", out); break;
+        default:   fprintf(out, "\\u%04x", c); break;
+        }
+    }
+    fwrite(run, 1, s - run, out);
+    fputc('"', out);
+}
+
+/* Writes s escaped for a quoted CSV field, without the quotes. */
+static void
+write_csv_text(FILE *out, const char *s)
+{
+    const char *quote;
+
+    while((quote = strchr(s, '"')) != NULL) {
+        fwrite(s, 1, quote - s + 1, out);
+        fputc('"', out);
+        s = quote + 1;
+    }
+    fputs(s, out);
+}
+
+static uint32_t
+is_interval(const char *s)
+{
+    while(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+    return s[0] == 'P' || (strlen(s) >= 25 && s[21] == ':');
+}
+
+/*
+ * Converts the text of a property to its typed form. Numbers and
+ * booleans come back in buf ready to be written as is, timestamps are
+ * normalized to ISO-8601 and anything that does not parse is null.
+ */
+static uint32_t
+typed_value(cimval_type_e type, const char *s, char *buf, size_t size, const char **value)
+{
+    uint64_t u;
+    int64_t i;
+    double d, back;
+    size_t len = strlen(s);
+
+    switch(type) {
+    case CIM_UINT8:
+    case CIM_UINT16:
+    case CIM_UINT32:
+    case CIM_UINT64:
+        if(!wr_parse_uint64(&u, s, len)) return VALUE_NULL;
+        snprintf(buf, size, "%" PRIu64, u);
+        *value = buf;
+        return VALUE_RAW;
+    case CIM_SINT8:
+    case CIM_SINT16:
+    case CIM_SINT32:
+    case CIM_SINT64:
+        if(!wr_parse_int64(&i, s, len)) return VALUE_NULL;
+        snprintf(buf, size, "%" PRId64, i);
+        *value = buf;
+        return VALUE_RAW;
+    case CIM_REAL32:
+    case CIM_REAL64:
+        if(!wr_parse_real64(&d, s, len) || !isfinite(d)) return VALUE_NULL;
+        /* shortest form that reads back to the same double */
+        snprintf(buf, size, "%.15g", d);
+        if(!wr_parse_real64(&back, buf, strlen(buf)) || back != d)
+            snprintf(buf, size, "%.17g", d);
+        *value = buf;
+        return VALUE_RAW;
+    case CIM_BOOLEAN:
+        if(!strcmp(s, "true")) *value = "true";
+        else if(!strcmp(s, "false")) *value = "false";
+        else return VALUE_NULL;
+        return VALUE_RAW;
+    case CIM_DATETIME:
+        if(!is_interval(s) && wr_parse_datetime(&i, s, len)) {
+            wr_format_datetime(buf, size, i);
+            *value = buf;
+        } else {
+            *value = s;
+        }
+        return VALUE_STRING;
+    default:
+        *value = s;
+        return VALUE_STRING;
+    }
+}
+
+static uint32_t
+is_nil(xmlNodePtr node)
+{
+    return xmlHasProp(node, BAD_CAST "nil") != NULL;
+}
+
+static void
+write_value(wr_output_t output, cimval_type_e type, xmlNodePtr node, uint32_t in_quotes)
+{
+    xmlNodePtr text = node->children;
+    char *copy = NULL;
+    const char *s, *value = NULL;
+    char buf[64];
+    uint32_t kind;
+
+    if(is_nil(node)) {
+        kind = VALUE_NULL;
+    } else {
+        /* avoid a copy for the usual single text child */
+        if(text == NULL) {
+            s = "";
+        } else if(text->next == NULL && text->type == XML_TEXT_NODE) {
+            s = (const char *) text->content;
+        } else {
+            copy = (char *) xmlNodeGetContent(node);
+            s = copy ? copy : "";
+        }
+        kind = typed_value(type, s, buf, sizeof(buf), &value);
+    }
+
+    if(output->format == WR_OUTPUT_JSON) {
+        if(kind == VALUE_NULL) fputs("null", output->out);
+        else if(kind == VALUE_RAW) fputs(value, output->out);
+        else write_json_string(output->out, value);
+    } else if(kind != VALUE_NULL) {
+        if(!in_quotes && kind == VALUE_STRING) fputc('"', output->out);
+        write_csv_text(output->out, value);
+        if(!in_quotes && kind == VALUE_STRING) fputc('"', output->out);
+    }
+    if(copy) free(copy);
+}
+
+static void
+write_property(wr_output_t output, cimval_t property, xmlNodePtr node)
+{
+    FILE *out = output->out;
+    uint32_t first = 1;
+
+    if(node == NULL || (property->is_array && is_nil(node))) {
+        if(output->format == WR_OUTPUT_JSON) fputs("null", out);
+        return;
+    }
+    if(!property->is_array) {
+        write_value(output, property->type, node, 0);
+        return;
+    }
+
+    /* array items are consecutive elements with the same name */
+    fputc(output->format == WR_OUTPUT_JSON ? '[' : '"', out);
+    for(; node && !strcmp((char *) node->name, property->name);
+            node = xmlNextElementSibling(node)) {
+        if(!first) fputc(output->format == WR_OUTPUT_JSON ? ',' : ';', out);
+        write_value(output, property->type, node, 1);
+        first = 0;
+    }
+    fputc(output->format == WR_OUTPUT_JSON ? ']' : '"', out);
+}
+
+static int32_t
+property_index(cimclass_t schema, const char *name, uint32_t hint)
+{
+    /* properties normally come in schema order */
+    if(hint < schema->property_count && !strcmp(schema->property[hint]->name, name))
+        return hint;
+    for(uint32_t p = 0; p < schema->property_count; p++) {
+        if(!strcmp(schema->property[p]->name, name)) return p;
+    }
+    return -1;
+}
+
+static void
+write_item(wr_output_t output, xmlNodePtr item)
+{
+    cimclass_t schema = output->schema;
+    uint32_t hint = 0;
+    int32_t p;
+
+    memset(output->slot, 0, sizeof(xmlNodePtr) * schema->property_count);
+    for(xmlNodePtr child = xmlFirstElementChild(item); child;
+            child = xmlNextElementSibling(child)) {
+        p = property_index(schema, (char *) child->name, hint);
+        if(p < 0) continue;
+        if(output->slot[p] == NULL) output->slot[p] = child;
+        hint = schema->property[p]->is_array ? p : p + 1;
+    }
+
+    if(output->format == WR_OUTPUT_JSON) fputc('{', output->out);
+    for(uint32_t i = 0; i < schema->property_count; i++) {
+        if(i > 0) fputc(',', output->out);
+        if(output->format == WR_OUTPUT_JSON) {
+            write_json_string(output->out, schema->property[i]->name);
+            fputc(':', output->out);
+        }
+        write_property(output, schema->property[i], output->slot[i]);
+    }
+    if(output->format == WR_OUTPUT_JSON) fputc('}', output->out);
+    fputc('\n', output->out);
+    output->count++;
+}
+
+uint32_t
+wr_output_items(xmlNodePtr items, void *data)
+{
+    wr_output_t output = (wr_output_t) data;
+
+    if(output == NULL || items == NULL) return 0;
+
+    for(xmlNodePtr item = xmlFirstElementChild(items); item;
+            item = xmlNextElementSibling(item)) {
+        write_item(output, item);
+    }
+    if(fflush(output->out) == EOF || ferror(output->out)) {
+        wr_error("Error - Unable to write output.\n");
+        return 0;
+    }
+    return 1;
+}
+
+uint64_t
+wr_output_count(wr_output_t output)
+{
+    if(output == NULL) return 0;
+    return output->count;
+}
+
+wr_output_t
+wr_output_new(FILE *out, wr_output_format_e format, cimclass_t schema)
+{
+    wr_output_t output;
+
+    if(out == NULL || schema == NULL) return NULL;
+
+    output = calloc(1, sizeof(struct _wr_output));
+    if(output == NULL) {
+        wr_error("Error - Unable to reserve memory for output.\n");
+        return NULL;
+    }
+    output->slot = calloc(schema->property_count + 1, sizeof(xmlNodePtr));
+    if(output->slot == NULL) {
+        wr_error("Error - Unable to reserve memory for output.\n");
+        free(output);
+        return NULL;
+    }
+    output->out = out;
+    output->format = format;
+    output->schema = schema;
+
+    if(format == WR_OUTPUT_CSV) {
+        for(uint32_t p = 0; p < schema->property_count; p++) {
+            if(p > 0) fputc(',', out);
+            fputc('"', out);
+            write_csv_text(out, schema->property[p]->name);
+            fputc('"', out);
+        }
+        fputc('\n', out);
+    }
+    return output;
+}
+
+void
+wr_output_free(wr_output_t *output)
+{
+    if(output == NULL || *output == NULL) return;
+    free((*output)->slot);
+    free(*output);
+    *output = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef __OUTPUT_H_
+#define __OUTPUT_H_
+#include <stdio.h>
+#include <stdint.h>
+#include <libxml/tree.h>
+#include "cimclass.h"
+
+typedef enum _wr_output_format {
+    WR_OUTPUT_JSON,     /* one JSON object per line */
+    WR_OUTPUT_CSV       /* header line, then one row per instance */
+} wr_output_format_e;
+
+typedef struct _wr_output *wr_output_t;
+
+uint32_t wr_output_format_from_string(wr_output_format_e *format, const char *name);
+wr_output_t wr_output_new(FILE *out, wr_output_format_e format, cimclass_t schema);
+void wr_output_free(wr_output_t *output);
+
+/*
+ * Writes every instance under items (the Items node of a Pull response)
+ * typed by the schema, and flushes the stream. Can be used directly as a
+ * wr_items_cb with the output as data.
+ */
+uint32_t wr_output_items(xmlNodePtr items, void *output);
+uint64_t wr_output_count(wr_output_t output);
+
+#endif
@@ -0,0 +1,473 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <pthread.h>
+#include <time.h>
+#include "parse.h"
+
+#define IS_DIGIT(c) ((unsigned char)((c) - '0') < 10)
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+#define USEC_PER_SEC  1000000LL
+#define USEC_PER_DAY  (86400LL * USEC_PER_SEC)
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WR_PARSE_SWAR 1
+#endif
+
+static const double _pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void
+trim(const char **s, size_t *len)
+{
+    while(*len > 0 && IS_SPACE(**s)) {
+        (*s)++;
+        (*len)--;
+    }
+    while(*len > 0 && IS_SPACE((*s)[*len - 1])) (*len)--;
+}
+
+#ifdef WR_PARSE_SWAR
+/*
+ * Eight ASCII digits are checked and converted at once by treating them
+ * as a little endian 64 bit word. Only used when the whole word is known
+ * to be inside the buffer.
+ */
+static inline uint64_t
+swar_load(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+swar_is_8digits(uint64_t v)
+{
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+        (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+        0x3333333333333333ULL);
+}
+
+static inline uint32_t
+swar_parse_8digits(uint64_t v)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; /* 100 + (1000000 << 32) */
+    const uint64_t mul2 = 0x0000271000000001ULL; /* 1 + (10000 << 32) */
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t) v;
+}
+#endif
+
+/*
+ * Accumulates a run of decimal digits. Returns the number of digits
+ * consumed and sets overflow if the value does not fit in 64 bits.
+ */
+static size_t
+parse_digits(uint64_t *value, uint32_t *overflow, const char *s, size_t len)
+{
+    uint64_t v = 0;
+    size_t i = 0;
+
+    *overflow = 0;
+#ifdef WR_PARSE_SWAR
+    while(len - i >= 8) {
+        uint64_t chunk = swar_load(s + i);
+        if(!swar_is_8digits(chunk)) break;
+        if(__builtin_mul_overflow(v, 100000000ULL, &v) ||
+                __builtin_add_overflow(v, swar_parse_8digits(chunk), &v)) {
+            *overflow = 1;
+        }
+        i += 8;
+    }
+#endif
+    for(; i < len && IS_DIGIT(s[i]); i++) {
+        if(__builtin_mul_overflow(v, 10, &v) ||
+                __builtin_add_overflow(v, (uint64_t)(s[i] - '0'), &v)) {
+            *overflow = 1;
+        }
+    }
+    *value = v;
+    return i;
+}
+
+/* Parses exactly n digits. Used for the fixed width date fields. */
+static uint32_t
+parse_fixed(int64_t *value, const char *s, size_t n)
+{
+    int64_t v = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(!IS_DIGIT(s[i])) return 0;
+        v = v * 10 + (s[i] - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+uint32_t
+wr_parse_uint64(uint64_t *value, const char *s, size_t len)
+{
+    uint32_t overflow;
+    size_t n;
+
+    if(value == NULL || s == NULL) return 0;
+    trim(&s, &len);
+    if(len > 0 && *s == '+') {
+        s++;
+        len--;
+    }
+    n = parse_digits(value, &overflow, s, len);
+    if(n == 0 || n != len || overflow) return 0;
+    return 1;
+}
+
+uint32_t
+wr_parse_int64(int64_t *value, const char *s, size_t len)
+{
+    uint32_t overflow, negative = 0;
+    uint64_t magnitude;
+    size_t n;
+
+    if(value == NULL || s == NULL) return 0;
+    trim(&s, &len);
+    if(len > 0 && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        s++;
+        len--;
+    }
+    n = parse_digits(&magnitude, &overflow, s, len);
+    if(n == 0 || n != len || overflow) return 0;
+    if(negative) {
+        if(magnitude > (uint64_t)INT64_MAX + 1) return 0;
+        *value = (int64_t)(0 - magnitude);
+    } else {
+        if(magnitude > INT64_MAX) return 0;
+        *value = (int64_t) magnitude;
+    }
+    return 1;
+}
+
+/*
+ * Integer of either sign, returned in an uint64_t the same way strtol
+ * did for the callers that store signed values in unsigned variables.
+ */
+uint32_t
+wr_parse_integer(uint64_t *value, const char *s, size_t len)
+{
+    int64_t signed_value;
+
+    if(value == NULL || s == NULL) return 0;
+    trim(&s, &len);
+    if(len > 0 && *s == '-') {
+        if(!wr_parse_int64(&signed_value, s, len)) return 0;
+        *value = (uint64_t) signed_value;
+        return 1;
+    }
+    return wr_parse_uint64(value, s, len);
+}
+
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+static locale_t c_locale = (locale_t) 0;
+
+static void
+c_locale_init(void)
+{
+    c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+}
+
+static uint32_t
+parse_real_slow(double *value, const char *s, size_t len)
+{
+    char buffer[64], *str = buffer, *end;
+    uint32_t result = 1;
+
+    /* the threads parsing at once all get the same one */
+    pthread_once(&c_locale_once, c_locale_init);
+    if(c_locale == (locale_t) 0) return 0;
+    if(len >= sizeof(buffer)) {
+        str = malloc(len + 1);
+        if(str == NULL) return 0;
+    }
+    memcpy(str, s, len);
+    str[len] = '\0';
+    *value = strtod_l(str, &end, c_locale);
+    if(end != str + len) result = 0;
+    if(str != buffer) free(str);
+    return result;
+}
+
+/*
+ * Values that have at most 19 significant digits, a mantissa that fits
+ * in a double and a small exponent are converted exactly with a single
+ * multiplication or division. Anything else goes to strtod_l in the
+ * "C" locale.
+ */
+uint32_t
+wr_parse_real64(double *value, const char *s, size_t len)
+{
+    const char *p, *end;
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    uint32_t negative = 0, digits = 0, truncated = 0;
+
+    if(value == NULL || s == NULL) return 0;
+    trim(&s, &len);
+    p = s;
+    end = s + len;
+
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    for(; p < end && IS_DIGIT(*p); p++, digits++) {
+        if(mantissa < 1000000000000000000ULL) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            exponent++;
+            truncated = 1;
+        }
+    }
+    if(p < end && *p == '.') {
+        p++;
+        for(; p < end && IS_DIGIT(*p); p++, digits++) {
+            if(mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            } else {
+                truncated = 1;
+            }
+        }
+    }
+    if(digits == 0) {
+        /* INF, NAN and friends */
+        return parse_real_slow(value, s, len);
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        int64_t e;
+        const char *e_start = ++p;
+        if(p < end && (*p == '-' || *p == '+')) p++;
+        while(p < end && IS_DIGIT(*p)) p++;
+        if(p - e_start > 6 || !wr_parse_int64(&e, e_start, p - e_start)) {
+            return parse_real_slow(value, s, len);
+        }
+        exponent += e;
+    }
+    if(p != end) return 0;
+
+    if(truncated || mantissa > MAX_EXACT_MANTISSA || exponent < -22 || exponent > 22) {
+        return parse_real_slow(value, s, len);
+    }
+    *value = (double) mantissa;
+    if(exponent < 0) {
+        *value /= _pow10[-exponent];
+    } else {
+        *value *= _pow10[exponent];
+    }
+    if(negative) *value = -*value;
+    return 1;
+}
+
+/* Days since 1970-01-01 of a proleptic gregorian date. */
+static int64_t
+days_from_civil(int64_t y, int64_t m, int64_t d)
+{
+    int64_t era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static uint32_t
+civil_to_usec(int64_t *usec, int64_t y, int64_t mo, int64_t d,
+        int64_t h, int64_t mi, int64_t sec, int64_t frac)
+{
+    if(mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 60)
+        return 0;
+    *usec = ((days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec)
+        * USEC_PER_SEC) + frac;
+    return 1;
+}
+
+/* Reads up to 6 fraction digits as microseconds, ignores the rest. */
+static const char *
+parse_fraction(int64_t *frac, const char *p, const char *end)
+{
+    int64_t scale = 100000;
+
+    *frac = 0;
+    for(; p < end && IS_DIGIT(*p); p++) {
+        *frac += (*p - '0') * scale;
+        scale /= 10;
+    }
+    return p;
+}
+
+/* yyyymmddHHMMSS.mmmmmmsUUU or ddddddddHHMMSS.mmmmmm:000 */
+static uint32_t
+parse_cim_datetime(int64_t *usec, const char *s)
+{
+    int64_t y, mo, d, h, mi, sec, frac, offset;
+
+    if(s[14] != '.') return 0;
+    if(!parse_fixed(&h, s + 8, 2) || !parse_fixed(&mi, s + 10, 2) ||
+            !parse_fixed(&sec, s + 12, 2) || !parse_fixed(&frac, s + 15, 6))
+        return 0;
+
+    if(s[21] == ':') {
+        if(!parse_fixed(&d, s, 8) || h > 23 || mi > 59 || sec > 59) return 0;
+        *usec = (((d * 24 + h) * 60 + mi) * 60 + sec) * USEC_PER_SEC + frac;
+        return 1;
+    }
+    if(s[21] != '+' && s[21] != '-') return 0;
+    if(!parse_fixed(&y, s, 4) || !parse_fixed(&mo, s + 4, 2) ||
+            !parse_fixed(&d, s + 6, 2) || !parse_fixed(&offset, s + 22, 3))
+        return 0;
+    if(!civil_to_usec(usec, y, mo, d, h, mi, sec, frac)) return 0;
+    if(s[21] == '-') offset = -offset;
+    *usec -= offset * 60 * USEC_PER_SEC;
+    return 1;
+}
+
+/* yyyy-mm-dd[THH:MM:SS[.f]][Z|+hh:mm|+hhmm] */
+static uint32_t
+parse_iso_datetime(int64_t *usec, const char *s, size_t len)
+{
+    const char *p = s + 10, *end = s + len;
+    int64_t y, mo, d, h = 0, mi = 0, sec = 0, frac = 0, oh = 0, om = 0;
+
+    if(s[4] != '-' || s[7] != '-') return 0;
+    if(!parse_fixed(&y, s, 4) || !parse_fixed(&mo, s + 5, 2) ||
+            !parse_fixed(&d, s + 8, 2))
+        return 0;
+
+    if(p < end) {
+        if((*p != 'T' && *p != ' ') || end - p < 9 || p[3] != ':' || p[6] != ':')
+            return 0;
+        if(!parse_fixed(&h, p + 1, 2) || !parse_fixed(&mi, p + 4, 2) ||
+                !parse_fixed(&sec, p + 7, 2))
+            return 0;
+        p += 9;
+        if(p < end && *p == '.') p = parse_fraction(&frac, p + 1, end);
+    }
+    if(!civil_to_usec(usec, y, mo, d, h, mi, sec, frac)) return 0;
+
+    if(p == end) return 1;
+    if(*p == 'Z' && p + 1 == end) return 1;
+    if(*p != '+' && *p != '-') return 0;
+    if(end - p == 6 && p[3] == ':') {
+        if(!parse_fixed(&oh, p + 1, 2) || !parse_fixed(&om, p + 4, 2)) return 0;
+    } else if(end - p == 5) {
+        if(!parse_fixed(&oh, p + 1, 2) || !parse_fixed(&om, p + 3, 2)) return 0;
+    } else {
+        return 0;
+    }
+    if(*p == '-') {
+        oh = -oh;
+        om = -om;
+    }
+    *usec -= (oh * 3600 + om * 60) * USEC_PER_SEC;
+    return 1;
+}
+
+/* PnDTnHnMn[.f]S as used by WS-Man for CIM intervals */
+static uint32_t
+parse_iso_duration(int64_t *usec, const char *s, size_t len)
+{
+    const char *p = s + 1, *end = s + len;
+    uint32_t in_time = 0, overflow;
+    int64_t total = 0;
+
+    if(len < 3) return 0;
+    while(p < end) {
+        uint64_t n;
+        int64_t frac = 0;
+        size_t digits;
+
+        if(*p == 'T' && !in_time) {
+            in_time = 1;
+            p++;
+            continue;
+        }
+        digits = parse_digits(&n, &overflow, p, end - p);
+        if(digits == 0 || overflow || n > 10000000ULL) return 0;
+        p += digits;
+        if(p < end && *p == '.' && in_time) p = parse_fraction(&frac, p + 1, end);
+        if(p == end) return 0;
+        switch(*p) {
+        case 'D':
+            if(in_time) return 0;
+            total += n * USEC_PER_DAY;
+            break;
+        case 'H':
+            if(!in_time) return 0;
+            total += n * 3600 * USEC_PER_SEC;
+            break;
+        case 'M':
+            if(!in_time) return 0;
+            total += n * 60 * USEC_PER_SEC;
+            break;
+        case 'S':
+            if(!in_time) return 0;
+            total += n * USEC_PER_SEC + frac;
+            break;
+        default:
+            return 0;
+        }
+        p++;
+    }
+    *usec = total;
+    return 1;
+}
+
+uint32_t
+wr_parse_datetime(int64_t *usec, const char *s, size_t len)
+{
+    if(usec == NULL || s == NULL) return 0;
+    trim(&s, &len);
+
+    if(len == 25 && IS_DIGIT(s[4])) return parse_cim_datetime(usec, s);
+    if(len >= 10 && s[4] == '-') return parse_iso_datetime(usec, s, len);
+    if(len > 0 && s[0] == 'P') return parse_iso_duration(usec, s, len);
+    return 0;
+}
+
+size_t
+wr_format_datetime(char *out, size_t max_buffer_size, int64_t usec)
+{
+    struct tm tm;
+    time_t t;
+    int64_t frac;
+    int len;
+
+    if(out == NULL || max_buffer_size == 0) return 0;
+
+    t = (time_t)(usec / USEC_PER_SEC);
+    frac = usec % USEC_PER_SEC;
+    if(frac < 0) {
+        frac += USEC_PER_SEC;
+        t--;
+    }
+    if(gmtime_r(&t, &tm) == NULL) {
+        out[0] = '\0';
+        return 0;
+    }
+    len = snprintf(out, max_buffer_size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+        tm.tm_hour, tm.tm_min, tm.tm_sec, (long) frac);
+    if(len < 0) return 0;
+    return (size_t) len < max_buffer_size ? (size_t) len : max_buffer_size - 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __PARSE_H_
+#define __PARSE_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Locale independent parsers for the values found in WS-Man responses.
+ * All of them take a buffer and its length (the buffer does not need
+ * to be \0 terminated), ignore surrounding whitespace and return 1 on
+ * success or 0 if the text is not valid or the value does not fit.
+ */
+uint32_t wr_parse_uint64(uint64_t *value, const char *s, size_t len);
+uint32_t wr_parse_int64(int64_t *value, const char *s, size_t len);
+uint32_t wr_parse_integer(uint64_t *value, const char *s, size_t len);
+uint32_t wr_parse_real64(double *value, const char *s, size_t len);
+
+/*
+ * Parses CIM_DATETIME ("yyyymmddHHMMSS.mmmmmmsUUU"), ISO-8601 timestamps
+ * ("yyyy-mm-ddTHH:MM:SS[.f][Z|+hh:mm]"), CIM intervals
+ * ("ddddddddHHMMSS.mmmmmm:000") and ISO-8601 durations ("PnDTnHnMnS").
+ * Timestamps are returned as microseconds since the epoch (UTC),
+ * intervals as their length in microseconds.
+ */
+uint32_t wr_parse_datetime(int64_t *usec, const char *s, size_t len);
+size_t wr_format_datetime(char *out, size_t max_buffer_size, int64_t usec);
+
+#endif
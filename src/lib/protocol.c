@@ -11,16 +11,37 @@
 #include "transport.h"
 #include "protocol.h"
 #include "xml.h"
+#include "parse.h"
+#include "cache.h"
+#include "hostslot.h"
+#include "deadline.h"
+#include "library.h"
 
 #define WR_PULL_MAX 10
+/* Pulls sent again with the same context after a failure */
+#define WR_PULL_RETRIES 2
+/* A Release goes out even when the deadline of the check is spent */
+#define WR_RELEASE_TIMEOUT_MS 500
+#define SOAP_ENV_NS "http://www.w3.org/2003/05/soap-envelope"
+/* OperationTimeout without a deadline, and the most it gets with one */
+#define WR_OPERATION_TIMEOUT_MS 20000
+#define WR_OPERATION_TIMEOUT_MIN_MS 500
 
 typedef struct _wrprotocol_ctx {
     xmlDocPtr xml_wr_response_doc;
     void *wrtransport_ctx;
     xmlWRDoc_p wrd;
     uuid_t EnumerationContext;
+    char *enumeration_uri;      /* of the enumeration open on the server */
     xmlDocPtr xml_wr_error_doc;
     xmlDocPtr xml_wr_pulled_doc;
+    xmlDictPtr dict;
+    uint32_t broken;
+    uint32_t login_pending;     /* logged in by the first request */
+    uint32_t idle;              /* its connection may be gone */
+    char *host;                 /* user@url, the key of cached results */
+    char *url;
+    wr_deadline_t *deadline;
 } *wrprotocol_ctx_t;
 
 typedef struct _wr_wql_ctx {
@@ -33,22 +54,36 @@ typedef struct _wr_wql_ctx {
     uuid_t enumeration_context;
     xmlDocPtr xml_schema;
     xmlDocPtr xml_response;
+    wr_cache_t cache;           /* locked until the result is stored */
+    uint32_t cached;
+    uint32_t stale;
+    time_t stale_age;
 } *wr_wql_ctx_t;
 
 void *
 wrprotocol_ctx_new()
 {
-    wrprotocol_ctx_t ctx = calloc(1, sizeof(struct _wrprotocol_ctx));
-    if(ctx == NULL) return NULL;
+    wrprotocol_ctx_t ctx;
 
-    xmlInitParser();
+    /* does nothing after the first session */
+    wr_library_init();
+    ctx = calloc(1, sizeof(struct _wrprotocol_ctx));
+    if(ctx == NULL) return NULL;
     ctx->wrtransport_ctx = wr_transport_ctx_new();
     if(ctx->wrtransport_ctx == NULL) {
-        fprintf(stderr, "Unable to create transport context\n");
+        wr_error("Unable to create transport context\n");
+        goto error;
+    }
+    /* Every response repeats the same element names, share them across
+     * all the documents parsed in this session. */
+    ctx->dict = xmlDictCreate();
+    if(ctx->dict == NULL) {
+        wr_error("Unable to create xml dictionary\n");
         goto error;
     }
     return ctx;
     error:
+    wr_transport_free(ctx->wrtransport_ctx);
     free(ctx);
     return NULL;
 }
@@ -60,13 +95,16 @@ wrprotocol_ctx_init(void *c, const char *username, const char *password, const c
     if(ctx == NULL) return 0;
 
     if(!wr_transport_ctx_init(ctx->wrtransport_ctx, username, password, url, mech_val)) {
-        fprintf(stderr, "Error - Unable to initialize transport context\n");
+        wr_error("Error - Unable to initialize transport context\n");
         return 0;
     }
-    if(username != NULL && password != NULL && !wr_transport_login(ctx->wrtransport_ctx)) {
-        fprintf(stderr, "Error - Unable to login to server.\n");
+    if(asprintf(&ctx->host, "%s@%s", username ? username : "", url ? url : "") == -1 ||
+            (url && (ctx->url = strdup(url)) == NULL)) {
+        wr_error("Error - Unable to reserve memory for host name.\n");
         return 0;
     }
+    /* a check answered from the cache never talks to the server */
+    ctx->login_pending = username != NULL && password != NULL;
     return 1;
 }
 
@@ -85,8 +123,80 @@ wrprotocol_ctx_free(void *c)
     ctx->xml_wr_pulled_doc = NULL;
     if(ctx->xml_wr_error_doc) xmlFreeDoc(ctx->xml_wr_error_doc);
     ctx->xml_wr_error_doc = NULL;
+    if(ctx->dict) xmlDictFree(ctx->dict);
+    ctx->dict = NULL;
+    free(ctx->host);
+    free(ctx->url);
+    free(ctx->enumeration_uri);
     free(ctx);
-    xmlCleanupParser();
+    /* libxml2 stays initialized, other sessions in the same process
+     * may still be using it, see wr_library_cleanup */
+}
+
+void
+wrprotocol_ctx_set_deadline(void *c, wr_deadline_t *deadline)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+
+    if(ctx == NULL) return;
+    ctx->deadline = deadline;
+    wr_transport_set_deadline(ctx->wrtransport_ctx, deadline);
+}
+
+void
+wrprotocol_ctx_set_idle(void *c)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+
+    if(ctx == NULL) return;
+    ctx->idle = 1;
+}
+
+uint32_t
+wrprotocol_ctx_usable(void *c)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+    if(ctx == NULL) return 0;
+    return !ctx->broken;
+}
+
+xmlDictPtr
+wrprotocol_ctx_dict(void *c)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+
+    if(ctx == NULL) return NULL;
+    return ctx->dict;
+}
+
+/*
+ * Parses a response with the session dictionary so element names and
+ * short text nodes are stored once for the whole session.
+ */
+static xmlDocPtr
+wr_parse_response(wrprotocol_ctx_t ctx, const char *data, size_t length)
+{
+    xmlParserCtxtPtr parser_ctx;
+    xmlDocPtr doc;
+
+    if(data == NULL) return NULL;
+
+    parser_ctx = xmlNewParserCtxt();
+    if(parser_ctx == NULL) {
+        wr_error("Error - Unable to create parser context.\n");
+        return NULL;
+    }
+    if(ctx->dict != NULL) {
+        xmlDictFree(parser_ctx->dict);
+        parser_ctx->dict = ctx->dict;
+        xmlDictReference(parser_ctx->dict);
+        parser_ctx->str_xml = xmlDictLookup(parser_ctx->dict, BAD_CAST "xml", 3);
+        parser_ctx->str_xmlns = xmlDictLookup(parser_ctx->dict, BAD_CAST "xmlns", 5);
+        parser_ctx->str_xml_ns = xmlDictLookup(parser_ctx->dict, XML_XML_NAMESPACE, -1);
+    }
+    doc = xmlCtxtReadMemory(parser_ctx, data, length, NULL, UTF8, XML_PARSE_NONET);
+    xmlFreeParserCtxt(parser_ctx);
+    return doc;
 }
 
 size_t
@@ -116,17 +226,16 @@ check_message_id(xmlDocPtr xml_wr_response_doc, uuid_t messageid)
     uuid_t related_to;
     if(!xml_get_uuid(related_to, xml_wr_response_doc, "//add:RelatesTo",
             "add", "http://schemas.xmlsoap.org/ws/2004/08/addressing")) {
-        fprintf(stderr, "Error - Invalid message ID received.\n");
+        wr_error("Error - Invalid message ID received.\n");
         result = 0;
         goto end;
     }
     if(uuid_compare(related_to, messageid)) {
-        char buf[32];
-        fprintf(stderr, "Error - Message received has wrong messageid.\n");
-        uuid_unparse_upper(related_to, buf);
-        fprintf(stderr, "Received id: %s\n", buf);
-        uuid_unparse_upper(messageid, buf);
-        fprintf(stderr, "Sent id: %s\n", buf);
+        char received[37], sent[37];
+        uuid_unparse_upper(related_to, received);
+        uuid_unparse_upper(messageid, sent);
+        wr_error("Error - Message received has wrong messageid.\n"
+            "Received id: %s\nSent id: %s\n", received, sent);
         result = 0;
         goto end;
     }
@@ -134,8 +243,75 @@ check_message_id(xmlDocPtr xml_wr_response_doc, uuid_t messageid)
     return result;
 }
 
+/*
+ * The server gets three quarters of the time left to answer, the rest is
+ * for the response to arrive before curl gives up.
+ */
 static uint32_t
-wr_send(void *c, xmlDocPtr request_doc)
+operation_timeout(const wr_deadline_t *deadline)
+{
+    int64_t left = wr_deadline_left(deadline);
+
+    if(left < 0) return WR_OPERATION_TIMEOUT_MS;
+    left = left * 3 / 4;
+    if(left < WR_OPERATION_TIMEOUT_MIN_MS) return WR_OPERATION_TIMEOUT_MIN_MS;
+    if(left > WR_OPERATION_TIMEOUT_MS) return WR_OPERATION_TIMEOUT_MS;
+    return left;
+}
+
+static uint32_t
+login_pending(wrprotocol_ctx_t ctx)
+{
+    if(!ctx->login_pending) return 1;
+    if(!wr_deadline_enter(ctx->deadline, "login")) {
+        wr_error("Error - No time left to login.\n");
+        return 0;
+    }
+    if(!wr_transport_login(ctx->wrtransport_ctx)) {
+        wr_deadline_check(ctx->deadline);
+        wr_error("Error - Unable to login to server.\n");
+        ctx->broken = 1;
+        return 0;
+    }
+    ctx->login_pending = 0;
+    return 1;
+}
+
+/* Keeps the fault the server answered with, without one the connection is broken. */
+static uint32_t
+send_message(wrprotocol_ctx_t ctx, struct ntlm_buffer *response, struct ntlm_buffer *message)
+{
+    if(wr_send_message(ctx->wrtransport_ctx, response, message)) return 1;
+    /* curl gave up at the deadline */
+    wr_deadline_check(ctx->deadline);
+    if(response->data) wr_error("%s\n", response->data);
+    if(ctx->xml_wr_error_doc) xmlFreeDoc(ctx->xml_wr_error_doc);
+    ctx->xml_wr_error_doc = wr_parse_response(ctx, response->data, response->length);
+    /* a fault still means the server answered, anything else leaves
+     * the connection in an unknown state */
+    if(ctx->xml_wr_error_doc == NULL) ctx->broken = 1;
+    return 0;
+}
+
+/*
+ * WinRM closes a connection unused for two minutes, and the NTLM
+ * encryption of a session goes with its connection: the first request
+ * of a session back from the pool gets a 401 or no answer. It is sent
+ * again on a new connection, the server never ran it.
+ */
+static uint32_t
+resend_after_idle(wrprotocol_ctx_t ctx, uint32_t idle)
+{
+    if(!idle || !ctx->broken || wr_deadline_left(ctx->deadline) == 0) return 0;
+    if(!wr_transport_reset(ctx->wrtransport_ctx)) return 0;
+    ctx->broken = 0;
+    ctx->login_pending = 1;
+    return 1;
+}
+
+/* phase names the request for a deadline that runs out during it */
+static uint32_t
+wr_send(void *c, xmlDocPtr request_doc, const char *phase)
 {
     wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
     uint32_t result = 1;
@@ -144,31 +320,56 @@ wr_send(void *c, xmlDocPtr request_doc)
     xmlBufferPtr buf = NULL;
     xmlOutputBufferPtr outbuf;
     uuid_t messageid;
+    wr_host_slot_t slot = NULL;
+    uint32_t idle;
 
     if(ctx == NULL || request_doc == NULL) return 0;
+    idle = ctx->idle;
+    ctx->idle = 0;
+    /* the fault of the last request only */
+    if(ctx->xml_wr_error_doc) xmlFreeDoc(ctx->xml_wr_error_doc);
+    ctx->xml_wr_error_doc = NULL;
 
     if(!xml_get_uuid(messageid, request_doc, "//add:MessageID", "add", 
             "http://schemas.xmlsoap.org/ws/2004/08/addressing")) {
-        fprintf(stderr, "Error - Invalid message ID in request message.\n");
+        wr_error("Error - Invalid message ID in request message.\n");
+        result = 0;
+        goto end;
+    }
+
+    /* with WR_HOST_MAX_CONCURRENCY, waits for a free slot of the host */
+    wr_deadline_enter(ctx->deadline, "host slot wait");
+    slot = wr_host_slot_acquire(ctx->url, ctx->deadline);
+    if(!login_pending(ctx)) {
+        result = 0;
+        goto end;
+    }
+    if(!wr_deadline_enter(ctx->deadline, phase)) {
+        wr_error("Error - No time left for %s.\n", phase);
         result = 0;
         goto end;
     }
 
+    if(!xml_set_operation_timeout(request_doc, operation_timeout(ctx->deadline))) {
+        result = 0;
+        goto end;
+    }
+    /* serialized once the timeout is known */
     buf = xmlBufferCreate();
     if (buf == NULL) {
-        fprintf(stderr, "Error creating the xml buffer\n");
+        wr_error("Error creating the xml buffer\n");
         result = 0;
         goto end;
     }
 
     outbuf = xmlOutputBufferCreateBuffer(buf, xmlFindCharEncodingHandler(UTF8));
     if(outbuf == NULL) {
-        fprintf(stderr, "Error creating output buffer\n");
+        wr_error("Error creating output buffer\n");
         result = 0;
         goto end;
     }
     if(xmlSaveFileTo(outbuf, request_doc, UTF8) == -1) {
-        fprintf(stderr, "Error - Unable to generate request xml file.\n");
+        wr_error("Error - Unable to generate request xml file.\n");
         result = 0;
         goto end;
     }
@@ -178,28 +379,38 @@ wr_send(void *c, xmlDocPtr request_doc)
 
     if(ctx->xml_wr_response_doc) 
         xmlFreeDoc(ctx->xml_wr_response_doc);
+    ctx->xml_wr_response_doc = NULL;
 
-    if(!wr_send_message(ctx->wrtransport_ctx, &response, &message)) {
-        result = 0;
-        fprintf(stderr, "%s\n", response.data);
-        ctx->xml_wr_error_doc = xmlParseDoc(response.data);
-        goto end;
+    if(!send_message(ctx, &response, &message)) {
+        if(!resend_after_idle(ctx, idle)) {
+            result = 0;
+            goto end;
+        }
+        wr_error("Error - Connection closed while idle, sending again.\n");
+        FREE(response.data);
+        response.length = 0;
+        if(!login_pending(ctx) || !wr_deadline_enter(ctx->deadline, phase) ||
+                !send_message(ctx, &response, &message)) {
+            result = 0;
+            goto end;
+        }
     }
 
-    ctx->xml_wr_response_doc = xmlParseDoc(response.data);
+    ctx->xml_wr_response_doc = wr_parse_response(ctx, response.data, response.length);
     if(ctx->xml_wr_response_doc == NULL) {
-        fprintf(stderr, "Error. Response is not XML.\n");
+        wr_error("Error. Response is not XML.\n");
         result = 0;
         goto end;
     }
 
     if(!check_message_id(ctx->xml_wr_response_doc, messageid)) {
-        fprintf(stderr, "Error. Invalid message id recieved.");
+        wr_error("Error. Invalid message id recieved.");
         result = 0;
         goto end;
     }
 
     end:
+    wr_host_slot_release(&slot);
     if(buf) xmlBufferFree(buf);
     FREE(response.data);
     return result;
@@ -230,7 +441,7 @@ wr_get(void *c, const char *resourceuri, const keyval_t *selectorset)
         goto end;
     }
 
-    if(!wr_send(ctx, wrd->doc)) {
+    if(!wr_send(ctx, wrd->doc, "Get")) {
         result = 0;
         goto end;
     }
@@ -253,6 +464,8 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
     xmlNsPtr *nslist=NULL, n, w;
 
     if(ctx == NULL || resourceuri == NULL) return 0;
+    /* the previous enumeration was not pulled to its end */
+    wr_release(ctx);
 
     wrd = xml_new_wr_doc();
     if(wrd == NULL) {
@@ -266,26 +479,26 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
 
     nslist = xmlGetNsList(wrd->doc, wrd->envelope);
     if(nslist == NULL) {
-        fprintf(stderr, "Error. Unable to create list of namespaces.\n");
+        wr_error("Error. Unable to create list of namespaces.\n");
         result = 0;
         goto end;
     }
     n = xml_get_ns(nslist, "n");
     if(n == NULL) {
-        fprintf(stderr, "Error. Namespace 'n' not found.\n");
+        wr_error("Error. Namespace 'n' not found.\n");
         result = 0;
         goto end;
     }
     w = xml_get_ns(nslist, "w");
     if(w == NULL) {
-        fprintf(stderr, "Error. Namespace 'w' not found.\n");
+        wr_error("Error. Namespace 'w' not found.\n");
         result = 0;
         goto end;
     }
 
     enumerate_n = xmlNewChild(wrd->body, n, "Enumerate", NULL);
     if(enumerate_n == NULL) {
-        fprintf(stderr, "Error - Unable to create 'Enumerate' node.\n");
+        wr_error("Error - Unable to create 'Enumerate' node.\n");
         result = 0;
         goto end;
     }
@@ -293,13 +506,13 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
         xmlNodePtr wql_n;
         wql_n = xmlNewChild(enumerate_n, w, "Filter", BAD_CAST WQL);
         if(wql_n == NULL) {
-            fprintf(stderr, "Error - Unable to create 'Filter' node.\n");
+            wr_error("Error - Unable to create 'Filter' node.\n");
             result = 0;
             goto end;
         }
         if(xmlNewProp(wql_n, BAD_CAST "Dialect", 
                 BAD_CAST "http://schemas.microsoft.com/wbem/wsman/1/WQL") == NULL) {
-            fprintf(stderr, "Error - Unable to set 'Dialect' property to 'Filter' node.\n");
+            wr_error("Error - Unable to set 'Dialect' property to 'Filter' node.\n");
             result = 0;
             goto end;
         }
@@ -307,13 +520,13 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
         xmlNodePtr filter_n;
         filter_n = xmlNewChild(enumerate_n, w, "Filter", BAD_CAST filter);
         if(filter_n = NULL) {
-            fprintf(stderr, "Error - Unable to create 'Filter' node.\n");
+            wr_error("Error - Unable to create 'Filter' node.\n");
             result = 0;
             goto end;
         }
         if(xmlNewProp(filter_n, BAD_CAST "Dialect", 
                 BAD_CAST "http://schemas.dmtf.org/wbem/wsman/1/wsman/SelectorFilter") == NULL) {
-            fprintf(stderr, "Error - Unable to set 'Dialect' property to 'Filter' node.\n");
+            wr_error("Error - Unable to set 'Dialect' property to 'Filter' node.\n");
             result = 0;
             goto end;
         }
@@ -325,14 +538,21 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
         }
     }
 
-    if(!wr_send(ctx, wrd->doc)) {
+    if(!wr_send(ctx, wrd->doc, "Enumerate")) {
         result = 0;
         goto end;
     }
     if(!xml_get_uuid(ctx->EnumerationContext, ctx->xml_wr_response_doc, 
             "//en:EnumerationContext", "en", 
             "http://schemas.xmlsoap.org/ws/2004/09/enumeration")) {
-        fprintf(stderr, "Error - Invalid EnumerationContext received.\n");
+        wr_error("Error - Invalid EnumerationContext received.\n");
+        result = 0;
+        goto end;
+    }
+    ctx->enumeration_uri = strdup(resourceuri);
+    if(ctx->enumeration_uri == NULL) {
+        wr_error("Error - Unable to reserve memory for resourceuri string.\n");
+        wr_release(ctx);
         result = 0;
         goto end;
     }
@@ -343,10 +563,92 @@ wr_enumerate(void *c, const char *resourceuri, const char *filter,
     return result;
 }
 
+static void
+forget_enumeration(wrprotocol_ctx_t ctx)
+{
+    memset(ctx->EnumerationContext, 0, sizeof(uuid_t));
+    free(ctx->enumeration_uri);
+    ctx->enumeration_uri = NULL;
+}
+
+/*
+ * Ends the enumeration still open on the server, which would hold it
+ * until it expires. Does nothing once the enumeration was pulled to its
+ * end, or when the connection failed.
+ */
 uint32_t
-wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
+wr_release(void *c)
 {
     wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+    uint32_t result = 1;
+    xmlWRDoc_p wrd = NULL;
+    xmlNsPtr *nslist = NULL, n;
+    xmlNodePtr release_n;
+    wr_deadline_t release_deadline, *deadline;
+    char buf[48];
+    const char *action = "http://schemas.xmlsoap.org/ws/2004/09/enumeration/Release";
+
+    if(ctx == NULL || uuid_is_null(ctx->EnumerationContext)) return 1;
+    if(ctx->enumeration_uri == NULL || ctx->broken) goto end;
+
+    wrd = xml_new_wr_doc();
+    if(wrd == NULL) {
+        result = 0;
+        goto end;
+    }
+    if(!xml_new_basic_header(wrd, ctx->enumeration_uri, action)) {
+        result = 0;
+        goto end;
+    }
+    nslist = xmlGetNsList(wrd->doc, wrd->envelope);
+    if(nslist == NULL) {
+        wr_error("Error. Unable to create list of namespaces.\n");
+        result = 0;
+        goto end;
+    }
+    n = xml_get_ns(nslist, "n");
+    if(n == NULL) {
+        wr_error("Error. Namespace 'n' not found.\n");
+        result = 0;
+        goto end;
+    }
+    release_n = xmlNewChild(wrd->body, n, "Release", NULL);
+    if(release_n == NULL) {
+        wr_error("Error - Unable to create 'Release' node.\n");
+        result = 0;
+        goto end;
+    }
+    sprintf(buf, "uuid:");
+    uuid_unparse_upper(ctx->EnumerationContext, buf+5);
+    if(xmlNewChild(release_n, n, "EnumerationContext", buf) == NULL) {
+        wr_error("Error - Unable to create 'EnumerationContext' node.\n");
+        result = 0;
+        goto end;
+    }
+
+    /* a time of its own, the check may have run out of it */
+    deadline = ctx->deadline;
+    wr_deadline_start(&release_deadline, WR_RELEASE_TIMEOUT_MS);
+    wrprotocol_ctx_set_deadline(ctx, &release_deadline);
+    result = wr_send(ctx, wrd->doc, "Release");
+    wrprotocol_ctx_set_deadline(ctx, deadline);
+
+    end:
+    forget_enumeration(ctx);
+    if(nslist) free(nslist);
+    xml_free_wr_doc(wrd);
+    return result;
+}
+
+/*
+ * Sends one Pull request. Returns 0 on error, *more is set to 0 once the
+ * server answered with EndOfSequence. The last response can still carry
+ * items.
+ */
+static uint32_t
+wr_pull_request(wrprotocol_ctx_t ctx, const char *resourceuri, uint32_t maxelements,
+    uint32_t *more)
+{
     uint32_t result = 1;
     xmlWRDoc_p wrd;
     xmlNsPtr *nslist=NULL, n;
@@ -354,7 +656,7 @@ wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
     char buf[48];
     const char *action = "http://schemas.xmlsoap.org/ws/2004/09/enumeration/Pull";
 
-
+    *more = 0;
     if(ctx == NULL || resourceuri == NULL) return 0;
 
     wrd = xml_new_wr_doc();
@@ -369,20 +671,20 @@ wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
 
     nslist = xmlGetNsList(wrd->doc, wrd->envelope);
     if(nslist == NULL) {
-        fprintf(stderr, "Error. Unable to create list of namespaces.\n");
+        wr_error("Error. Unable to create list of namespaces.\n");
         result = 0;
         goto end;
     }
     n = xml_get_ns(nslist, "n");
     if(n == NULL) {
-        fprintf(stderr, "Error. Namespace 'n' not found.\n");
+        wr_error("Error. Namespace 'n' not found.\n");
         result = 0;
         goto end;
     }
 
     pull_n = xmlNewChild(wrd->body, n, "Pull", NULL);
     if(pull_n == NULL) {
-        fprintf(stderr, "Error - Unable to create 'Pull' node.\n");
+        wr_error("Error - Unable to create 'Pull' node.\n");
         result = 0;
         goto end;
     }
@@ -390,37 +692,37 @@ wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
     sprintf(buf, "uuid:");
     uuid_unparse_upper(ctx->EnumerationContext, buf+5);
     if(xmlNewChild(pull_n, n, "EnumerationContext", buf) == NULL) {
-        fprintf(stderr, "Error - Unable to create 'EnumerationContext' node.\n");
+        wr_error("Error - Unable to create 'EnumerationContext' node.\n");
         result = 0;
         goto end;
     }
 
     sprintf(buf, "%d", maxelements);
     if(xmlNewChild(pull_n, n, "MaxElements", buf) == NULL) {
-        fprintf(stderr, "Error - Unable to create 'MaxElements' node.\n");
+        wr_error("Error - Unable to create 'MaxElements' node.\n");
         result = 0;
         goto end;
     }
 
-    if(!wr_send(ctx, wrd->doc)) {
+    if(!wr_send(ctx, wrd->doc, "Pull")) {
         result = 0;
         goto end;
     }
 
     if(xml_find_first(NULL, ctx->xml_wr_response_doc, "//e:EndOfSequence", 
             "e", "http://schemas.xmlsoap.org/ws/2004/09/enumeration")) {
-        memset(ctx->EnumerationContext, 0, sizeof(uuid_t));
-        result = 0;
+        forget_enumeration(ctx);
         goto end;
     }
 
     if(!xml_get_uuid(ctx->EnumerationContext, ctx->xml_wr_response_doc, 
             "//e:EnumerationContext", "e", 
             "http://schemas.xmlsoap.org/ws/2004/09/enumeration")) {
-        fprintf(stderr, "Error - Invalid EnumerationContext received.\n");
+        wr_error("Error - Invalid EnumerationContext received.\n");
         result = 0;
         goto end;
     }
+    *more = 1;
 
     end:
     if(nslist) free(nslist);
@@ -428,6 +730,94 @@ wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
     return result;
 }
 
+/*
+ * A Pull that timed out on the server, or lost its connection, can be
+ * sent again with the same EnumerationContext: the server still holds
+ * the enumeration. A lost connection needs a new login first.
+ */
+static uint32_t
+pull_retryable(wrprotocol_ctx_t ctx)
+{
+    if(uuid_is_null(ctx->EnumerationContext) || wr_deadline_left(ctx->deadline) == 0)
+        return 0;
+    if(ctx->xml_wr_error_doc != NULL)
+        return xml_find_first(NULL, ctx->xml_wr_error_doc,
+            "//s:Subcode/s:Value[contains(., 'TimedOut')]", "s", SOAP_ENV_NS);
+    if(!ctx->broken || !wr_transport_reset(ctx->wrtransport_ctx)) return 0;
+    ctx->broken = 0;
+    ctx->login_pending = 1;
+    return 1;
+}
+
+/* Every attempt is a new message, with a MessageID of its own. */
+static uint32_t
+wr_pull_retry(wrprotocol_ctx_t ctx, const char *resourceuri, uint32_t maxelements,
+    uint32_t *more)
+{
+    for(uint32_t attempt = 0; ; attempt++) {
+        if(wr_pull_request(ctx, resourceuri, maxelements, more)) return 1;
+        if(attempt == WR_PULL_RETRIES || !pull_retryable(ctx)) break;
+        wr_error("Error - Pull failed, sending it again.\n");
+    }
+    /* the enumeration is given up */
+    wr_release(ctx);
+    return 0;
+}
+
+uint32_t
+wr_pull(void *c, const char *resourceuri, uint32_t maxelements)
+{
+    uint32_t more = 0;
+
+    if(c == NULL || resourceuri == NULL) return 0;
+    return wr_pull_retry((wrprotocol_ctx_t) c, resourceuri, maxelements, &more) && more;
+}
+
+/*
+ * Pulls until the end of the enumeration and calls callback with the
+ * Items node of every response. The response is released on the next
+ * Pull, so only one batch is in memory at a time. Stops with an error
+ * if callback returns 0, or once the deadline of the session is spent.
+ */
+uint32_t
+wr_pull_each(void *c, const char *resourceuri, wr_items_cb callback, void *data)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+    xmlNodePtr items;
+    uint32_t more = 1;
+
+    if(ctx == NULL || resourceuri == NULL || callback == NULL) return 0;
+
+    while(more) {
+        if(!wr_pull_retry(ctx, resourceuri, WR_PULL_MAX, &more)) return 0;
+        if(!xml_find_first(&items, ctx->xml_wr_response_doc, "//n:PullResponse/n:Items",
+                "n", "http://schemas.xmlsoap.org/ws/2004/09/enumeration") || items == NULL)
+            continue;
+        if(!callback(items, data)) {
+            /* the caller stopped early */
+            wr_release(ctx);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t
+wr_pull_copy_items(xmlNodePtr items, void *data)
+{
+    xmlNodePtr response_items = (xmlNodePtr) data;
+
+    for(xmlNodePtr item = items->children; item; item = item->next) {
+        xmlNodePtr item_copy = xmlDocCopyNode(item, response_items->doc, 1);
+        if(item_copy == NULL) {
+            wr_error("Error - Unable to create a copy of the node.\n");
+            return 0;
+        }
+        xmlAddChild(response_items, item_copy);
+    }
+    return 1;
+}
+
 uint32_t
 wr_pull_all(void *c, const char *resourceuri)
 {
@@ -435,7 +825,6 @@ wr_pull_all(void *c, const char *resourceuri)
     wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
     xmlWRDoc_p wrd;
     xmlNodePtr pullreponse, response_items;
-    uint32_t pull_continue = 0;
     xmlNsPtr *nslist, n;
     
 
@@ -443,48 +832,42 @@ wr_pull_all(void *c, const char *resourceuri)
 
     wrd = xml_new_wr_doc();
     if (wrd == NULL) {
-        fprintf(stderr, "Error - Unable to create an XML doc for the result\n");
+        wr_error("Error - Unable to create an XML doc for the result\n");
         result = 0;
         goto end;
     }
+    if(ctx->dict != NULL) {
+        /* copied items keep using the session dictionary */
+        wrd->doc->dict = ctx->dict;
+        xmlDictReference(ctx->dict);
+    }
     nslist = xmlGetNsList(wrd->doc, wrd->envelope);
     n = xml_get_ns(nslist, "n");
     free(nslist);
     pullreponse = xmlNewChild(wrd->body, n, BAD_CAST "PullReponse", NULL);
     if(pullreponse == NULL) {
-        fprintf(stderr, "Error - Unable to create PullReponse node.\n");
+        wr_error("Error - Unable to create PullReponse node.\n");
         result = 0;
         goto end;
     }
     response_items = xmlNewChild(pullreponse, n, BAD_CAST "Items", NULL);
-    if(pullreponse == NULL) {
-        fprintf(stderr, "Error - Unable to create Items node.\n");
+    if(response_items == NULL) {
+        wr_error("Error - Unable to create Items node.\n");
         result = 0;
         goto end;
     }
 
-    do {
-        xmlNodePtr items, item;
-
-        pull_continue = wr_pull(c, resourceuri, WR_PULL_MAX);
-        xml_find_first(&items, ctx->xml_wr_response_doc, "//n:PullResponse/n:Items",
-            "n", "http://schemas.xmlsoap.org/ws/2004/09/enumeration");
-        for(item = items->children; item; item = item->next) {
-            xmlNodePtr item_copy = xmlCopyNode(item, 1);
-            if(item_copy == NULL) {
-                fprintf(stderr, "Error - Unable to create a copy of the node.\n");
-                result = 0;
-                goto end;
-            }
-            xmlAddChild(response_items, item_copy);
-        }
-    } while(pull_continue);
+    if(!wr_pull_each(c, resourceuri, wr_pull_copy_items, response_items)) {
+        result = 0;
+        goto end;
+    }
 
     if(ctx->xml_wr_pulled_doc) {
         xmlFreeDoc(ctx->xml_wr_pulled_doc);
         ctx->xml_wr_pulled_doc = NULL;
     }
-    ctx->xml_wr_pulled_doc = xmlCopyDoc(wrd->doc, 1);
+    ctx->xml_wr_pulled_doc = wrd->doc;
+    wrd->doc = NULL;
 
     end:
     xml_free_wr_doc(wrd);
@@ -506,12 +889,12 @@ extract_class_name(char *classname, size_t max_buffer_size, const char *wql)
     }
 
     if (regcomp(&regex, re, REG_NEWLINE | REG_ICASE)){
-        fprintf(stderr, "Error - Unable to create regex context for Class Name.\n");
+        wr_error("Error - Unable to create regex context for Class Name.\n");
         regfree(&regex);
         return -1;
     }
     if (regexec(&regex, wql, ARRAY_SIZE(pmatch), pmatch, 0)) {
-        fprintf(stderr, "Error - Unable to find Class Name.\n");
+        wr_error("Error - Unable to find Class Name.\n");
         regfree(&regex);
         return -1;
     }
@@ -519,7 +902,7 @@ extract_class_name(char *classname, size_t max_buffer_size, const char *wql)
     s += pmatch[0].rm_eo;
     sscanf(s, "%ms", &cn);
     if(cn == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for buffer.\n");
+        wr_error("Error - Unable to reserve memory for buffer.\n");
         return -1;
     }
     strncpy(classname, cn, max_buffer_size - 1);
@@ -572,6 +955,17 @@ wr_wql_tostring(void *c, char *out_xml, size_t max_buffer_size)
     return out_xml_len;
 }
 
+xmlNodePtr
+wr_response_body(void *c)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+    xmlNodePtr node = NULL;
+
+    if(ctx == NULL) return NULL;
+    xml_find_first(&node, ctx->xml_wr_response_doc, "//s:Body/*", "s", SOAP_ENV_NS);
+    return node;
+}
+
 xmlDocPtr
 wr_result_toxml(void *c)
 {
@@ -609,7 +1003,8 @@ wr_get_cim_schema_xml(void *c, const char *namespace, const char *classname)
     if(!wr_get(ctx, resourceuri, selectorset)) {
         goto end;
     } else {
-        outdoc = xmlCopyDoc(ctx->xml_wr_response_doc, 1);
+        outdoc = ctx->xml_wr_response_doc;
+        ctx->xml_wr_response_doc = NULL;
     }
     end:
     return outdoc;
@@ -675,6 +1070,36 @@ wr_get_wmi_class(void *c, char *out_xml, size_t max_buffer_size, const char *nam
     return out_xml_len;
 }
 
+uint32_t
+wr_get_wmi_class_stream(void *c, const char *namespace, const char *classname,
+    wr_items_cb callback, void *data)
+{
+    wrprotocol_ctx_t ctx = (wrprotocol_ctx_t) c;
+    char *resourceuri = NULL;
+    uint32_t result = 1;
+
+    if(ctx == NULL || classname == NULL || namespace == NULL) return 0;
+
+    asprintf(&resourceuri,  "http://schemas.microsoft.com/wbem/wsman/1/wmi/%s/%s", namespace, classname);
+    if(resourceuri == NULL) {
+        result = 0;
+        goto end;
+    }
+
+    if(!wr_enumerate(ctx, resourceuri, NULL, NULL, NULL)) {
+        result = 0;
+        goto end;
+    }
+    if(!wr_pull_each(ctx, resourceuri, callback, data)) {
+        result = 0;
+        goto end;
+    }
+
+    end:
+    if(resourceuri) free(resourceuri);
+    return result;
+}
+
 void
 wr_wql_free(void *w)
 {
@@ -702,6 +1127,7 @@ wr_wql_free(void *w)
         free((*wql_ctx)->classuri);
         (*wql_ctx)->classuri = NULL;
     }
+    wr_cache_close(&(*wql_ctx)->cache);
     xmlFreeDoc((*wql_ctx)->xml_schema);
     xmlFreeDoc((*wql_ctx)->xml_response);
     free(*wql_ctx);
@@ -710,71 +1136,225 @@ wr_wql_free(void *w)
 
 #define MAX_CLASS_NAME_LENGTH 128
 
+/*
+ * Reads the schema and the response of a cached result, a stale one
+ * when age is given.
+ */
+static uint32_t
+wql_cache_load(wrprotocol_ctx_t ctx, wr_cache_t cache, xmlDocPtr *schema, xmlDocPtr *response,
+        time_t *age)
+{
+    char *parts[2] = { NULL, NULL };
+    size_t lengths[2];
+
+    if(age == NULL && !wr_cache_load(cache, parts, lengths, 2)) return 0;
+    if(age != NULL && !wr_cache_load_stale(cache, parts, lengths, 2, age)) return 0;
+    *schema = wr_parse_response(ctx, parts[0], lengths[0]);
+    *response = wr_parse_response(ctx, parts[1], lengths[1]);
+    free(parts[0]);
+    free(parts[1]);
+    if(*schema != NULL && *response != NULL) return 1;
+    xmlFreeDoc(*schema);
+    xmlFreeDoc(*response);
+    *schema = *response = NULL;
+    return 0;
+}
+
+static uint32_t
+wql_cache_store(wr_cache_t cache, xmlDocPtr schema, xmlDocPtr response)
+{
+    char *parts[2] = { NULL, NULL };
+    size_t lengths[2];
+    uint32_t result = 0;
+    int size;
+
+    xmlDocDumpMemory(schema, (xmlChar **) &parts[0], &size);
+    lengths[0] = size;
+    xmlDocDumpMemory(response, (xmlChar **) &parts[1], &size);
+    lengths[1] = size;
+    if(parts[0] != NULL && parts[1] != NULL)
+        result = wr_cache_store(cache, parts, lengths, 2);
+    xmlFree(parts[0]);
+    xmlFree(parts[1]);
+    return result;
+}
+
+struct wql_refresh {
+    wrprotocol_ctx_t ctx;
+    const char *namespace;
+    const char *query;
+};
+
+/* Fetches and stores a result in the background process of wr_cache_revalidate. */
+static uint32_t
+wql_refresh(wr_cache_t cache, void *data)
+{
+    struct wql_refresh *refresh = (struct wql_refresh *) data;
+    wrprotocol_ctx_t ctx = refresh->ctx;
+    char classname[MAX_CLASS_NAME_LENGTH];
+    char *resourceuri = NULL;
+    xmlDocPtr schema = NULL;
+    uint32_t result = 0;
+
+    /* the session of the check stays with it, and so does its deadline */
+    if(!wr_transport_detach(ctx->wrtransport_ctx)) return 0;
+    ctx->login_pending = 1;
+    wrprotocol_ctx_set_deadline(ctx, NULL);
+
+    extract_class_name(classname, MAX_CLASS_NAME_LENGTH, refresh->query);
+    schema = wr_get_cim_schema_xml(ctx, refresh->namespace, classname);
+    if(schema == NULL) goto end;
+    if(asprintf(&resourceuri, "http://schemas.microsoft.com/wbem/wsman/1/wmi/%s/*",
+            refresh->namespace) == -1) {
+        resourceuri = NULL;
+        goto end;
+    }
+    if(!wr_enumerate(ctx, resourceuri, NULL, refresh->query, NULL) ||
+            !wr_pull_all(ctx, resourceuri) || ctx->xml_wr_pulled_doc == NULL)
+        goto end;
+    result = wql_cache_store(cache, schema, ctx->xml_wr_pulled_doc);
+
+    end:
+    free(resourceuri);
+    xmlFreeDoc(schema);
+    return result;
+}
+
+/*
+ * Looks the query up in the cache. A stale result starts a refresh in
+ * the background and is used when the refresh does not end within the
+ * soft deadline, stale is then set to its age. Returns 0 when the
+ * caller has to fetch the result, the entry is locked until it is
+ * stored.
+ */
+static uint32_t
+wql_cache_lookup(wrprotocol_ctx_t ctx, wr_cache_t cache, const char *namespace,
+        const char *query, xmlDocPtr *schema, xmlDocPtr *response, time_t *stale)
+{
+    struct wql_refresh refresh = { ctx, namespace, query };
+    xmlDocPtr stale_schema = NULL, stale_response = NULL;
+
+    *stale = -1;
+    if(wql_cache_load(ctx, cache, schema, response, NULL)) return 1;
+    if(!wql_cache_load(ctx, cache, &stale_schema, &stale_response, stale)) {
+        /* nothing to use meanwhile, waits for the process fetching it */
+        *stale = -1;
+        return wr_cache_lock(cache) && wql_cache_load(ctx, cache, schema, response, NULL);
+    }
+
+    if(wr_cache_locked(cache)) {
+        if(wr_cache_revalidate(cache, wql_refresh, &refresh) &&
+                wql_cache_load(ctx, cache, schema, response, NULL)) {
+            *stale = -1;
+            goto fresh;
+        }
+        if(wr_cache_locked(cache)) {
+            /* no background process, fetched by the caller */
+            *stale = -1;
+            goto fresh;
+        }
+    }
+    *schema = stale_schema;
+    *response = stale_response;
+    return 1;
+
+    fresh:
+    xmlFreeDoc(stale_schema);
+    xmlFreeDoc(stale_response);
+    return *response != NULL;
+}
+
 void *
 wr_wql_new(void *p, const char *namespace, const char *query)
 {
     wr_wql_ctx_t wql_ctx;
     char buffer[MAX_CLASS_NAME_LENGTH];
-    xmlDocPtr xml_schema;
+    xmlDocPtr xml_schema = NULL, xml_response = NULL;
     xmlNodePtr node;
     char *classname;
+    wr_cache_t cache;
+    time_t stale = -1;
 
     if(p == NULL || namespace == NULL || query == NULL) return NULL;
 
-    classname = buffer;
-    extract_class_name(classname, MAX_CLASS_NAME_LENGTH, query);
-    xml_schema = wr_get_cim_schema_xml(p, namespace, classname);
-    if(xml_schema == NULL) {
-        fprintf(stderr, "Error - Unable to locate schema for class %s.\n", classname);
-        return NULL;
+    /*
+     * With WR_CACHE_TTL a recent result of the same query is used as is.
+     * Otherwise the entry stays locked until wr_wql_run stores the new
+     * result, other processes asking the same wait for it.
+     */
+    cache = wr_cache_open(((wrprotocol_ctx_t) p)->host, namespace, query,
+        ((wrprotocol_ctx_t) p)->deadline);
+    if(cache != NULL && wql_cache_lookup((wrprotocol_ctx_t) p, cache, namespace, query,
+            &xml_schema, &xml_response, &stale)) {
+        wr_cache_close(&cache);
+    } else {
+        classname = buffer;
+        extract_class_name(classname, MAX_CLASS_NAME_LENGTH, query);
+        xml_schema = wr_get_cim_schema_xml(p, namespace, classname);
+        if(xml_schema == NULL) {
+            wr_cache_close(&cache);
+            wr_error("Error - Unable to locate schema for class %s.\n", classname);
+            return NULL;
+        }
     }
 
     xml_find_first(&node, xml_schema, "//CLASS", NULL, NULL);
     if(node == NULL) {
+        wr_cache_close(&cache);
         xmlFreeDoc(xml_schema);
-        fprintf(stderr, "Error - Invalid schema.\n");
+        xmlFreeDoc(xml_response);
+        wr_error("Error - Invalid schema.\n");
         return NULL;
     }
 
     classname = xmlGetProp(node, "NAME");
     if(classname == NULL) {
+        wr_cache_close(&cache);
         xmlFreeDoc(xml_schema);
-        fprintf(stderr, "Error - Invalid schema.\n");
+        xmlFreeDoc(xml_response);
+        wr_error("Error - Invalid schema.\n");
         return NULL;
     }
 
     wql_ctx = calloc(1, sizeof(struct _wr_wql_ctx));
     if(wql_ctx == NULL) {
         free(classname);
+        wr_cache_close(&cache);
         xmlFreeDoc(xml_schema);
-        fprintf(stderr, "Error - Unable to reserve memory for WQL context.\n");
+        xmlFreeDoc(xml_response);
+        wr_error("Error - Unable to reserve memory for WQL context.\n");
         goto error;
     }
 
     wql_ctx->xml_schema = xml_schema;
+    wql_ctx->xml_response = xml_response;
+    wql_ctx->cached = xml_response != NULL;
+    wql_ctx->stale = stale != -1;
+    wql_ctx->stale_age = stale;
+    wql_ctx->cache = cache;
     wql_ctx->protocol_ctx = (wrprotocol_ctx_t) p;
     wql_ctx->query = strdup(query);
     if(wql_ctx->query == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for query string.\n");
+        wr_error("Error - Unable to reserve memory for query string.\n");
         goto error;
     }
 
     wql_ctx->namespace = strdup(namespace);
     if(wql_ctx->namespace == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for namespace string.\n");
+        wr_error("Error - Unable to reserve memory for namespace string.\n");
         goto error;
     }
 
     wql_ctx->classname = classname;
     if(wql_ctx->classname == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for class name string.\n");
+        wr_error("Error - Unable to reserve memory for class name string.\n");
         goto error;
 
     }
     asprintf(&wql_ctx->resourceuri, 
         "http://schemas.microsoft.com/wbem/wsman/1/wmi/%s/*", wql_ctx->namespace);
     if(wql_ctx->resourceuri == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for resourceuri string.\n");
+        wr_error("Error - Unable to reserve memory for resourceuri string.\n");
         goto error;
     }
 
@@ -782,7 +1362,7 @@ wr_wql_new(void *p, const char *namespace, const char *query)
         "http://schemas.microsoft.com/wbem/wsman/1/wmi/%s/%s", wql_ctx->namespace, 
         wql_ctx->classname);
     if(wql_ctx->classuri == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for classuri string.\n");
+        wr_error("Error - Unable to reserve memory for classuri string.\n");
         goto error;
     }
 
@@ -800,15 +1380,17 @@ wr_wql_run(void *w)
 
     wr_wql_ctx_t wql_ctx = (wr_wql_ctx_t) w;
 
+    if(wql_ctx->cached) return 1;
+
     if(!wr_enumerate(wql_ctx->protocol_ctx, 
             wql_ctx->resourceuri, NULL, wql_ctx->query, NULL)) {
-        fprintf(stderr, "Error - Unable to enumerate result.\n");
+        wr_error("Error - Unable to enumerate result.\n");
         result = 0;
         goto end;
     }
 
     if(!wr_pull_all(wql_ctx->protocol_ctx, wql_ctx->resourceuri)) {
-        fprintf(stderr, "Error - Unable to pull result.\n");
+        wr_error("Error - Unable to pull result.\n");
         result = 0;
         goto end;
     }
@@ -816,17 +1398,46 @@ wr_wql_run(void *w)
     if(wql_ctx->xml_response != NULL) {
         xmlFreeDoc(wql_ctx->xml_response);
     }
-    wql_ctx->xml_response = wr_result_toxml(wql_ctx->protocol_ctx);
+    wql_ctx->xml_response = wql_ctx->protocol_ctx->xml_wr_pulled_doc;
+    wql_ctx->protocol_ctx->xml_wr_pulled_doc = NULL;
     if(wql_ctx->xml_response == NULL) {
-        fprintf(stderr, "Error - Unable to make a copy of the result XML.\n");
+        wr_error("Error - Response has no result XML.\n");
         result = 0;
         goto end;
     }
+    if(wql_ctx->cache != NULL) {
+        wql_cache_store(wql_ctx->cache, wql_ctx->xml_schema, wql_ctx->xml_response);
+        wr_cache_close(&wql_ctx->cache);
+    }
 
     end:
     return result;
 }
 
+/*
+ * Same as wr_wql_run but hands every Pull batch to callback instead of
+ * building the whole response document.
+ */
+uint32_t
+wr_wql_stream(void *w, wr_items_cb callback, void *data)
+{
+    wr_wql_ctx_t wql_ctx = (wr_wql_ctx_t) w;
+
+    if(wql_ctx == NULL || callback == NULL) return 0;
+
+    if(!wr_enumerate(wql_ctx->protocol_ctx, 
+            wql_ctx->resourceuri, NULL, wql_ctx->query, NULL)) {
+        wr_error("Error - Unable to enumerate result.\n");
+        return 0;
+    }
+
+    if(!wr_pull_each(wql_ctx->protocol_ctx, wql_ctx->resourceuri, callback, data)) {
+        wr_error("Error - Unable to pull result.\n");
+        return 0;
+    }
+    return 1;
+}
+
 xmlDocPtr
 wr_wql_response_toxml(void *w)
 {
@@ -836,6 +1447,16 @@ wr_wql_response_toxml(void *w)
     return wql_ctx->xml_response;
 }
 
+uint32_t
+wr_wql_stale(void *w, long *age)
+{
+    wr_wql_ctx_t wql_ctx = (wr_wql_ctx_t) w;
+
+    if(wql_ctx == NULL || !wql_ctx->stale) return 0;
+    if(age != NULL) *age = wql_ctx->stale_age;
+    return 1;
+}
+
 xmlDocPtr
 wr_wql_schema_toxml(void *w)
 {
@@ -860,39 +1481,39 @@ wr_wql_get_integer(void *w, const char *property)
 
     asprintf(&xPathExpr, "//CLASS/PROPERTY[@NAME='%s']", property);
     if(xPathExpr == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for xpath expression.\n");
+        wr_error("Error - Unable to reserve memory for xpath expression.\n");
         return -1;
     }
     xml_find_first(&node, wql_ctx->xml_schema, xPathExpr, NULL, NULL);
     free(xPathExpr);
     if(node == NULL) {
-        fprintf(stderr, "Error - Property \"%s\" not found in class \"%s\".\n", 
+        wr_error("Error - Property \"%s\" not found in class \"%s\".\n", 
             property, wql_ctx->classname);
         return -1;
     }
 
     type = xmlGetProp(node, "TYPE");
     if(type == NULL) {
-        fprintf(stderr, "Error - Invalid schema.\n");
+        wr_error("Error - Invalid schema.\n");
         return -1;
     }
 
     if(strncmp(type, "uint", 4) != 0 && strncmp(type, "sint", 4) != 0) {
         free(type);
-        fprintf(stderr, "Error - Property cannot be converted to integer.\n");
+        wr_error("Error - Property cannot be converted to integer.\n");
         return -1;
     }
     free(type);
 
     asprintf(&xPathExpr, "//p:%s/p:%s", wql_ctx->classname, property);
     if(xPathExpr == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for xpath expression.\n");
+        wr_error("Error - Unable to reserve memory for xpath expression.\n");
         return -1;
     }
     xml_find_first(&node, wql_ctx->xml_response, xPathExpr, "p", wql_ctx->classuri);
     free(xPathExpr);
     if(node == NULL) {
-        fprintf(stderr, "Error - No elements found.\n");
+        wr_error("Error - No elements found.\n");
         return -1;
     }
 
@@ -902,8 +1523,12 @@ wr_wql_get_integer(void *w, const char *property)
         return -1;
     } else {
         str_value = xmlNodeGetContent(node);
+        if(str_value == NULL) return -1;
+    }
+    if(!wr_parse_integer(&l_value, str_value, strlen(str_value))) {
+        wr_error("Error - Invalid integer value for %s.\n", property);
+        l_value = -1;
     }
-    l_value = strtol(str_value, NULL, 10);
     free(str_value);
     return l_value;
 }
@@ -0,0 +1,692 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <libxml/tree.h>
+#include "protocol.h"
+#include "parse.h"
+#include "refresher.h"
+#include "library.h"
+
+#define REFRESHER_FILE_VERSION 1
+#define WMI_NS_URL "http://schemas.microsoft.com/wbem/wsman/1/wmi/"
+
+/* Timestamps every Win32_PerfRawData instance carries */
+enum {
+    TS_SYS100NS,
+    TS_PERFTIME,
+    FREQ_PERFTIME,
+    TS_OBJECT,
+    FREQ_OBJECT,
+    TS_COUNT
+};
+
+static const char *timestamp_name[TS_COUNT] = {
+    "Timestamp_Sys100NS",
+    "Timestamp_PerfTime",
+    "Frequency_PerfTime",
+    "Timestamp_Object",
+    "Frequency_Object"
+};
+
+typedef struct _wr_sample {
+    char *instance;
+    uint64_t timestamp[TS_COUNT];
+    uint64_t *value;            /* value and base of every counter */
+} wr_sample_t;
+
+typedef struct _wr_sample_set {
+    wr_sample_t *sample;
+    uint32_t count;
+} wr_sample_set_t;
+
+struct _wr_refresher {
+    char *namespace;
+    char *classname;
+    wr_counter_t *counter;
+    char **base_name;           /* <name>_Base, NULL for counters without base */
+    uint32_t count;
+    wr_sample_set_t previous;
+    wr_sample_set_t current;
+};
+
+/* Last samples kept in memory by long running processes */
+typedef struct _wr_saved {
+    char *key;
+    wr_sample_set_t set;
+    time_t time;                /* the sample was taken */
+    struct _wr_saved *next;
+} *wr_saved_t;
+
+static wr_saved_t saved = NULL;
+/* the checks of every thread keep their samples there */
+static pthread_mutex_t saved_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Seconds a previous sample is used for, WR_STATE_MAX_AGE overrides it */
+static time_t
+state_max_age(void)
+{
+    const char *value = getenv("WR_STATE_MAX_AGE");
+    char *end;
+    long seconds;
+
+    if(value == NULL || *value == '\0') return WR_STATE_MAX_AGE_DEFAULT;
+    seconds = strtol(value, &end, 10);
+    if(*end != '\0' || seconds <= 0) return WR_STATE_MAX_AGE_DEFAULT;
+    return seconds;
+}
+
+static uint32_t
+needs_base(uint32_t type)
+{
+    return type == WR_PERF_RAW_FRACTION || type == WR_PERF_AVERAGE_TIMER ||
+        type == WR_PERF_AVERAGE_BULK || type == WR_PERF_PRECISION_100NS_TIMER;
+}
+
+static void
+sample_set_clear(wr_sample_set_t *set)
+{
+    for(uint32_t i = 0; i < set->count; i++) {
+        free(set->sample[i].instance);
+        free(set->sample[i].value);
+    }
+    free(set->sample);
+    set->sample = NULL;
+    set->count = 0;
+}
+
+static wr_sample_t *
+sample_set_add(wr_sample_set_t *set, const char *instance, uint32_t values)
+{
+    wr_sample_t *sample = realloc(set->sample, (set->count + 1) * sizeof(wr_sample_t));
+
+    if(sample == NULL) goto error;
+    set->sample = sample;
+    sample = &set->sample[set->count];
+    memset(sample, 0, sizeof(wr_sample_t));
+    sample->instance = strdup(instance);
+    sample->value = calloc(values, sizeof(uint64_t));
+    if(sample->instance == NULL || sample->value == NULL) {
+        free(sample->instance);
+        free(sample->value);
+        goto error;
+    }
+    set->count++;
+    return sample;
+
+    error:
+    wr_error("Error - Unable to reserve memory for sample.\n");
+    return NULL;
+}
+
+static uint32_t
+sample_set_copy(wr_sample_set_t *dst, const wr_sample_set_t *src, uint32_t values)
+{
+    wr_sample_t *sample;
+
+    sample_set_clear(dst);
+    for(uint32_t i = 0; i < src->count; i++) {
+        sample = sample_set_add(dst, src->sample[i].instance, values);
+        if(sample == NULL) return 0;
+        memcpy(sample->timestamp, src->sample[i].timestamp, sizeof(sample->timestamp));
+        memcpy(sample->value, src->sample[i].value, values * sizeof(uint64_t));
+    }
+    return 1;
+}
+
+static const wr_sample_t *
+sample_set_find(const wr_sample_set_t *set, const char *instance)
+{
+    for(uint32_t i = 0; i < set->count; i++) {
+        if(!strcmp(set->sample[i].instance, instance)) return &set->sample[i];
+    }
+    return NULL;
+}
+
+wr_refresher_t
+wr_refresher_new(const char *namespace, const char *classname,
+        const wr_counter_t *counters, uint32_t count)
+{
+    wr_refresher_t refresher;
+
+    if(namespace == NULL || classname == NULL || counters == NULL || count == 0)
+        return NULL;
+
+    refresher = calloc(1, sizeof(struct _wr_refresher));
+    if(refresher == NULL) goto error;
+    refresher->namespace = strdup(namespace);
+    refresher->classname = strdup(classname);
+    refresher->counter = calloc(count, sizeof(wr_counter_t));
+    refresher->base_name = calloc(count, sizeof(char *));
+    if(refresher->namespace == NULL || refresher->classname == NULL ||
+            refresher->counter == NULL || refresher->base_name == NULL)
+        goto error;
+    refresher->count = count;
+    for(uint32_t i = 0; i < count; i++) {
+        refresher->counter[i] = counters[i];
+        if(needs_base(counters[i].type) &&
+                asprintf(&refresher->base_name[i], "%s_Base", counters[i].name) == -1) {
+            refresher->base_name[i] = NULL;
+            goto error;
+        }
+    }
+    return refresher;
+
+    error:
+    wr_error("Error - Unable to reserve memory for refresher.\n");
+    wr_refresher_free(&refresher);
+    return NULL;
+}
+
+void
+wr_refresher_free(wr_refresher_t *refresher)
+{
+    wr_refresher_t r;
+
+    if(refresher == NULL || *refresher == NULL) return;
+    r = *refresher;
+    sample_set_clear(&r->previous);
+    sample_set_clear(&r->current);
+    for(uint32_t i = 0; r->base_name && i < r->count; i++)
+        free(r->base_name[i]);
+    free(r->base_name);
+    free(r->counter);
+    free(r->classname);
+    free(r->namespace);
+    free(r);
+    *refresher = NULL;
+}
+
+static char *
+state_path(wr_refresher_t refresher, const char *key)
+{
+    const char *dir = getenv("WR_STATE_DIR");
+    char *path = NULL, *p;
+    struct stat st;
+    size_t dir_len;
+
+    if(dir == NULL || *dir == '\0') dir = WR_STATE_DIR_DEFAULT;
+    if(mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        wr_error("Error - Unable to create state directory %s: %s\n",
+            dir, strerror(errno));
+        return NULL;
+    }
+    /* /var/tmp is shared, another user could have made it first */
+    if(lstat(dir, &st) == -1) {
+        wr_error("Error - Unable to read state directory %s: %s\n",
+            dir, strerror(errno));
+        return NULL;
+    }
+    if(!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        wr_error("Error - State directory %s must be a directory writable only by "
+            "its owner, this user.\n", dir);
+        return NULL;
+    }
+    if(asprintf(&path, "%s/%s_%s.state", dir, key, refresher->classname) == -1)
+        return NULL;
+    /* the key is usually the url of the host */
+    dir_len = strlen(dir) + 1;
+    for(p = path + dir_len; *p; p++) {
+        if((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+                (*p >= '0' && *p <= '9') || *p == '.' || *p == '-' || *p == '_')
+            continue;
+        *p = '_';
+    }
+    return path;
+}
+
+static char *
+saved_key(wr_refresher_t refresher, const char *key)
+{
+    char *s = NULL;
+    if(asprintf(&s, "%s\n%s\n%s", key, refresher->namespace, refresher->classname) == -1)
+        return NULL;
+    return s;
+}
+
+static uint32_t
+next_field(const char **p, const char **field, size_t *len)
+{
+    if(*p == NULL) return 0;
+    *field = *p;
+    *len = strcspn(*p, "\t\n");
+    *p = (*p)[*len] == '\t' ? *p + *len + 1 : NULL;
+    return 1;
+}
+
+static uint32_t
+load_file(wr_refresher_t refresher, const char *path)
+{
+    uint32_t values = refresher->count * 2, version, count, result = 0;
+    char *line = NULL, classname[256];
+    const char *p, *field;
+    size_t size = 0, len;
+    wr_sample_t *sample;
+    struct stat st;
+    FILE *in;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if(fd == -1) return 0;
+    /* a sample from hours ago would give the average since then */
+    if(fstat(fd, &st) == -1 || time(NULL) - st.st_mtime > state_max_age()) {
+        close(fd);
+        return 0;
+    }
+    in = fdopen(fd, "r");
+    if(in == NULL) {
+        close(fd);
+        return 0;
+    }
+
+    if(getline(&line, &size, in) == -1 ||
+            sscanf(line, "# wr-refresher %u %255s %u", &version, classname, &count) != 3 ||
+            version != REFRESHER_FILE_VERSION || count != refresher->count ||
+            strcmp(classname, refresher->classname))
+        goto end;
+
+    while(getline(&line, &size, in) != -1) {
+        p = line;
+        if(!next_field(&p, &field, &len)) goto end;
+        line[len] = '\0';
+        sample = sample_set_add(&refresher->previous, field, values);
+        if(sample == NULL) goto end;
+        for(uint32_t i = 0; i < TS_COUNT; i++) {
+            if(!next_field(&p, &field, &len) ||
+                    !wr_parse_uint64(&sample->timestamp[i], field, len))
+                goto end;
+        }
+        for(uint32_t i = 0; i < values; i++) {
+            if(!next_field(&p, &field, &len) ||
+                    !wr_parse_uint64(&sample->value[i], field, len))
+                goto end;
+        }
+    }
+    result = refresher->previous.count > 0;
+
+    end:
+    if(!result) sample_set_clear(&refresher->previous);
+    free(line);
+    fclose(in);
+    return result;
+}
+
+uint32_t
+wr_refresher_load(wr_refresher_t refresher, const char *key)
+{
+    char *s, *path;
+    uint32_t result = 0;
+
+    if(refresher == NULL || key == NULL) return 0;
+    sample_set_clear(&refresher->previous);
+
+    if((s = saved_key(refresher, key)) != NULL) {
+        pthread_mutex_lock(&saved_lock);
+        for(wr_saved_t entry = saved; entry; entry = entry->next) {
+            if(strcmp(entry->key, s)) continue;
+            if(time(NULL) - entry->time <= state_max_age())
+                result = sample_set_copy(&refresher->previous, &entry->set, refresher->count * 2);
+            break;
+        }
+        pthread_mutex_unlock(&saved_lock);
+        free(s);
+    }
+    if(result) return 1;
+
+    if((path = state_path(refresher, key)) == NULL) return 0;
+    result = load_file(refresher, path);
+    free(path);
+    return result;
+}
+
+static uint32_t
+save_file(wr_refresher_t refresher, const char *path)
+{
+    uint32_t values = refresher->count * 2, result = 0;
+    char *temp_path = NULL;
+    FILE *out = NULL;
+    int fd;
+
+    /* written aside and renamed, a check reading it never sees a partial file */
+    if(asprintf(&temp_path, "%s.XXXXXX", path) == -1) return 0;
+    fd = mkstemp(temp_path);
+    if(fd == -1 || (out = fdopen(fd, "w")) == NULL) {
+        wr_error("Error - Unable to create %s: %s\n", temp_path, strerror(errno));
+        if(fd != -1) close(fd);
+        goto end;
+    }
+    fprintf(out, "# wr-refresher %u %s %u\n", REFRESHER_FILE_VERSION,
+        refresher->classname, refresher->count);
+    for(uint32_t i = 0; i < refresher->current.count; i++) {
+        wr_sample_t *sample = &refresher->current.sample[i];
+        /* instance names never have tabs or newlines in practice */
+        for(char *c = sample->instance; *c; c++) {
+            if(*c == '\t' || *c == '\n') *c = ' ';
+        }
+        fputs(sample->instance, out);
+        for(uint32_t t = 0; t < TS_COUNT; t++)
+            fprintf(out, "\t%" PRIu64, sample->timestamp[t]);
+        for(uint32_t v = 0; v < values; v++)
+            fprintf(out, "\t%" PRIu64, sample->value[v]);
+        fputc('\n', out);
+    }
+    if(fclose(out) == EOF) {
+        wr_error("Error - Unable to write %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    if(rename(temp_path, path) == -1) {
+        wr_error("Error - Unable to rename %s: %s\n", temp_path, strerror(errno));
+        goto end;
+    }
+    result = 1;
+
+    end:
+    if(!result) unlink(temp_path);
+    free(temp_path);
+    return result;
+}
+
+/*
+ * Drops the samples of the hosts no check asked for within the max age,
+ * a process polling changing hosts would keep them all. Called with
+ * saved_lock held.
+ */
+static void
+saved_expire(time_t now)
+{
+    time_t max_age = state_max_age();
+    wr_saved_t entry;
+
+    for(wr_saved_t *link = &saved; (entry = *link) != NULL;) {
+        if(now - entry->time <= max_age) {
+            link = &entry->next;
+            continue;
+        }
+        *link = entry->next;
+        sample_set_clear(&entry->set);
+        free(entry->key);
+        free(entry);
+    }
+}
+
+uint32_t
+wr_refresher_save(wr_refresher_t refresher, const char *key)
+{
+    wr_saved_t entry;
+    time_t now = time(NULL);
+    char *s, *path;
+    uint32_t result;
+
+    if(refresher == NULL || key == NULL || refresher->current.count == 0) return 0;
+
+    if((s = saved_key(refresher, key)) != NULL) {
+        pthread_mutex_lock(&saved_lock);
+        saved_expire(now);
+        for(entry = saved; entry && strcmp(entry->key, s); entry = entry->next);
+        if(entry == NULL && (entry = calloc(1, sizeof(struct _wr_saved))) != NULL) {
+            entry->key = s;
+            s = NULL;
+            entry->next = saved;
+            saved = entry;
+        }
+        if(entry) {
+            entry->time = now;
+            sample_set_copy(&entry->set, &refresher->current, refresher->count * 2);
+        }
+        pthread_mutex_unlock(&saved_lock);
+        free(s);
+    }
+
+    if((path = state_path(refresher, key)) == NULL) return 0;
+    result = save_file(refresher, path);
+    free(path);
+    return result;
+}
+
+/* Reads the properties of one instance, or projected item, in a single pass. */
+static uint32_t
+read_instance(wr_refresher_t refresher, xmlNodePtr node)
+{
+    uint32_t values = refresher->count * 2;
+    char *name = NULL, *text;
+    wr_sample_t *sample;
+    xmlNodePtr child;
+    uint64_t *slot;
+
+    for(child = xmlFirstElementChild(node); child; child = xmlNextElementSibling(child)) {
+        if(!strcmp((char *) child->name, "Name")) {
+            name = (char *) xmlNodeGetContent(child);
+            break;
+        }
+    }
+    sample = sample_set_add(&refresher->current, name ? name : "", values);
+    xmlFree(name);
+    if(sample == NULL) return 0;
+
+    for(child = xmlFirstElementChild(node); child; child = xmlNextElementSibling(child)) {
+        slot = NULL;
+        for(uint32_t t = 0; t < TS_COUNT && slot == NULL; t++) {
+            if(!strcmp((char *) child->name, timestamp_name[t])) slot = &sample->timestamp[t];
+        }
+        for(uint32_t c = 0; c < refresher->count && slot == NULL; c++) {
+            if(!strcmp((char *) child->name, refresher->counter[c].name))
+                slot = &sample->value[c * 2];
+            else if(refresher->base_name[c] && !strcmp((char *) child->name, refresher->base_name[c]))
+                slot = &sample->value[c * 2 + 1];
+        }
+        if(slot == NULL) continue;
+        text = (char *) xmlNodeGetContent(child);
+        if(text && !wr_parse_uint64(slot, text, strlen(text))) *slot = 0;
+        xmlFree(text);
+    }
+    return 1;
+}
+
+static uint32_t
+read_items(xmlNodePtr items, void *data)
+{
+    wr_refresher_t refresher = (wr_refresher_t) data;
+
+    for(xmlNodePtr item = xmlFirstElementChild(items); item; item = xmlNextElementSibling(item)) {
+        if(!read_instance(refresher, item)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Selects only the name, the timestamps and the counters (with their
+ * bases), the raw classes carry many more properties than a check reads.
+ */
+static char *
+sample_query(wr_refresher_t refresher, const char *where)
+{
+    char *wql = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&wql, &len);
+
+    if(f == NULL) return NULL;
+    fprintf(f, "SELECT Name");
+    for(uint32_t t = 0; t < TS_COUNT; t++)
+        fprintf(f, ", %s", timestamp_name[t]);
+    for(uint32_t c = 0; c < refresher->count; c++) {
+        fprintf(f, ", %s", refresher->counter[c].name);
+        if(refresher->base_name[c])
+            fprintf(f, ", %s", refresher->base_name[c]);
+    }
+    fprintf(f, " FROM %s", refresher->classname);
+    if(where)
+        fprintf(f, " WHERE %s", where);
+    if(fclose(f) != 0) {
+        free(wql);
+        return NULL;
+    }
+    return wql;
+}
+
+uint32_t
+wr_refresher_sample(wr_refresher_t refresher, void *proto, const char *where)
+{
+    char *wql = NULL, *resource_uri = NULL;
+    uint32_t result = 0;
+
+    if(refresher == NULL || proto == NULL) return 0;
+
+    /* the last sample becomes the previous one */
+    if(refresher->current.count > 0) {
+        sample_set_clear(&refresher->previous);
+        refresher->previous = refresher->current;
+        refresher->current.sample = NULL;
+        refresher->current.count = 0;
+    }
+
+    if((wql = sample_query(refresher, where)) == NULL) {
+        wr_error("Error - Unable to reserve memory for query.\n");
+        goto end;
+    }
+    if(asprintf(&resource_uri, WMI_NS_URL "%s/*", refresher->namespace) == -1) {
+        resource_uri = NULL;
+        goto end;
+    }
+
+    /* the items are read as they arrive, no schema is needed */
+    if(!wr_enumerate(proto, resource_uri, NULL, wql, NULL) ||
+            !wr_pull_each(proto, resource_uri, read_items, refresher))
+        goto end;
+    result = refresher->current.count > 0;
+
+    end:
+    free(wql);
+    free(resource_uri);
+    return result;
+}
+
+uint32_t
+wr_refresher_instance_count(wr_refresher_t refresher)
+{
+    if(refresher == NULL) return 0;
+    return refresher->current.count;
+}
+
+const char *
+wr_refresher_instance_name(wr_refresher_t refresher, uint32_t instance)
+{
+    if(refresher == NULL || instance >= refresher->current.count) return NULL;
+    return refresher->current.sample[instance].instance;
+}
+
+int32_t
+wr_refresher_instance_index(wr_refresher_t refresher, const char *name)
+{
+    if(refresher == NULL || name == NULL) return -1;
+    /* WQL compares instance names ignoring case */
+    for(uint32_t i = 0; i < refresher->current.count; i++) {
+        if(!strcasecmp(refresher->current.sample[i].instance, name)) return i;
+    }
+    return -1;
+}
+
+uint32_t
+wr_refresher_value(wr_refresher_t refresher, uint32_t instance, uint32_t counter, double *value)
+{
+    const wr_sample_t *s1, *s0;
+    uint64_t x1, x0, b1, b0, y1, y0, f;
+    uint32_t type;
+
+    if(refresher == NULL || value == NULL || counter >= refresher->count ||
+            instance >= refresher->current.count)
+        return 0;
+
+    type = refresher->counter[counter].type;
+    s1 = &refresher->current.sample[instance];
+    x1 = s1->value[counter * 2];
+    b1 = s1->value[counter * 2 + 1];
+
+    /* counters computed from the last sample alone */
+    switch(type) {
+    case WR_PERF_COUNTER_RAWCOUNT:
+    case WR_PERF_COUNTER_LARGE_RAWCOUNT:
+        *value = (double) x1;
+        return 1;
+    case WR_PERF_RAW_FRACTION:
+        if(b1 == 0) return 0;
+        *value = 100.0 * x1 / b1;
+        return 1;
+    case WR_PERF_ELAPSED_TIME:
+        f = s1->timestamp[FREQ_OBJECT];
+        if(f == 0 || s1->timestamp[TS_OBJECT] < x1) return 0;
+        *value = (double) (s1->timestamp[TS_OBJECT] - x1) / f;
+        return 1;
+    }
+
+    s0 = sample_set_find(&refresher->previous, s1->instance);
+    if(s0 == NULL) return 0;
+    x0 = s0->value[counter * 2];
+    b0 = s0->value[counter * 2 + 1];
+    /* the counters were reset, the server or the service restarted */
+    if(x1 < x0 || b1 < b0) return 0;
+
+    switch(type) {
+    case WR_PERF_100NSEC_TIMER:
+    case WR_PERF_100NSEC_TIMER_INV:
+    case WR_PERF_COUNTER_100NS_QUEUELEN_TYPE:
+        y1 = s1->timestamp[TS_SYS100NS];
+        y0 = s0->timestamp[TS_SYS100NS];
+        if(y1 <= y0) return 0;
+        *value = (double) (x1 - x0) / (y1 - y0);
+        if(type == WR_PERF_100NSEC_TIMER)
+            *value *= 100.0;
+        else if(type == WR_PERF_100NSEC_TIMER_INV)
+            *value = 100.0 * (1.0 - *value);
+        break;
+    case WR_PERF_COUNTER_COUNTER:
+    case WR_PERF_COUNTER_BULK_COUNT:
+        y1 = s1->timestamp[TS_PERFTIME];
+        y0 = s0->timestamp[TS_PERFTIME];
+        f = s1->timestamp[FREQ_PERFTIME];
+        if(y1 <= y0 || f == 0) return 0;
+        *value = (double) (x1 - x0) / ((double) (y1 - y0) / f);
+        break;
+    case WR_PERF_PRECISION_100NS_TIMER:
+        if(b1 <= b0) return 0;
+        *value = 100.0 * (x1 - x0) / (b1 - b0);
+        break;
+    case WR_PERF_AVERAGE_TIMER:
+        f = s1->timestamp[FREQ_PERFTIME];
+        if(b1 <= b0 || f == 0) return 0;
+        *value = ((double) (x1 - x0) / f) / (b1 - b0);
+        break;
+    case WR_PERF_AVERAGE_BULK:
+        if(b1 <= b0) return 0;
+        *value = (double) (x1 - x0) / (b1 - b0);
+        break;
+    default:
+        wr_error("Error - Unsupported counter type 0x%08x for %s.\n",
+            type, refresher->counter[counter].name);
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t
+wr_refresher_delta(wr_refresher_t refresher, uint32_t instance, uint32_t counter, double *value)
+{
+    const wr_sample_t *s1, *s0;
+
+    if(refresher == NULL || value == NULL || counter >= refresher->count ||
+            instance >= refresher->current.count)
+        return 0;
+
+    s1 = &refresher->current.sample[instance];
+    s0 = sample_set_find(&refresher->previous, s1->instance);
+    if(s0 == NULL || s1->value[counter * 2] < s0->value[counter * 2]) return 0;
+    *value = (double) (s1->value[counter * 2] - s0->value[counter * 2]);
+    return 1;
+}
@@ -0,0 +1,73 @@
+#ifndef __REFRESHER_H_
+#define __REFRESHER_H_
+#include <stdint.h>
+
+/*
+ * Computes the values of the formatted performance counter classes from
+ * two samples of the matching Win32_PerfRawData class, the way WMI does
+ * it on the server. The previous sample of every host is kept in memory
+ * and in a state file, so that the values are averages over the time
+ * between two checks.
+ */
+
+/* CounterType qualifier of the raw counter properties */
+#define WR_PERF_COUNTER_RAWCOUNT            0x00010000
+#define WR_PERF_COUNTER_LARGE_RAWCOUNT      0x00010100
+#define WR_PERF_COUNTER_100NS_QUEUELEN_TYPE 0x00550500
+#define WR_PERF_COUNTER_COUNTER             0x10410400
+#define WR_PERF_COUNTER_BULK_COUNT          0x10410500
+#define WR_PERF_RAW_FRACTION                0x20020400
+#define WR_PERF_100NSEC_TIMER               0x20510500
+#define WR_PERF_PRECISION_100NS_TIMER       0x20570500
+#define WR_PERF_100NSEC_TIMER_INV           0x21510500
+#define WR_PERF_AVERAGE_TIMER               0x30020400
+#define WR_PERF_ELAPSED_TIME                0x30240500
+#define WR_PERF_AVERAGE_BULK                0x40020500
+
+/* Directory of the state files, WR_STATE_DIR overrides it */
+#define WR_STATE_DIR_DEFAULT "/var/tmp/check_wr"
+/*
+ * Seconds a previous sample is used for, WR_STATE_MAX_AGE overrides it.
+ * An older one, of a check that did not run for a while, is dropped and
+ * the check takes two samples a second apart instead.
+ */
+#define WR_STATE_MAX_AGE_DEFAULT 900
+
+typedef struct _wr_counter {
+    const char *name;
+    uint32_t type;
+} wr_counter_t;
+
+typedef struct _wr_refresher *wr_refresher_t;
+
+wr_refresher_t wr_refresher_new(const char *namespace, const char *classname,
+        const wr_counter_t *counters, uint32_t count);
+void wr_refresher_free(wr_refresher_t *refresher);
+
+/*
+ * The key names the host the samples come from. load returns 0 when
+ * there is no previous sample, save keeps the last one for next time.
+ */
+uint32_t wr_refresher_load(wr_refresher_t refresher, const char *key);
+uint32_t wr_refresher_save(wr_refresher_t refresher, const char *key);
+
+/* Queries a new sample, where (without WHERE) can be NULL. */
+uint32_t wr_refresher_sample(wr_refresher_t refresher, void *proto, const char *where);
+
+uint32_t wr_refresher_instance_count(wr_refresher_t refresher);
+const char *wr_refresher_instance_name(wr_refresher_t refresher, uint32_t instance);
+int32_t wr_refresher_instance_index(wr_refresher_t refresher, const char *name);
+
+/*
+ * Returns 1 and the value of the counter when both samples have the
+ * instance and the counter did not go back (counters restart with the
+ * server). Raw counts only need the last sample.
+ */
+uint32_t wr_refresher_value(wr_refresher_t refresher, uint32_t instance,
+        uint32_t counter, double *value);
+
+/* Returns how much a cumulative raw count grew since the previous sample. */
+uint32_t wr_refresher_delta(wr_refresher_t refresher, uint32_t instance,
+        uint32_t counter, double *value);
+
+#endif
@@ -0,0 +1,499 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "transport.h"
+#include "protocol.h"
+#include "cache.h"
+#include "library.h"
+#include "scheduler.h"
+
+#define SCHED_WORKERS_MAX 256
+#define SCHED_HOST_BUCKETS 256
+/* the key of tasks without a deadline, after all the others */
+#define SCHED_NO_DEADLINE INT64_MAX
+
+typedef struct _sched_entry {
+    int64_t key;
+    void *item;
+} sched_entry_t;
+
+/* Binary heap, the entry with the smallest key on top */
+typedef struct _sched_heap {
+    sched_entry_t *entry;
+    uint32_t count;
+    uint32_t size;
+} sched_heap_t;
+
+typedef struct _sched_task {
+    wr_deadline_t deadline;
+    wr_sched_task_cb task;
+    void *data;
+} *sched_task_t;
+
+typedef struct _sched_host {
+    pthread_mutex_t lock;
+    char *username;
+    char *password;
+    char *url;
+    void *proto;                /* used by the worker running the host */
+    sched_heap_t tasks;
+    uint32_t scheduled;         /* in a run queue or running */
+    struct _sched_host *next;
+} *sched_host_t;
+
+typedef struct _sched_worker {
+    pthread_mutex_t lock;
+    sched_heap_t queue;         /* hosts with tasks, by their earliest deadline */
+    pthread_t thread;
+    uint32_t index;
+    struct _wr_sched *sched;
+} sched_worker_t;
+
+struct _wr_sched {
+    sched_worker_t *worker;
+    uint32_t count;
+    uint32_t started;           /* threads running, count unless one failed */
+    struct {
+        pthread_mutex_t lock;
+        sched_host_t list;
+    } host[SCHED_HOST_BUCKETS];
+    uint32_t next;              /* worker given the next task from outside */
+    int64_t ready;              /* hosts in the run queues */
+    int64_t outstanding;        /* tasks submitted and not run yet */
+    uint32_t sleeping;
+    uint32_t stop;
+    /* only taken by the workers with nothing to do, and to wait */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    pthread_cond_t done;
+};
+
+/* worker of the calling thread, tasks it submits go to its own queue */
+static __thread sched_worker_t *current = NULL;
+
+static uint32_t
+heap_reserve(sched_heap_t *heap, uint32_t count)
+{
+    sched_entry_t *entry;
+    uint32_t size;
+
+    if(count <= heap->size) return 1;
+    size = heap->size ? heap->size * 2 : 16;
+    if(size < count) size = count;
+    entry = realloc(heap->entry, size * sizeof(sched_entry_t));
+    if(entry == NULL) {
+        wr_error("Error - Unable to reserve memory for scheduler queue.\n");
+        return 0;
+    }
+    heap->entry = entry;
+    heap->size = size;
+    return 1;
+}
+
+static uint32_t
+heap_push(sched_heap_t *heap, int64_t key, void *item)
+{
+    uint32_t i, parent;
+
+    if(!heap_reserve(heap, heap->count + 1)) return 0;
+    for(i = heap->count++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if(heap->entry[parent].key <= key) break;
+        heap->entry[i] = heap->entry[parent];
+    }
+    heap->entry[i].key = key;
+    heap->entry[i].item = item;
+    return 1;
+}
+
+static uint32_t
+heap_pop(sched_heap_t *heap, sched_entry_t *top)
+{
+    sched_entry_t last;
+    uint32_t i = 0, child;
+
+    if(heap->count == 0) return 0;
+    *top = heap->entry[0];
+    last = heap->entry[--heap->count];
+    while((child = 2 * i + 1) < heap->count) {
+        if(child + 1 < heap->count && heap->entry[child + 1].key < heap->entry[child].key)
+            child++;
+        if(last.key <= heap->entry[child].key) break;
+        heap->entry[i] = heap->entry[child];
+        i = child;
+    }
+    heap->entry[i] = last;
+    return 1;
+}
+
+static int64_t
+deadline_key(const wr_deadline_t *deadline)
+{
+    if(deadline->expires.tv_sec == 0 && deadline->expires.tv_nsec == 0)
+        return SCHED_NO_DEADLINE;
+    return (int64_t) deadline->expires.tv_sec * 1000 + deadline->expires.tv_nsec / 1000000L;
+}
+
+static uint32_t
+str_match(const char *a, const char *b)
+{
+    if(a == NULL || b == NULL) return a == b;
+    return !strcmp(a, b);
+}
+
+static void
+host_free(sched_host_t host)
+{
+    sched_entry_t entry;
+
+    if(host == NULL) return;
+    if(host->proto) {
+        wr_release(host->proto);
+        wrprotocol_ctx_free(host->proto);
+    }
+    while(heap_pop(&host->tasks, &entry)) free(entry.item);
+    free(host->tasks.entry);
+    free(host->username);
+    if(host->password) {
+        memset(host->password, 0, strlen(host->password));
+        free(host->password);
+    }
+    free(host->url);
+    pthread_mutex_destroy(&host->lock);
+    free(host);
+}
+
+static sched_host_t
+host_get(wr_sched_t sched, const char *username, const char *password, const char *url)
+{
+    uint32_t bucket = wr_cache_hash(url ? url : "") % SCHED_HOST_BUCKETS;
+    sched_host_t host;
+
+    pthread_mutex_lock(&sched->host[bucket].lock);
+    for(host = sched->host[bucket].list; host; host = host->next) {
+        if(str_match(host->url, url) && str_match(host->username, username) &&
+                str_match(host->password, password))
+            goto end;
+    }
+    host = calloc(1, sizeof(struct _sched_host));
+    if(host == NULL) {
+        wr_error("Error - Unable to reserve memory for scheduler host.\n");
+        goto end;
+    }
+    pthread_mutex_init(&host->lock, NULL);
+    if((username && (host->username = strdup(username)) == NULL) ||
+            (password && (host->password = strdup(password)) == NULL) ||
+            (url && (host->url = strdup(url)) == NULL)) {
+        wr_error("Error - Unable to reserve memory for scheduler host.\n");
+        host_free(host);
+        host = NULL;
+        goto end;
+    }
+    host->next = sched->host[bucket].list;
+    sched->host[bucket].list = host;
+
+    end:
+    pthread_mutex_unlock(&sched->host[bucket].lock);
+    return host;
+}
+
+/* Queues a host with tasks, it is then in no other queue. */
+static uint32_t
+queue_push(sched_worker_t *worker, int64_t key, sched_host_t host)
+{
+    wr_sched_t sched = worker->sched;
+    uint32_t result;
+
+    pthread_mutex_lock(&worker->lock);
+    result = heap_push(&worker->queue, key, host);
+    pthread_mutex_unlock(&worker->lock);
+    if(!result) return 0;
+
+    __atomic_add_fetch(&sched->ready, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&sched->sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&sched->idle_lock);
+        pthread_cond_signal(&sched->idle);
+        pthread_mutex_unlock(&sched->idle_lock);
+    }
+    return 1;
+}
+
+static sched_host_t
+queue_pop(sched_worker_t *worker)
+{
+    sched_entry_t entry;
+    uint32_t result;
+
+    pthread_mutex_lock(&worker->lock);
+    result = heap_pop(&worker->queue, &entry);
+    pthread_mutex_unlock(&worker->lock);
+    if(!result) return NULL;
+    __atomic_sub_fetch(&worker->sched->ready, 1, __ATOMIC_SEQ_CST);
+    return entry.item;
+}
+
+static void
+task_done(wr_sched_t sched)
+{
+    if(__atomic_sub_fetch(&sched->outstanding, 1, __ATOMIC_SEQ_CST) > 0) return;
+    pthread_mutex_lock(&sched->idle_lock);
+    pthread_cond_broadcast(&sched->done);
+    pthread_mutex_unlock(&sched->idle_lock);
+}
+
+static void
+task_run(sched_host_t host, sched_task_t task)
+{
+    /* its turn came too late */
+    if(!wr_deadline_check(&task->deadline)) goto fail;
+
+    if(host->proto == NULL) {
+        host->proto = wrprotocol_ctx_new();
+        if(host->proto == NULL) goto fail;
+        if(!wrprotocol_ctx_init(host->proto, host->username, host->password,
+                host->url, WR_MECH_NTLM)) {
+            wrprotocol_ctx_free(host->proto);
+            host->proto = NULL;
+            goto fail;
+        }
+    }
+    wrprotocol_ctx_set_deadline(host->proto, &task->deadline);
+    task->task(host->proto, &task->deadline, task->data);
+    /* an enumeration the task did not pull to its end */
+    wr_release(host->proto);
+    wrprotocol_ctx_set_deadline(host->proto, NULL);
+    if(!wrprotocol_ctx_usable(host->proto)) {
+        wrprotocol_ctx_free(host->proto);
+        host->proto = NULL;
+    }
+    return;
+
+    fail:
+    task->task(NULL, &task->deadline, task->data);
+}
+
+/*
+ * Runs the most urgent task of the host, then queues the host again on
+ * this worker while it has more, so that the hosts with an earlier
+ * deadline go first.
+ */
+static void
+host_run(sched_worker_t *worker, sched_host_t host)
+{
+    sched_entry_t entry;
+    uint32_t more;
+
+    for(;;) {
+        pthread_mutex_lock(&host->lock);
+        more = heap_pop(&host->tasks, &entry);
+        pthread_mutex_unlock(&host->lock);
+        if(!more) break;
+
+        task_run(host, entry.item);
+        free(entry.item);
+        task_done(worker->sched);
+
+        pthread_mutex_lock(&host->lock);
+        if(host->tasks.count == 0) {
+            host->scheduled = 0;
+            pthread_mutex_unlock(&host->lock);
+            return;
+        }
+        more = queue_push(worker, host->tasks.entry[0].key, host);
+        pthread_mutex_unlock(&host->lock);
+        if(more) return;
+        /* without room in the queue the worker keeps the host */
+    }
+    pthread_mutex_lock(&host->lock);
+    host->scheduled = 0;
+    pthread_mutex_unlock(&host->lock);
+}
+
+/* Takes a host from the queue of the worker, or from the others. */
+static sched_host_t
+worker_next(sched_worker_t *worker)
+{
+    wr_sched_t sched = worker->sched;
+    sched_host_t host;
+
+    for(;;) {
+        if((host = queue_pop(worker)) != NULL) return host;
+        for(uint32_t i = 1; i < sched->count; i++) {
+            host = queue_pop(&sched->worker[(worker->index + i) % sched->count]);
+            if(host != NULL) return host;
+        }
+
+        pthread_mutex_lock(&sched->idle_lock);
+        __atomic_add_fetch(&sched->sleeping, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&sched->ready, __ATOMIC_SEQ_CST) <= 0 && !sched->stop)
+            pthread_cond_wait(&sched->idle, &sched->idle_lock);
+        __atomic_sub_fetch(&sched->sleeping, 1, __ATOMIC_SEQ_CST);
+        if(sched->stop && __atomic_load_n(&sched->ready, __ATOMIC_SEQ_CST) <= 0) {
+            pthread_mutex_unlock(&sched->idle_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&sched->idle_lock);
+    }
+}
+
+static void *
+worker_main(void *arg)
+{
+    sched_worker_t *worker = arg;
+    sched_host_t host;
+
+    current = worker;
+    while((host = worker_next(worker)) != NULL)
+        host_run(worker, host);
+    current = NULL;
+    return NULL;
+}
+
+static void
+sched_stop(wr_sched_t sched)
+{
+    pthread_mutex_lock(&sched->idle_lock);
+    sched->stop = 1;
+    pthread_cond_broadcast(&sched->idle);
+    pthread_mutex_unlock(&sched->idle_lock);
+    for(uint32_t i = 0; i < sched->started; i++)
+        pthread_join(sched->worker[i].thread, NULL);
+}
+
+wr_sched_t
+wr_sched_new(uint32_t workers)
+{
+    wr_sched_t sched;
+    long cores;
+
+    if(workers == 0) {
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? cores : 1;
+    }
+    if(workers > SCHED_WORKERS_MAX) workers = SCHED_WORKERS_MAX;
+    /* the sessions are created by the workers */
+    wr_library_init();
+
+    sched = calloc(1, sizeof(struct _wr_sched));
+    if(sched == NULL) goto error;
+    sched->worker = calloc(workers, sizeof(sched_worker_t));
+    if(sched->worker == NULL) goto error;
+    for(uint32_t i = 0; i < SCHED_HOST_BUCKETS; i++)
+        pthread_mutex_init(&sched->host[i].lock, NULL);
+    pthread_mutex_init(&sched->idle_lock, NULL);
+    pthread_cond_init(&sched->idle, NULL);
+    pthread_cond_init(&sched->done, NULL);
+
+    for(uint32_t i = 0; i < workers; i++) {
+        sched_worker_t *worker = &sched->worker[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->index = i;
+        worker->sched = sched;
+    }
+    sched->count = workers;
+    for(sched->started = 0; sched->started < workers; sched->started++) {
+        if(pthread_create(&sched->worker[sched->started].thread, NULL, worker_main,
+                &sched->worker[sched->started]) != 0) {
+            wr_error("Error - Unable to start scheduler worker.\n");
+            sched_stop(sched);
+            wr_sched_free(sched);
+            return NULL;
+        }
+    }
+    return sched;
+
+    error:
+    wr_error("Error - Unable to reserve memory for scheduler.\n");
+    if(sched) free(sched->worker);
+    free(sched);
+    return NULL;
+}
+
+uint32_t
+wr_sched_submit(wr_sched_t sched, const char *username, const char *password,
+        const char *url, uint32_t timeout_ms, wr_sched_task_cb task, void *data)
+{
+    sched_worker_t *worker;
+    sched_task_t t;
+    sched_host_t host;
+    int64_t key;
+
+    if(sched == NULL || task == NULL) return 0;
+    t = calloc(1, sizeof(struct _sched_task));
+    if(t == NULL) {
+        wr_error("Error - Unable to reserve memory for scheduler task.\n");
+        return 0;
+    }
+    if(timeout_ms) wr_deadline_start(&t->deadline, timeout_ms);
+    t->task = task;
+    t->data = data;
+    key = deadline_key(&t->deadline);
+
+    host = host_get(sched, username, password, url);
+    if(host == NULL) goto error;
+    if(current != NULL && current->sched == sched)
+        worker = current;
+    else
+        worker = &sched->worker[__atomic_fetch_add(&sched->next, 1, __ATOMIC_RELAXED) % sched->count];
+
+    __atomic_add_fetch(&sched->outstanding, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&host->lock);
+    /* the push below then cannot fail */
+    if(!heap_reserve(&host->tasks, host->tasks.count + 1)) goto unlock;
+    if(!host->scheduled) {
+        /* the task is the most urgent one, the host has none */
+        if(!queue_push(worker, key, host)) goto unlock;
+        host->scheduled = 1;
+    }
+    heap_push(&host->tasks, key, t);
+    pthread_mutex_unlock(&host->lock);
+    return 1;
+
+    unlock:
+    pthread_mutex_unlock(&host->lock);
+    __atomic_sub_fetch(&sched->outstanding, 1, __ATOMIC_SEQ_CST);
+    error:
+    free(t);
+    return 0;
+}
+
+void
+wr_sched_wait(wr_sched_t sched)
+{
+    if(sched == NULL) return;
+    pthread_mutex_lock(&sched->idle_lock);
+    while(__atomic_load_n(&sched->outstanding, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_wait(&sched->done, &sched->idle_lock);
+    pthread_mutex_unlock(&sched->idle_lock);
+}
+
+void
+wr_sched_free(wr_sched_t sched)
+{
+    sched_host_t host;
+
+    if(sched == NULL) return;
+    if(!sched->stop) {
+        wr_sched_wait(sched);
+        sched_stop(sched);
+    }
+    for(uint32_t i = 0; i < SCHED_HOST_BUCKETS; i++) {
+        while((host = sched->host[i].list) != NULL) {
+            sched->host[i].list = host->next;
+            host_free(host);
+        }
+        pthread_mutex_destroy(&sched->host[i].lock);
+    }
+    for(uint32_t i = 0; i < sched->count; i++) {
+        free(sched->worker[i].queue.entry);
+        pthread_mutex_destroy(&sched->worker[i].lock);
+    }
+    pthread_mutex_destroy(&sched->idle_lock);
+    pthread_cond_destroy(&sched->idle);
+    pthread_cond_destroy(&sched->done);
+    free(sched->worker);
+    free(sched);
+}
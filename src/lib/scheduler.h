@@ -0,0 +1,38 @@
+#ifndef __SCHEDULER_H_
+#define __SCHEDULER_H_
+#include <stdint.h>
+#include "deadline.h"
+
+/*
+ * Runs the tasks of a collector polling many hosts on a pool of worker
+ * threads. Every host, a username, password and url, has one session
+ * and its tasks run one at a time on it: the GSS context of a session
+ * numbers its messages and cannot be shared. Different hosts run in
+ * parallel. Each worker has its own run queue of hosts, ordered by the
+ * deadline of their most urgent task, and takes from the others when
+ * its own is empty, so no lock is shared by all the workers.
+ */
+
+typedef struct _wr_sched *wr_sched_t;
+
+/*
+ * Runs a task with the session of its host, limited to deadline. proto
+ * is NULL when the task could not run: the deadline was spent before
+ * its turn came or the session could not be created.
+ */
+typedef void (*wr_sched_task_cb)(void *proto, wr_deadline_t *deadline, void *data);
+
+/* workers 0 starts one per core */
+wr_sched_t wr_sched_new(uint32_t workers);
+/*
+ * Queues a task, also from a running task. timeout_ms counts from now,
+ * 0 for none.
+ */
+uint32_t wr_sched_submit(wr_sched_t sched, const char *username, const char *password,
+        const char *url, uint32_t timeout_ms, wr_sched_task_cb task, void *data);
+/* Waits until every task submitted has run, not to be called by a task. */
+void wr_sched_wait(wr_sched_t sched);
+/* Stops the workers once the tasks queued have run, and frees the sessions. */
+void wr_sched_free(wr_sched_t sched);
+
+#endif
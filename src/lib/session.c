@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "transport.h"
+#include "protocol.h"
+#include "session.h"
+#include "cache.h"
+#include "hostslot.h"
+#include "deadline.h"
+#include "library.h"
+
+typedef struct _wr_session {
+    char *username;
+    char *password;
+    char *url;
+    void *proto;
+    time_t last_used;
+    uint32_t in_use;
+    pthread_t owner;            /* thread the session is checked out to */
+    struct _wr_session *next;
+} *wr_session_t;
+
+/* shared by the threads of the process, the sessions are not */
+static struct {
+    pthread_mutex_t lock;
+    uint32_t enabled;
+    uint32_t max_idle;
+    wr_session_t list;
+} pool = { PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL };
+
+static uint32_t
+str_match(const char *a, const char *b)
+{
+    if(a == NULL || b == NULL) return a == b;
+    return !strcmp(a, b);
+}
+
+static void
+session_free(wr_session_t session)
+{
+    if(session == NULL) return;
+    wrprotocol_ctx_free(session->proto);
+    free(session->username);
+    if(session->password) {
+        memset(session->password, 0, strlen(session->password));
+        free(session->password);
+    }
+    free(session->url);
+    free(session);
+}
+
+/* Frees the sessions matching the condition, outside of the pool lock. */
+static void
+pool_remove(uint32_t (*condition)(wr_session_t))
+{
+    wr_session_t *link, session, removed = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    link = &pool.list;
+    while((session = *link) != NULL) {
+        if(condition(session)) {
+            *link = session->next;
+            session->next = removed;
+            removed = session;
+        } else {
+            link = &session->next;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    while((session = removed) != NULL) {
+        removed = session->next;
+        session_free(session);
+    }
+}
+
+static uint32_t
+is_expired(wr_session_t session)
+{
+    return !session->in_use && time(NULL) - session->last_used > pool.max_idle;
+}
+
+static uint32_t
+is_idle(wr_session_t session)
+{
+    return !session->in_use;
+}
+
+static uint32_t
+is_checked_out(wr_session_t session)
+{
+    return session->in_use && pthread_equal(session->owner, pthread_self());
+}
+
+void
+wr_session_pool_enable(uint32_t max_idle)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.enabled = 1;
+    pool.max_idle = max_idle;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void
+wr_session_pool_free(void)
+{
+    pool_remove(is_idle);
+}
+
+static void *
+session_login(const char *username, const char *password, const char *url)
+{
+    void *proto = wrprotocol_ctx_new();
+
+    if(proto == NULL) return NULL;
+    if(!wrprotocol_ctx_init(proto, username, password, url, WR_MECH_NTLM)) {
+        wrprotocol_ctx_free(proto);
+        return NULL;
+    }
+    wrprotocol_ctx_set_deadline(proto, wr_check_deadline());
+    return proto;
+}
+
+void *
+wr_session_get(const char *username, const char *password, const char *url)
+{
+    wr_session_t session;
+    uint32_t enabled;
+
+    pthread_mutex_lock(&pool.lock);
+    enabled = pool.enabled;
+    pthread_mutex_unlock(&pool.lock);
+    if(!enabled) return session_login(username, password, url);
+
+    pool_remove(is_expired);
+    pthread_mutex_lock(&pool.lock);
+    for(session = pool.list; session; session = session->next) {
+        if(session->in_use) continue;
+        if(!str_match(session->url, url) || !str_match(session->username, username) ||
+                !str_match(session->password, password))
+            continue;
+        session->in_use = 1;
+        session->owner = pthread_self();
+        break;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if(session != NULL) {
+        wrprotocol_ctx_set_deadline(session->proto, wr_check_deadline());
+        wrprotocol_ctx_set_idle(session->proto);
+        return session->proto;
+    }
+
+    session = calloc(1, sizeof(struct _wr_session));
+    if(session == NULL) {
+        wr_error("Error - Unable to reserve memory for session.\n");
+        return NULL;
+    }
+    if((username && (session->username = strdup(username)) == NULL) ||
+            (password && (session->password = strdup(password)) == NULL) ||
+            (url && (session->url = strdup(url)) == NULL)) {
+        wr_error("Error - Unable to reserve memory for session.\n");
+        goto error;
+    }
+    session->proto = session_login(username, password, url);
+    if(session->proto == NULL) goto error;
+
+    session->in_use = 1;
+    session->owner = pthread_self();
+    pthread_mutex_lock(&pool.lock);
+    session->next = pool.list;
+    pool.list = session;
+    pthread_mutex_unlock(&pool.lock);
+    return session->proto;
+
+    error:
+    session_free(session);
+    return NULL;
+}
+
+void
+wr_session_put(void *proto)
+{
+    wr_session_t *link, session;
+
+    if(proto == NULL) return;
+    /* an enumeration the check did not pull to its end */
+    wr_release(proto);
+
+    pthread_mutex_lock(&pool.lock);
+    for(link = &pool.list; (session = *link) != NULL; link = &session->next) {
+        if(session->proto != proto) continue;
+        if(!wrprotocol_ctx_usable(proto)) {
+            *link = session->next;
+            break;
+        }
+        /* the session goes back to the pool, nobody else has it yet */
+        wrprotocol_ctx_set_deadline(proto, NULL);
+        session->in_use = 0;
+        session->last_used = time(NULL);
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if(session != NULL) {
+        session_free(session);
+        return;
+    }
+    /* not from the pool */
+    wrprotocol_ctx_free(proto);
+}
+
+void
+wr_session_abandon(void)
+{
+    /* no Release for their enumerations, a request may have been cut short;
+     * those of the other threads are still in use */
+    pool_remove(is_checked_out);
+    /* the locks of the aborted check would be held until the process ends */
+    wr_cache_abandon();
+    wr_host_slot_abandon();
+}
@@ -0,0 +1,28 @@
+#ifndef __SESSION_H_
+#define __SESSION_H_
+#include <stdint.h>
+
+/*
+ * Protocol sessions handed out to the checks. Unless the pool is
+ * enabled every get opens a new session and every put frees it, which
+ * is what a plugin run once per check wants. Sessions log in with their
+ * first request, a check answered from the cache never does. Long running processes
+ * (the worker mode of check_wr) enable the pool so that sessions stay
+ * logged in and are reused by the next check against the same server
+ * with the same credentials. The sessions handed out are limited to
+ * the deadline of the check, see wr_check_deadline. The pool is shared
+ * by the threads of the process, a session by one thread at a time.
+ */
+void wr_session_pool_enable(uint32_t max_idle);
+void wr_session_pool_free(void);
+
+void *wr_session_get(const char *username, const char *password, const char *url);
+void wr_session_put(void *proto);
+
+/*
+ * Drops the sessions still checked out and the cache and host slot locks
+ * still held by the calling thread, used after a check was aborted.
+ */
+void wr_session_abandon(void);
+
+#endif
@@ -9,6 +9,7 @@
 #include <openssl/evp.h>
 #include <regex.h>
 #include "transport.h"
+#include "library.h"
 
 #define SAMM_USERAGENT "User-Agent: samm/1.0.0"
 
@@ -20,6 +21,8 @@ struct wr_transport_ctx {
     gss_name_t target_name;
     uint64_t response_code;
     struct ntlm_buffer response;
+    const wr_deadline_t *deadline;
+    char *url;
 };
 
 static size_t 
@@ -44,6 +47,39 @@ header_callback(char *ptr, size_t size, size_t nmemb, void *challenge)
     return size * nmemb;
 }
 
+/*
+ * A handle with the options every request shares. The ones of a single
+ * request, like the size of its body, are not carried to the next one.
+ */
+static CURL *
+curl_new(const char *url)
+{
+    CURL *curl_ctx = curl_easy_init();
+
+    if(curl_ctx == NULL) {
+        wr_error("Error - Unable to initialize curl context.\n");
+        return NULL;
+    }
+    curl_easy_setopt(curl_ctx, CURLOPT_URL, url);
+    curl_easy_setopt(curl_ctx, CURLOPT_CUSTOMREQUEST, "POST");
+    /* the resolver timeout would take over the SIGALRM of the plugin */
+    curl_easy_setopt(curl_ctx, CURLOPT_NOSIGNAL, 1L);
+    return curl_ctx;
+}
+
+/* Every request gets the time left to the deadline, no limit without it */
+static void
+set_timeouts(struct wr_transport_ctx *ctx)
+{
+    int64_t left = wr_deadline_left(ctx->deadline);
+
+    /* 0 means no timeout to curl */
+    if(left == 0) left = 1;
+    if(left < 0) left = 0;
+    curl_easy_setopt(ctx->curl_ctx, CURLOPT_TIMEOUT_MS, (long) left);
+    curl_easy_setopt(ctx->curl_ctx, CURLOPT_CONNECTTIMEOUT_MS, (long) left);
+}
+
 static void
 debug_bin_print(const void *b, int len, int indent)
 {
@@ -177,7 +213,7 @@ set_ntlm_flags(gss_cred_id_t cred, uint32_t flags)
     ntlm_flags.value = &flags;
     maj_stat = gss_set_cred_option(&min_stat, &cred, &o, &ntlm_flags);
     if (maj_stat != GSS_S_COMPLETE) {
-        printf("Error - setting flags %x %x\n", maj_stat, min_stat);
+        wr_error("Error - setting flags %x %x\n", maj_stat, min_stat);
         return 0;
     }
     return 1;
@@ -191,7 +227,7 @@ get_ntlm_session_key(gss_ctx_id_t gss_context)
 
     maj_stat = gss_inquire_sec_context_by_oid(&min_stat, gss_context, GSS_C_INQ_SSPI_SESSION_KEY, &buffer_set);
     if (maj_stat != GSS_S_COMPLETE) {
-        printf("Error - Getting session key. %x %x\n", maj_stat, min_stat);
+        wr_error("Error - Getting session key. %x %x\n", maj_stat, min_stat);
         return 0;
     }
     for(int i=0; i < buffer_set->count; i++) {
@@ -216,7 +252,7 @@ enable_ntlm_mic(gss_ctx_id_t gss_context)
     o.elements = GSS_SPNEGO_REQUIRE_MIC_OID_STRING;
     maj_stat = gss_inquire_sec_context_by_oid(&min_stat, gss_context, &o, &buffer_set);
     if (maj_stat != GSS_S_COMPLETE) {
-        printf("Error - setting MIC on %x %x\n", maj_stat, min_stat);
+        wr_error("Error - setting MIC on %x %x\n", maj_stat, min_stat);
         return 0;
     }
 
@@ -227,7 +263,11 @@ enable_ntlm_mic(gss_ctx_id_t gss_context)
 void *
 wr_transport_ctx_new()
 {
-    struct wr_transport_ctx *ctx = calloc(1, sizeof(struct wr_transport_ctx));
+    struct wr_transport_ctx *ctx;
+
+    /* curl_easy_init would otherwise set up curl, unsafe with other threads */
+    wr_library_init();
+    ctx = calloc(1, sizeof(struct wr_transport_ctx));
     if(ctx == NULL) return NULL;
     return ctx;
 }
@@ -249,7 +289,7 @@ wr_transport_ctx_init(void *c, const char *username, const char *password, const
     if(mech_val == WR_MECH_NTLM) {
         maj_stat = gss_create_empty_oid_set(&min_stat, &ctx->mechsp);
         if(maj_stat != GSS_S_COMPLETE) {
-            fprintf(stderr, "Error - Unable to create mech oid set.\n");
+            wr_error("Error - Unable to create mech oid set.\n");
             result = 0;
             goto end;
         }
@@ -259,7 +299,7 @@ wr_transport_ctx_init(void *c, const char *username, const char *password, const
         };
         maj_stat = gss_add_oid_set_member(&min_stat, &mech, &ctx->mechsp);
         if(maj_stat != GSS_S_COMPLETE) {
-            fprintf(stderr, "Error - Unable to add mech to oid set.\n");
+            wr_error("Error - Unable to add mech to oid set.\n");
             result = 0;
             goto end;
         }
@@ -274,7 +314,7 @@ wr_transport_ctx_init(void *c, const char *username, const char *password, const
                                (gss_OID) gss_nt_user_name,
                                &gss_username);
     if (maj_stat != GSS_S_COMPLETE) {
-        fprintf(stderr, "Error - parsing client name %d %d\n", maj_stat, min_stat);
+        wr_error("Error - parsing client name %d %d\n", maj_stat, min_stat);
         result = 0;
         goto end;
     }
@@ -288,19 +328,22 @@ wr_transport_ctx_init(void *c, const char *username, const char *password, const
                                               ctx->mechsp, GSS_C_INITIATE,
                                               &ctx->cred, NULL, NULL);
     if (maj_stat != GSS_S_COMPLETE) {
-        fprintf(stderr, "Error - acquiring creds %x %x\n", maj_stat, min_stat);
+        wr_error("Error - acquiring creds %x %x\n", maj_stat, min_stat);
         result = 0;
         goto end;
     }
 
-    ctx->curl_ctx = curl_easy_init();
+    ctx->url = strdup(url);
+    if(ctx->url == NULL) {
+        wr_error("Error - Unable to reserve memory for url.\n");
+        result = 0;
+        goto end;
+    }
+    ctx->curl_ctx = curl_new(ctx->url);
     if(ctx->curl_ctx == NULL) {
-        fprintf(stderr, "Error - Unable to initialize curl context.\n");
         result = 0;
         goto end;
     }
-    curl_easy_setopt(ctx->curl_ctx, CURLOPT_URL, url);
-    curl_easy_setopt(ctx->curl_ctx, CURLOPT_CUSTOMREQUEST, "POST");
 
     end:
     if(gss_username != GSS_C_NO_NAME) gss_release_name(&min_stat, &gss_username);
@@ -336,6 +379,8 @@ wr_transport_login(void *c)
                                (gss_OID) gss_nt_service_name,
                                &ctx->target_name);
 
+    /* the tokens go in the headers, without the body of the last request */
+    curl_easy_setopt(ctx->curl_ctx, CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_HEADERFUNCTION, header_callback);
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_HEADERDATA, &challenge_buffer);
 
@@ -349,7 +394,7 @@ wr_transport_login(void *c)
                                         &send_tok, &ret_flags,
                                         NULL);  /* time_rec */
         if(GSS_ERROR(maj_stat)) {
-            fprintf(stderr, "Unable to create context. %x %x\n", maj_stat, min_stat);
+            wr_error("Unable to create context. %x %x\n", maj_stat, min_stat);
             result = 0;
             goto end;
         }
@@ -363,11 +408,13 @@ wr_transport_login(void *c)
         list = curl_slist_append(list, SAMM_USERAGENT);
 
 
-        size_t auth_buffer_size = send_tok.length * 2.5;
+        /* the header name, the token in base64 and the \0 b64encode ends it with */
+        size_t auth_buffer_size = strlen("Authorization: Negotiate ") +
+            (send_tok.length + 2) / 3 * 4 + 1;
         char *auth_buffer = malloc(auth_buffer_size);
         size_t auth_buffer_len;
         if(auth_buffer == NULL) {
-            printf("Unable to allocate memory for auth buffer\n");
+            wr_error("Unable to allocate memory for auth buffer\n");
             result = 0;
             goto end;
         }
@@ -382,9 +429,10 @@ wr_transport_login(void *c)
 
         curl_easy_setopt(ctx->curl_ctx, CURLOPT_HTTPHEADER, list);
 
+        set_timeouts(ctx);
         res = curl_easy_perform(ctx->curl_ctx);
         if(res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n",
+            wr_error("curl_easy_perform() failed: %s\n",
             curl_easy_strerror(res));
             result = 0;
             goto end;
@@ -394,13 +442,13 @@ wr_transport_login(void *c)
 
         if(maj_stat == GSS_S_CONTINUE_NEEDED) {
             if(challenge_buffer.data == NULL) {
-                printf("Server didn't send a challenge.\n");
+                wr_error("Server didn't send a challenge.\n");
                 result = 0;
                 goto end;
             }
             challenge = calloc(1, challenge_buffer.length);
             if(challenge == NULL) {
-                fprintf(stderr, "Unable to reserve memory for challenge.\n");
+                wr_error("Unable to reserve memory for challenge.\n");
                 free(challenge_buffer.data);
                 goto end;
             }
@@ -418,7 +466,7 @@ wr_transport_login(void *c)
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_HEADERDATA, NULL);
     curl_easy_getinfo(ctx->curl_ctx, CURLINFO_RESPONSE_CODE, &response_code);
     if(response_code != 200) {
-        fprintf(stderr, "Error. Server response code was %ld\n", response_code);
+        wr_error("Error. Server response code was %ld\n", response_code);
         result = 0;
         goto end;
     }
@@ -426,6 +474,60 @@ wr_transport_login(void *c)
     return result;
 }
 
+void
+wr_transport_set_deadline(void *c, const wr_deadline_t *deadline)
+{
+    struct wr_transport_ctx *ctx = (struct wr_transport_ctx*) c;
+
+    if(ctx == NULL) return;
+    ctx->deadline = deadline;
+}
+
+/*
+ * Replaces the connection and the security context with new ones, the
+ * old ones are dropped unless they still belong to another process.
+ */
+static uint32_t
+renew_session(struct wr_transport_ctx *ctx, uint32_t drop)
+{
+    OM_uint32 min_stat;
+    CURL *curl_ctx;
+
+    if(ctx == NULL || ctx->curl_ctx == NULL) return 0;
+    /* not curl_easy_duphandle, it would copy the body size of the last
+     * request to the login, that has no body to read */
+    curl_ctx = curl_new(ctx->url);
+    if(curl_ctx == NULL) return 0;
+    if(drop) {
+        curl_easy_cleanup(ctx->curl_ctx);
+        if(ctx->gss_ctx != GSS_C_NO_CONTEXT)
+            gss_delete_sec_context(&min_stat, &ctx->gss_ctx, GSS_C_NO_BUFFER);
+    }
+    ctx->curl_ctx = curl_ctx;
+    ctx->gss_ctx = GSS_C_NO_CONTEXT;
+    if(ctx->target_name != GSS_C_NO_NAME)
+        gss_release_name(&min_stat, &ctx->target_name);
+    ctx->target_name = GSS_C_NO_NAME;
+    return 1;
+}
+
+/*
+ * Gives a forked process a connection and security context of its own,
+ * the ones it inherited stay with the parent. It has to login again.
+ */
+uint32_t
+wr_transport_detach(void *c)
+{
+    return renew_session((struct wr_transport_ctx*) c, 0);
+}
+
+/* Starts over after a failed connection, the next request has to login again. */
+uint32_t
+wr_transport_reset(void *c)
+{
+    return renew_session((struct wr_transport_ctx*) c, 1);
+}
+
 void
 wr_transport_free(void *c)
 {
@@ -442,6 +544,7 @@ wr_transport_free(void *c)
         gss_delete_sec_context(&min_stat, &ctx->gss_ctx,
                                            GSS_C_NO_BUFFER);
     if(ctx->curl_ctx) curl_easy_cleanup(ctx->curl_ctx);
+    free(ctx->url);
     free(ctx);
 }
 
@@ -454,7 +557,7 @@ multipart_encode(struct ntlm_buffer *payload, struct ntlm_buffer *encrypted)
 
     payload->data = calloc(1, encrypted->length + 256);
     if(payload->data == NULL) {
-        fprintf(stderr, "Unable to reserve memory for payload data.\n");
+        wr_error("Unable to reserve memory for payload data.\n");
         return 0;
     }
     p = payload->data;
@@ -495,7 +598,7 @@ wr_prepare_encrypted_request(void *c, struct ntlm_buffer *payload, const struct
     maj_stat = gss_wrap (&min_stat, ctx->gss_ctx, 1, GSS_C_QOP_DEFAULT,
         &msg_buffer, &conf_state, &out_msg);
     if(GSS_ERROR(maj_stat)) {
-        fprintf(stderr, "Unable to create context. %x %x\n", maj_stat, min_stat);
+        wr_error("Unable to create context. %x %x\n", maj_stat, min_stat);
         result = 0;
         goto end;
     }
@@ -504,7 +607,7 @@ wr_prepare_encrypted_request(void *c, struct ntlm_buffer *payload, const struct
     encrypted.length = out_msg.length;
 
     if(!multipart_encode(payload, &encrypted)) {
-        fprintf(stderr, "Error encoding data into multipart\n");
+        wr_error("Error encoding data into multipart\n");
         result = 0;
         goto end;
     }
@@ -531,7 +634,7 @@ wr_prepare_encrypted_request(void *c, struct ntlm_buffer *payload, const struct
  *                          in a multipart encoded data stream.
  *
  * Returns: 1 if succesfull
- *          0 if fails. In case of failure, the reason will be printed in stderr
+ *          0 if fails. In case of failure, the reason is reported with wr_error
  *          This means that the function will be called until it returns 0.
  *
  * Effects:
@@ -553,12 +656,12 @@ multipart_decode(struct ntlm_buffer *encrypted, struct ntlm_buffer *multipart_en
     char *re = "OriginalContent: type=application/soap+xml;charset=UTF-8;Length=";
 
     if (regcomp(&regex, re, REG_NEWLINE)){
-        fprintf(stderr, "Error - Unable to create regex context for length.\n");
+        wr_error("Error - Unable to create regex context for length.\n");
         regfree(&regex);
         return 0;
     }
     if (regexec(&regex, s, ARRAY_SIZE(pmatch), pmatch, 0)) {
-        fprintf(stderr, "Error - Unable to find multipart length.\n");
+        wr_error("Error - Unable to find multipart length.\n");
         regfree(&regex);
         return 0;
     }
@@ -568,13 +671,13 @@ multipart_decode(struct ntlm_buffer *encrypted, struct ntlm_buffer *multipart_en
     encrypted->length += 20;
     re = "Content-Type: application/octet-stream";
     if (regcomp(&regex, re, REG_NEWLINE)) {
-        fprintf(stderr, "Error - Unable to create regex context for data.\n");
+        wr_error("Error - Unable to create regex context for data.\n");
         regfree(&regex);
         return 0;
     }
     if (regexec(&regex, s, ARRAY_SIZE(pmatch), pmatch, 0)) {
         /* Invalid data, could not find Length */
-        fprintf(stderr, "Error - Unable to find start of data.\n");
+        wr_error("Error - Unable to find start of data.\n");
         regfree(&regex);
         return 0;
     }
@@ -605,7 +708,7 @@ multipart_decode(struct ntlm_buffer *encrypted, struct ntlm_buffer *multipart_en
  *                          size of the signature header.
  *
  * Returns: 1 if succesfull
- *          0 if fails. In case of failure, the reason will be printed in stderr
+ *          0 if fails. In case of failure, the reason is reported with wr_error
  *          This means that the function will be called until it returns 0.
  *
  * Effects:
@@ -639,7 +742,7 @@ wr_unwrap(void *c, struct ntlm_buffer *outmsg, struct ntlm_buffer *multipart_enc
     maj_stat = gss_unwrap (&min_stat, ctx->gss_ctx, &msg_buffer, &out_msg,
         &conf_state, &qop_state);
     if(GSS_ERROR(maj_stat)) {
-        fprintf(stderr, "Unable to unwrap message. %x %x\n", maj_stat, min_stat);
+        wr_error("Unable to unwrap message. %x %x\n", maj_stat, min_stat);
         result = 0;
         goto end;
     }
@@ -770,9 +873,10 @@ wr_send_message_request(void *c, struct ntlm_buffer *encrypted_message)
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_READDATA, &payload_temp);
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_WRITEFUNCTION, curl_write_cb);
     curl_easy_setopt(ctx->curl_ctx, CURLOPT_WRITEDATA, &ctx->response);
+    set_timeouts(ctx);
     res = curl_easy_perform(ctx->curl_ctx);
     if(res != CURLE_OK) {
-        fprintf(stderr, "curl_easy_perform() failed: %s\n",
+        wr_error("curl_easy_perform() failed: %s\n",
         curl_easy_strerror(res));
         result = 0;
         goto end;
@@ -819,17 +923,17 @@ wr_send_message(void *c, struct ntlm_buffer *recv_data, const struct ntlm_buffer
     if(c == NULL || message == NULL || message->data == NULL) return 0;
 
     if(!wr_prepare_encrypted_request(ctx, &encrypted_message, message)) {
-        fprintf(stderr, "Error wrapping message.\n");
+        wr_error("Error wrapping message.\n");
         result = 0;
         goto end;
     }
     if(!wr_send_message_request(ctx, &encrypted_message)) {
-        fprintf(stderr, "Error sending enrypted message.\n");
+        wr_error("Error sending enrypted message.\n");
         result = 0;
         goto end;
     }
     if(!wr_get_message_response(ctx, recv_data)) {
-        fprintf(stderr, "Error getting data from server.\n");
+        wr_error("Error getting data from server.\n");
         result = 0;
         goto end;
     }
@@ -1,6 +1,7 @@
 #ifndef __TRANSPORT_H_
 #define __TRANSPORT_H_
 #include "wrcommon.h"
+#include "deadline.h"
 
 #define discard_const(ptr) ((void *)((uintptr_t)(ptr)))
 #define DEBUG_BUFFER(b) printf(#b ".data=%p " #b ".length=%ld\n", b.data, b.length)
@@ -12,6 +13,10 @@
 void *wr_transport_ctx_new();
 uint32_t wr_transport_ctx_init(void *c, const char *username, const char *password, const char *url, uint32_t mech_val);
 uint32_t wr_transport_login(void *c);
+uint32_t wr_transport_detach(void *c);
+uint32_t wr_transport_reset(void *c);
+/* Limits the requests to the time left to deadline, NULL for no limit. */
+void wr_transport_set_deadline(void *c, const wr_deadline_t *deadline);
 uint32_t wr_send_message(void *c, struct ntlm_buffer *recv_data, const struct ntlm_buffer *message);
 void wr_transport_free(void *c);
 
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+#include "transport.h"
+#include "protocol.h"
+#include "xml.h"
+#include "deadline.h"
+#include "library.h"
+#include "winremote.h"
+
+#define WMI_RESOURCE_URI "http://schemas.microsoft.com/wbem/wsman/1/wmi/"
+#define VERSION_STRING(major, minor) #major "." #minor
+#define VERSION_OF(major, minor) VERSION_STRING(major, minor)
+
+struct winremote_session {
+    void *proto;
+    char *username;
+    char *password;
+    char *url;
+    uint32_t timeout_ms;
+    wr_deadline_t deadline;
+};
+
+typedef struct _item_delivery {
+    winremote_item_cb callback;
+    void *data;
+    uint32_t stopped;           /* by the callback */
+    uint32_t failed;
+} item_delivery_t;
+
+/* Every item goes out as a document of its own, with the namespaces it uses. */
+static uint32_t
+deliver_node(xmlNodePtr node, item_delivery_t *delivery)
+{
+    xmlDocPtr doc = NULL;
+    xmlNodePtr copy;
+    xmlBufferPtr buf = NULL;
+    uint32_t result = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    buf = xmlBufferCreate();
+    if(doc == NULL || buf == NULL || (copy = xmlDocCopyNode(node, doc, 1)) == NULL) {
+        wr_error("Error - Unable to reserve memory for result item.\n");
+        delivery->failed = 1;
+        goto end;
+    }
+    xmlDocSetRootElement(doc, copy);
+    xmlReconciliateNs(doc, copy);
+    if(xmlNodeDump(buf, doc, copy, 0, 0) == -1) {
+        wr_error("Error - Unable to write result item.\n");
+        delivery->failed = 1;
+        goto end;
+    }
+    result = delivery->callback((const char *) xmlBufferContent(buf),
+        xmlBufferLength(buf), delivery->data);
+    if(!result) delivery->stopped = 1;
+
+    end:
+    xmlBufferFree(buf);
+    xmlFreeDoc(doc);
+    return result;
+}
+
+static uint32_t
+deliver_items(xmlNodePtr items, void *data)
+{
+    for(xmlNodePtr node = xmlFirstElementChild(items); node; node = xmlNextElementSibling(node)) {
+        if(!deliver_node(node, data)) return 0;
+    }
+    return 1;
+}
+
+static char *
+copy_string(const char *s)
+{
+    char *copy;
+
+    if(s == NULL) return NULL;
+    copy = wr_library_allocator()->strdup_fn(s);
+    if(copy == NULL) wr_error("Error - Unable to reserve memory for session.\n");
+    return copy;
+}
+
+static uint32_t
+session_connect(winremote_session_t *session)
+{
+    session->proto = wrprotocol_ctx_new();
+    if(session->proto == NULL) return 0;
+    if(!wrprotocol_ctx_init(session->proto, session->username, session->password,
+            session->url, WR_MECH_NTLM)) {
+        wrprotocol_ctx_free(session->proto);
+        session->proto = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Starts a call, with a new session when the connection of the last one broke. */
+static uint32_t
+session_begin(winremote_session_t *session)
+{
+    if(session == NULL) return 0;
+    wr_error_clear();
+    if(session->proto != NULL && !wrprotocol_ctx_usable(session->proto)) {
+        wrprotocol_ctx_free(session->proto);
+        session->proto = NULL;
+    }
+    if(session->proto == NULL) {
+        if(!session_connect(session)) return 0;
+    } else {
+        /* the program may not have called for minutes */
+        wrprotocol_ctx_set_idle(session->proto);
+    }
+
+    if(session->timeout_ms) {
+        wr_deadline_start(&session->deadline, session->timeout_ms);
+        wrprotocol_ctx_set_deadline(session->proto, &session->deadline);
+    } else {
+        wrprotocol_ctx_set_deadline(session->proto, NULL);
+    }
+    return 1;
+}
+
+/* Pulls the enumeration started, the callback stopping it is no error. */
+static uint32_t
+session_pull(winremote_session_t *session, const char *resource_uri,
+        winremote_item_cb callback, void *data)
+{
+    item_delivery_t delivery = { callback, data, 0, 0 };
+
+    if(wr_pull_each(session->proto, resource_uri, deliver_items, &delivery)) return 1;
+    return delivery.stopped;
+}
+
+uint32_t
+winremote_init(const winremote_allocator_t *allocator)
+{
+    wr_allocator_t a;
+
+    if(allocator != NULL) {
+        a.malloc_fn = allocator->malloc_fn;
+        a.calloc_fn = allocator->calloc_fn;
+        a.realloc_fn = allocator->realloc_fn;
+        a.free_fn = allocator->free_fn;
+        a.strdup_fn = allocator->strdup_fn;
+        if(!wr_library_set_allocator(&a)) {
+            wr_error("Error - Invalid allocator.\n");
+            return 0;
+        }
+    }
+    /* the errors are read with winremote_last_error */
+    wr_error_quiet(1);
+    wr_library_init();
+    return 1;
+}
+
+void
+winremote_cleanup(void)
+{
+    wr_library_cleanup();
+}
+
+const char *
+winremote_version(void)
+{
+    return VERSION_OF(WINREMOTE_VERSION_MAJOR, WINREMOTE_VERSION_MINOR);
+}
+
+const char *
+winremote_last_error(void)
+{
+    return wr_last_error();
+}
+
+winremote_session_t *
+winremote_session_open(const char *username, const char *password, const char *url)
+{
+    const wr_allocator_t *a = wr_library_allocator();
+    winremote_session_t *session;
+
+    if(url == NULL) {
+        wr_error("Error - A session needs the url of the server.\n");
+        return NULL;
+    }
+    session = a->calloc_fn(1, sizeof(struct winremote_session));
+    if(session == NULL) {
+        wr_error("Error - Unable to reserve memory for session.\n");
+        return NULL;
+    }
+    if((username && (session->username = copy_string(username)) == NULL) ||
+            (password && (session->password = copy_string(password)) == NULL) ||
+            (session->url = copy_string(url)) == NULL)
+        goto error;
+    if(!session_connect(session)) goto error;
+    return session;
+
+    error:
+    winremote_session_close(session);
+    return NULL;
+}
+
+void
+winremote_session_close(winremote_session_t *session)
+{
+    const wr_allocator_t *a = wr_library_allocator();
+
+    if(session == NULL) return;
+    if(session->proto) {
+        wr_release(session->proto);
+        wrprotocol_ctx_free(session->proto);
+    }
+    a->free_fn(session->username);
+    if(session->password) {
+        memset(session->password, 0, strlen(session->password));
+        a->free_fn(session->password);
+    }
+    a->free_fn(session->url);
+    a->free_fn(session);
+}
+
+void
+winremote_session_set_timeout(winremote_session_t *session, uint32_t timeout_ms)
+{
+    if(session == NULL) return;
+    session->timeout_ms = timeout_ms;
+}
+
+uint32_t
+winremote_wql(winremote_session_t *session, const char *wmi_namespace,
+        const char *query, winremote_item_cb callback, void *data)
+{
+    char *resource_uri = NULL;
+    uint32_t result = 0;
+
+    if(wmi_namespace == NULL || query == NULL || callback == NULL) return 0;
+    if(!session_begin(session)) return 0;
+
+    if(asprintf(&resource_uri, WMI_RESOURCE_URI "%s/*", wmi_namespace) == -1) {
+        wr_error("Error - Unable to reserve memory for resourceuri string.\n");
+        return 0;
+    }
+    if(!wr_enumerate(session->proto, resource_uri, NULL, query, NULL)) goto end;
+    result = session_pull(session, resource_uri, callback, data);
+
+    end:
+    free(resource_uri);
+    return result;
+}
+
+uint32_t
+winremote_enumerate(winremote_session_t *session, const char *resource_uri,
+        winremote_item_cb callback, void *data)
+{
+    if(resource_uri == NULL || callback == NULL) return 0;
+    if(!session_begin(session)) return 0;
+
+    if(!wr_enumerate(session->proto, resource_uri, NULL, NULL, NULL)) return 0;
+    return session_pull(session, resource_uri, callback, data);
+}
+
+uint32_t
+winremote_get(winremote_session_t *session, const char *resource_uri,
+        const char *const *selectors, winremote_item_cb callback, void *data)
+{
+    const wr_allocator_t *a = wr_library_allocator();
+    item_delivery_t delivery = { callback, data, 0, 0 };
+    keyval_desc *selector = NULL;
+    keyval_t *selectorset = NULL;
+    xmlNodePtr body;
+    uint32_t count = 0, result = 0;
+
+    if(resource_uri == NULL || callback == NULL) return 0;
+    if(!session_begin(session)) return 0;
+
+    for(; selectors && selectors[count * 2]; count++) {
+        if(selectors[count * 2 + 1] == NULL) {
+            wr_error("Error - Selector %s has no value.\n", selectors[count * 2]);
+            return 0;
+        }
+    }
+    if(count) {
+        selector = a->calloc_fn(count, sizeof(keyval_desc));
+        selectorset = a->calloc_fn(count + 1, sizeof(keyval_t));
+        if(selector == NULL || selectorset == NULL) {
+            wr_error("Error - Unable to reserve memory for selectors.\n");
+            goto end;
+        }
+        for(uint32_t i = 0; i < count; i++) {
+            selector[i].key = (char *) selectors[i * 2];
+            selector[i].value = (char *) selectors[i * 2 + 1];
+            selectorset[i] = &selector[i];
+        }
+    }
+
+    if(!wr_get(session->proto, resource_uri, selectorset)) goto end;
+    body = wr_response_body(session->proto);
+    if(body == NULL) {
+        wr_error("Error - Response has no result XML.\n");
+        goto end;
+    }
+    deliver_node(body, &delivery);
+    result = !delivery.failed;
+
+    end:
+    if(selector) a->free_fn(selector);
+    if(selectorset) a->free_fn(selectorset);
+    return result;
+}
+
+uint32_t
+winremote_get_class(winremote_session_t *session, const char *wmi_namespace,
+        const char *classname, winremote_item_cb callback, void *data)
+{
+    item_delivery_t delivery = { callback, data, 0, 0 };
+    xmlNodeSetPtr nodes = NULL;
+    xmlDocPtr schema;
+    uint32_t count;
+
+    if(wmi_namespace == NULL || classname == NULL || *classname == '\0' || callback == NULL)
+        return 0;
+    if(!session_begin(session)) return 0;
+
+    schema = wr_get_cim_schema_xml(session->proto, wmi_namespace, classname);
+    if(schema == NULL) return 0;
+    count = xml_find_all(&nodes, schema, "//CLASS", NULL, NULL);
+    if(count == 0) wr_error("Error - Invalid schema.\n");
+    for(uint32_t i = 0; i < count; i++) {
+        if(!deliver_node(nodes->nodeTab[i], &delivery)) break;
+    }
+    xmlXPathFreeNodeSet(nodes);
+    xmlFreeDoc(schema);
+    return count > 0 && !delivery.failed;
+}
@@ -0,0 +1,87 @@
+#ifndef __WINREMOTE_H_
+#define __WINREMOTE_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Public interface of libwinremote, for the programs that link the
+ * shared library, in C or through the FFI of another language, and
+ * keep their sessions open instead of running the plugins. Only the
+ * winremote_ functions are exported, the rest of the library may change
+ * between releases.
+ *
+ * Functions returning uint32_t return 1 on success and 0 on failure,
+ * winremote_last_error then tells why. A session is used by one thread
+ * at a time, different sessions can be used by different threads.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WINREMOTE_VERSION_MAJOR 1
+#define WINREMOTE_VERSION_MINOR 0
+
+typedef struct winremote_session winremote_session_t;
+
+/* Memory functions of the caller, see winremote_init. */
+typedef struct winremote_allocator {
+    void *(*malloc_fn)(size_t size);
+    void *(*calloc_fn)(size_t count, size_t size);
+    void *(*realloc_fn)(void *ptr, size_t size);
+    void (*free_fn)(void *ptr);
+    char *(*strdup_fn)(const char *s);
+} winremote_allocator_t;
+
+/*
+ * Called with every item of a result, a WMI instance or class, as an
+ * XML document of length bytes. xml is only valid during the call.
+ * Return 0 to stop, the rest of the result is then dropped.
+ */
+typedef uint32_t (*winremote_item_cb)(const char *xml, size_t length, void *data);
+
+/*
+ * Sets the library up, before any other call and before the threads
+ * using it start. allocator, NULL for the one of the libc, is used for
+ * the handles and given to libcurl. libxml2 keeps the libc one.
+ */
+uint32_t winremote_init(const winremote_allocator_t *allocator);
+/* Once every session is closed. */
+void winremote_cleanup(void);
+/* "major.minor" of the library loaded, to compare with WINREMOTE_VERSION_* */
+const char *winremote_version(void);
+/* Last error of the calling thread, "" when none. */
+const char *winremote_last_error(void);
+
+/*
+ * Opens a session with NTLM authentication. url is the WS-Management
+ * endpoint, http://host:5985/wsman. The session logs in with its first
+ * request and logs in again when the connection breaks.
+ */
+winremote_session_t *winremote_session_open(const char *username, const char *password,
+        const char *url);
+void winremote_session_close(winremote_session_t *session);
+/* Time limit of each call of the session, 0 for none, the default. */
+void winremote_session_set_timeout(winremote_session_t *session, uint32_t timeout_ms);
+
+/* Runs a WQL query in wmi_namespace, root/cimv2 for most classes. */
+uint32_t winremote_wql(winremote_session_t *session, const char *wmi_namespace,
+        const char *query, winremote_item_cb callback, void *data);
+/* Enumerates all the instances of a resource. */
+uint32_t winremote_enumerate(winremote_session_t *session, const char *resource_uri,
+        winremote_item_cb callback, void *data);
+/*
+ * Gets one resource. selectors are name, value pairs ending with NULL,
+ * NULL itself for none.
+ */
+uint32_t winremote_get(winremote_session_t *session, const char *resource_uri,
+        const char *const *selectors, winremote_item_cb callback, void *data);
+/* Gets the CIM definition of a class, with the type of its properties. */
+uint32_t winremote_get_class(winremote_session_t *session, const char *wmi_namespace,
+        const char *classname, winremote_item_cb callback, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,6 +1,8 @@
 #define _GNU_SOURCE
 #include <string.h>
 #include "xml.h"
+#include "parse.h"
+#include "library.h"
 
 
 #define XML_NODE_FIRST_NAME(r, name, node) do { \
@@ -47,7 +49,7 @@ xml_add_selectorset(xmlWRDoc_p wrd, const keyval_t *selectorset)
 
     selector_set_node = xmlNewChild(wrd->header, w, BAD_CAST "SelectorSet", NULL);
     if(selector_set_node == NULL) {
-        fprintf(stderr, "Error - Unable to create 'SelectorSet' node.\n");
+        wr_error("Error - Unable to create 'SelectorSet' node.\n");
         result = 0;
         goto end;
     }
@@ -57,7 +59,7 @@ xml_add_selectorset(xmlWRDoc_p wrd, const keyval_t *selectorset)
         s = xmlNewChild(selector_set_node, w, BAD_CAST "Selector", 
             BAD_CAST (*selectorset)->value);
         if(s == NULL) {
-            fprintf(stderr, "Error - Unable to create 'Selector' node.\n");
+            wr_error("Error - Unable to create 'Selector' node.\n");
             result = 0;
             goto end;
         }
@@ -83,21 +85,21 @@ xml_new_basic_header(xmlWRDoc_p wrd, const char *resourceuri, const char *action
 
     nslist = xmlGetNsList(wrd->doc, wrd->envelope);
     if(nslist == NULL) {
-        fprintf(stderr, "Error. Unable to create list of namespaces.\n");
+        wr_error("Error. Unable to create list of namespaces.\n");
         result = 0;
         goto end;
     }
 
     a = xml_get_ns(nslist, "a");
     if(a == NULL) {
-        fprintf(stderr, "Error. Namespace 'a' not found.\n");
+        wr_error("Error. Namespace 'a' not found.\n");
         result = 0;
         goto end;
     }
 
     w = xml_get_ns(nslist, "w");
     if(w == NULL) {
-        fprintf(stderr, "Error. Namespace 'w' not found.\n");
+        wr_error("Error. Namespace 'w' not found.\n");
         result = 0;
         goto end;
     }
@@ -110,118 +112,118 @@ xml_new_basic_header(xmlWRDoc_p wrd, const char *resourceuri, const char *action
 
     current_node = xmlNewChild(header, a, "To", BAD_CAST "http://windows-host:5985/wsman");
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'To' node.\n");
+        wr_error("Error. Unable to create 'To' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, a, "ReplyTo", NULL);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'ReplyTo' node.\n");
+        wr_error("Error. Unable to create 'ReplyTo' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(current_node, a, "Address", BAD_CAST "http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous");
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'ReplyTo' node.\n");
+        wr_error("Error. Unable to create 'ReplyTo' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "true");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'Address' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'Address' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, w, "MaxEnvelopeSize", BAD_CAST "153600");
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'MaxEnvelopeSize' node.\n");
+        wr_error("Error. Unable to create 'MaxEnvelopeSize' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "true");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'MaxEnvelopeSize' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'MaxEnvelopeSize' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, a, "MessageID", BAD_CAST uuid_str);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'MessageID' node.\n");
+        wr_error("Error. Unable to create 'MessageID' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, w, "Locale", NULL);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'Locale' node.\n");
+        wr_error("Error. Unable to create 'Locale' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "false");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'Locale' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'Locale' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "xml:lang", BAD_CAST "en-US");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'xml:lang' property to 'Locale' node.\n");
+        wr_error("Error. Unable to set 'xml:lang' property to 'Locale' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, w, "DataLocale", NULL);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'DataLocale' node.\n");
+        wr_error("Error. Unable to create 'DataLocale' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "false");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'DataLocale' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'DataLocale' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "xml:lang", BAD_CAST "en-US");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'xml:lang' property to 'DataLocale' node.\n");
+        wr_error("Error. Unable to set 'xml:lang' property to 'DataLocale' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, w, "OperationTimeout", BAD_CAST "PT20S");
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'OperationTimeout' node.\n");
+        wr_error("Error. Unable to create 'OperationTimeout' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, w, "ResourceURI", BAD_CAST resourceuri);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'ResourceURI' node.\n");
+        wr_error("Error. Unable to create 'ResourceURI' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "true");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'ResourceURI' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'ResourceURI' node.\n");
         result = 0;
         goto end;
     }
 
     current_node = xmlNewChild(header, a, "Action", BAD_CAST action);
     if(current_node == NULL) {
-        fprintf(stderr, "Error. Unable to create 'Action' node.\n");
+        wr_error("Error. Unable to create 'Action' node.\n");
         result = 0;
         goto end;
     }
     current_node_prop = xmlNewProp(current_node, BAD_CAST "mustUnderstand", BAD_CAST "true");
     if(current_node_prop == NULL) {
-        fprintf(stderr, "Error. Unable to set 'mustUnderstand' property to 'Action' node.\n");
+        wr_error("Error. Unable to set 'mustUnderstand' property to 'Action' node.\n");
         result = 0;
         goto end;
     }
@@ -231,58 +233,75 @@ xml_new_basic_header(xmlWRDoc_p wrd, const char *resourceuri, const char *action
     return result;
 }
 
+/* Replaces the 20 seconds OperationTimeout of the basic header. */
+uint32_t
+xml_set_operation_timeout(xmlDocPtr doc, uint32_t ms)
+{
+    xmlNodePtr node = NULL;
+    char buf[32];
+
+    if(!xml_find_first(&node, doc, "//w:OperationTimeout", "w",
+            "http://schemas.dmtf.org/wbem/wsman/1/wsman.xsd") || node == NULL) {
+        wr_error("Error. 'OperationTimeout' node not found.\n");
+        return 0;
+    }
+    snprintf(buf, sizeof(buf), "PT%u.%03uS", ms / 1000, ms % 1000);
+    xmlNodeSetContent(node, BAD_CAST buf);
+    return 1;
+}
+
 xmlWRDoc_p
 xml_new_wr_doc()
 {
     xmlNsPtr xsi, env, a, w, n, xsd;
     xmlWRDoc_p wrd = calloc(1, sizeof(xmlWRDoc_desc));
     if(wrd == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for xmlWRDoc.\n");
+        wr_error("Error - Unable to reserve memory for xmlWRDoc.\n");
         goto error;
     }
 
     wrd->doc = xmlNewDoc(BAD_CAST XML_DEFAULT_VERSION);
     if (wrd->doc == NULL) {
-        fprintf(stderr, "Error creating the xml document tree\n");
+        wr_error("Error creating the xml document tree\n");
         goto error;
     }
 
     wrd->envelope = xmlNewDocNode(wrd->doc, NULL, BAD_CAST "env:Envelope", NULL);
     if (wrd->envelope == NULL) {
-        fprintf(stderr, "Error creating the xml node\n");
+        wr_error("Error creating the xml node\n");
         goto error;
     }
     xmlDocSetRootElement(wrd->doc, wrd->envelope);
 
     env = xmlNewNs(wrd->envelope, BAD_CAST "http://www.w3.org/2003/05/soap-envelope", BAD_CAST "env");
     if(env == NULL) {
-        fprintf(stderr, "Error - Unable to create 'env' namespace.\n");
+        wr_error("Error - Unable to create 'env' namespace.\n");
         goto error;
     }
     a = xmlNewNs(wrd->envelope, BAD_CAST "http://schemas.xmlsoap.org/ws/2004/08/addressing", BAD_CAST "a");
     if(a == NULL) {
-        fprintf(stderr, "Error - Unable to create 'a' namespace.\n");
+        wr_error("Error - Unable to create 'a' namespace.\n");
         goto error;
     }
     w = xmlNewNs(wrd->envelope, BAD_CAST "http://schemas.dmtf.org/wbem/wsman/1/wsman.xsd", BAD_CAST "w");
     if(w == NULL) {
-        fprintf(stderr, "Error - Unable to create 'w' namespace.\n");
+        wr_error("Error - Unable to create 'w' namespace.\n");
         goto error;
     }
     n = xmlNewNs(wrd->envelope, BAD_CAST "http://schemas.xmlsoap.org/ws/2004/09/enumeration", BAD_CAST "n");
     if(n == NULL) {
-        fprintf(stderr, "Error - Unable to create 'n' namespace.\n");
+        wr_error("Error - Unable to create 'n' namespace.\n");
         goto error;
     }
 
     wrd->header = xmlNewChild(wrd->envelope, env, "Header", NULL);
     if (wrd->header == NULL) {
-        fprintf(stderr, "Error creating header\n");
+        wr_error("Error creating header\n");
         goto error;
     }
     wrd->body = xmlNewChild(wrd->envelope, env, "Body", NULL);
     if (wrd->body == NULL) {
-        fprintf(stderr, "Error creating body\n");
+        wr_error("Error creating body\n");
         goto error;
     }
 
@@ -312,14 +331,14 @@ xml_to_buffer(char *out_xml, size_t max_buffer_size, xmlDocPtr doc)
 
     buf = xmlBufferCreate();
     if (buf == NULL) {
-        fprintf(stderr, "Error creating the xml buffer\n");
+        wr_error("Error creating the xml buffer\n");
         out_xml_len = -1;
         goto end;
     }
 
     outbuf = xmlOutputBufferCreateBuffer(buf, xmlFindCharEncodingHandler(UTF8));
     if(outbuf == NULL) {
-        fprintf(stderr, "Error creating output buffer\n");
+        wr_error("Error creating output buffer\n");
         out_xml_len = -1;
         goto end;
     }
@@ -444,7 +463,7 @@ xml_schema_is_number(const xmlDocPtr schema, const char *name)
     if(schema == NULL || name == NULL) return 0;
     asprintf(&xPathExpr, "//CLASS/PROPERTY[@NAME='%s']", name);
     if(xPathExpr == NULL) {
-        fprintf(stderr, "Error - Unable to reserve memory for xpath expression.\n");
+        wr_error("Error - Unable to reserve memory for xpath expression.\n");
         return 0;
     }
     if(!xml_find_first(&schema_node, schema, xPathExpr, NULL, NULL)) {
@@ -454,19 +473,19 @@ xml_schema_is_number(const xmlDocPtr schema, const char *name)
     free(xPathExpr);
 
     if(schema_node == NULL) {
-        fprintf(stderr, "Error - Property \"%s\" not found in class.\n", 
+        wr_error("Error - Property \"%s\" not found in class.\n", 
             name);
         return 0;
     }
 
     type = xmlGetProp(schema_node, "TYPE");
     if(type == NULL) {
-        fprintf(stderr, "Error - Invalid schema.\n");
+        wr_error("Error - Invalid schema.\n");
         return 0;
     }
 
     if(strncmp(type, "uint", 4) != 0 && strncmp(type, "sint", 4) != 0) {
-        fprintf(stderr, "Error - Property cannot be converted to integer. (%s)\n", type);
+        wr_error("Error - Property cannot be converted to integer. (%s)\n", type);
         free(type);
         return 0;
     }
@@ -498,8 +517,15 @@ xml_prop_node_to_number(xmlNodePtr property_node, xmlDocPtr schema, uint64_t *va
         return 0;
     } else {
         str_value = xmlNodeGetContent(property_node);
+        if(str_value == NULL) {
+            return 0;
+        }
+    }
+    if(!wr_parse_integer(value, str_value, strlen(str_value))) {
+        wr_error("Error - Invalid integer value for %s.\n", property);
+        free(str_value);
+        return 0;
     }
-    *value = strtol(str_value, NULL, 10);
     free(str_value);
     return 1;
 }
@@ -531,7 +557,11 @@ xml_class_get_prop_num(uint64_t *value, const xmlNodePtr class, const char *name
                 return 0;
             }
         }
-        *value = strtol(str_value, NULL, 10);
+        if(!wr_parse_integer(value, str_value, strlen(str_value))) {
+            wr_error("Error - Invalid integer value for %s.\n", name);
+            free(str_value);
+            return 0;
+        }
         free(str_value);
         return 1;
 
@@ -539,13 +569,14 @@ xml_class_get_prop_num(uint64_t *value, const xmlNodePtr class, const char *name
     return 0;
 }
 
+/* The value is a copy to be freed, schema is not needed. */
 uint32_t
 xml_class_get_prop_string(char **value, const xmlNodePtr class, const char *name, const xmlDocPtr schema)
 {
     xmlNodePtr property = NULL;
     char *nil = NULL;
 
-    if(class == NULL || schema == NULL || value == NULL) return 0;
+    if(class == NULL || class->children == NULL || value == NULL) return 0;
 
     property = class->children;
     do {
@@ -567,3 +598,85 @@ xml_class_get_prop_string(char **value, const xmlNodePtr class, const char *name
     } while(property = property->next);
     return 0;
 }
+
+/*
+ * Same as xml_class_get_prop_string but the value is looked up in dict
+ * instead of copied. The returned pointer belongs to the dictionary, so
+ * two values are equal only if the pointers are equal. The dictionary
+ * of a session lives as long as it, only values taking a few different
+ * values (states, types, ...) belong there, not names.
+ */
+uint32_t
+xml_class_get_prop_interned(const char **value, const xmlNodePtr class, const char *name, xmlDictPtr dict)
+{
+    xmlNodePtr property = NULL, text;
+    char *copy;
+
+    if(class == NULL || dict == NULL || value == NULL) return 0;
+
+    *value = NULL;
+    for(property = class->children; property; property = property->next) {
+        if(property->type != XML_ELEMENT_NODE || strcmp(property->name, name) != 0) continue;
+
+        if(xmlHasProp(property, "nil") != NULL) return 0;
+
+        text = property->children;
+        if(text == NULL) {
+            *value = xmlDictLookup(dict, BAD_CAST "", 0);
+        } else if(text->next == NULL && text->type == XML_TEXT_NODE) {
+            *value = xmlDictLookup(dict, text->content, -1);
+        } else {
+            copy = xmlNodeGetContent(property);
+            if(copy == NULL) return 0;
+            *value = xmlDictLookup(dict, copy, -1);
+            free(copy);
+        }
+        return *value != NULL;
+    }
+    return 0;
+}
+
+/*
+ * Reads an unsigned integer property without the class schema, for the
+ * projected queries that skip fetching it.
+ */
+uint32_t
+xml_class_get_prop_uint64(uint64_t *value, const xmlNodePtr class, const char *name)
+{
+    xmlNodePtr property;
+    char *str_value;
+    uint32_t result;
+
+    if(class == NULL || value == NULL) return 0;
+
+    for(property = class->children; property; property = property->next) {
+        if(property->type != XML_ELEMENT_NODE || strcmp(property->name, name) != 0) continue;
+
+        if(xmlHasProp(property, "nil") != NULL) return 0;
+        str_value = xmlNodeGetContent(property);
+        if(str_value == NULL) return 0;
+        result = wr_parse_uint64(value, str_value, strlen(str_value));
+        free(str_value);
+        return result;
+    }
+    return 0;
+}
+
+uint32_t
+xml_class_get_prop_datetime(int64_t *usec, const xmlNodePtr class, const char *name, const xmlDocPtr schema)
+{
+    char *str_value = NULL;
+    uint32_t result;
+
+    if(usec == NULL) return 0;
+
+    if(!xml_class_get_prop_string(&str_value, class, name, schema)) {
+        return 0;
+    }
+    result = wr_parse_datetime(usec, str_value, strlen(str_value));
+    if(!result) {
+        wr_error("Error - Invalid datetime value for %s.\n", name);
+    }
+    free(str_value);
+    return result;
+}
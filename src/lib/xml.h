@@ -1,6 +1,7 @@
 #ifndef __XML_H_
 #define __XML_H_
 #include <libxml/tree.h>
+#include <libxml/dict.h>
 #include <uuid/uuid.h>
 #include <libxml/xpathInternals.h>
 #include "wrcommon.h"
@@ -15,6 +16,7 @@ typedef struct xmlWRDoc {
 
 
 uint32_t xml_new_basic_header(xmlWRDoc_p wrd, const char *resourceuri, const char *action);
+uint32_t xml_set_operation_timeout(xmlDocPtr doc, uint32_t ms);
 uint32_t xml_get_uuid(uuid_t uuid, xmlDocPtr doc, const char *xpathExpr, 
         const char *nsSuffix, const char *nsHref);
 xmlWRDoc_p xml_new_wr_doc();
@@ -30,5 +32,8 @@ uint32_t xml_prop_node_to_number(xmlNodePtr node, xmlDocPtr schema, uint64_t *va
 uint32_t xml_schema_is_number(const xmlDocPtr schema, const char *name);
 uint32_t xml_class_get_prop_num(uint64_t *value, const xmlNodePtr class, const char *name, const xmlDocPtr schema);
 uint32_t xml_class_get_prop_string(char **value, const xmlNodePtr class, const char *name, const xmlDocPtr schema);
+uint32_t xml_class_get_prop_interned(const char **value, const xmlNodePtr class, const char *name, xmlDictPtr dict);
+uint32_t xml_class_get_prop_uint64(uint64_t *value, const xmlNodePtr class, const char *name);
+uint32_t xml_class_get_prop_datetime(int64_t *usec, const xmlNodePtr class, const char *name, const xmlDocPtr schema);
 
 #endif
\ No newline at end of file
@@ -18,8 +18,7 @@ int main(int argc, char const *argv[])
     void *ctx = NULL;
     const char *namespace = "root/cimv2";
     const char *classname = "Win32_ComputerSystem";
-    char buf[MAX_BUFFER_SIZE];
-    size_t buf_len;
+    char *buf;
 
     username = getenv("WR_USERNAME");
     password = getenv("WR_PASSWORD");
@@ -37,6 +36,13 @@ int main(int argc, char const *argv[])
         classname = argv[2];
     }
 
+    /* too big for the stack */
+    buf = malloc(MAX_BUFFER_SIZE);
+    if(buf == NULL) {
+        fprintf(stderr, "Error - Unable to reserve memory for buffer.\n");
+        exit(1);
+    }
+
     struct timespec tp, tp_start, tp_new, tp_init, tp_schema, tp_class, tp_free, tplast = {0, 0};
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp_start);
     printf("start=%ld\n", (tp_start.tv_nsec - tplast.tv_nsec) / 1000);
@@ -80,8 +86,9 @@ int main(int argc, char const *argv[])
             (tp_free.tv_nsec - tplast.tv_nsec) / 1000);
         tplast = tp;
 
-        read(STDIN_FILENO, buf, 4000000);
+        read(STDIN_FILENO, buf, MAX_BUFFER_SIZE);
     }
 
+    free(buf);
     return result;
 }
\ No newline at end of file
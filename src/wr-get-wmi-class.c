@@ -5,6 +5,8 @@
 #include <time.h>
 #include "transport.h"
 #include "protocol.h"
+#include "cimclass.h"
+#include "output.h"
 
 #define LOOP_COUNT 5
 #define MAX_BUFFER_SIZE (1<<22) /* 4MB */
@@ -18,8 +20,11 @@ int main(int argc, char const *argv[])
     void *ctx = NULL;
     const char *namespace = "root/cimv2";
     const char *classname = "Win32_ComputerSystem";
-    char buf[MAX_BUFFER_SIZE];
-    size_t buf_len;
+    char *buf = NULL;
+    wr_output_format_e format;
+    xmlDocPtr xml_schema = NULL;
+    cimclass_t cimclass_schema = NULL;
+    wr_output_t output = NULL;
 
     username = getenv("WR_USERNAME");
     password = getenv("WR_PASSWORD");
@@ -36,6 +41,9 @@ int main(int argc, char const *argv[])
     if(argc > 2) {
         classname = argv[2];
     }
+    if(argc > 3 && !wr_output_format_from_string(&format, argv[3])) {
+        exit(1);
+    }
 
     ctx = wrprotocol_ctx_new();
     if(ctx == NULL) {
@@ -46,6 +54,27 @@ int main(int argc, char const *argv[])
         result = 1;
         goto end;
     }
+    if(argc > 3) {
+        /* one line per instance, written as each Pull batch arrives */
+        xml_schema = wr_get_cim_schema_xml(ctx, namespace, classname);
+        cimclass_schema = cimschema_from_xmlschema(xml_schema);
+        if(cimclass_schema == NULL) {
+            result = 1;
+            goto end;
+        }
+        output = wr_output_new(stdout, format, cimclass_schema);
+        if(output == NULL || 
+                !wr_get_wmi_class_stream(ctx, namespace, classname, wr_output_items, output)) {
+            result = 1;
+        }
+        goto end;
+    }
+
+    buf = malloc(MAX_BUFFER_SIZE);
+    if(buf == NULL) {
+        result = 1;
+        goto end;
+    }
     if(wr_get_cim_schema(ctx, buf, MAX_BUFFER_SIZE, namespace, classname) == -1) {
         result = 1;
         goto end;
@@ -57,6 +86,10 @@ int main(int argc, char const *argv[])
     }
     printf("%s\n", buf);
     end:
+    wr_output_free(&output);
+    cimclass_free(&cimclass_schema);
+    xmlFreeDoc(xml_schema);
+    free(buf);
     wrprotocol_ctx_free(ctx);
 
     return result;
@@ -9,8 +9,10 @@
 #include "transport.h"
 #include "protocol.h"
 #include "cimclass.h"
+#include "cimbin.h"
+#include "output.h"
 
-#define MAX_BUFFER_SIZE (1<<22) /* 4MB */
+#define MAX_CLASS_NAME_LENGTH 256
 
 uint32_t
 usage(const char *msg, int argc, char * const*argv)
@@ -20,7 +22,9 @@ usage(const char *msg, int argc, char * const*argv)
     }
     fprintf(stderr, "Usage: %s -H <host address> -u <username> "
         "-p <password> [ -n <namespace, 'root/cimv2' is default> ] "
-        "-q <WMI query in quotes>\n", argv[0]);
+        "-q <WMI query in quotes> [ -o <save result to binary file> ] "
+        "[ -f <json|csv> ]\n"
+        "       %s -i <print result saved with -o>\n", argv[0], argv[0]);
     return 3;
 }
 
@@ -33,15 +37,20 @@ int main(int argc, char * const*argv)
     void *proto = NULL;
     const char *namespace = "root/cimv2";
     const char *wql = NULL;
-    char buf[MAX_BUFFER_SIZE];
-    char *classname = buf;
-    size_t buf_len;
+    char classname[MAX_CLASS_NAME_LENGTH];
     xmlDocPtr xml_schema = NULL;
     cimclass_t cimclass_schema = NULL;
     xmlDocPtr xml_class = NULL;
     cimclass_set_t cimclass_set = NULL;
+    const char *outfile = NULL;
+    const char *infile = NULL;
+    cimbin_t cimbin = NULL;
+    const char *format_name = NULL;
+    wr_output_format_e format;
+    wr_output_t output = NULL;
+    void *wql_ctx = NULL;
 
-    while ((opt = getopt(argc, argv, "hu:p:H:n:q:")) != -1) {
+    while ((opt = getopt(argc, argv, "hu:p:H:n:q:o:i:f:")) != -1) {
         switch(opt) {
         case 'h':
             usage(NULL, argc, argv);
@@ -61,11 +70,32 @@ int main(int argc, char * const*argv)
         case 'q':
             wql = optarg;
             break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 'i':
+            infile = optarg;
+            break;
+        case 'f':
+            format_name = optarg;
+            break;
         default:
             exit(usage(NULL, argc, argv));
             break;
         }
     }
+    if(format_name != NULL && !wr_output_format_from_string(&format, format_name)) {
+        exit(usage(NULL, argc, argv));
+    }
+    if(infile != NULL) {
+        cimbin = cimbin_open(infile);
+        if(cimbin == NULL) {
+            result = 1;
+            goto end;
+        }
+        cimbin_print(cimbin);
+        goto end;
+    }
     if(username == NULL) {
         username = getenv("WR_USERNAME");
         if(username == NULL) {
@@ -103,7 +133,27 @@ int main(int argc, char * const*argv)
         goto end;
     }
 
-    extract_class_name(classname, MAX_BUFFER_SIZE, wql);
+    if(format_name != NULL) {
+        /* write every Pull batch as it arrives instead of building
+         * the whole result */
+        wql_ctx = wr_wql_new(proto, namespace, wql);
+        if(wql_ctx == NULL) {
+            result = 1;
+            goto end;
+        }
+        cimclass_schema = cimschema_from_xmlschema(wr_wql_schema_toxml(wql_ctx));
+        if(cimclass_schema == NULL) {
+            result = 1;
+            goto end;
+        }
+        output = wr_output_new(stdout, format, cimclass_schema);
+        if(output == NULL || !wr_wql_stream(wql_ctx, wr_output_items, output)) {
+            result = 1;
+        }
+        goto end;
+    }
+
+    extract_class_name(classname, MAX_CLASS_NAME_LENGTH, wql);
 
     xml_schema = wr_get_cim_schema_xml(proto, namespace, classname);
     if(xml_schema == NULL) {
@@ -126,9 +176,19 @@ int main(int argc, char * const*argv)
 
     cimclass_set = cimclass_set_from_xml_doc(xml_class, cimclass_schema);
 
-    cimclass_set_print(cimclass_set);
+    if(outfile != NULL) {
+        if(!cimbin_write(outfile, cimclass_schema, cimclass_set)) {
+            result = 1;
+            goto end;
+        }
+    } else {
+        cimclass_set_print(cimclass_set);
+    }
 
     end:
+    cimbin_close(&cimbin);
+    wr_output_free(&output);
+    wr_wql_free(&wql_ctx);
     xmlFreeDoc(xml_schema);
     xmlFreeDoc(xml_class);
     cimclass_free(&cimclass_schema);
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include <gssapi/gssapi_generic.h>
+#include <gssapi/gssapi_ext.h>
+#include "mock_gssapi.h"
+
+#define MOCK_GSS_TOKEN "TlRMTVNTUAADAAAA"
+
+static unsigned long logins = 0;
+
+unsigned long
+mock_gss_logins(void)
+{
+    return __atomic_load_n(&logins, __ATOMIC_SEQ_CST);
+}
+
+/* Names, credentials and contexts only need to be distinct pointers. */
+static void *
+mock_handle(void)
+{
+    return malloc(1);
+}
+
+static OM_uint32
+mock_buffer(gss_buffer_t buffer, const void *head, size_t head_len,
+        const void *data, size_t len)
+{
+    buffer->value = malloc(head_len + len + 1);
+    if(buffer->value == NULL) return GSS_S_FAILURE;
+    memcpy(buffer->value, head, head_len);
+    memcpy((char *) buffer->value + head_len, data, len);
+    ((char *) buffer->value)[head_len + len] = '\0';
+    buffer->length = head_len + len;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_create_empty_oid_set(OM_uint32 *minor_status, gss_OID_set *oid_set)
+{
+    *minor_status = 0;
+    *oid_set = calloc(1, sizeof(gss_OID_set_desc));
+    return *oid_set ? GSS_S_COMPLETE : GSS_S_FAILURE;
+}
+
+OM_uint32
+gss_add_oid_set_member(OM_uint32 *minor_status, gss_OID member_oid, gss_OID_set *oid_set)
+{
+    *minor_status = 0;
+    (*oid_set)->count++;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_release_oid_set(OM_uint32 *minor_status, gss_OID_set *set)
+{
+    *minor_status = 0;
+    free(*set);
+    *set = GSS_C_NO_OID_SET;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_import_name(OM_uint32 *minor_status, gss_buffer_t input_name_buffer,
+        gss_OID input_name_type, gss_name_t *output_name)
+{
+    *minor_status = 0;
+    *output_name = mock_handle();
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_release_name(OM_uint32 *minor_status, gss_name_t *input_name)
+{
+    *minor_status = 0;
+    free(*input_name);
+    *input_name = GSS_C_NO_NAME;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_acquire_cred_with_password(OM_uint32 *minor_status, const gss_name_t desired_name,
+        const gss_buffer_t password, OM_uint32 time_req, const gss_OID_set desired_mechs,
+        gss_cred_usage_t cred_usage, gss_cred_id_t *output_cred_handle,
+        gss_OID_set *actual_mechs, OM_uint32 *time_rec)
+{
+    *minor_status = 0;
+    *output_cred_handle = mock_handle();
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_release_cred(OM_uint32 *minor_status, gss_cred_id_t *cred_handle)
+{
+    *minor_status = 0;
+    free(*cred_handle);
+    *cred_handle = GSS_C_NO_CREDENTIAL;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_init_sec_context(OM_uint32 *minor_status, gss_cred_id_t claimant_cred_handle,
+        gss_ctx_id_t *context_handle, gss_name_t target_name, gss_OID mech_type,
+        OM_uint32 req_flags, OM_uint32 time_req, gss_channel_bindings_t input_chan_bindings,
+        gss_buffer_t input_token, gss_OID *actual_mech_type, gss_buffer_t output_token,
+        OM_uint32 *ret_flags, OM_uint32 *time_rec)
+{
+    *minor_status = 0;
+    if(*context_handle == GSS_C_NO_CONTEXT) *context_handle = mock_handle();
+    if(ret_flags) *ret_flags = req_flags;
+    __atomic_add_fetch(&logins, 1, __ATOMIC_SEQ_CST);
+    return mock_buffer(output_token, "", 0, MOCK_GSS_TOKEN, strlen(MOCK_GSS_TOKEN));
+}
+
+OM_uint32
+gss_delete_sec_context(OM_uint32 *minor_status, gss_ctx_id_t *context_handle,
+        gss_buffer_t output_token)
+{
+    *minor_status = 0;
+    free(*context_handle);
+    *context_handle = GSS_C_NO_CONTEXT;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32
+gss_wrap(OM_uint32 *minor_status, gss_ctx_id_t context_handle, int conf_req_flag,
+        gss_qop_t qop_req, gss_buffer_t input_message_buffer, int *conf_state,
+        gss_buffer_t output_message_buffer)
+{
+    static const char signature[MOCK_GSS_SIGNATURE] = { 0 };
+
+    *minor_status = 0;
+    if(context_handle == GSS_C_NO_CONTEXT) return GSS_S_NO_CONTEXT;
+    if(conf_state) *conf_state = conf_req_flag;
+    return mock_buffer(output_message_buffer, signature, sizeof(signature),
+        input_message_buffer->value, input_message_buffer->length);
+}
+
+OM_uint32
+gss_unwrap(OM_uint32 *minor_status, gss_ctx_id_t context_handle,
+        gss_buffer_t input_message_buffer, gss_buffer_t output_message_buffer,
+        int *conf_state, gss_qop_t *qop_state)
+{
+    *minor_status = 0;
+    if(context_handle == GSS_C_NO_CONTEXT) return GSS_S_NO_CONTEXT;
+    if(input_message_buffer->length < MOCK_GSS_SIGNATURE) return GSS_S_DEFECTIVE_TOKEN;
+    if(conf_state) *conf_state = 1;
+    if(qop_state) *qop_state = GSS_C_QOP_DEFAULT;
+    return mock_buffer(output_message_buffer, "", 0,
+        (char *) input_message_buffer->value + MOCK_GSS_SIGNATURE,
+        input_message_buffer->length - MOCK_GSS_SIGNATURE);
+}
+
+OM_uint32
+gss_release_buffer(OM_uint32 *minor_status, gss_buffer_t buffer)
+{
+    *minor_status = 0;
+    if(buffer == GSS_C_NO_BUFFER) return GSS_S_COMPLETE;
+    free(buffer->value);
+    buffer->value = NULL;
+    buffer->length = 0;
+    return GSS_S_COMPLETE;
+}
@@ -0,0 +1,16 @@
+#ifndef __MOCK_GSSAPI_H_
+#define __MOCK_GSSAPI_H_
+
+/*
+ * GSS-API of the tests, its functions are linked instead of the ones of
+ * libgssapi_krb5. The login takes a single token and the wrap only puts
+ * a 16 bytes signature in front of the message, like NTLM, so a server
+ * sending back the body it got makes an answer the transport unwraps.
+ */
+
+#define MOCK_GSS_SIGNATURE 16
+
+/* Security contexts set up so far. */
+unsigned long mock_gss_logins(void);
+
+#endif
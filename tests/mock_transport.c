@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "transport.h"
+#include "library.h"
+#include "mock_transport.h"
+
+#define MOCK_ENUMERATION_CONTEXT \
+    "<n:EnumerationContext>uuid:11111111-2222-3333-4444-555555555555</n:EnumerationContext>"
+#define MOCK_DELAY_US 100
+
+typedef struct _mock_ctx {
+    uint32_t pulls;
+    uint32_t busy;              /* sends in progress, more than one is a bug */
+    unsigned long connection;   /* the closed ones have a lower number */
+} mock_ctx_t;
+
+static unsigned long requests = 0, resets = 0, closed = 0;
+
+unsigned long
+mock_requests(void)
+{
+    return __atomic_load_n(&requests, __ATOMIC_SEQ_CST);
+}
+
+unsigned long
+mock_resets(void)
+{
+    return __atomic_load_n(&resets, __ATOMIC_SEQ_CST);
+}
+
+void
+mock_close_connections(void)
+{
+    __atomic_add_fetch(&closed, 1, __ATOMIC_SEQ_CST);
+}
+
+/* A connection opened after the last mock_close_connections. */
+static void
+mock_connect(mock_ctx_t *ctx)
+{
+    ctx->connection = __atomic_load_n(&closed, __ATOMIC_SEQ_CST);
+}
+
+void *
+wr_transport_ctx_new()
+{
+    mock_ctx_t *ctx;
+
+    wr_library_init();
+    ctx = calloc(1, sizeof(mock_ctx_t));
+    if(ctx) mock_connect(ctx);
+    return ctx;
+}
+
+uint32_t
+wr_transport_ctx_init(void *c, const char *username, const char *password, const char *url,
+        uint32_t mech_val)
+{
+    return c != NULL;
+}
+
+uint32_t
+wr_transport_login(void *c)
+{
+    return 1;
+}
+
+uint32_t
+wr_transport_detach(void *c)
+{
+    mock_connect(c);
+    return 1;
+}
+
+uint32_t
+wr_transport_reset(void *c)
+{
+    __atomic_add_fetch(&resets, 1, __ATOMIC_SEQ_CST);
+    mock_connect(c);
+    return 1;
+}
+
+void
+wr_transport_set_deadline(void *c, const wr_deadline_t *deadline)
+{
+}
+
+void
+wr_transport_free(void *c)
+{
+    free(c);
+}
+
+static const char *
+mock_body(mock_ctx_t *ctx, const char *request, char *body, size_t size)
+{
+    if(strstr(request, "enumeration/Enumerate<")) {
+        ctx->pulls = 0;
+        snprintf(body, size, "<n:EnumerateResponse>" MOCK_ENUMERATION_CONTEXT
+            "</n:EnumerateResponse>");
+    } else if(strstr(request, "enumeration/Pull<")) {
+        if(++ctx->pulls < MOCK_PULLS)
+            snprintf(body, size, "<n:PullResponse>" MOCK_ENUMERATION_CONTEXT
+                "<n:Items><p:Item>%u</p:Item></n:Items></n:PullResponse>", ctx->pulls);
+        else
+            snprintf(body, size, "<n:PullResponse><n:Items><p:Item>%u</p:Item></n:Items>"
+                "<n:EndOfSequence/></n:PullResponse>", ctx->pulls);
+    } else if(strstr(request, "enumeration/Release<")) {
+        snprintf(body, size, "<n:ReleaseResponse/>");
+    } else {
+        return NULL;
+    }
+    return body;
+}
+
+uint32_t
+wr_send_message(void *c, struct ntlm_buffer *recv_data, const struct ntlm_buffer *message)
+{
+    mock_ctx_t *ctx = c;
+    const char *request = (const char *) message->data, *message_id;
+    char body[1024], *response = NULL;
+    int length;
+
+    if(__atomic_fetch_add(&ctx->busy, 1, __ATOMIC_SEQ_CST) != 0) {
+        fprintf(stderr, "Error - Session used by two threads at once.\n");
+        abort();
+    }
+    __atomic_add_fetch(&requests, 1, __ATOMIC_SEQ_CST);
+    /* long enough for the other threads to run into a session shared by mistake */
+    usleep(MOCK_DELAY_US);
+
+    if(ctx->connection != __atomic_load_n(&closed, __ATOMIC_SEQ_CST)) {
+        wr_error("Error - Mock connection was closed.\n");
+        goto error;
+    }
+    message_id = strstr(request, "MessageID>");
+    if(message_id == NULL || mock_body(ctx, request, body, sizeof(body)) == NULL) {
+        wr_error("Error - Mock transport does not know the request.\n");
+        goto error;
+    }
+    message_id += strlen("MessageID>");
+    length = asprintf(&response,
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+        "xmlns:a=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+        "xmlns:n=\"http://schemas.xmlsoap.org/ws/2004/09/enumeration\" "
+        "xmlns:p=\"http://schemas.microsoft.com/wbem/wsman/1/wmi/root/cimv2\">"
+        "<s:Header><a:RelatesTo>%.*s</a:RelatesTo></s:Header>"
+        "<s:Body>%s</s:Body></s:Envelope>",
+        (int) strcspn(message_id, "<"), message_id, body);
+    if(length == -1) {
+        wr_error("Error - Unable to reserve memory for response.\n");
+        goto error;
+    }
+    recv_data->data = (uint8_t *) response;
+    recv_data->length = length;
+    __atomic_sub_fetch(&ctx->busy, 1, __ATOMIC_SEQ_CST);
+    return 1;
+
+    error:
+    __atomic_sub_fetch(&ctx->busy, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef __MOCK_TRANSPORT_H_
+#define __MOCK_TRANSPORT_H_
+
+/*
+ * Transport of the tests, linked instead of transport.c. Every session
+ * answers an Enumerate with MOCK_PULLS Pulls of one item each, then a
+ * Release, without a server. Two threads sending on the same session at
+ * once abort the test, the GSS context of a real one would be broken.
+ */
+
+#define MOCK_PULLS 3
+#define MOCK_RESOURCE_URI "http://schemas.microsoft.com/wbem/wsman/1/wmi/root/cimv2/*"
+#define MOCK_QUERY "SELECT * FROM Win32_OperatingSystem"
+
+/* Requests sent by all the sessions so far. */
+unsigned long mock_requests(void);
+/* Sessions that started over on a new connection so far. */
+unsigned long mock_resets(void);
+/* Closes the connections open, like a server dropping the idle ones. */
+void mock_close_connections(void);
+
+#endif
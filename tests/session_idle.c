@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <libxml/tree.h>
+#include "protocol.h"
+#include "session.h"
+#include "deadline.h"
+#include "library.h"
+#include "mock_transport.h"
+
+/*
+ * A session back from the pool after the server closed its connection
+ * sends its first request again on a new one. A connection lost in the
+ * middle of a check is still an error.
+ */
+
+#define IDLE_URL "http://host0:5985/wsman"
+
+static uint32_t
+count_items(xmlNodePtr items, void *data)
+{
+    (*(uint32_t *) data)++;
+    return 1;
+}
+
+static uint32_t
+run_check(void *proto)
+{
+    uint32_t items = 0;
+
+    return wr_enumerate(proto, MOCK_RESOURCE_URI, NULL, MOCK_QUERY, NULL) &&
+        wr_pull_each(proto, MOCK_RESOURCE_URI, count_items, &items) && items == MOCK_PULLS;
+}
+
+int
+main(int argc, char **argv)
+{
+    void *proto;
+    int failed = 0;
+
+    wr_error_quiet(1);
+    wr_library_init();
+    wr_session_pool_enable(60);
+
+    wr_check_deadline_start(10);
+    proto = wr_session_get("user", "password", IDLE_URL);
+    if(proto == NULL || !run_check(proto)) {
+        fprintf(stderr, "first check: %s\n", wr_last_error());
+        return 1;
+    }
+    wr_session_put(proto);
+
+    mock_close_connections();
+    wr_check_deadline_start(10);
+    proto = wr_session_get("user", "password", IDLE_URL);
+    if(proto == NULL || !run_check(proto)) {
+        fprintf(stderr, "check after idle: %s\n", wr_last_error());
+        failed = 1;
+    }
+    if(mock_resets() != 1) {
+        fprintf(stderr, "%lu new connections instead of 1\n", mock_resets());
+        failed = 1;
+    }
+
+    /* the same session, no longer idle */
+    mock_close_connections();
+    if(proto != NULL && run_check(proto)) {
+        fprintf(stderr, "check on a lost connection did not fail\n");
+        failed = 1;
+    }
+    wr_session_put(proto);
+    printf("requests=%lu resets=%lu\n", mock_requests(), mock_resets());
+
+    wr_session_pool_free();
+    wr_library_cleanup();
+    return failed;
+}
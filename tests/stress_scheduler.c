@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/tree.h>
+#include "protocol.h"
+#include "scheduler.h"
+#include "library.h"
+#include "mock_transport.h"
+
+/*
+ * Many hosts polled by the scheduler, some tasks queuing others and some
+ * with a deadline too short to run, to be run under TSan. The mock
+ * aborts when two workers use the session of a host at once.
+ * WR_STRESS_THREADS sets the workers, WR_STRESS_HOSTS and
+ * WR_STRESS_TASKS the tasks queued for each host.
+ */
+
+#define STRESS_FOLLOW_EVERY 10
+#define STRESS_SHORT_EVERY 3
+
+static wr_sched_t sched;
+/* skipped counts the tasks that ran out of time, before or while running */
+static long done = 0, skipped = 0, failed = 0, queued = 0;
+
+static uint32_t
+count_items(xmlNodePtr items, void *data)
+{
+    (*(uint32_t *) data)++;
+    return 1;
+}
+
+static uint32_t
+env_count(const char *name, uint32_t value)
+{
+    const char *text = getenv(name);
+    long n;
+
+    if(text == NULL || *text == '\0') return value;
+    n = strtol(text, NULL, 10);
+    return n > 0 ? n : value;
+}
+
+static void
+poll_host(void *proto, wr_deadline_t *deadline, void *data)
+{
+    long n = (long) data;
+    uint32_t items = 0;
+
+    if(proto == NULL) {
+        __atomic_add_fetch(&skipped, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if(wr_enumerate(proto, MOCK_RESOURCE_URI, NULL, MOCK_QUERY, NULL) &&
+            wr_pull_each(proto, MOCK_RESOURCE_URI, count_items, &items) &&
+            items == MOCK_PULLS)
+        __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+    else if(wr_deadline_expired(deadline) != NULL)
+        __atomic_add_fetch(&skipped, 1, __ATOMIC_SEQ_CST);
+    else
+        __atomic_add_fetch(&failed, 1, __ATOMIC_SEQ_CST);
+
+    /* tasks queuing others, to a host every worker takes turns on */
+    if(n > 0 && n % STRESS_FOLLOW_EVERY == 0) {
+        __atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+        wr_sched_submit(sched, "user", "password", "http://follow:5985/wsman", 5000,
+            poll_host, (void *) 1L);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t hosts = env_count("WR_STRESS_HOSTS", 50), tasks = env_count("WR_STRESS_TASKS", 20);
+    char url[64];
+
+    wr_error_quiet(1);
+    wr_library_init();
+    sched = wr_sched_new(env_count("WR_STRESS_THREADS", 8));
+    if(sched == NULL) {
+        fprintf(stderr, "%s\n", wr_last_error());
+        return 1;
+    }
+    for(uint32_t t = 0; t < tasks; t++) {
+        for(uint32_t h = 0; h < hosts; h++) {
+            snprintf(url, sizeof(url), "http://host%u:5985/wsman", h);
+            /* every third host has 2ms, most of its tasks miss their turn */
+            wr_sched_submit(sched, "user", "password", url,
+                h % STRESS_SHORT_EVERY ? 30000 : 2, poll_host, (void *) (long) (t * hosts + h));
+        }
+    }
+    wr_sched_wait(sched);
+    printf("done=%ld skipped=%ld failed=%ld queued=%ld tasks=%lu requests=%lu\n",
+        done, skipped, failed, queued, (unsigned long) hosts * tasks + queued, mock_requests());
+    wr_sched_free(sched);
+    wr_library_cleanup();
+
+    if(failed || done + skipped != (long) hosts * tasks + queued) return 1;
+    return 0;
+}
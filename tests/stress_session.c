@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libxml/tree.h>
+#include "protocol.h"
+#include "session.h"
+#include "deadline.h"
+#include "hostslot.h"
+#include "library.h"
+#include "mock_transport.h"
+
+/*
+ * Threads running checks against a few hosts through the session pool,
+ * the way a daemon embedding the library would, to be run under TSan.
+ * WR_STRESS_THREADS and WR_STRESS_CHECKS set the size of the run.
+ */
+
+#define STRESS_HOSTS 4
+#define STRESS_THREADS_MAX 256
+
+static uint32_t checks = 200;
+
+static uint32_t
+count_items(xmlNodePtr items, void *data)
+{
+    (*(uint32_t *) data)++;
+    return 1;
+}
+
+static uint32_t
+env_count(const char *name, uint32_t value, uint32_t max)
+{
+    const char *text = getenv(name);
+    long n;
+
+    if(text == NULL || *text == '\0') return value;
+    n = strtol(text, NULL, 10);
+    if(n <= 0) return value;
+    return n > max ? max : n;
+}
+
+static void *
+run_checks(void *arg)
+{
+    long id = (long) arg;
+    char url[64], error[64];
+    uint32_t items, failed = 0;
+    void *proto;
+
+    snprintf(url, sizeof(url), "http://host%ld:5985/wsman", id % STRESS_HOSTS);
+    for(uint32_t i = 0; i < checks && !failed; i++) {
+        wr_check_deadline_start(10);
+        proto = wr_session_get("user", "password", url);
+        if(proto == NULL) {
+            fprintf(stderr, "thread %ld: %s\n", id, wr_last_error());
+            failed = 1;
+            break;
+        }
+        items = 0;
+        if(!wr_enumerate(proto, MOCK_RESOURCE_URI, NULL, MOCK_QUERY, NULL) ||
+                !wr_pull_each(proto, MOCK_RESOURCE_URI, count_items, &items)) {
+            fprintf(stderr, "thread %ld: %s\n", id, wr_last_error());
+            failed = 1;
+        } else if(items != MOCK_PULLS) {
+            fprintf(stderr, "thread %ld: %u pulls instead of %u\n", id, items, MOCK_PULLS);
+            failed = 1;
+        }
+        /* errors are per thread, another one failing meanwhile does not show here */
+        snprintf(error, sizeof(error), "Error - thread %ld check %u", id, i);
+        wr_error("%s\n", error);
+        if(strcmp(wr_last_error(), error) != 0) {
+            fprintf(stderr, "thread %ld: got the error \"%s\"\n", id, wr_last_error());
+            failed = 1;
+        }
+        wr_session_put(proto);
+    }
+    return (void *) (long) failed;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t threads = env_count("WR_STRESS_THREADS", 8, STRESS_THREADS_MAX);
+    pthread_t thread[STRESS_THREADS_MAX];
+    wr_host_slot_stats_t stats;
+    long failed = 0;
+    void *result;
+
+    checks = env_count("WR_STRESS_CHECKS", checks, 1000000);
+    wr_error_quiet(1);
+    wr_library_init();
+    wr_session_pool_enable(60);
+    for(long i = 0; i < threads; i++) {
+        if(pthread_create(&thread[i], NULL, run_checks, (void *) i) != 0) {
+            fprintf(stderr, "Unable to start thread %ld\n", i);
+            return 1;
+        }
+    }
+    for(uint32_t i = 0; i < threads; i++) {
+        pthread_join(thread[i], &result);
+        failed += (long) result;
+    }
+    wr_host_slot_stats(&stats);
+    printf("threads=%u checks=%u requests=%lu slots=%llu waited=%llu\n", threads, checks,
+        mock_requests(), (unsigned long long) stats.acquired, (unsigned long long) stats.waited);
+
+    wr_session_pool_free();
+    wr_library_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "transport.h"
+#include "library.h"
+#include "mock_gssapi.h"
+
+/*
+ * The real transport against a local server sending back every body it
+ * gets. After a request, a reset (the Pull retry) and a detach (the
+ * background refresh) have to login and send again on a new connection.
+ */
+
+#define ECHO_HEADER_MAX 4096
+
+static unsigned long requests = 0;
+
+static int
+read_full(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0) {
+        n = read(fd, buf, len);
+        if(n <= 0) return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int
+write_full(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n <= 0) return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* Reads the headers of a request and returns the length of its body, -1 at the end. */
+static long
+read_request_head(int fd)
+{
+    char head[ECHO_HEADER_MAX], *p;
+    size_t len = 0;
+    ssize_t n;
+
+    while(len < sizeof(head) - 1) {
+        n = read(fd, head + len, 1);
+        if(n <= 0) return -1;
+        len += n;
+        head[len] = '\0';
+        if(len >= 4 && !strcmp(head + len - 4, "\r\n\r\n")) break;
+    }
+    for(p = head; (p = strchr(p, '\n')) != NULL; ) {
+        p++;
+        if(!strncasecmp(p, "Content-Length:", 15)) return strtol(p + 15, NULL, 10);
+    }
+    return 0;
+}
+
+static void *
+echo_connection(void *arg)
+{
+    int fd = (int) (long) arg;
+    char head[256], *body;
+    long len;
+
+    while((len = read_request_head(fd)) >= 0) {
+        body = malloc(len + 1);
+        if(body == NULL || !read_full(fd, body, len)) {
+            free(body);
+            break;
+        }
+        __atomic_add_fetch(&requests, 1, __ATOMIC_SEQ_CST);
+        /* the login has no body, the messages go back as they came */
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n"
+            "Content-Type: multipart/encrypted;protocol=\"application/HTTP-SPNEGO-session-encrypted\";"
+            "boundary=\"Encrypted Boundary\"\r\n\r\n", len);
+        if(!write_full(fd, head, strlen(head)) || !write_full(fd, body, len)) {
+            free(body);
+            break;
+        }
+        free(body);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *
+echo_server(void *arg)
+{
+    int listen_fd = (int) (long) arg, fd;
+    pthread_t thread;
+
+    while((fd = accept(listen_fd, NULL, NULL)) != -1) {
+        if(pthread_create(&thread, NULL, echo_connection, (void *) (long) fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int
+echo_start(char *url, size_t size)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) return 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 16) == -1 ||
+            getsockname(fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+        close(fd);
+        return 0;
+    }
+    if(pthread_create(&thread, NULL, echo_server, (void *) (long) fd) != 0) {
+        close(fd);
+        return 0;
+    }
+    pthread_detach(thread);
+    snprintf(url, size, "http://127.0.0.1:%u/wsman", ntohs(addr.sin_port));
+    return 1;
+}
+
+/* Sends text and checks it came back. */
+static int
+send_text(void *transport, const char *step, const char *text)
+{
+    struct ntlm_buffer message = { (uint8_t *) text, strlen(text) }, recv_data = { NULL, 0 };
+    int result;
+
+    if(!wr_send_message(transport, &recv_data, &message)) {
+        fprintf(stderr, "%s: %s\n", step, wr_last_error());
+        return 0;
+    }
+    result = recv_data.length == message.length && !memcmp(recv_data.data, text, message.length);
+    if(!result) fprintf(stderr, "%s: got \"%.*s\"\n", step, (int) recv_data.length, recv_data.data);
+    free(recv_data.data);
+    return result;
+}
+
+int
+main(int argc, char **argv)
+{
+    char url[64];
+    void *transport;
+    int failed = 0;
+
+    wr_error_quiet(1);
+    wr_library_init();
+    if(!echo_start(url, sizeof(url))) {
+        fprintf(stderr, "Unable to start the server\n");
+        return 1;
+    }
+    transport = wr_transport_ctx_new();
+    if(transport == NULL || !wr_transport_ctx_init(transport, "user", "password", url, WR_MECH_NTLM) ||
+            !wr_transport_login(transport)) {
+        fprintf(stderr, "login: %s\n", wr_last_error());
+        return 1;
+    }
+    failed |= !send_text(transport, "first", "<s:Envelope>first</s:Envelope>");
+
+    /* the body of the request before must not go with the new login */
+    if(!wr_transport_reset(transport) || !wr_transport_login(transport)) {
+        fprintf(stderr, "reset: %s\n", wr_last_error());
+        failed = 1;
+    } else {
+        failed |= !send_text(transport, "reset", "<s:Envelope>after the reset</s:Envelope>");
+    }
+    /* the background refresh of a WQL result, in a process of its own */
+    if(!wr_transport_detach(transport) || !wr_transport_login(transport)) {
+        fprintf(stderr, "detach: %s\n", wr_last_error());
+        failed = 1;
+    } else {
+        failed |= !send_text(transport, "detach", "<s:Envelope>after the detach</s:Envelope>");
+    }
+    printf("logins=%lu requests=%lu\n", mock_gss_logins(), __atomic_load_n(&requests, __ATOMIC_SEQ_CST));
+    if(mock_gss_logins() != 3) failed = 1;
+
+    wr_transport_free(transport);
+    wr_library_cleanup();
+    return failed;
+}